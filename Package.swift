@@ -1,6 +1,13 @@
 // swift-tools-version: 5.7
 import PackageDescription
 
+// The Objective-C sources implementing the Mach backend only build on Apple platforms.
+#if os(Linux)
+let machExceptionHelperExclude = ["mach_exception_helper.m"]
+#else
+let machExceptionHelperExclude: [String] = []
+#endif
+
 let package = Package(
     name: "mach-exception",
     platforms: [
@@ -19,7 +26,19 @@ let package = Package(
             targets: [
                 "MachInterfaceGenerator"
             ]
-        )
+        ),
+        .executable(
+            name: "mach-exception-log",
+            targets: [
+                "MachExceptionLogTool"
+            ]
+        ),
+        .executable(
+            name: "mach-exception-benchmark",
+            targets: [
+                "MachExceptionBenchmark"
+            ]
+        ),
     ],
     dependencies: [
         .package(url: "https://github.com/apple/swift-argument-parser", from: "1.2.0"),
@@ -34,7 +53,12 @@ let package = Package(
         .target(
             name: "mach-exception-helper",
             dependencies: [
-            ]
+            ],
+            exclude: machExceptionHelperExclude
+            // The servers are generated by the MachInterfaceGenerator command plugin and checked in, rather than by
+            // a build-tool plugin. The generator only emits C, and with tools version 5.7 a build-tool plugin's
+            // outputs are only compiled into Swift targets. Generating them during the build needs a tools version
+            // whose build-tool plugins feed C sources and headers to a C target.
 //            sources: [
 //                "mach_exception_helper.m",
 //                "mach_excServer.c",
@@ -53,6 +77,12 @@ let package = Package(
                 "mach-exception-helper",
             ]
         ),
+        .testTarget(
+            name: "MachInterfaceGeneratorToolTests",
+            dependencies: [
+                "MachInterfaceGeneratorTool",
+            ]
+        ),
         .plugin(
             name: "MachInterfaceGenerator",
             capability: .command(
@@ -71,11 +101,21 @@ let package = Package(
                 .product(name: "ArgumentParser", package: "swift-argument-parser"),
             ]
         ),
-//        .plugin(name: "MachInterfaceGenerator",
-//                capability: .buildTool(),
-//                dependencies: [
-//                    "MachInterfaceGeneratorTool",
-//                ]
-//        ),
+        .executableTarget(
+            name: "MachExceptionLogTool",
+            dependencies: [
+                "mach-exception",
+                "mach-exception-helper",
+                .product(name: "ArgumentParser", package: "swift-argument-parser"),
+            ]
+        ),
+        .executableTarget(
+            name: "MachExceptionBenchmark",
+            dependencies: [
+                "mach-exception",
+                "mach-exception-helper",
+                .product(name: "ArgumentParser", package: "swift-argument-parser"),
+            ]
+        ),
     ]
 )
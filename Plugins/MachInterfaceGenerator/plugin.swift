@@ -8,47 +8,50 @@ struct MachInterfaceGenerator: CommandPlugin {
 
     func performCommand(context: PluginContext, arguments: [String]) async throws
     {
-        let mig = try context.tool(named: "mig")
+        // The builtin compiler generates portable servers, and is the only one on hosts without mig.
+        var mig = try? context.tool(named: "mig")
+        if arguments.contains("--builtin") {
+            mig = nil
+        }
+        let compilerArguments = mig.map { ["--mig", $0.path.string] }
+            ?? ["--compiler", "builtin", "--portable-header", "mach_exception_compat.h"]
 
+        // One run of the tool generates every definitions file of the package, in parallel, and the cache it keeps
+        // in the plugin's work directory skips those that haven't changed since the last run.
+        let fileManager = FileManager.default
+        var inputPaths: [String] = []
         for target in context.package.targets {
-            let fileManager = FileManager.default
-            let inputPaths = try fileManager.contentsOfDirectory(atPath: target.directory.string)
+            inputPaths += try fileManager.contentsOfDirectory(atPath: target.directory.string)
                 .map { Path(target.directory.string + "/" + $0) }
                 .filter { $0.extension == "defs" }
+                .map { $0.string }
+        }
+        guard !inputPaths.isEmpty else {
+            return
+        }
 
-            for inputPath in inputPaths {
-                let serverSideRPCSourceName = inputPath.stem + "Server.c"
-                let serverSideRPCHeaderName = inputPath.stem + "Server.h"
-
-                let process = Process()
-                let executable = try context.tool(named: "MachInterfaceGeneratorTool").path
-                process.executableURL = URL(fileURLWithPath: executable.string)
+        let process = Process()
+        let executable = try context.tool(named: "MachInterfaceGeneratorTool").path
+        process.executableURL = URL(fileURLWithPath: executable.string)
+        process.arguments = ["--server"] + compilerArguments + [
+            "--cache-path", context.pluginWorkDirectory.appending("generation-cache.json").string,
+        ] + inputPaths
+        log(executable.string)
+        for argument in process.arguments! {
+            log(argument)
+        }
 
-                process.arguments = [
-                    "--server",
-                    "--mig", mig.path.string,
-                    "--output-path", target.directory.string,
-                    inputPath.string
-                ]
-                log(executable.string)
-                for argument in process.arguments! {
-                    log(argument)
-                }
-                try process.run()
-                process.waitUntilExit()
+        let outputPipe = Pipe()
+        process.standardOutput = outputPipe
+        try process.run()
+        let output = outputPipe.fileHandleForReading.readDataToEndOfFile()
+        process.waitUntilExit()
+        log(String(decoding: output, as: UTF8.self))
 
-                let displayName = """
-                            Generating \(serverSideRPCSourceName) and \(serverSideRPCHeaderName) \
-                            from \(inputPath.lastComponent)
-                            """
-                if process.terminationReason == .exit && process.terminationStatus == 0 {
-                    log(displayName)
-                } else {
-                    let problem = "\(process.terminationReason):\(process.terminationStatus)"
-                    log(problem)
-                    Diagnostics.error("Mach Interface Generator invocation failed: \(problem)")
-                }
-            }
+        if !(process.terminationReason == .exit && process.terminationStatus == 0) {
+            let problem = "\(process.terminationReason):\(process.terminationStatus)"
+            log(problem)
+            Diagnostics.error("Mach Interface Generator invocation failed: \(problem)")
         }
     }
 
@@ -67,42 +70,3 @@ struct MachInterfaceGenerator: CommandPlugin {
         }
     }
 }
-
-//@main
-//struct MachInterfaceGenerator: BuildToolPlugin {
-//
-//    func createBuildCommands(context: PluginContext, target: Target) async throws -> [Command] {
-//        guard let target = target as? ClangSourceModuleTarget else {
-//            return []
-//        }
-//        return try target.sourceFiles(withSuffix: ".defs").map { sourceFile in
-//            let inputPath = sourceFile.path
-//            let serverSideRPCSourceName = inputPath.stem + "Server.c"
-//            let serverSideRPCHeaderName = inputPath.stem + "Server.h"
-//            let serverSideRPCSourcePath = context.pluginWorkDirectory.appending(serverSideRPCSourceName)
-//            let serverSideRPCHeaderPath = context.pluginWorkDirectory.appending(serverSideRPCHeaderName)
-//
-//            let mig = try context.tool(named: "mig").path
-//
-//            let arguments = [
-//                "--server",
-//                "--mig", mig.string,
-//                "--output-path", context.pluginWorkDirectory.string,
-//                inputPath.string
-//            ]
-//
-//            let displayName = """
-//                Generating \(serverSideRPCSourceName) and \(serverSideRPCHeaderName) \
-//                from \(inputPath.lastComponent)
-//                """
-//
-//            let executable = try context.tool(named: "MachInterfaceGeneratorTool").path
-//
-//            return .buildCommand(displayName: displayName,
-//                                 executable: executable,
-//                                 arguments: arguments,
-//                                 inputFiles: [inputPath],
-//                                 outputFiles: [serverSideRPCSourcePath, serverSideRPCHeaderPath])
-//        }
-//    }
-//}
@@ -0,0 +1,508 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// mach-exception
+// MachExceptionBenchmark.swift
+// Created by Patrick Gili on 2/23/23.
+//
+
+import Foundation
+import ArgumentParser
+import mach_exception
+import mach_exception_helper
+
+@main
+struct MachExceptionBenchmark: ParsableCommand {
+    static var configuration = CommandConfiguration(
+        commandName: "mach-exception-benchmark",
+        abstract: "Measure the overhead of Mach exception scopes.",
+        discussion: """
+            Each benchmark takes a number of samples, and reports the 50th, 99th and 99.9th percentiles of the time \
+            per operation, in nanoseconds. A benchmark whose operation is too quick to time on its own times a batch \
+            of operations per sample, so its percentiles are those of the batches' mean times.
+            """
+    )
+
+    @Option(help: "The number of samples each benchmark takes.")
+    var samples = 10_000
+
+    @Option(help: "The number of samples each benchmark discards before taking its samples.")
+    var warmup = 1_000
+
+    @Option(help: "The number of operations timed per sample, by the benchmarks whose operations are quick.")
+    var batch = 100
+
+    @Option(help: "The number of threads the first-fault benchmark creates, taking a sample on each.")
+    var threads = 200
+
+    @Option(help: "The path of a capture file the replay benchmark replays, as fast as possible, once per sample.")
+    var replay: String?
+
+    @Option(help: "Run only the benchmarks whose names contain this string.")
+    var filter: String?
+
+    @Option(help: "Write the results as JSON to this path, or to standard output if the path is -.")
+    var json: String?
+
+    @Option(help: "The path of a JSON results file to compare with. The command fails if a benchmark regressed.")
+    var baseline: String?
+
+    @Option(help: "The increase of a benchmark's p50 or p99 over the baseline's tolerated, as a fraction.")
+    var tolerance = 0.1
+
+    mutating func validate() throws {
+        guard samples > 0, warmup >= 0, batch > 0, threads > 0 else {
+            throw ValidationError("The samples, batch and threads must be positive, and the warmup non-negative.")
+        }
+        guard tolerance >= 0 else {
+            throw ValidationError("The tolerance must be non-negative.")
+        }
+    }
+
+    mutating func run() throws {
+        var results: [BenchmarkResult] = []
+        for benchmark in benchmarks() where filter.map({ benchmark.name.contains($0) }) ?? true {
+            let result = try benchmark.run()
+            results.append(result)
+            if json != "-" {
+                print(result.summary)
+            }
+        }
+
+        let report = BenchmarkReport(architecture: BenchmarkReport.hostArchitecture,
+                                     operatingSystem: BenchmarkReport.hostOperatingSystem,
+                                     results: results)
+        if let json = json {
+            let encoder = JSONEncoder()
+            encoder.outputFormatting = [.prettyPrinted, .sortedKeys]
+            let data = try encoder.encode(report)
+            if json == "-" {
+                FileHandle.standardOutput.write(data)
+                FileHandle.standardOutput.write("\n".data(using: .utf8)!)
+            } else {
+                try data.write(to: URL(fileURLWithPath: json))
+            }
+        }
+
+        if let baseline = baseline {
+            let data = try Data(contentsOf: URL(fileURLWithPath: baseline))
+            let previous = try JSONDecoder().decode(BenchmarkReport.self, from: data)
+            let regressions = report.regressions(from: previous, tolerance: tolerance)
+            for regression in regressions {
+                FileHandle.standardError.write("regression: \(regression)\n".data(using: .utf8)!)
+            }
+            if !regressions.isEmpty {
+                throw ExitCode.failure
+            }
+        }
+    }
+
+    // MARK: - Benchmarks
+
+    func benchmarks() -> [Benchmark] {
+        let sampler = Sampler(samples: samples, warmup: warmup, batch: batch)
+        var benchmarks = [
+            Benchmark(name: "scope.no-fault") {
+                try sampler.batched {
+                    try withUnsafeMachException(types: [.badAccess]) {}
+                }
+            },
+            Benchmark(name: "scope.no-fault.result") {
+                try sampler.batched {
+                    _ = try withUnsafeMachExceptionResult(types: [.badAccess]) {}
+                }
+            },
+            Benchmark(name: "scope.nested-4.no-fault") {
+                try sampler.batched {
+                    try nested(depth: 4) {}
+                }
+            },
+            Benchmark(name: "fault.first") {
+                try sampler.firstFault(threads: threads)
+            },
+            Benchmark(name: "fault.sustained") {
+                try sampler.single {
+                    _ = try withUnsafeMachExceptionResult(types: [.badAccess]) {
+                        fault()
+                    }
+                }
+            },
+            Benchmark(name: "fault.nested-4.outermost") {
+                try sampler.single {
+                    try nested(depth: 4) {
+                        fault()
+                    }
+                }
+            },
+            Benchmark(name: "async.no-fault.concurrent") {
+                try sampler.concurrent(calls: 10 * ProcessInfo.processInfo.activeProcessorCount) {}
+            },
+            Benchmark(name: "async.fault.concurrent") {
+                try sampler.concurrent(calls: 10 * ProcessInfo.processInfo.activeProcessorCount) {
+                    fault()
+                }
+            },
+            Benchmark(name: "probe.load.no-fault") {
+                try prepareSafeMemoryAccess()
+                var word = 0
+                return try sampler.batched {
+                    blackHole(safeLoad(from: &word, as: Int.self))
+                }
+            },
+            Benchmark(name: "probe.load.fault") {
+                try prepareSafeMemoryAccess()
+                return try sampler.single {
+                    blackHole(safeLoad(from: UnsafeRawPointer(bitPattern: 8)!, as: Int.self))
+                }
+            },
+            Benchmark(name: "probe.memcpy-4k.no-fault") {
+                try prepareSafeMemoryAccess()
+                let source = [UInt8](repeating: 1, count: 4_096)
+                var destination = [UInt8](repeating: 0, count: 4_096)
+                return try sampler.batched {
+                    safeMemcpy(&destination, source, 4_096)
+                }
+            },
+        ]
+        for (name, decoder) in decoders() {
+            benchmarks.append(Benchmark(name: "decode.\(name)") {
+                try sampler.batched {
+                    decoder.decode(decoder.error)
+                }
+            })
+        }
+        if let replay = replay {
+            benchmarks.append(Benchmark(name: "replay") {
+                try sampler.replay(try MachExceptionReplay(file: replay))
+            })
+        }
+        return benchmarks
+    }
+
+    // Execute an operation in `depth` nested scopes. The outermost scope catches bad access exceptions, and the
+    // scopes it encloses only catch arithmetic exceptions, so a bad access unwinds every one of them.
+    func nested(depth: Int, _ operation: @escaping () -> ()) throws {
+        var inner = operation
+        for _ in 1 ..< depth {
+            let enclosed = inner
+            inner = {
+                _ = try? withUnsafeMachExceptionResult(types: [.arithmetic], operation: enclosed)
+            }
+        }
+        _ = try withUnsafeMachExceptionResult(types: [.badAccess], operation: inner)
+    }
+
+    // A representative error of each exception type, paired with its decoder.
+    func decoders() -> [(String, Decoder)] {
+        func error(_ type: exception_type_t,
+                   _ code: mach_exception_data_type_t,
+                   _ subcode: mach_exception_data_type_t) -> MachExceptionError
+        {
+            return MachExceptionError(mach_exception_record_t(type: type, code: code, subcode: subcode))!
+        }
+
+#if arch(arm) || arch(arm64)
+        let badInstruction = error(EXC_BAD_INSTRUCTION, mach_exception_data_type_t(EXC_ARM_UNDEFINED), 0xd4200000)
+        let arithmetic = error(EXC_ARITHMETIC, mach_exception_data_type_t(EXC_ARM_FP_DZ), 0x1e201800)
+        let breakpoint = error(EXC_BREAKPOINT, mach_exception_data_type_t(EXC_ARM_BREAKPOINT), 0)
+#else
+        let badInstruction = error(EXC_BAD_INSTRUCTION, mach_exception_data_type_t(EXC_I386_INVOP), 0)
+        let arithmetic = error(EXC_ARITHMETIC, mach_exception_data_type_t(EXC_I386_DIV), 0)
+        let breakpoint = error(EXC_BREAKPOINT, mach_exception_data_type_t(EXC_I386_BPT), 0)
+#endif
+        // The codes of crash, resource, guard and corpse notify exceptions are bit fields; see the `Code` types of
+        // their decoders.
+        let crash = error(EXC_CRASH, 11 << 24 | mach_exception_data_type_t(EXC_BAD_ACCESS) << 20 | 1, 0)
+        let resource = error(EXC_RESOURCE,
+                             mach_exception_data_type_t(RESOURCE_TYPE_CPU) << 61 | 1 << 58 | 180 << 7 | 50,
+                             75)
+        let machPortGuard = error(EXC_GUARD, mach_exception_data_type_t(GUARD_TYPE_MACH_PORT) << 61 | 2 << 32 | 1, 3)
+        let corpseNotify = error(EXC_CORPSE_NOTIFY,
+                                 mach_exception_data_type_t(EXC_CRASH),
+                                 mach_exception_data_type_t(OSReasonNamespace.signal.rawValue) << 32 | 11)
+
+        let badAccess = error(EXC_BAD_ACCESS, mach_exception_data_type_t(KERN_INVALID_ADDRESS), 8)
+
+        return [
+            ("badAccess", Decoder(badAccess) { $0.badAccess }),
+            ("badInstruction", Decoder(badInstruction) { $0.badInstruction }),
+            ("arithmetic", Decoder(arithmetic) { $0.arithmetic }),
+            ("breakpoint", Decoder(breakpoint) { $0.breakpoint }),
+            ("syscall", Decoder(error(EXC_SYSCALL, 0x2000004, 0)) { $0.syscall }),
+            ("machSyscall", Decoder(error(EXC_MACH_SYSCALL, -31, 0)) { $0.machSyscall }),
+            ("rpcAlert", Decoder(error(EXC_RPC_ALERT, 0xff000001, 1)) { $0.rpcAlert }),
+            ("crash", Decoder(crash) { $0.crash }),
+            ("resource", Decoder(resource) { $0.resource }),
+            ("guard", Decoder(machPortGuard) { $0.guard }),
+            ("corpseNotify", Decoder(corpseNotify) { $0.corpseNotify }),
+        ]
+    }
+}
+
+// MARK: - Sampling
+
+// A named benchmark.
+struct Benchmark {
+    let name: String
+    let measure: () throws -> Sampler.Samples
+
+    init(name: String, measure: @escaping () throws -> Sampler.Samples) {
+        self.name = name
+        self.measure = measure
+    }
+
+    func run() throws -> BenchmarkResult {
+        return BenchmarkResult(name: name, samples: try measure())
+    }
+}
+
+// A Mach exception error, and the decoder whose cost a benchmark measures. The decoded value is passed to
+// `blackHole` as it is, rather than boxed in an existential, so the benchmark doesn't measure an allocation.
+struct Decoder {
+    let error: MachExceptionError
+    let decode: (MachExceptionError) -> ()
+
+    init<T>(_ error: MachExceptionError, _ decoder: @escaping (MachExceptionError) -> T?) {
+        precondition(decoder(error) != nil, "\(error) doesn't decode")
+        self.error = error
+        self.decode = { blackHole(decoder($0)) }
+    }
+}
+
+struct Sampler {
+    let samples: Int
+    let warmup: Int
+    let batch: Int
+
+    // The samples a benchmark took, in nanoseconds per operation, and the time it spent taking them.
+    struct Samples {
+        var nanoseconds: [Double]
+        var elapsed: UInt64
+        var operations: Int
+    }
+
+    static func now() -> UInt64 {
+        return DispatchTime.now().uptimeNanoseconds
+    }
+
+    // Sample the mean time of batches of operations.
+    func batched(_ operation: () throws -> ()) throws -> Samples {
+        for _ in 0 ..< warmup {
+            try operation()
+        }
+        var nanoseconds = [Double](repeating: 0, count: samples)
+        let start = Self.now()
+        for sample in 0 ..< samples {
+            let begin = Self.now()
+            for _ in 0 ..< batch {
+                try operation()
+            }
+            nanoseconds[sample] = Double(Self.now() - begin) / Double(batch)
+        }
+        return Samples(nanoseconds: nanoseconds, elapsed: Self.now() - start, operations: samples * batch)
+    }
+
+    // Sample the time of single operations.
+    func single(_ operation: () throws -> ()) throws -> Samples {
+        for _ in 0 ..< warmup {
+            try operation()
+        }
+        var nanoseconds = [Double](repeating: 0, count: samples)
+        let start = Self.now()
+        for sample in 0 ..< samples {
+            let begin = Self.now()
+            try operation()
+            nanoseconds[sample] = Double(Self.now() - begin)
+        }
+        return Samples(nanoseconds: nanoseconds, elapsed: Self.now() - start, operations: samples)
+    }
+
+    // Sample the time a thread takes to catch its first fault, which includes preparing the thread to catch
+    // exceptions, by catching a fault on each of a number of new threads in turn.
+    func firstFault(threads: Int) throws -> Samples {
+        var nanoseconds = [Double](repeating: 0, count: threads)
+        var failure: Error?
+        let start = Self.now()
+        for sample in 0 ..< threads {
+            let done = DispatchSemaphore(value: 0)
+            let thread = Thread {
+                let begin = Self.now()
+                do {
+                    _ = try withUnsafeMachExceptionResult(types: [.badAccess]) {
+                        fault()
+                    }
+                    nanoseconds[sample] = Double(Self.now() - begin)
+                } catch {
+                    failure = error
+                }
+                done.signal()
+            }
+            thread.start()
+            done.wait()
+            if let failure = failure {
+                throw failure
+            }
+        }
+        return Samples(nanoseconds: nanoseconds, elapsed: Self.now() - start, operations: threads)
+    }
+
+    // Sample the mean time of delivering an event of a capture, by replaying the whole capture per sample, so the
+    // events replay in their recorded mix and order.
+    func replay(_ capture: MachExceptionReplay) throws -> Samples {
+        let events = capture.reduce(0) { count, _ in count + 1 }
+        guard events > 0 else {
+            throw ValidationError("The capture holds no events.")
+        }
+        for _ in 0 ..< warmup {
+            capture.run { blackHole($0) }
+        }
+        var nanoseconds = [Double](repeating: 0, count: samples)
+        let start = Self.now()
+        for sample in 0 ..< samples {
+            let statistics = capture.run { blackHole($0) }
+            nanoseconds[sample] = Double(statistics.elapsed) / Double(events)
+        }
+        return Samples(nanoseconds: nanoseconds, elapsed: Self.now() - start, operations: samples * events)
+    }
+
+    // Sample the mean time of a call among a number of concurrent asynchronous calls.
+    func concurrent(calls: Int, _ operation: @escaping () -> ()) throws -> Samples {
+        final class Outcome {
+            var failure: Error?
+        }
+
+        // Perform the calls in tasks of the cooperative pool, and wait for them on this thread.
+        func round() throws {
+            let done = DispatchSemaphore(value: 0)
+            let outcome = Outcome()
+            Task {
+                do {
+                    try await withThrowingTaskGroup(of: Void.self) { group in
+                        for _ in 0 ..< calls {
+                            group.addTask {
+                                _ = try await withUnsafeMachExceptionResult(types: [.badAccess], operation: operation)
+                            }
+                        }
+                        try await group.waitForAll()
+                    }
+                } catch {
+                    outcome.failure = error
+                }
+                done.signal()
+            }
+            done.wait()
+            if let failure = outcome.failure {
+                throw failure
+            }
+        }
+
+        for _ in 0 ..< warmup {
+            try round()
+        }
+        var nanoseconds = [Double](repeating: 0, count: samples)
+        let start = Self.now()
+        for sample in 0 ..< samples {
+            let begin = Self.now()
+            try round()
+            nanoseconds[sample] = Double(Self.now() - begin) / Double(calls)
+        }
+        return Samples(nanoseconds: nanoseconds, elapsed: Self.now() - start, operations: samples * calls)
+    }
+}
+
+// Raise a bad access exception, by writing to the unmapped first page.
+@inline(never)
+func fault() {
+    UnsafeMutablePointer<UInt8>(bitPattern: 8)!.pointee = 0
+}
+
+// Keep the optimizer from discarding a value a benchmark computes.
+@inline(never)
+@_optimize(none)
+func blackHole<T>(_ value: T) {
+}
+
+// MARK: - Results
+
+struct BenchmarkResult: Codable, Equatable {
+    let name: String
+    let samples: Int
+    let p50: Double
+    let p99: Double
+    let p999: Double
+    let mean: Double
+    let min: Double
+    let max: Double
+
+    /// The operations per second, over the whole run of the benchmark.
+    let operationsPerSecond: Double
+
+    init(name: String, samples: Sampler.Samples) {
+        let sorted = samples.nanoseconds.sorted()
+        self.name = name
+        self.samples = sorted.count
+        self.p50 = Self.percentile(0.5, of: sorted)
+        self.p99 = Self.percentile(0.99, of: sorted)
+        self.p999 = Self.percentile(0.999, of: sorted)
+        self.mean = sorted.reduce(0, +) / Double(sorted.count)
+        self.min = sorted.first!
+        self.max = sorted.last!
+        self.operationsPerSecond = samples.elapsed == 0
+            ? 0
+            : Double(samples.operations) / (Double(samples.elapsed) / 1e9)
+    }
+
+    // The nearest-rank percentile of sorted samples.
+    static func percentile(_ fraction: Double, of sorted: [Double]) -> Double {
+        let rank = Int((fraction * Double(sorted.count)).rounded(.up))
+        return sorted[Swift.min(Swift.max(rank, 1), sorted.count) - 1]
+    }
+
+    var summary: String {
+        func format(_ value: Double) -> String {
+            return String(format: "%10.1f", value)
+        }
+        let name = self.name.padding(toLength: 28, withPad: " ", startingAt: 0)
+        return "\(name) p50 \(format(p50)) ns  p99 \(format(p99)) ns  p999 \(format(p999)) ns  "
+            + String(format: "%12.0f ops/s", operationsPerSecond)
+    }
+}
+
+struct BenchmarkReport: Codable {
+    let architecture: String
+    let operatingSystem: String
+    let results: [BenchmarkResult]
+
+#if arch(arm64)
+    static let hostArchitecture = "arm64"
+#elseif arch(x86_64)
+    static let hostArchitecture = "x86_64"
+#else
+    static let hostArchitecture = "unknown"
+#endif
+
+#if os(Linux)
+    static let hostOperatingSystem = "Linux"
+#else
+    static let hostOperatingSystem = "Darwin"
+#endif
+
+    // The benchmarks whose p50 or p99 exceeds that of the same benchmark in a baseline by more than a tolerated
+    // fraction. The p999 is too noisy to gate on, so it is reported but not compared.
+    func regressions(from baseline: BenchmarkReport, tolerance: Double) -> [String] {
+        var regressions: [String] = []
+        for result in results {
+            guard let previous = baseline.results.first(where: { $0.name == result.name }) else {
+                continue
+            }
+            for (percentile, current, limit) in [("p50", result.p50, previous.p50), ("p99", result.p99, previous.p99)]
+                where current > limit * (1 + tolerance)
+            {
+                regressions.append("\(result.name) \(percentile) "
+                                   + String(format: "%.1f ns, baseline %.1f ns", current, limit))
+            }
+        }
+        return regressions
+    }
+}
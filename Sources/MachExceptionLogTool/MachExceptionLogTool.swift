@@ -0,0 +1,103 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// mach-exception
+// MachExceptionLogTool.swift
+// Created by Patrick Gili on 2/8/23.
+//
+
+import Foundation
+import ArgumentParser
+import mach_exception
+import mach_exception_helper
+
+@main
+struct MachExceptionLogTool: ParsableCommand {
+    static var configuration = CommandConfiguration(
+        commandName: "mach-exception-log",
+        abstract: "Print the records of a Mach exception event log."
+    )
+
+    @Option(help: "The sequence number of the first file to print.")
+    var from: UInt64 = 0
+
+    @Flag(help: "Keep printing records as they are appended, following the log as it rotates.")
+    var follow = false
+
+    @Option(help: "How long a record may stay pending, in seconds, before a follower gives up waiting for it.")
+    var pendingTimeout: Double = 1
+
+    @Argument(help: "The path from which the log's file names derive (the files are <path>.<sequence>).")
+    var path: String
+
+    mutating func run() throws {
+        var sequence = from
+        while true {
+            let file = MachExceptionLogReader.file(path: path, sequence: sequence)
+            guard FileManager.default.fileExists(atPath: file) else {
+                guard follow else {
+                    return
+                }
+                Thread.sleep(forTimeInterval: 0.1)
+                continue
+            }
+            let reader = try MachExceptionLogReader(file: file)
+            if follow {
+                try printFollowing(reader)
+            } else {
+                for record in reader {
+                    print(describe(record.pointee))
+                }
+            }
+            sequence += 1
+        }
+    }
+
+    // Print a file's records as they are committed, until the file fills up and every record has been printed.
+    // Writers commit records out of order, so wait for a pending record, unless it stays pending so long its writer
+    // must be gone.
+    func printFollowing(_ reader: MachExceptionLogReader) throws {
+        var cursor: UInt64 = 0
+        var pendingSince: Date?
+        while true {
+            if let record = reader.next(&cursor, skipPending: false) {
+                print(describe(record.pointee))
+                pendingSince = nil
+                continue
+            }
+            let tail = min(reader.header.tail, reader.header.capacity)
+            if cursor < tail {
+                let since = pendingSince ?? Date()
+                pendingSince = since
+                if Date().timeIntervalSince(since) >= pendingTimeout {
+                    cursor += 1
+                    pendingSince = nil
+                    continue
+                }
+            } else if reader.isFull {
+                return
+            }
+            fflush(stdout)
+            Thread.sleep(forTimeInterval: 0.05)
+        }
+    }
+
+    func describe(_ record: mach_exception_log_record_t) -> String {
+        let seconds = Double(record.timestamp) / 1e9
+        let date = ISO8601DateFormatter.string(from: Date(timeIntervalSince1970: seconds),
+                                               timeZone: TimeZone(identifier: "UTC")!,
+                                               formatOptions: [.withInternetDateTime, .withFractionalSeconds])
+        let type = MachExceptionType(rawValue: record.type).map { "\($0)" } ?? "\(record.type)"
+        var line = "\(date) thread \(record.thread) \(type)"
+        line += " code 0x\(String(UInt64(bitPattern: record.code), radix: 16))"
+        line += " subcode 0x\(String(UInt64(bitPattern: record.subcode), radix: 16))"
+        if record.pc != 0 {
+            line += " pc 0x\(String(record.pc, radix: 16))"
+        }
+        for frame in record.backtrace {
+            line += "\n    0x\(String(frame, radix: 16))"
+        }
+        return line
+    }
+}
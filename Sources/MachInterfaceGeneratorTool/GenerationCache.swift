@@ -0,0 +1,62 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// mach-exception
+// GenerationCache.swift
+// Created by Patrick Gili on 2/27/23.
+//
+
+import Foundation
+
+/// The keys from which the outputs of definitions files were last generated, persisted between runs of the tool so
+/// that it only regenerates the outputs of the definitions that changed.
+///
+/// A key hashes everything the outputs depend on: the build of the tool, its options, and the definitions. For the
+/// builtin compiler, the definitions are hashed as tokens after preprocessing, which covers the files they include
+/// and the names defined, but not comments or layout, so a change that can't change the outputs regenerates nothing.
+struct GenerationCache: Codable, Equatable {
+
+    /// The key of each definitions file, by path.
+    var keys: [String: String] = [:]
+
+    init() {}
+
+    /// Read a cache, or start an empty one if there is none, or it can't be read.
+    init(contentsOfFile path: String) {
+        let data = FileManager.default.contents(atPath: path)
+        keys = data.flatMap { try? JSONDecoder().decode(Self.self, from: $0) }?.keys ?? [:]
+    }
+
+    func write(toFile path: String) throws {
+        let encoder = JSONEncoder()
+        encoder.outputFormatting = [.prettyPrinted, .sortedKeys]
+        try encoder.encode(self).write(to: URL(fileURLWithPath: path), options: .atomic)
+    }
+
+    /// Whether the outputs of a definitions file are current: last generated from the same key, and still present.
+    func isCurrent(_ input: String, key: String, outputs: [String]) -> Bool {
+        return keys[input] == key && outputs.allSatisfy { FileManager.default.fileExists(atPath: $0) }
+    }
+}
+
+/// A 64-bit FNV-1a hash of content.
+struct ContentHash {
+    private(set) var value: UInt64 = 0xcbf2_9ce4_8422_2325
+
+    mutating func combine<Bytes: Sequence>(_ bytes: Bytes) where Bytes.Element == UInt8 {
+        for byte in bytes {
+            value = (value ^ UInt64(byte)) &* 0x0000_0100_0000_01b3
+        }
+    }
+
+    /// Combine a string, terminated so that the strings combined can't run into each other.
+    mutating func combine(_ string: String) {
+        combine(string.utf8)
+        combine(CollectionOfOne(0))
+    }
+
+    var hexDigest: String {
+        return String(format: "%016llx", value)
+    }
+}
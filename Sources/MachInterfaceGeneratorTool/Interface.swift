@@ -0,0 +1,133 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// mach-exception
+// Interface.swift
+// Created by Patrick Gili on 2/26/23.
+//
+
+import Foundation
+
+/// A location in a Mach interface definitions file.
+struct SourceLocation: Equatable, CustomStringConvertible {
+    var file: String
+    var line: Int
+
+    var description: String {
+        return "\(file):\(line)"
+    }
+}
+
+/// An error compiling a Mach interface definitions file.
+struct InterfaceError: Error, CustomStringConvertible {
+    var location: SourceLocation?
+    var message: String
+
+    init(_ message: String, at location: SourceLocation? = nil) {
+        self.message = message
+        self.location = location
+    }
+
+    var description: String {
+        if let location = location {
+            return "\(location): error: \(message)"
+        }
+        return "error: \(message)"
+    }
+}
+
+/// A type a Mach interface definition declares, resolved to the form in which it travels in a message.
+indirect enum InterfaceType: Equatable {
+    /// An inline integer of a number of bytes.
+    case integer(size: Int)
+
+    /// A port right, which travels in a port descriptor. A receiver finds the disposition the kernel converts the
+    /// sender's disposition into: `MACH_MSG_TYPE_PORT_SEND`, `MACH_MSG_TYPE_PORT_SEND_ONCE` or
+    /// `MACH_MSG_TYPE_PORT_RECEIVE`.
+    case port(receivedDisposition: Int)
+
+    /// An inline array of elements, of a fixed number of elements, or, if `variable`, of at most `count` elements,
+    /// preceded by the number of elements the message carries.
+    case array(element: InterfaceType, count: Int, variable: Bool)
+
+    /// The number of bytes an element of this type occupies in a message.
+    var size: Int {
+        switch self {
+        case .integer(let size):
+            return size
+        case .port:
+            return 4
+        case .array(let element, let count, _):
+            return element.size * count
+        }
+    }
+}
+
+/// A type declaration, naming a type, the C type by which handlers receive it, and for an array, the C type of its
+/// elements.
+struct TypeDeclaration: Equatable {
+    var name: String
+    var type: InterfaceType
+    var cType: String
+    var elementCType: String
+
+    init(name: String, type: InterfaceType, cType: String, elementCType: String? = nil) {
+        self.name = name
+        self.type = type
+        self.cType = cType
+        self.elementCType = elementCType ?? cType
+    }
+}
+
+/// The direction in which a routine argument travels.
+enum ArgumentDirection: String, Equatable {
+    case requestPort = "requestport"
+    case `in`
+    case out
+    case `inout`
+}
+
+/// An argument of a routine.
+struct Argument: Equatable {
+    var name: String
+    var direction: ArgumentDirection
+    var type: TypeDeclaration
+    var isConst: Bool
+    var location: SourceLocation
+
+    /// Whether the argument travels in the request.
+    var isInRequest: Bool {
+        return direction == .in || direction == .inout
+    }
+
+    /// Whether the argument travels in the reply.
+    var isInReply: Bool {
+        return direction == .out || direction == .inout
+    }
+}
+
+/// A routine of a subsystem, or a skipped message identifier.
+struct Routine: Equatable {
+    var name: String
+    var isSimple: Bool
+    var arguments: [Argument]
+    var location: SourceLocation
+}
+
+/// A compiled Mach interface: a subsystem and its routines, in the order of their message identifiers.
+struct Interface: Equatable {
+    var subsystem: String
+    var base: Int
+    var serverPrefix: String
+    var userPrefix: String
+    var imports: [String]
+
+    /// The routines, indexed by message identifier less `base`, with `nil` for the identifiers skipped.
+    var routines: [Routine?]
+
+    /// The message identifier of a routine.
+    func identifier(of routine: Routine) -> Int? {
+        return routines.firstIndex { $0?.name == routine.name }.map { base + $0 }
+    }
+}
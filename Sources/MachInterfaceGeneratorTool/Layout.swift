@@ -0,0 +1,135 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// mach-exception
+// Layout.swift
+// Created by Patrick Gili on 2/26/23.
+//
+
+import Foundation
+
+/// The layout of a routine's request or reply, as `mig` lays messages out on 64-bit hosts.
+///
+/// A message starts with its 24-byte header. A message carrying port rights is complex: the header is followed by
+/// the number of descriptors, and a 12-byte port descriptor per right. The NDR record follows, if the message
+/// carries inline data, and in a reply, the return code. The inline arguments follow in order, each padded to a
+/// 4-byte boundary. A variable-length array is preceded by the number of elements it carries, and only occupies
+/// their bytes, so the arguments that follow it shift with its length.
+struct MessageLayout: Equatable {
+
+    /// The size of a message header.
+    static let headerSize = 24
+
+    /// The size of a port descriptor.
+    static let descriptorSize = 12
+
+    /// The size of an NDR record.
+    static let ndrSize = 8
+
+    /// The size of the error reply, `mig_reply_error_t`, which every reply starts with.
+    static let errorReplySize = headerSize + ndrSize + 4
+
+    /// The arguments carried in port descriptors.
+    var descriptors: [Argument]
+
+    /// The arguments carried inline, in order.
+    var items: [Argument]
+
+    /// The offset of the first inline argument.
+    var start: Int
+
+    /// The size of the message when its variable-length arrays are empty.
+    var minimumSize: Int
+
+    /// The size of the message when its variable-length arrays are full.
+    var maximumSize: Int
+
+    /// Whether the message carries port descriptors.
+    var isComplex: Bool {
+        return !descriptors.isEmpty
+    }
+
+    /// The layout of a routine's request.
+    init(request routine: Routine) {
+        let arguments = routine.arguments.filter { $0.isInRequest }
+        descriptors = arguments.filter {
+            if case .port = $0.type.type {
+                return true
+            }
+            return false
+        }
+        items = arguments.filter {
+            if case .port = $0.type.type {
+                return false
+            }
+            return true
+        }
+        start = Self.headerSize
+        if !descriptors.isEmpty {
+            start += 4 + Self.descriptorSize * descriptors.count
+        }
+        if !items.isEmpty {
+            start += Self.ndrSize
+        }
+        minimumSize = start + items.reduce(0) { $0 + $1.type.type.inlineMinimum }
+        maximumSize = start + items.reduce(0) { $0 + $1.type.type.inlineMaximum }
+    }
+
+    /// The layout of a routine's reply.
+    init(reply routine: Routine) {
+        descriptors = []
+        items = routine.arguments.filter { $0.isInReply }
+        start = Self.errorReplySize
+        minimumSize = start + items.reduce(0) { $0 + $1.type.type.inlineMinimum }
+        maximumSize = start + items.reduce(0) { $0 + $1.type.type.inlineMaximum }
+    }
+
+    /// Round a size up to a 4-byte boundary.
+    static func aligned(_ size: Int) -> Int {
+        return (size + 3) & ~3
+    }
+}
+
+extension InterfaceType {
+
+    /// The smallest number of bytes the type occupies inline.
+    var inlineMinimum: Int {
+        if case .array(_, _, true) = self {
+            return 4
+        }
+        return inlineMaximum
+    }
+
+    /// The largest number of bytes the type occupies inline.
+    var inlineMaximum: Int {
+        if case .array(_, _, true) = self {
+            return 4 + MessageLayout.aligned(size)
+        }
+        return MessageLayout.aligned(size)
+    }
+
+    /// Whether the type is a variable-length array.
+    var isVariable: Bool {
+        if case .array(_, _, true) = self {
+            return true
+        }
+        return false
+    }
+
+    /// The element of an array, or the type itself.
+    var element: InterfaceType {
+        if case .array(let element, _, _) = self {
+            return element
+        }
+        return self
+    }
+
+    /// The number of elements of an array, or 1.
+    var count: Int {
+        if case .array(_, let count, _) = self {
+            return count
+        }
+        return 1
+    }
+}
@@ -0,0 +1,334 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// mach-exception
+// Lexer.swift
+// Created by Patrick Gili on 2/26/23.
+//
+
+import Foundation
+
+/// A token of a Mach interface definitions file.
+struct Token: Equatable {
+    enum Kind: Equatable {
+        case identifier(String)
+        case number(Int)
+        case string(String)
+        case symbol(Character)
+    }
+
+    var kind: Kind
+    var location: SourceLocation
+}
+
+/// Split Mach interface definitions into tokens, performing the subset of the C preprocessor they use: comments,
+/// `#include`, `#define` and `#undef` of names, and conditional sections on `#if`, `#ifdef` and `#ifndef`.
+///
+/// `mig` runs the definitions through the C preprocessor with the SDK's headers on the include path. So that the
+/// definitions compile on any host, the lexer carries the definitions of `<mach/std_types.defs>` and
+/// `<mach/mach_types.defs>` the interfaces of this package use, and substitutes them for those files when they are
+/// not on the include path.
+struct Lexer {
+
+    /// The directories searched for included files.
+    var includePaths: [String]
+
+    /// The names defined, and their values.
+    var defines: [String: String]
+
+    init(includePaths: [String] = [], defines: [String: String] = [:]) {
+        self.includePaths = includePaths
+        self.defines = defines
+    }
+
+    /// Tokenize a file, and the files it includes.
+    mutating func tokenize(file path: String, depth: Int = 0) throws -> [Token] {
+        guard let source = FileManager.default.contents(atPath: path) else {
+            throw InterfaceError("cannot read \(path)")
+        }
+        return try tokenize(String(decoding: source, as: UTF8.self), file: path, depth: depth)
+    }
+
+    /// Tokenize source text, and the files it includes.
+    mutating func tokenize(_ source: String, file: String, depth: Int = 0) throws -> [Token] {
+        guard depth < 32 else {
+            throw InterfaceError("includes nested too deeply", at: SourceLocation(file: file, line: 1))
+        }
+
+        var tokens: [Token] = []
+        // The conditional sections enclosing the current line: whether each is active, and whether a branch of it
+        // has been taken.
+        var conditions: [(active: Bool, taken: Bool)] = []
+        var active: Bool {
+            return conditions.allSatisfy { $0.active }
+        }
+
+        for (index, line) in Self.lines(of: try Self.strippingComments(source, file: file)).enumerated() {
+            let location = SourceLocation(file: file, line: index + 1)
+            let trimmed = line.trimmingCharacters(in: .whitespaces)
+
+            if trimmed.hasPrefix("#") {
+                let directive = trimmed.dropFirst().trimmingCharacters(in: .whitespaces)
+                let name = String(directive.prefix { $0.isLetter })
+                let operand = directive.dropFirst(name.count).trimmingCharacters(in: .whitespaces)
+                switch name {
+                case "if", "ifdef", "ifndef":
+                    // A section within an inactive section takes none of its branches.
+                    guard active else {
+                        conditions.append((false, true))
+                        break
+                    }
+                    let value = name == "if"
+                        ? try evaluate(operand, at: location)
+                        : (defines[operand] != nil) == (name == "ifdef")
+                    conditions.append((value, value))
+                case "elif":
+                    guard let last = conditions.last else {
+                        throw InterfaceError("#elif without #if", at: location)
+                    }
+                    let value = !last.taken && (try evaluate(operand, at: location))
+                    conditions[conditions.count - 1] = (value, last.taken || value)
+                case "else":
+                    guard let last = conditions.last else {
+                        throw InterfaceError("#else without #if", at: location)
+                    }
+                    conditions[conditions.count - 1] = (!last.taken, true)
+                case "endif":
+                    guard conditions.popLast() != nil else {
+                        throw InterfaceError("#endif without #if", at: location)
+                    }
+                case "define" where active:
+                    let parts = operand.split(separator: " ", maxSplits: 1)
+                    guard let defined = parts.first else {
+                        throw InterfaceError("#define without a name", at: location)
+                    }
+                    defines[String(defined)] = parts.count > 1 ? parts[1].trimmingCharacters(in: .whitespaces) : ""
+                case "undef" where active:
+                    defines[operand] = nil
+                case "include" where active:
+                    tokens += try include(operand, from: file, depth: depth, at: location)
+                case "define", "undef", "include":
+                    break
+                default:
+                    if active {
+                        throw InterfaceError("unsupported preprocessor directive #\(name)", at: location)
+                    }
+                }
+                continue
+            }
+
+            if active {
+                tokens += try Self.tokens(of: line, at: location)
+            }
+        }
+        guard conditions.isEmpty else {
+            throw InterfaceError("#if without #endif", at: SourceLocation(file: file, line: 1))
+        }
+        return tokens
+    }
+
+    // MARK: - Preprocessing
+
+    // Replace each comment with a space, keeping the newlines of block comments so lines keep their numbers.
+    static func strippingComments(_ source: String, file: String) throws -> String {
+        var result = ""
+        var characters = source.makeIterator()
+        var pending = characters.next()
+        var line = 1
+        while let character = pending {
+            pending = characters.next()
+            if character == "/" && pending == "/" {
+                while let next = pending, next != "\n" {
+                    pending = characters.next()
+                }
+                result.append(" ")
+            } else if character == "/" && pending == "*" {
+                let start = line
+                pending = characters.next()
+                var previous: Character = " "
+                while true {
+                    guard let next = pending else {
+                        throw InterfaceError("unterminated comment", at: SourceLocation(file: file, line: start))
+                    }
+                    pending = characters.next()
+                    if next == "\n" {
+                        result.append("\n")
+                        line += 1
+                    }
+                    if previous == "*" && next == "/" {
+                        break
+                    }
+                    previous = next
+                }
+                result.append(" ")
+            } else {
+                if character == "\n" {
+                    line += 1
+                }
+                result.append(character)
+            }
+        }
+        return result
+    }
+
+    // Split source into lines, joining the lines a backslash continues with empty lines, so lines keep their numbers.
+    static func lines(of source: String) -> [String] {
+        var lines: [String] = []
+        var continued = ""
+        var joined = 0
+        for line in source.split(separator: "\n", omittingEmptySubsequences: false) {
+            if line.hasSuffix("\\") {
+                continued += line.dropLast() + " "
+                joined += 1
+                continue
+            }
+            lines.append(continued + line)
+            lines += Array(repeating: "", count: joined)
+            continued = ""
+            joined = 0
+        }
+        return lines
+    }
+
+    // Evaluate the condition of an #if or #elif: a number, a defined name, `defined(NAME)`, or the negation of one.
+    func evaluate(_ condition: String, at location: SourceLocation) throws -> Bool {
+        let condition = condition.trimmingCharacters(in: .whitespaces)
+        if condition.hasPrefix("!") {
+            return !(try evaluate(String(condition.dropFirst()), at: location))
+        }
+        if condition.hasPrefix("(") && condition.hasSuffix(")") {
+            return try evaluate(String(condition.dropFirst().dropLast()), at: location)
+        }
+        if condition.hasPrefix("defined") {
+            let name = condition.dropFirst("defined".count)
+                .trimmingCharacters(in: CharacterSet(charactersIn: "() \t"))
+            return defines[name] != nil
+        }
+        if let value = Int(condition) {
+            return value != 0
+        }
+        if condition.allSatisfy({ $0.isLetter || $0.isNumber || $0 == "_" }) {
+            guard let value = defines[condition] else {
+                return false
+            }
+            return value.isEmpty ? true : try evaluate(value, at: location)
+        }
+        throw InterfaceError("unsupported condition \(condition)", at: location)
+    }
+
+    // The tokens of an included file, found relative to the including file for a quoted name, or on the include path.
+    mutating func include(_ operand: String, from file: String, depth: Int, at location: SourceLocation) throws
+        -> [Token]
+    {
+        guard operand.count > 2,
+              let first = operand.first, let last = operand.last,
+              (first == "<" && last == ">") || (first == "\"" && last == "\"") else {
+            throw InterfaceError("malformed #include \(operand)", at: location)
+        }
+        let name = String(operand.dropFirst().dropLast())
+        var directories = includePaths
+        if first == "\"" {
+            directories.insert(Path(file).removingLastComponent().string, at: 0)
+        }
+        for directory in directories {
+            let path = Path(directory).appending(subpath: name).string
+            if FileManager.default.fileExists(atPath: path) {
+                return try tokenize(file: path, depth: depth + 1)
+            }
+        }
+        if let builtin = Self.builtins[name] {
+            return try tokenize(builtin, file: "<builtin>/" + name, depth: depth + 1)
+        }
+        throw InterfaceError("cannot find included file \(name)", at: location)
+    }
+
+    // MARK: - Tokens
+
+    static func tokens(of line: String, at location: SourceLocation) throws -> [Token] {
+        var tokens: [Token] = []
+        var index = line.startIndex
+        while index < line.endIndex {
+            let character = line[index]
+            if character.isWhitespace {
+                index = line.index(after: index)
+            } else if character.isLetter || character == "_" {
+                let end = line[index...].firstIndex { !($0.isLetter || $0.isNumber || $0 == "_") } ?? line.endIndex
+                tokens.append(Token(kind: .identifier(String(line[index ..< end])), location: location))
+                index = end
+            } else if character.isNumber {
+                let end = line[index...].firstIndex { !($0.isLetter || $0.isNumber) } ?? line.endIndex
+                let literal = line[index ..< end]
+                let value = literal.hasPrefix("0x") || literal.hasPrefix("0X")
+                    ? Int(literal.dropFirst(2), radix: 16)
+                    : Int(literal)
+                guard let number = value else {
+                    throw InterfaceError("malformed number \(literal)", at: location)
+                }
+                tokens.append(Token(kind: .number(number), location: location))
+                index = end
+            } else if character == "\"" || (character == "<" && Self.isImport(tokens.last)) {
+                let terminator: Character = character == "\"" ? "\"" : ">"
+                let start = line.index(after: index)
+                guard let end = line[start...].firstIndex(of: terminator) else {
+                    throw InterfaceError("unterminated file name", at: location)
+                }
+                let name = character == "\"" ? "\"\(line[start ..< end])\"" : "<\(line[start ..< end])>"
+                tokens.append(Token(kind: .string(name), location: location))
+                index = line.index(after: end)
+            } else if "();:,=[]*<>".contains(character) {
+                tokens.append(Token(kind: .symbol(character), location: location))
+                index = line.index(after: index)
+            } else {
+                throw InterfaceError("unexpected character \(character)", at: location)
+            }
+        }
+        return tokens
+    }
+
+    static func isImport(_ token: Token?) -> Bool {
+        guard case .identifier(let name)? = token?.kind else {
+            return false
+        }
+        return ["import", "uimport", "simport"].contains(name.lowercased())
+    }
+
+    // MARK: - Built-in definitions
+
+    // The definitions of the SDK's standard definitions files that the interfaces of this package use.
+    static let builtins: [String: String] = [
+        "mach/std_types.defs": """
+            type int32 = MACH_MSG_TYPE_INTEGER_32;
+            type int64 = MACH_MSG_TYPE_INTEGER_64;
+            type boolean_t = MACH_MSG_TYPE_BOOLEAN;
+            type unsigned = MACH_MSG_TYPE_INTEGER_32;
+            type uint32 = MACH_MSG_TYPE_INTEGER_32;
+            type uint64 = MACH_MSG_TYPE_INTEGER_64;
+            type int32_t = MACH_MSG_TYPE_INTEGER_32;
+            type uint32_t = MACH_MSG_TYPE_INTEGER_32;
+            type int64_t = MACH_MSG_TYPE_INTEGER_64;
+            type uint64_t = MACH_MSG_TYPE_INTEGER_64;
+            type integer_t = int32;
+            type natural_t = uint32;
+            type int = int32;
+            type kern_return_t = int;
+            type mach_port_name_t = MACH_MSG_TYPE_PORT_NAME;
+            type mach_port_t = MACH_MSG_TYPE_COPY_SEND;
+            type mach_port_move_receive_t = MACH_MSG_TYPE_MOVE_RECEIVE;
+            type mach_port_copy_send_t = MACH_MSG_TYPE_COPY_SEND;
+            type mach_port_make_send_t = MACH_MSG_TYPE_MAKE_SEND;
+            type mach_port_move_send_t = MACH_MSG_TYPE_MOVE_SEND;
+            type mach_port_make_send_once_t = MACH_MSG_TYPE_MAKE_SEND_ONCE;
+            type mach_port_move_send_once_t = MACH_MSG_TYPE_MOVE_SEND_ONCE;
+            """,
+        "mach/mach_types.defs": """
+            type task_t = mach_port_t;
+            type thread_t = mach_port_t;
+            type thread_act_t = mach_port_t;
+            type exception_mask_t = int;
+            type exception_behavior_t = int;
+            type thread_state_flavor_t = int;
+            type thread_state_t = array[*:1296] of natural_t;
+            """,
+    ]
+}
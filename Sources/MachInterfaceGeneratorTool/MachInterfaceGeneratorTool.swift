@@ -12,6 +12,16 @@ import ArgumentParser
 
 @main
 struct MachInterfaceGeneratorTool: ParsableCommand {
+
+    /// The compilers generating source code files from Mach interface definitions.
+    enum Compiler: String, CaseIterable, ExpressibleByArgument {
+        /// The compiler built into this tool, which generates portable servers on any host.
+        case builtin
+
+        /// The Mach interface generator of Apple's SDK.
+        case mig
+    }
+
     @Flag(help: "Generate server-side RPC source code files.")
     var server = false
     
@@ -21,20 +31,267 @@ struct MachInterfaceGeneratorTool: ParsableCommand {
     @Option(help: "The path of the directory into which to generate source code files.")
     var outputPath: String?
     
+    @Option(help: "The Mach interface compiler with which to generate source code files (builtin or mig).")
+    var compiler: Compiler = .builtin
+
     @Option(help: "The path of a specific Mach interface compiler to use for generating source code files.")
     var mig: String?
 
-    @Argument(help: "The path of the Mach interface definitions file.")
-    var inputPath: String
-    
+    @Flag(help: "Generate a server that switches on message identifiers to inlined routines (builtin compiler only).")
+    var specialized = false
+
+    @Option(name: .customLong("routine"),
+            help: "A routine the server serves, answering the others with MIG_BAD_ID (builtin compiler only).")
+    var routines: [String] = []
+
+    @Option(name: [.customShort("I", allowingJoined: true), .customLong("include-path")],
+            help: "A directory to search for included definitions files.")
+    var includePaths: [String] = []
+
+    @Option(name: [.customShort("D", allowingJoined: true), .customLong("define")],
+            help: "A preprocessor name to define, as NAME or NAME=VALUE.")
+    var defines: [String] = []
+
+    @Option(help: "The header declaring the Mach types on hosts other than Apple's (builtin compiler only).")
+    var portableHeader: String?
+
+    @Option(help: "The path of a file caching the keys of the outputs generated, so that only the outputs of the "
+                + "definitions that changed are generated again.")
+    var cachePath: String?
+
+    @Argument(help: "The paths of the Mach interface definitions files.")
+    var inputPaths: [String]
+
+    // A path to mig selects mig.
+    var selectedCompiler: Compiler {
+        return mig != nil ? .mig : compiler
+    }
+
+    func validate() throws {
+        if selectedCompiler == .builtin && user {
+            throw ValidationError("The builtin compiler only generates servers; use --compiler mig with --user.")
+        }
+        if selectedCompiler == .mig && (specialized || !routines.isEmpty) {
+            throw ValidationError("--specialized and --routine require the builtin compiler.")
+        }
+    }
+
     mutating func run() throws {
-        let input = Path(inputPath)
-        guard input.extension == "defs" else {
-            return
+        let summary = try generate()
+        if cachePath != nil || inputPaths.count > 1 {
+            print(summary)
         }
-        
+    }
+
+    // MARK: - Generation
+
+    /// What generating the outputs of a definitions file amounted to.
+    enum Outcome {
+        /// The outputs were written.
+        case generated
+
+        /// The outputs were generated again, but identical to those written before, which were left untouched.
+        case unchanged
+
+        /// The cache recorded the outputs as current, so they weren't generated again.
+        case cached
+    }
+
+    /// The outcomes of generating the outputs of definitions files.
+    struct Summary: CustomStringConvertible {
+        var generated: [String] = []
+        var unchanged: [String] = []
+        var cached: [String] = []
+
+        var description: String {
+            return "Generated \(generated.count), unchanged \(unchanged.count), cached \(cached.count) "
+                + "definitions files."
+        }
+    }
+
+    // Identifies the build of the tool, so that rebuilding it invalidates what it cached.
+    static let toolFingerprint = fingerprint(ofFile: Bundle.main.executablePath ?? CommandLine.arguments[0])
+
+    static func fingerprint(ofFile path: String) -> String {
+        let attributes = try? FileManager.default.attributesOfItem(atPath: path)
+        let size = (attributes?[.size] as? NSNumber)?.int64Value ?? 0
+        let modified = (attributes?[.modificationDate] as? Date)?.timeIntervalSince1970 ?? 0
+        return "\(path):\(size):\(modified)"
+    }
+
+    // The options the outputs depend on.
+    var configuration: [String] {
+        return [
+            selectedCompiler.rawValue,
+            "server=\(server)",
+            "user=\(user)",
+            "specialized=\(specialized)",
+            "routines=\(routines.sorted())",
+            "include-paths=\(includePaths)",
+            "defines=\(defines)",
+            "portable-header=\(portableHeader ?? "")",
+            "mig=\(mig.map { Self.fingerprint(ofFile: $0) } ?? "")",
+            "output-path=\(outputPath ?? "")",
+        ]
+    }
+
+    /// Generate the outputs of the definitions files, in parallel, skipping those the cache records as current.
+    func generate() throws -> Summary {
+        let inputs = inputPaths.map { Path($0) }.filter { $0.extension == "defs" }
+        let cache = cachePath.map { GenerationCache(contentsOfFile: $0) } ?? GenerationCache()
+
+        var results = [Result<(key: String, outcome: Outcome), Error>?](repeating: nil, count: inputs.count)
+        let lock = NSLock()
+        DispatchQueue.concurrentPerform(iterations: inputs.count) { index in
+            let result = Result { try generate(inputs[index], cache: cache) }
+            lock.lock()
+            results[index] = result
+            lock.unlock()
+        }
+
+        var summary = Summary()
+        var updated = cache
+        var failure: Error?
+        for (input, result) in zip(inputs, results) {
+            switch result! {
+            case .success(let generation):
+                updated.keys[input.string] = generation.key
+                switch generation.outcome {
+                case .generated:
+                    summary.generated.append(input.string)
+                case .unchanged:
+                    summary.unchanged.append(input.string)
+                case .cached:
+                    summary.cached.append(input.string)
+                }
+            case .failure(let error):
+                updated.keys[input.string] = nil
+                if let error = error as? InterfaceError {
+                    FileHandle.standardError.write(Data((error.description + "\n").utf8))
+                    failure = failure ?? ExitCode.failure
+                } else {
+                    failure = failure ?? error
+                }
+            }
+        }
+        if let cachePath = cachePath, updated != cache {
+            try updated.write(toFile: cachePath)
+        }
+        if let failure = failure {
+            throw failure
+        }
+        return summary
+    }
+
+    func generate(_ input: Path, cache: GenerationCache) throws -> (key: String, outcome: Outcome) {
         let output = Path(outputPath ?? input.removingLastComponent().string)
-        
+        switch selectedCompiler {
+        case .builtin:
+            return try compile(input, into: output, cache: cache)
+        case .mig:
+            var hash = ContentHash()
+            hash.combine(Self.toolFingerprint)
+            configuration.forEach { hash.combine($0) }
+            hash.combine(try preprocess(input))
+            let key = hash.hexDigest
+
+            var outputs: [String] = []
+            if server {
+                outputs += [input.stem + "Server.c", input.stem + "Server.h"]
+            }
+            if user {
+                outputs += [input.stem + "User.c", input.stem + "User.h"]
+            }
+            if cache.isCurrent(input.string, key: key, outputs: outputs.map { output.appending($0).string }) {
+                return (key, .cached)
+            }
+            try runMig(input, into: output)
+            return (key, .generated)
+        }
+    }
+
+    // Write a file, unless it already has the contents, so that what depends on it isn't rebuilt needlessly.
+    static func write(_ contents: String, to path: Path) throws -> Bool {
+        let data = Data(contents.utf8)
+        if FileManager.default.contents(atPath: path.string) == data {
+            return false
+        }
+        try data.write(to: URL(fileURLWithPath: path.string), options: .atomic)
+        return true
+    }
+
+    // MARK: - Builtin compiler
+
+    func compile(_ input: Path, into output: Path, cache: GenerationCache) throws
+        -> (key: String, outcome: Outcome)
+    {
+        var values: [String: String] = [:]
+        for define in defines {
+            let parts = define.split(separator: "=", maxSplits: 1)
+            guard let name = parts.first else {
+                throw ValidationError("Malformed definition \(define).")
+            }
+            values[String(name)] = parts.count > 1 ? String(parts[1]) : "1"
+        }
+
+        var lexer = Lexer(includePaths: includePaths, defines: values)
+        let tokens = try lexer.tokenize(file: input.string)
+        var hash = ContentHash()
+        hash.combine(Self.toolFingerprint)
+        configuration.forEach { hash.combine($0) }
+        tokens.forEach { hash.combine(String(describing: $0.kind)) }
+        let key = hash.hexDigest
+
+        let headerName = input.stem + "Server.h"
+        let source = output.appending(input.stem + "Server.c")
+        let header = output.appending(headerName)
+        guard server else {
+            return (key, .unchanged)
+        }
+        if cache.isCurrent(input.string, key: key, outputs: [source.string, header.string]) {
+            return (key, .cached)
+        }
+
+        var parser = Parser(tokens: tokens)
+        let options = ServerGenerator.Options(specialized: specialized,
+                                              routines: routines.isEmpty ? nil : Set(routines),
+                                              portableHeader: portableHeader)
+        let generator = try ServerGenerator(interface: try parser.parse(),
+                                            options: options,
+                                            definitionsName: input.lastComponent,
+                                            headerName: headerName)
+        let wroteSource = try Self.write(generator.source(), to: source)
+        let wroteHeader = try Self.write(generator.header(), to: header)
+        return (key, wroteSource || wroteHeader ? .generated : .unchanged)
+    }
+
+    // MARK: - mig
+
+    // The SDK's headers, which mig's preprocessing searches for the standard definitions files.
+    static let sdkIncludePath =
+        "/Applications/Xcode.app/Contents/Developer/Platforms/MacOSX.platform/Developer/SDKs/MacOSX.sdk/usr/include"
+
+    // The definitions as mig compiles them, run through the C preprocessor with mig's include paths and definitions,
+    // so that a change to an included file changes the key. Line markers are left out, so that editing comments or
+    // blank lines doesn't.
+    func preprocess(_ input: Path) throws -> Data {
+        let process = Process()
+        process.executableURL = URL(fileURLWithPath: "/usr/bin/cc")
+        process.arguments = ["-E", "-P", "-x", "c", "-I" + Self.sdkIncludePath]
+            + includePaths.map { "-I" + $0 } + defines.map { "-D" + $0 } + [input.string]
+        let outputPipe = Pipe()
+        process.standardOutput = outputPipe
+        process.standardError = FileHandle.nullDevice
+        try process.run()
+        let preprocessed = outputPipe.fileHandleForReading.readDataToEndOfFile()
+        process.waitUntilExit()
+        guard process.terminationReason == .exit && process.terminationStatus == 0 else {
+            throw InterfaceError("cannot preprocess \(input.string)")
+        }
+        return preprocessed
+    }
+
+    func runMig(_ input: Path, into output: Path) throws {
         let serverSideRPCSourcePath: Path
         let serverSideRPCHeaderPath: Path
         if server {
@@ -78,7 +335,8 @@ struct MachInterfaceGeneratorTool: ParsableCommand {
             "-user", userSideRPCSourcePath.string,
             "-header", userSideRPCHeaderPath.string,
             //"-isysroot", sdkPath.string,
-            "-I/Applications/Xcode.app/Contents/Developer/Platforms/MacOSX.platform/Developer/SDKs/MacOSX.sdk/usr/include",
+            "-I" + Self.sdkIncludePath,
+        ] + includePaths.map { "-I" + $0 } + defines.map { "-D" + $0 } + [
             input.string
         ]
         
@@ -0,0 +1,273 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// mach-exception
+// Parser.swift
+// Created by Patrick Gili on 2/26/23.
+//
+
+import Foundation
+
+/// Parse the tokens of Mach interface definitions into an interface.
+///
+/// The parser accepts the subset of the `mig` language in which the exception interfaces are written: a subsystem,
+/// server and user prefixes, imports, type declarations of integers, port rights and inline arrays of integers,
+/// routines and simple routines with `requestport`, `in`, `out` and `inout` arguments, and skipped identifiers. It
+/// rejects anything else with an error, rather than generating a server that decodes messages differently than the
+/// server `mig` would generate.
+struct Parser {
+    private var tokens: [Token]
+    private var index = 0
+    private var types: [String: TypeDeclaration] = [:]
+
+    init(tokens: [Token]) {
+        self.tokens = tokens
+    }
+
+    /// Parse an interface.
+    mutating func parse() throws -> Interface {
+        var subsystem: (name: String, base: Int)?
+        var serverPrefix = ""
+        var userPrefix = ""
+        var imports: [String] = []
+        var routines: [Routine?] = []
+
+        while let token = peek() {
+            let keyword = try identifier()
+            switch keyword.lowercased() {
+            case "subsystem":
+                guard subsystem == nil else {
+                    throw InterfaceError("more than one subsystem", at: token.location)
+                }
+                var name = try identifier()
+                while ["kerneluser", "kernelserver"].contains(name.lowercased()) {
+                    name = try identifier()
+                }
+                subsystem = (name, try number())
+            case "serverprefix":
+                serverPrefix = try identifier()
+            case "userprefix":
+                userPrefix = try identifier()
+            case "import", "uimport", "simport":
+                guard case .string(let name)? = next()?.kind else {
+                    throw InterfaceError("expected a file name", at: token.location)
+                }
+                imports.append(name)
+            case "type":
+                let name = try identifier()
+                try expect("=")
+                let resolved = try type()
+                types[name] = TypeDeclaration(name: name,
+                                              type: resolved.type,
+                                              cType: name,
+                                              elementCType: resolved.elementCType)
+            case "routine", "simpleroutine":
+                routines.append(try routine(isSimple: keyword.lowercased() == "simpleroutine", at: token.location))
+                continue
+            case "skip":
+                routines.append(nil)
+            default:
+                throw InterfaceError("unsupported statement \(keyword)", at: token.location)
+            }
+            try expect(";")
+        }
+
+        guard let subsystem = subsystem else {
+            throw InterfaceError("the definitions declare no subsystem")
+        }
+        return Interface(subsystem: subsystem.name,
+                         base: subsystem.base,
+                         serverPrefix: serverPrefix,
+                         userPrefix: userPrefix,
+                         imports: imports,
+                         routines: routines)
+    }
+
+    // MARK: - Types
+
+    // The types `mig` defines intrinsically, which the standard definitions files name.
+    static let intrinsics: [String: InterfaceType] = [
+        "MACH_MSG_TYPE_BOOLEAN": .integer(size: 4),
+        "MACH_MSG_TYPE_INTEGER_64": .integer(size: 8),
+        "MACH_MSG_TYPE_INTEGER_32": .integer(size: 4),
+        "MACH_MSG_TYPE_INTEGER_16": .integer(size: 2),
+        "MACH_MSG_TYPE_INTEGER_8": .integer(size: 1),
+        "MACH_MSG_TYPE_CHAR": .integer(size: 1),
+        "MACH_MSG_TYPE_BYTE": .integer(size: 1),
+        "MACH_MSG_TYPE_PORT_NAME": .integer(size: 4),
+        "MACH_MSG_TYPE_MOVE_RECEIVE": .port(receivedDisposition: 16),
+        "MACH_MSG_TYPE_MOVE_SEND": .port(receivedDisposition: 17),
+        "MACH_MSG_TYPE_COPY_SEND": .port(receivedDisposition: 17),
+        "MACH_MSG_TYPE_MAKE_SEND": .port(receivedDisposition: 17),
+        "MACH_MSG_TYPE_MOVE_SEND_ONCE": .port(receivedDisposition: 18),
+        "MACH_MSG_TYPE_MAKE_SEND_ONCE": .port(receivedDisposition: 18),
+    ]
+
+    // A type specification: an intrinsic or declared type, or an inline array of one.
+    mutating func type() throws -> TypeDeclaration {
+        let location = peek()?.location
+        let name = try identifier()
+        if name.lowercased() == "array" {
+            try expect("[")
+            var variable = false
+            let count: Int
+            if accept("*") {
+                variable = true
+                guard accept(":") else {
+                    throw InterfaceError("unbounded arrays travel out of line, which is not supported", at: location)
+                }
+                count = try number()
+            } else {
+                count = try number()
+            }
+            try expect("]")
+            guard try identifier().lowercased() == "of" else {
+                throw InterfaceError("expected of", at: location)
+            }
+            let element = try type()
+            guard case .integer = element.type else {
+                throw InterfaceError("arrays of \(element.name) are not supported", at: location)
+            }
+            return TypeDeclaration(name: element.name,
+                                   type: .array(element: element.type, count: count, variable: variable),
+                                   cType: element.cType + " *",
+                                   elementCType: element.cType)
+        }
+        if let intrinsic = Self.intrinsics[name] {
+            return TypeDeclaration(name: name, type: intrinsic, cType: name)
+        }
+        guard let declared = types[name] else {
+            throw InterfaceError("undeclared type \(name)", at: location)
+        }
+        return declared
+    }
+
+    // MARK: - Routines
+
+    mutating func routine(isSimple: Bool, at location: SourceLocation) throws -> Routine {
+        let name = try identifier()
+        try expect("(")
+        var arguments: [Argument] = []
+        while !accept(")") {
+            arguments.append(try argument())
+            if !accept(";") {
+                try expect(")")
+                break
+            }
+        }
+        try expect(";")
+
+        // Unless an argument is the request port, the first argument is.
+        if !arguments.contains(where: { $0.direction == .requestPort }) {
+            guard let first = arguments.first, first.direction == .in else {
+                throw InterfaceError("routine \(name) has no request port", at: location)
+            }
+            arguments[0].direction = .requestPort
+        }
+        for argument in arguments {
+            if argument.direction == .requestPort, case .port = argument.type.type {
+                continue
+            }
+            if argument.direction == .requestPort {
+                throw InterfaceError("the request port \(argument.name) is not a port", at: argument.location)
+            }
+            if argument.isInReply, case .port = argument.type.type {
+                throw InterfaceError("port rights in replies are not supported", at: argument.location)
+            }
+            if argument.direction == .inout, case .array = argument.type.type {
+                throw InterfaceError("inout arrays are not supported", at: argument.location)
+            }
+            if isSimple && argument.isInReply {
+                throw InterfaceError("simple routine \(name) has a reply argument", at: argument.location)
+            }
+        }
+        if arguments.filter({ $0.direction == .requestPort }).count > 1 {
+            throw InterfaceError("routine \(name) has more than one request port", at: location)
+        }
+        try Self.validateReply(of: arguments, routine: name, at: location)
+        return Routine(name: name, isSimple: isSimple, arguments: arguments, location: location)
+    }
+
+    // A handler writes a reply's variable-length array in place, so the array must be the last argument of the
+    // reply, and the only variable-length one.
+    static func validateReply(of arguments: [Argument], routine: String, at location: SourceLocation) throws {
+        let reply = arguments.filter { $0.isInReply }
+        for (position, argument) in reply.enumerated() {
+            if case .array(_, _, true) = argument.type.type, position != reply.count - 1 {
+                throw InterfaceError("a variable-length reply array must be the last reply argument of \(routine)",
+                                     at: argument.location)
+            }
+        }
+    }
+
+    mutating func argument() throws -> Argument {
+        guard let location = peek()?.location else {
+            throw InterfaceError("unexpected end of the definitions")
+        }
+        var name = try identifier()
+        var direction = ArgumentDirection.in
+        if case .identifier? = peek()?.kind {
+            guard let specified = ArgumentDirection(rawValue: name.lowercased()) else {
+                throw InterfaceError("unsupported argument direction \(name)", at: location)
+            }
+            direction = specified
+            name = try identifier()
+        }
+        try expect(":")
+        guard case .identifier(let typeName)? = peek()?.kind, typeName.lowercased() != "array" else {
+            throw InterfaceError("the type of argument \(name) must be named", at: location)
+        }
+        let type = try self.type()
+        var isConst = false
+        while accept(",") {
+            let flag = try identifier()
+            guard flag.lowercased() == "const" else {
+                throw InterfaceError("unsupported argument flag \(flag)", at: location)
+            }
+            isConst = true
+        }
+        return Argument(name: name, direction: direction, type: type, isConst: isConst, location: location)
+    }
+
+    // MARK: - Tokens
+
+    func peek() -> Token? {
+        return index < tokens.count ? tokens[index] : nil
+    }
+
+    mutating func next() -> Token? {
+        defer { index += 1 }
+        return peek()
+    }
+
+    mutating func identifier() throws -> String {
+        let token = next()
+        guard case .identifier(let name)? = token?.kind else {
+            throw InterfaceError("expected an identifier", at: token?.location ?? tokens.last?.location)
+        }
+        return name
+    }
+
+    mutating func number() throws -> Int {
+        let token = next()
+        guard case .number(let value)? = token?.kind else {
+            throw InterfaceError("expected a number", at: token?.location ?? tokens.last?.location)
+        }
+        return value
+    }
+
+    mutating func accept(_ symbol: Character) -> Bool {
+        guard case .symbol(symbol)? = peek()?.kind else {
+            return false
+        }
+        index += 1
+        return true
+    }
+
+    mutating func expect(_ symbol: Character) throws {
+        guard accept(symbol) else {
+            throw InterfaceError("expected \(symbol)", at: peek()?.location ?? tokens.last?.location)
+        }
+    }
+}
@@ -0,0 +1,617 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// mach-exception
+// ServerGenerator.swift
+// Created by Patrick Gili on 2/26/23.
+//
+
+import Foundation
+
+/// Generate the server side of an interface: C that decodes requests, performs the checks the server `mig` generates
+/// performs, invokes the routines' handlers, and builds the replies, on caller-provided byte buffers.
+///
+/// Unlike `mig`'s server, the generated server depends on neither the SDK nor a Mach kernel, so it builds and runs on
+/// any little-endian host. Its entry point is `<subsystem>_server_dispatch(request, request_size, reply)`, which
+/// returns `false` for a request of no routine it serves, as `<subsystem>_server` does. The handlers are the
+/// functions `mig` would have the server call, named with the interface's server prefix, and with the same
+/// parameters.
+///
+/// By default, the server dispatches requests through a table of routines, as `mig`'s server does. A specialized
+/// server instead switches on the request's identifier to routines inlined into the switch, starts each reply from
+/// a static template of its header, and serves only the routines it is asked to, answering the others with
+/// `MIG_BAD_ID`, so the handlers of routines a program doesn't implement needn't exist.
+struct ServerGenerator {
+
+    /// The options shaping the generated server.
+    struct Options {
+        /// Whether to generate a specialized server.
+        var specialized = false
+
+        /// The names of the routines to serve, or `nil` to serve every routine.
+        var routines: Set<String>?
+
+        /// A header declaring the Mach types on hosts other than Apple's, such as `mach_exception_compat.h`.
+        var portableHeader: String?
+    }
+
+    let interface: Interface
+    let options: Options
+    let definitionsName: String
+    let headerName: String
+
+    /// The routines served, with their message identifiers.
+    let served: [(identifier: Int, routine: Routine)]
+
+    init(interface: Interface, options: Options, definitionsName: String, headerName: String) throws {
+        self.interface = interface
+        self.options = options
+        self.definitionsName = definitionsName
+        self.headerName = headerName
+
+        let named = Set(interface.routines.compactMap { $0?.name })
+        for name in options.routines ?? [] where !named.contains(name) {
+            throw InterfaceError("the subsystem \(interface.subsystem) has no routine \(name)")
+        }
+        served = interface.routines.enumerated().compactMap { index, routine -> (identifier: Int, routine: Routine)? in
+            guard let routine = routine, options.routines?.contains(routine.name) ?? true else {
+                return nil
+            }
+            return (interface.base + index, routine)
+        }
+    }
+
+    var prefix: String {
+        return interface.subsystem
+    }
+
+    var constantPrefix: String {
+        return interface.subsystem.uppercased()
+    }
+
+    func handlerName(of routine: Routine) -> String {
+        return interface.serverPrefix + routine.name
+    }
+
+    // As mig does, name a routine's stub after the routine, with an _X prefix.
+    func stubName(of routine: Routine) -> String {
+        return "_X\(routine.name)"
+    }
+
+    // MARK: - Header
+
+    /// The server's header, declaring the handlers and the dispatch function.
+    func header() -> String {
+        let guardName = "_\(prefix)_server_"
+        var lines = banner()
+        lines += [
+            "#ifndef \(guardName)",
+            "#define \(guardName)",
+            "",
+            "#include <stdbool.h>",
+            "#include <stddef.h>",
+            "#include <stdint.h>",
+            "",
+            "#ifdef __APPLE__",
+            "#include <mach/mach_types.h>",
+            "#include <mach/mig_errors.h>",
+        ]
+        if let portableHeader = options.portableHeader {
+            lines += [
+                "#else",
+                "#include \"\(portableHeader)\"",
+            ]
+        }
+        lines.append("#endif")
+        for name in interface.imports {
+            lines.append("#include \(name)")
+        }
+
+        let requestMaximum = served.map { MessageLayout(request: $0.routine).maximumSize }.max() ?? 0
+        let replyMaximum = served.map { MessageLayout(reply: $0.routine).maximumSize }.max() ?? 0
+        lines += [
+            "",
+            "/// The number of message identifiers of the subsystem, starting at \(interface.base).",
+            "#define \(prefix)_MSG_COUNT \(interface.routines.count)",
+            "",
+            "/// The size of the largest request the server accepts, excluding the trailer the kernel",
+            "/// appends, and of the largest reply it builds.",
+            "#define \(constantPrefix)_SERVER_REQUEST_MAX \(requestMaximum)",
+            "#define \(constantPrefix)_SERVER_REPLY_MAX \(Swift.max(replyMaximum, MessageLayout.errorReplySize))",
+            "",
+            "// The handlers of the routines served, which the program implements.",
+        ]
+        for (identifier, routine) in served {
+            lines.append("")
+            lines.append("/// \(routine.name) (\(identifier))")
+            lines += call("kern_return_t \(handlerName(of: routine))", parameters(of: routine), terminator: ";")
+        }
+        lines += [
+            "",
+            "/// Dispatch a request to its routine's handler, and build its reply.",
+            "///",
+            "/// Like the server mig generates, the function always builds a reply: either the routine's",
+            "/// reply, or an error reply whose return code is `MIG_BAD_ID` for a request of no routine",
+            "/// served, `MIG_BAD_ARGUMENTS` or `MIG_TYPE_ERROR` for a malformed request, or the handler's",
+            "/// failure.",
+            "///",
+            "/// - Parameters:",
+            "///   - request: The request, starting with its message header, aligned on a 4-byte boundary.",
+            "///   - request_size: The number of bytes available at `request`, which bounds the size the",
+            "///     header claims.",
+            "///   - reply: The buffer receiving the reply, which must hold at least",
+            "///     `\(constantPrefix)_SERVER_REPLY_MAX` bytes.",
+            "///",
+            "/// - Returns: `true` if the request's identifier is one of the routines served, or `false` otherwise.",
+            "bool \(prefix)_server_dispatch(void *request, size_t request_size, void *reply);",
+            "",
+            "#endif /* \(guardName) */",
+        ]
+        return lines.joined(separator: "\n") + "\n"
+    }
+
+    // The parameters of a routine's handler.
+    func parameters(of routine: Routine) -> [String] {
+        var parameters: [String] = []
+        for argument in routine.arguments {
+            let name = argument.name
+            let type = argument.type
+            if case .port = type.type {
+                // As mig does, pass port rights by name, whatever the type declaring them.
+                parameters.append("mach_port_t \(name)")
+                continue
+            }
+            switch argument.direction {
+            case .requestPort:
+                parameters.append("\(type.cType) \(name)")
+            case .in:
+                parameters.append("\(argument.isConst ? "const " : "")\(type.cType) \(name)")
+                if type.type.isVariable {
+                    parameters.append("mach_msg_type_number_t \(name)Cnt")
+                }
+            case .inout:
+                parameters.append("\(type.cType) *\(name)")
+            case .out:
+                if case .array = type.type {
+                    parameters.append("\(type.cType) \(name)")
+                    if type.type.isVariable {
+                        parameters.append("mach_msg_type_number_t *\(name)Cnt")
+                    }
+                } else {
+                    parameters.append("\(type.cType) *\(name)")
+                }
+            }
+        }
+        return parameters
+    }
+
+    // MARK: - Source
+
+    /// The server's source.
+    func source() -> String {
+        var lines = banner()
+        lines += [
+            "#include <string.h>",
+            "#include \"\(headerName)\"",
+            "",
+            "#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__",
+            "#error \"The server encodes messages for little-endian hosts.\"",
+            "#endif",
+            "",
+            "// NDR_record for a little-endian host.",
+            "static const uint8_t \(prefix)_ndr_record[8] = { 0, 0, 0, 0, 1, 0, 0, 0 };",
+            "",
+            "static inline uint32_t \(prefix)_load32(const uint8_t *buffer, size_t offset)",
+            "{",
+            "    uint32_t value;",
+            "    memcpy(&value, buffer + offset, sizeof(value));",
+            "    return value;",
+            "}",
+            "",
+            "static inline void \(prefix)_store32(uint8_t *buffer, size_t offset, uint32_t value)",
+            "{",
+            "    memcpy(buffer + offset, &value, sizeof(value));",
+            "}",
+            "",
+            "static inline size_t \(prefix)_aligned(size_t size)",
+            "{",
+            "    return (size + 3) & ~(size_t) 3;",
+            "}",
+            "",
+            "// Whether a port descriptor carries a right of a disposition.",
+            "static inline bool \(prefix)_is_port(const uint8_t *descriptor, uint8_t disposition)",
+            "{",
+            "    return descriptor[11] == 0 && descriptor[10] == disposition;",
+            "}",
+            "",
+            "// Build an error reply to a request, or to a request too short to have a header.",
+        ]
+        lines += call("static void \(prefix)_error_reply",
+                      ["const uint8_t *in", "size_t request_size", "uint8_t *out", "kern_return_t code"],
+                      terminator: "")
+        lines += [
+            "{",
+            "    memset(out, 0, \(MessageLayout.errorReplySize));",
+            "    memcpy(out + 24, \(prefix)_ndr_record, sizeof(\(prefix)_ndr_record));",
+            "    \(prefix)_store32(out, 4, \(MessageLayout.errorReplySize));",
+            "    if (request_size >= 24) {",
+            "        \(prefix)_store32(out, 0, \(prefix)_load32(in, 0) & 0x1fu);",
+            "        \(prefix)_store32(out, 8, \(prefix)_load32(in, 8));",
+            "        \(prefix)_store32(out, 20, \(prefix)_load32(in, 20) + 100);",
+            "    }",
+            "    \(prefix)_store32(out, 32, (uint32_t) code);",
+            "}",
+        ]
+        for (identifier, routine) in served {
+            lines.append("")
+            lines += stub(for: routine, identifier: identifier)
+        }
+        lines.append("")
+        lines += options.specialized ? specializedDispatch() : tableDispatch()
+        return lines.joined(separator: "\n") + "\n"
+    }
+
+    func banner() -> [String] {
+        var lines = [
+            "//",
+            "// Generated by MachInterfaceGeneratorTool from \(definitionsName). Do not edit.",
+            "//",
+        ]
+        if options.specialized {
+            lines.append("// Specialized to serve \(served.map { $0.routine.name }.joined(separator: ", ")).")
+            lines.append("//")
+        }
+        lines.append("")
+        return lines
+    }
+
+    // A routine's stub: it checks and decodes a request, calls the handler, and completes the reply.
+    func stub(for routine: Routine, identifier: Int) -> [String] {
+        let request = MessageLayout(request: routine)
+        let reply = MessageLayout(reply: routine)
+        let load = "\(prefix)_load32"
+        let qualifier = options.specialized ? "static inline __attribute__((always_inline))" : "static"
+        var lines = [
+            "// \(routine.name) (\(identifier))",
+            "\(qualifier) kern_return_t \(stubName(of: routine))(uint8_t *in, mach_msg_size_t size, uint8_t *out)",
+            "{",
+        ]
+
+        // The shape of the request: whether it is complex, its descriptors, and its size.
+        var shape: [String] = []
+        if request.isComplex {
+            shape.append("!(\(load)(in, 0) & 0x80000000u)")
+            shape.append("\(load)(in, 24) != \(request.descriptors.count)")
+        } else {
+            shape.append("(\(load)(in, 0) & 0x80000000u)")
+        }
+        shape.append("size < \(request.minimumSize)")
+        shape.append("size > \(request.maximumSize)")
+        lines += failure(shape, "MIG_BAD_ARGUMENTS")
+
+        var descriptorOffsets: [String: Int] = [:]
+        for (index, argument) in request.descriptors.enumerated() {
+            descriptorOffsets[argument.name] = 28 + MessageLayout.descriptorSize * index
+        }
+        if !request.descriptors.isEmpty {
+            lines += failure(request.descriptors.map { argument in
+                guard case .port(let disposition) = argument.type.type else {
+                    return "true"
+                }
+                return "!\(prefix)_is_port(in + \(descriptorOffsets[argument.name]!), \(disposition))"
+            }, "MIG_TYPE_ERROR")
+        }
+
+        // The inline arguments, which follow the variable-length arrays before them.
+        if !request.items.isEmpty {
+            lines.append("")
+            lines.append("    size_t offset = \(request.start);")
+        }
+        for (position, argument) in request.items.enumerated() {
+            let name = argument.name
+            let type = argument.type
+            let remaining = request.items[(position + 1)...].reduce(0) { $0 + $1.type.type.inlineMinimum }
+            switch type.type {
+            case .array(let element, let count, true):
+                lines += [
+                    "    mach_msg_type_number_t \(name)Cnt = \(load)(in, offset);",
+                    "    offset += 4;",
+                ]
+                let bytes = arrayBytes(element: element, count: "\(name)Cnt")
+                let required = remaining > 0 ? "offset + \(bytes) + \(remaining)" : "offset + \(bytes)"
+                lines += failure(["\(name)Cnt > \(count)", "size < \(required)"], "MIG_BAD_ARGUMENTS")
+                lines += decodeArray(argument, bytes: "\(element.size) * \(name)Cnt")
+                lines.append("    offset += \(bytes);")
+            case .array(let element, let count, false):
+                lines += decodeArray(argument, bytes: "\(element.size * count)")
+                lines.append("    offset += \(type.type.inlineMaximum);")
+            default:
+                lines += [
+                    "    \(type.cType) \(name) = 0;",
+                    "    memcpy(&\(name), in + offset, \(type.type.size));",
+                    "    offset += \(type.type.inlineMaximum);",
+                ]
+            }
+        }
+        if request.items.contains(where: { $0.type.type.isVariable }) {
+            lines += failure(["size != offset"], "MIG_BAD_ARGUMENTS")
+        }
+
+        // The reply arguments, which the handler writes in place when it can.
+        var replyOffsets: [String: Int] = [:]
+        var replyOffset = reply.start
+        for argument in reply.items {
+            replyOffsets[argument.name] = replyOffset
+            replyOffset += argument.type.type.inlineMaximum
+        }
+        if reply.items.contains(where: { $0.direction == .out }) {
+            lines.append("")
+        }
+        for argument in reply.items where argument.direction == .out {
+            let name = argument.name
+            let type = argument.type
+            var dataOffset = replyOffsets[name]!
+            switch type.type {
+            case .array(let element, let count, let variable):
+                if variable {
+                    lines.append("    mach_msg_type_number_t \(name)Cnt = \(count);")
+                    dataOffset += 4
+                }
+                if element.size <= 4 {
+                    lines.append("    \(type.cType) \(name) = (\(type.cType))(void *)(out + \(dataOffset));")
+                } else {
+                    lines.append("    \(type.elementCType) \(name)[\(count)];")
+                }
+            default:
+                lines.append("    \(type.cType) \(name) = 0;")
+            }
+        }
+
+        // The handler.
+        var arguments: [String] = []
+        for argument in routine.arguments {
+            let name = argument.name
+            switch argument.direction {
+            case .requestPort:
+                arguments.append("\(load)(in, 12)")
+            case .in:
+                if case .port = argument.type.type {
+                    arguments.append("\(load)(in, \(descriptorOffsets[name]!))")
+                } else {
+                    arguments.append(name)
+                    if argument.type.type.isVariable {
+                        arguments.append("\(name)Cnt")
+                    }
+                }
+            case .inout:
+                arguments.append("&\(name)")
+            case .out:
+                if case .array = argument.type.type {
+                    arguments.append(name)
+                    if argument.type.type.isVariable {
+                        arguments.append("&\(name)Cnt")
+                    }
+                } else {
+                    arguments.append("&\(name)")
+                }
+            }
+        }
+        lines.append("")
+        lines += call("    kern_return_t result = \(handlerName(of: routine))", arguments, terminator: ";")
+        lines += [
+            "    if (result != KERN_SUCCESS) {",
+            "        return result;",
+            "    }",
+        ]
+
+        // The reply.
+        if reply.items.isEmpty {
+            lines.append("    (void) out;")
+        }
+        if routine.isSimple {
+            lines += [
+                "    return MIG_NO_REPLY;",
+                "}",
+            ]
+            return lines
+        }
+        var size = "\(reply.minimumSize)"
+        for argument in reply.items {
+            let name = argument.name
+            let type = argument.type
+            let offset = replyOffsets[name]!
+            switch type.type {
+            case .array(let element, let count, let variable):
+                let dataOffset = variable ? offset + 4 : offset
+                if variable {
+                    lines.append("    \(prefix)_store32(out, \(offset), \(name)Cnt);")
+                    size = "\(dataOffset) + \(arrayBytes(element: element, count: "\(name)Cnt"))"
+                }
+                if element.size > 4 {
+                    let bytes = variable ? "\(element.size) * \(name)Cnt" : "\(element.size * count)"
+                    lines.append("    memcpy(out + \(dataOffset), \(name), \(bytes));")
+                }
+            default:
+                lines.append("    memcpy(out + \(offset), &\(name), \(type.type.size));")
+            }
+        }
+        if !reply.items.isEmpty {
+            lines.append("    \(prefix)_store32(out, 4, (uint32_t)(\(size)));")
+        }
+        lines += [
+            "    return KERN_SUCCESS;",
+            "}",
+        ]
+        return lines
+    }
+
+    // The bytes a variable-length array of a number of elements occupies.
+    func arrayBytes(element: InterfaceType, count: String) -> String {
+        let bytes = "\(element.size) * \(count)"
+        return element.size % 4 == 0 ? bytes : "\(prefix)_aligned(\(bytes))"
+    }
+
+    // Decode an inline array: in place, when its elements need no more than the 4-byte alignment of the message, or
+    // into an aligned copy.
+    func decodeArray(_ argument: Argument, bytes: String) -> [String] {
+        let type = argument.type
+        if type.type.element.size <= 4 {
+            return ["    \(type.cType) \(argument.name) = (\(type.cType))(void *)(in + offset);"]
+        }
+        return [
+            "    \(type.elementCType) \(argument.name)[\(type.type.count)];",
+            "    memcpy(\(argument.name), in + offset, \(bytes));",
+        ]
+    }
+
+    // MARK: - Dispatch
+
+    // Dispatch through a table of routines indexed by message identifier, as mig's server does.
+    func tableDispatch() -> [String] {
+        var lines = [
+            "typedef kern_return_t (*\(prefix)_routine_t)(uint8_t *in, mach_msg_size_t size, uint8_t *out);",
+            "",
+            "static const \(prefix)_routine_t \(prefix)_routines[\(interface.routines.count)] = {",
+        ]
+        for (index, routine) in interface.routines.enumerated() {
+            if let routine = routine, served.contains(where: { $0.routine.name == routine.name }) {
+                lines.append("    \(stubName(of: routine)),")
+            } else {
+                lines.append("    NULL, // \(interface.base + index)")
+            }
+        }
+        let base = interface.base
+        lines += [
+            "};",
+            "",
+            "bool \(prefix)_server_dispatch(void *request, size_t request_size, void *reply)",
+            "{",
+            "    uint8_t *in = request;",
+            "    uint8_t *out = reply;",
+            "",
+            "    // Build the error reply's header, which a successful routine amends.",
+            "    \(prefix)_error_reply(in, request_size, out, MIG_BAD_ARGUMENTS);",
+            "    if (request_size < 24) {",
+            "        return false;",
+            "    }",
+            "",
+            "    int32_t identifier = (int32_t) \(prefix)_load32(in, 20);",
+            "    \(prefix)_routine_t routine = NULL;",
+            "    if (identifier >= \(base) && identifier < \(base + interface.routines.count)) {",
+            "        routine = \(prefix)_routines[identifier - \(base)];",
+            "    }",
+            "    if (routine == NULL) {",
+            "        \(prefix)_store32(out, 32, (uint32_t) MIG_BAD_ID);",
+            "        return false;",
+            "    }",
+            "",
+            "    // The size the header claims must not exceed the bytes actually available.",
+            "    mach_msg_size_t size = \(prefix)_load32(in, 4);",
+            "    kern_return_t result = size > request_size ? MIG_BAD_ARGUMENTS : routine(in, size, out);",
+            "    if (result != KERN_SUCCESS) {",
+            "        \(prefix)_store32(out, 4, \(MessageLayout.errorReplySize));",
+            "    }",
+            "    \(prefix)_store32(out, 32, (uint32_t) result);",
+            "    return true;",
+            "}",
+        ]
+        return lines
+    }
+
+    // Dispatch with a switch on the message identifier, starting each reply from a static template.
+    func specializedDispatch() -> [String] {
+        var lines = [
+            "// The header, NDR record and return code of each routine's reply, which the request's bits and",
+            "// reply port complete.",
+        ]
+        for (identifier, routine) in served {
+            var bytes = [UInt8](repeating: 0, count: MessageLayout.errorReplySize)
+            Self.store(UInt32(MessageLayout.errorReplySize), at: 4, in: &bytes)
+            Self.store(UInt32(truncatingIfNeeded: identifier + 100), at: 20, in: &bytes)
+            bytes[28] = 1
+            lines.append("static const uint8_t \(stubName(of: routine))_reply[\(bytes.count)] = {")
+            for row in stride(from: 0, to: bytes.count, by: 12) {
+                let values = bytes[row ..< Swift.min(row + 12, bytes.count)].map { String(format: "0x%02x", $0) }
+                lines.append("    " + values.joined(separator: ", ") + ",")
+            }
+            lines.append("};")
+            lines.append("")
+        }
+        lines += [
+            "bool \(prefix)_server_dispatch(void *request, size_t request_size, void *reply)",
+            "{",
+            "    uint8_t *in = request;",
+            "    uint8_t *out = reply;",
+            "    if (request_size < 24) {",
+            "        \(prefix)_error_reply(in, request_size, out, MIG_BAD_ARGUMENTS);",
+            "        return false;",
+            "    }",
+            "",
+            "    // The size the header claims must not exceed the bytes actually available.",
+            "    mach_msg_size_t size = \(prefix)_load32(in, 4);",
+            "    kern_return_t result;",
+            "    switch ((int32_t) \(prefix)_load32(in, 20)) {",
+        ]
+        for (identifier, routine) in served {
+            let stub = stubName(of: routine)
+            lines += [
+                "    case \(identifier):",
+                "        memcpy(out, \(stub)_reply, sizeof(\(stub)_reply));",
+                "        result = size > request_size ? MIG_BAD_ARGUMENTS : \(stub)(in, size, out);",
+                "        break;",
+            ]
+        }
+        lines += [
+            "    default:",
+            "        \(prefix)_error_reply(in, request_size, out, MIG_BAD_ID);",
+            "        return false;",
+            "    }",
+            "",
+            "    \(prefix)_store32(out, 0, \(prefix)_load32(in, 0) & 0x1fu);",
+            "    \(prefix)_store32(out, 8, \(prefix)_load32(in, 8));",
+            "    if (result != KERN_SUCCESS) {",
+            "        \(prefix)_store32(out, 4, \(MessageLayout.errorReplySize));",
+            "    }",
+            "    \(prefix)_store32(out, 32, (uint32_t) result);",
+            "    return true;",
+            "}",
+        ]
+        return lines
+    }
+
+    // MARK: - Formatting
+
+    // A statement or condition failing with a return code when any of its conditions hold.
+    func failure(_ conditions: [String], _ code: String) -> [String] {
+        var lines: [String] = []
+        for (index, condition) in conditions.enumerated() {
+            let lead = index == 0 ? "    if (" : "        "
+            let trail = index == conditions.count - 1 ? ") {" : " ||"
+            lines.append(lead + condition + trail)
+        }
+        return lines + [
+            "        return \(code);",
+            "    }",
+        ]
+    }
+
+    // A call or declaration, with an argument per line aligned after the opening parenthesis.
+    func call(_ function: String, _ arguments: [String], terminator: String) -> [String] {
+        guard !arguments.isEmpty else {
+            return [function + "(void)" + terminator]
+        }
+        let indent = String(repeating: " ", count: function.count + 1)
+        return arguments.enumerated().map { index, argument in
+            let lead = index == 0 ? function + "(" : indent
+            let trail = index == arguments.count - 1 ? ")" + terminator : ","
+            return lead + argument + trail
+        }
+    }
+
+    static func store(_ value: UInt32, at offset: Int, in bytes: inout [UInt8]) {
+        for byte in 0 ..< 4 {
+            bytes[offset + byte] = UInt8(truncatingIfNeeded: value >> (8 * byte))
+        }
+    }
+}
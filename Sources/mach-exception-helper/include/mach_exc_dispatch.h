@@ -0,0 +1,137 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// mach-exception
+// mach_exc_dispatch.h
+// Created by Patrick Gili on 2/4/23.
+//
+
+#ifndef mach_exc_dispatch_h
+#define mach_exc_dispatch_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __APPLE__
+#include <mach/exception_types.h>
+#include <mach/mach_types.h>
+#include <mach/mig_errors.h>
+#else
+#include "mach_exception_compat.h"
+#endif
+
+// The exception server's portable core. It decodes the mach_exception_raise, mach_exception_raise_state and
+// mach_exception_raise_state_identity requests described by mach_exc.defs, performs the same checks as the server
+// MIG generates, invokes a handler, and builds the reply, all on caller-provided byte buffers. The core doesn't
+// depend on a Mach kernel, so it builds and runs anywhere, including in unit tests given synthetic messages.
+
+// MARK: - Message identifiers
+
+#define MACH_EXC_DISPATCH_RAISE                 2405
+#define MACH_EXC_DISPATCH_RAISE_STATE           2406
+#define MACH_EXC_DISPATCH_RAISE_STATE_IDENTITY  2407
+
+// The reply to a request carries the request's identifier plus this value.
+#define MACH_EXC_DISPATCH_REPLY_ID_OFFSET       100
+
+// MARK: - Message sizes
+
+// The largest number of exception codes, and of 32-bit words of thread state, a request can carry.
+#define MACH_EXC_DISPATCH_CODE_MAX              2
+#define MACH_EXC_DISPATCH_STATE_MAX             1296
+
+// The size of the largest request, excluding the trailer the kernel appends, and of the largest reply.
+#define MACH_EXC_DISPATCH_REQUEST_MAX           (76 + 8 * MACH_EXC_DISPATCH_CODE_MAX + 4 * MACH_EXC_DISPATCH_STATE_MAX)
+#define MACH_EXC_DISPATCH_REPLY_MAX             (44 + 4 * MACH_EXC_DISPATCH_STATE_MAX)
+
+// MARK: - Handlers
+
+/// The routines to which the core delivers decoded requests, mirroring the catch_mach_exception_raise* routines.
+/// Each routine receives the handlers' context, and the name of the port on which the request arrived.
+typedef struct mach_exc_dispatch_handlers {
+    kern_return_t (*raise)(void *context,
+                           mach_port_name_t exception_port,
+                           mach_port_name_t thread,
+                           mach_port_name_t task,
+                           exception_type_t exception,
+                           mach_exception_data_t code,
+                           mach_msg_type_number_t codeCnt);
+
+    kern_return_t (*raise_state)(void *context,
+                                 mach_port_name_t exception_port,
+                                 exception_type_t exception,
+                                 mach_exception_data_t code,
+                                 mach_msg_type_number_t codeCnt,
+                                 int *flavor,
+                                 natural_t *old_state,
+                                 mach_msg_type_number_t old_stateCnt,
+                                 natural_t *new_state,
+                                 mach_msg_type_number_t *new_stateCnt);
+
+    kern_return_t (*raise_state_identity)(void *context,
+                                          mach_port_name_t exception_port,
+                                          mach_port_name_t thread,
+                                          mach_port_name_t task,
+                                          exception_type_t exception,
+                                          mach_exception_data_t code,
+                                          mach_msg_type_number_t codeCnt,
+                                          int *flavor,
+                                          natural_t *old_state,
+                                          mach_msg_type_number_t old_stateCnt,
+                                          natural_t *new_state,
+                                          mach_msg_type_number_t *new_stateCnt);
+
+    void *context;
+} mach_exc_dispatch_handlers_t;
+
+/// Dispatch an exception request to a handler, and build its reply.
+///
+/// Like the server MIG generates, the function always builds a reply: either the routine's reply, or an error
+/// reply whose return code is `MIG_BAD_ID` for a message that isn't an exception request, `MIG_BAD_ARGUMENTS` or
+/// `MIG_TYPE_ERROR` for a malformed request, or the handler's failure. A `NULL` handler is treated as a routine the
+/// server doesn't implement.
+///
+/// - Parameters:
+///   - handlers: The routines handling each request.
+///   - request: The request, starting with its message header, aligned on a 4-byte boundary. The handlers receive
+///     pointers to the thread state it carries.
+///   - request_size: The number of bytes available at `request`, which bounds the size the header claims.
+///   - reply: The buffer receiving the reply, which must hold at least `MACH_EXC_DISPATCH_REPLY_MAX` bytes.
+///
+/// - Returns: `true` if the request's identifier is one of the exception routines', or `false` otherwise.
+bool mach_exc_dispatch(const mach_exc_dispatch_handlers_t *handlers,
+                       void *request,
+                       size_t request_size,
+                       void *reply);
+
+/// The return code of a reply built by `mach_exc_dispatch`.
+kern_return_t mach_exc_dispatch_reply_code(const void *reply);
+
+// MARK: - Buffer arena
+
+/// The request and reply buffers a listener reuses for every message it receives, so that receiving a message
+/// allocates nothing.
+typedef struct mach_exc_arena {
+    void *request;
+    size_t request_size;
+    void *reply;
+    size_t reply_size;
+} mach_exc_arena_t;
+
+/// Allocate an arena's buffers, with room for a request of `request_size` bytes and for the largest reply.
+///
+/// - Returns: `true` on success, or `false` if the buffers could not be allocated.
+bool mach_exc_arena_init(mach_exc_arena_t *arena, size_t request_size);
+
+/// Grow an arena's request buffer to hold at least `request_size` bytes. The buffer's contents are not preserved.
+///
+/// - Returns: `true` on success, or `false` if the buffer could not be reallocated, in which case the arena is
+///   unchanged.
+bool mach_exc_arena_reserve(mach_exc_arena_t *arena, size_t request_size);
+
+/// Release an arena's buffers.
+void mach_exc_arena_destroy(mach_exc_arena_t *arena);
+
+#endif /* mach_exc_dispatch_h */
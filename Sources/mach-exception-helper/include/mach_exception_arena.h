@@ -0,0 +1,72 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// mach-exception
+// mach_exception_arena.h
+// Created by Patrick Gili on 2/18/23.
+//
+
+#ifndef mach_exception_arena_h
+#define mach_exception_arena_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A bump allocator over a reserved range of virtual memory, committed as bad-access faults reach into it.
+//
+// An arena reserves its capacity, followed by a guard region, as inaccessible memory. An allocation probes its last
+// byte rather than checking the arena's capacity: when the probe reaches past the committed memory, it faults, and
+// the arena's fault resolver (see mach_exception_resolver.h) commits the memory up to the chunk holding the probed
+// byte, after which the probe executes again. A probe reaching past the capacity faults in the guard region, which
+// the resolver leaves alone, so the fault raises EXC_BAD_ACCESS. Allocations therefore grow the arena only while the
+// allocating thread is inside a scope catching EXC_BAD_ACCESS; the memory they return is committed, and is
+// accessible from anywhere. An arena isn't thread-safe.
+
+/// The largest allocation an arena makes, which is also the size of the guard region that follows its capacity, so
+/// no probe skips over the guard region.
+#define MACH_EXCEPTION_ARENA_MAX_ALLOCATION ((size_t) 64 * 1024 * 1024)
+
+/// An arena. Only `top` changes on the allocation path.
+typedef struct mach_exception_arena {
+    uint8_t *top;
+    uint8_t *base;
+    uint8_t *limit;
+    uint8_t *committed;
+    size_t chunk_size;
+} mach_exception_arena_t;
+
+/// Create an arena reserving `capacity` bytes, committed `chunk_size` bytes at a time. Both are rounded up to a
+/// multiple of the page size. No memory is committed until the first allocation.
+///
+/// - Returns: `NULL`, with `errno` set, if the memory cannot be reserved or the resolver cannot be registered.
+mach_exception_arena_t *mach_exception_arena_create(size_t capacity, size_t chunk_size);
+
+/// Destroy an arena, releasing its reservation.
+void mach_exception_arena_destroy(mach_exception_arena_t *arena);
+
+/// Release every allocation, keeping the committed memory for the allocations that follow.
+void mach_exception_arena_reset(mach_exception_arena_t *arena);
+
+/// The number of bytes the arena has committed.
+size_t mach_exception_arena_committed(const mach_exception_arena_t *arena);
+
+/// Allocate `size` bytes aligned to `alignment`, a power of two. The allocating thread must be inside a scope
+/// catching EXC_BAD_ACCESS, which catches the exception raised if the arena is exhausted.
+///
+/// - Returns: `NULL` if `size` exceeds `MACH_EXCEPTION_ARENA_MAX_ALLOCATION`.
+static inline void *mach_exception_arena_allocate(mach_exception_arena_t *arena, size_t size, size_t alignment)
+{
+    if (size > MACH_EXCEPTION_ARENA_MAX_ALLOCATION) {
+        return NULL;
+    }
+    uint8_t *pointer = (uint8_t *) (((uintptr_t) arena->top + alignment - 1) & ~(uintptr_t) (alignment - 1));
+    if (size != 0) {
+        (void) *(volatile const uint8_t *) (pointer + size - 1);
+    }
+    arena->top = pointer + size;
+    return pointer;
+}
+
+#endif /* mach_exception_arena_h */
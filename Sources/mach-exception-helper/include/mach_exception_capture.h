@@ -0,0 +1,218 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// mach-exception
+// mach_exception_capture.h
+// Created by Patrick Gili on 2/28/23.
+//
+
+#ifndef mach_exception_capture_h
+#define mach_exception_capture_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#if defined(__linux__)
+#include <signal.h>
+#endif
+#include "mach_exc_dispatch.h"
+#include "mach_exception_decode.h"
+#include "mach_exception_record.h"
+
+// Capture and replay of the raw inputs of the exception handlers.
+//
+// While a capture is installed, the handlers append their inputs to its file, before acting on them: the Darwin
+// listener appends each request message it receives, and the Linux signal handler appends each fault signal a scope
+// owns, with its siginfo and the context the kernel delivered it with. Each event carries the monotonic time it
+// arrived, so a capture records the timing of a fault storm along with its contents. Appending an event is a single
+// write to a file opened for appending, so it is async-signal-safe, and concurrent handlers never interleave their
+// events.
+//
+// A replay maps a capture file and feeds its events back through the same decoding the handlers perform, either at
+// the recorded pace, or as fast as possible: requests go through the portable dispatch core, and fault signals
+// through the signal backend's translation of siginfo and context into exception records and machine state. None
+// of it involves the kernel's exception delivery, so a capture taken in production replays in a unit test, or in a
+// benchmark. Requests replay on any host; fault signals only replay on a Linux host of the architecture that
+// captured them, as their contexts are the kernel's.
+//
+// Events are stored in the byte order of the host that captured them.
+
+// MARK: - File format
+
+/// The first four bytes of a capture file ("MXCP", read as a little-endian integer).
+#define MACH_EXCEPTION_CAPTURE_MAGIC            0x5043584du
+
+/// The version of the file format this library writes.
+#define MACH_EXCEPTION_CAPTURE_VERSION          1
+
+/// The size of a file's header, in bytes.
+#define MACH_EXCEPTION_CAPTURE_HEADER_SIZE      64
+
+/// The kinds of event a capture holds.
+#define MACH_EXCEPTION_CAPTURE_MESSAGE          1
+#define MACH_EXCEPTION_CAPTURE_SIGNAL           2
+
+/// The operating systems whose handlers capture events.
+#define MACH_EXCEPTION_CAPTURE_DARWIN           0
+#define MACH_EXCEPTION_CAPTURE_LINUX            1
+
+/// The header at the start of each capture file. The architecture and operating system are those of the host that
+/// captured the events. The creation time is in nanoseconds since the Unix epoch; the origin is the monotonic time,
+/// in nanoseconds, from which the events' timestamps count.
+typedef struct mach_exception_capture_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;
+    uint32_t arch;
+    uint32_t system;
+    uint64_t created;
+    uint64_t origin;
+    uint8_t padding[MACH_EXCEPTION_CAPTURE_HEADER_SIZE - 32];
+} mach_exception_capture_header_t;
+
+/// An event of a capture file, followed by its `size` bytes of payload, padded to a multiple of 8 bytes. The
+/// timestamp is the number of nanoseconds between the origin of the file and the event's arrival.
+///
+/// The payload of a message is the request, as it was received, without its trailer. The payload of a signal is a
+/// `mach_exception_capture_signal_t`.
+typedef struct mach_exception_capture_event {
+    uint32_t kind;
+    uint32_t size;
+    uint64_t timestamp;
+} mach_exception_capture_event_t;
+
+/// A fault signal, as captured: its number and siginfo, followed by the `context_size` bytes of the `ucontext_t`
+/// the kernel delivered it with, padded to a multiple of 8 bytes, and by the `fpstate_size` bytes of floating-point
+/// state the context points to outside itself, which is the legacy FXSAVE area on x86_64, and nothing on arm64.
+/// On arm64, the instruction is the faulting instruction for SIGILL and SIGFPE, whose exception codes include it; it
+/// is 0 otherwise.
+typedef struct mach_exception_capture_signal {
+    int32_t signal;
+    int32_t code;
+    uint64_t address;
+    uint32_t context_size;
+    uint32_t fpstate_size;
+    uint32_t instruction;
+    uint32_t reserved;
+} mach_exception_capture_signal_t;
+
+// MARK: - Capturing
+
+/// An open capture file.
+typedef struct mach_exception_capture mach_exception_capture_t;
+
+/// Create a capture file at `path`, replacing any file there.
+///
+/// - Returns: The capture, or `NULL` with `errno` set, if the file cannot be created.
+mach_exception_capture_t *mach_exception_capture_open(const char *path);
+
+/// Close a capture, uninstalling it first if it is installed, and waiting for the handlers appending to it.
+void mach_exception_capture_close(mach_exception_capture_t *capture);
+
+/// Install a capture, to which the handlers append their inputs, replacing the one installed, if any, which is
+/// returned. Passing `NULL` uninstalls the capture installed.
+mach_exception_capture_t *mach_exception_capture_install(mach_exception_capture_t *capture);
+
+/// Append a request message of `size` bytes to a capture. This function is async-signal-safe.
+///
+/// - Returns: `false`, with `errno` set, if the event could not be written.
+bool mach_exception_capture_message(mach_exception_capture_t *capture, const void *message, size_t size);
+
+/// Append a request message to the capture installed, if any. This function is async-signal-safe, and costs a
+/// single load when no capture is installed.
+void mach_exception_capture_installed_message(const void *message, size_t size);
+
+#if defined(__linux__)
+/// Append a fault signal to a capture, with the siginfo and context it was delivered with. This function is
+/// async-signal-safe.
+///
+/// - Returns: `false`, with `errno` set, if the event could not be written.
+bool mach_exception_capture_signal(mach_exception_capture_t *capture,
+                                   int signal,
+                                   const siginfo_t *info,
+                                   const void *ucontext);
+
+/// Append a fault signal to the capture installed, if any. This function is async-signal-safe, and costs a single
+/// load when no capture is installed.
+void mach_exception_capture_installed_signal(int signal, const siginfo_t *info, const void *ucontext);
+#endif
+
+// MARK: - Replaying
+
+/// A capture file mapped for replaying.
+typedef struct mach_exception_replay {
+    const mach_exception_capture_header_t *header;
+    size_t size;
+} mach_exception_replay_t;
+
+/// A fault signal, decoded as the signal handler decodes it. The machine state lacks what the handler reads from
+/// the faulting thread's memory rather than from the signal's context, i.e., the return address on x86_64, and
+/// lanes aren't attributed, as attribution re-executes the faulting instruction on its operands.
+typedef struct mach_exception_replay_fault {
+    int signal;
+    mach_exception_record_t record;
+    mach_exception_state_t state;
+} mach_exception_replay_fault_t;
+
+/// The receivers of the events a replay decodes. A `NULL` receiver leaves the events it would receive undecoded.
+typedef struct mach_exception_replay_receivers {
+    /// The routines handling the requests, whose replies are built and discarded.
+    const mach_exc_dispatch_handlers_t *handlers;
+
+    /// The routine receiving the faults, with the context.
+    void (*fault)(void *context, const mach_exception_replay_fault_t *fault);
+    void *context;
+} mach_exception_replay_receivers_t;
+
+/// The number of events a replay delivered, and the time it took. Events a replay can't decode on this host (i.e.,
+/// fault signals captured on another system or architecture), or that no receiver receives, are skipped.
+typedef struct mach_exception_replay_statistics {
+    uint64_t messages;
+    uint64_t handled;
+    uint64_t faults;
+    uint64_t skipped;
+    uint64_t elapsed;
+} mach_exception_replay_statistics_t;
+
+/// Handlers that accept every request, returning the thread state they receive unchanged, so that replaying
+/// requests through them exercises the whole dispatch, including building the replies.
+extern const mach_exc_dispatch_handlers_t mach_exception_replay_accepting_handlers;
+
+/// Map a capture file for replaying.
+///
+/// - Returns: `false`, with `errno` set, if the file cannot be mapped, or isn't a capture file of a version this
+///   library reads (`EINVAL`).
+bool mach_exception_replay_open(mach_exception_replay_t *replay, const char *file);
+
+/// Unmap a capture file.
+void mach_exception_replay_close(mach_exception_replay_t *replay);
+
+/// The next event at or after the byte offset `*cursor` (0 for the first event), which advances past it, or `NULL`
+/// if there are no more, or the rest of the file is truncated. The event lives in the mapped file, and stays valid
+/// until the replay is closed.
+const mach_exception_capture_event_t *mach_exception_replay_next(const mach_exception_replay_t *replay,
+                                                                 uint64_t *cursor);
+
+/// Decode a fault signal's event as the signal handler would. Returns `false` if the event isn't a fault signal
+/// this host can decode, or the signal doesn't correspond to a Mach exception.
+bool mach_exception_replay_decode_fault(const mach_exception_replay_t *replay,
+                                        const mach_exception_capture_event_t *event,
+                                        mach_exception_replay_fault_t *fault);
+
+/// Deliver every event of a capture to receivers.
+///
+/// - Parameters:
+///   - replay: The capture.
+///   - receivers: The receivers of the events.
+///   - speed: The pace of the replay relative to the capture's (e.g., 2 replays twice as fast), or 0 to replay as
+///     fast as possible.
+///   - statistics: Receives the number of events delivered, and the time the replay took.
+///
+/// - Returns: `false`, with `errno` set, if the buffers the requests are dispatched in could not be allocated.
+bool mach_exception_replay_run(const mach_exception_replay_t *replay,
+                               const mach_exception_replay_receivers_t *receivers,
+                               double speed,
+                               mach_exception_replay_statistics_t *statistics);
+
+#endif /* mach_exception_capture_h */
@@ -0,0 +1,188 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// mach-exception
+// mach_exception_compat.h
+// Created by Patrick Gili on 1/28/23.
+//
+
+#ifndef mach_exception_compat_h
+#define mach_exception_compat_h
+
+// The Mach types and constants the Swift layer uses to describe exceptions. On Apple platforms they come from the
+// kernel headers. Elsewhere, this header defines them with the values found in darwin-xnu, so exceptions raised by
+// a non-Mach backend decode exactly as they would on Darwin.
+#if !defined(__APPLE__)
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// A Boolean-value that disables Swift's exclusivity checking (see the following Swift Blog entry
+// for further details: https://www.swift.org/blog/swift-5-exclusivity/).
+extern bool _swift_disableExclusivityChecking;
+
+// A Boolean-value that enables Swift's reporting of fatal errors to the debugger. This setting is not
+// documented anywhere, rather defined in Swift's standard library.
+extern bool _swift_reportFatalErrorsToDebugger;
+
+// MARK: - Types (see darwin-xnu/osfmk/mach/exception_types.h)
+
+typedef unsigned int natural_t;
+typedef int kern_return_t;
+typedef natural_t mach_port_name_t;
+typedef mach_port_name_t mach_port_t;
+typedef natural_t mach_msg_type_number_t;
+typedef natural_t mach_msg_size_t;
+typedef natural_t mach_msg_timeout_t;
+typedef int exception_type_t;
+typedef unsigned int exception_mask_t;
+typedef int64_t mach_exception_data_type_t;
+typedef mach_exception_data_type_t * mach_exception_data_t;
+typedef natural_t * thread_state_t;
+
+// MARK: - Exception types (see darwin-xnu/osfmk/mach/exception_types.h)
+
+#define EXC_BAD_ACCESS          1
+#define EXC_BAD_INSTRUCTION     2
+#define EXC_ARITHMETIC          3
+#define EXC_EMULATION           4
+#define EXC_SOFTWARE            5
+#define EXC_BREAKPOINT          6
+#define EXC_SYSCALL             7
+#define EXC_MACH_SYSCALL        8
+#define EXC_RPC_ALERT           9
+#define EXC_CRASH               10
+#define EXC_RESOURCE            11
+#define EXC_GUARD               12
+#define EXC_CORPSE_NOTIFY       13
+
+#define EXC_TYPES_COUNT         14
+
+#define EXC_MASK_BAD_ACCESS         (1 << EXC_BAD_ACCESS)
+#define EXC_MASK_BAD_INSTRUCTION    (1 << EXC_BAD_INSTRUCTION)
+#define EXC_MASK_ARITHMETIC         (1 << EXC_ARITHMETIC)
+#define EXC_MASK_EMULATION          (1 << EXC_EMULATION)
+#define EXC_MASK_SOFTWARE           (1 << EXC_SOFTWARE)
+#define EXC_MASK_BREAKPOINT         (1 << EXC_BREAKPOINT)
+#define EXC_MASK_SYSCALL            (1 << EXC_SYSCALL)
+#define EXC_MASK_MACH_SYSCALL       (1 << EXC_MACH_SYSCALL)
+#define EXC_MASK_RPC_ALERT          (1 << EXC_RPC_ALERT)
+#define EXC_MASK_CRASH              (1 << EXC_CRASH)
+#define EXC_MASK_RESOURCE           (1 << EXC_RESOURCE)
+#define EXC_MASK_GUARD              (1 << EXC_GUARD)
+#define EXC_MASK_CORPSE_NOTIFY      (1 << EXC_CORPSE_NOTIFY)
+
+// MARK: - Kernel return codes (see darwin-xnu/osfmk/mach/kern_return.h)
+
+#define KERN_SUCCESS                0
+#define KERN_INVALID_ADDRESS        1
+#define KERN_PROTECTION_FAILURE     2
+#define KERN_NO_SPACE               3
+#define KERN_INVALID_ARGUMENT       4
+#define KERN_FAILURE                5
+#define KERN_RESOURCE_SHORTAGE      6
+#define KERN_NOT_RECEIVER           7
+#define KERN_NO_ACCESS              8
+#define KERN_MEMORY_FAILURE         9
+#define KERN_MEMORY_ERROR           10
+#define KERN_NOT_SUPPORTED          46
+#define KERN_RETURN_MAX             0x100
+
+// MARK: - MIG return codes (see darwin-xnu/osfmk/mach/mig_errors.h)
+
+#define MIG_TYPE_ERROR              -300
+#define MIG_REPLY_MISMATCH          -301
+#define MIG_REMOTE_ERROR            -302
+#define MIG_BAD_ID                  -303
+#define MIG_BAD_ARGUMENTS           -304
+#define MIG_NO_REPLY                -305
+
+// MARK: - Virtual memory protections (see darwin-xnu/osfmk/mach/vm_prot.h)
+
+#define VM_PROT_NONE                0x00
+#define VM_PROT_READ                0x01
+#define VM_PROT_WRITE               0x02
+#define VM_PROT_EXECUTE             0x04
+
+// MARK: - i386 exception codes (see darwin-xnu/osfmk/mach/i386/exception.h)
+
+#define EXC_I386_INVOP              1
+
+#define EXC_I386_DIV                1
+#define EXC_I386_INTO               2
+#define EXC_I386_NOEXT              3
+#define EXC_I386_EXTOVR             4
+#define EXC_I386_EXTERR             5
+#define EXC_I386_EMERR              6
+#define EXC_I386_BOUND              7
+#define EXC_I386_SSEEXTERR          8
+
+#define EXC_I386_SGL                1
+#define EXC_I386_BPT                2
+
+#define EXC_I386_INVTSSFLT          10
+#define EXC_I386_SEGNPFLT           11
+#define EXC_I386_STKFLT             12
+#define EXC_I386_GPFLT              13
+
+// MARK: - ARM exception codes (see darwin-xnu/osfmk/mach/arm/exception.h)
+
+#define EXC_ARM_UNDEFINED           1
+
+#define EXC_ARM_FP_UNDEFINED        0
+#define EXC_ARM_FP_IO               1
+#define EXC_ARM_FP_DZ               2
+#define EXC_ARM_FP_OF               3
+#define EXC_ARM_FP_UF               4
+#define EXC_ARM_FP_IX               5
+#define EXC_ARM_FP_ID               6
+
+#define EXC_ARM_DA_ALIGN            0x101
+#define EXC_ARM_DA_DEBUG            0x102
+#define EXC_ARM_SP_ALIGN            0x103
+#define EXC_ARM_SWP                 0x104
+#define EXC_ARM_PAC_FAIL            0x105
+
+#define EXC_ARM_BREAKPOINT          1
+
+// MARK: - Resource exceptions (see darwin-xnu/osfmk/kern/exc_resource.h)
+
+#define RESOURCE_TYPE_CPU           1
+#define RESOURCE_TYPE_WAKEUPS       2
+#define RESOURCE_TYPE_MEMORY        3
+#define RESOURCE_TYPE_IO            4
+#define RESOURCE_TYPE_THREADS       5
+
+// MARK: - Guard exceptions (see darwin-xnu/osfmk/kern/exc_guard.h)
+
+#define GUARD_TYPE_NONE             0x0
+#define GUARD_TYPE_MACH_PORT        0x1
+#define GUARD_TYPE_FD               0x2
+#define GUARD_TYPE_USER             0x3
+#define GUARD_TYPE_VN               0x4
+#define GUARD_TYPE_VIRT_MEMORY      0x5
+
+// See darwin-xnu/osfmk/mach/port.h.
+enum mach_port_guard_exception_codes {
+    kGUARD_EXC_DESTROY              = 1u << 0,
+    kGUARD_EXC_MOD_REFS             = 1u << 1,
+    kGUARD_EXC_SET_CONTEXT          = 1u << 2,
+    kGUARD_EXC_UNGUARDED            = 1u << 3,
+    kGUARD_EXC_INCORRECT_GUARD      = 1u << 4,
+    kGUARD_EXC_IMMOVABLE            = 1u << 5,
+    kGUARD_EXC_STRICT_REPLY         = 1u << 6,
+    kGUARD_EXC_MSG_FILTERED         = 1u << 7,
+    kGUARD_EXC_INVALID_RIGHT        = 1u << 8,
+    kGUARD_EXC_INVALID_NAME         = 1u << 9,
+    kGUARD_EXC_INVALID_VALUE        = 1u << 10,
+    kGUARD_EXC_INVALID_ARGUMENT     = 1u << 11,
+    kGUARD_EXC_RIGHT_EXISTS         = 1u << 12,
+    kGUARD_EXC_KERN_NO_SPACE        = 1u << 13,
+    kGUARD_EXC_KERN_FAILURE         = 1u << 14,
+    kGUARD_EXC_KERN_RESOURCE        = 1u << 15,
+};
+
+#endif /* !defined(__APPLE__) */
+
+#endif /* mach_exception_compat_h */
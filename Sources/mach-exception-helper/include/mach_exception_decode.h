@@ -0,0 +1,141 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// mach-exception
+// mach_exception_decode.h
+// Created by Patrick Gili on 2/6/23.
+//
+
+#ifndef mach_exception_decode_h
+#define mach_exception_decode_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+// An offline decoder for exception records reported by a host of any supported architecture. Unlike the decoders
+// behind MachExceptionError, which use the running host's constants, the decoder takes the reporting host's
+// architecture as input, and depends on nothing but the C standard library, so it builds and runs anywhere.
+
+// MARK: - Architectures
+
+/// The architecture of the host that reported a batch of exception records.
+typedef enum mach_exception_arch {
+    MACH_EXCEPTION_ARCH_X86_64 = 0,
+    MACH_EXCEPTION_ARCH_ARM64 = 1,
+} mach_exception_arch_t;
+
+// MARK: - Causes
+
+/// The architecture-independent cause of an exception, stored in a byte.
+typedef uint8_t mach_exception_cause_t;
+
+enum {
+    /// The record's type, or its code for the reporting host's architecture, is unknown.
+    MACH_EXCEPTION_CAUSE_UNKNOWN = 0,
+
+    // EXC_BAD_ACCESS
+    MACH_EXCEPTION_CAUSE_VM_FAULT,
+    MACH_EXCEPTION_CAUSE_FPU_SEGMENT_FAULT,
+    MACH_EXCEPTION_CAUSE_GENERAL_PROTECTION_FAULT,
+    MACH_EXCEPTION_CAUSE_DATA_ACCESS_ALIGNMENT,
+    MACH_EXCEPTION_CAUSE_DATA_ACCESS_DEBUG,
+    MACH_EXCEPTION_CAUSE_STACK_POINTER_ALIGNMENT,
+    MACH_EXCEPTION_CAUSE_SWP_INSTRUCTION,
+    MACH_EXCEPTION_CAUSE_POINTER_AUTHENTICATION_FAILURE,
+
+    // EXC_BAD_INSTRUCTION
+    MACH_EXCEPTION_CAUSE_UNDEFINED_INSTRUCTION,
+    MACH_EXCEPTION_CAUSE_INVALID_TSS,
+    MACH_EXCEPTION_CAUSE_SEGMENT_NOT_PRESENT,
+    MACH_EXCEPTION_CAUSE_STACK_FAULT,
+    MACH_EXCEPTION_CAUSE_INVALID_OPCODE,
+    MACH_EXCEPTION_CAUSE_PAGE_FAULT,
+
+    // EXC_ARITHMETIC
+    MACH_EXCEPTION_CAUSE_FP_UNDERFLOW,
+    MACH_EXCEPTION_CAUSE_FP_OVERFLOW,
+    MACH_EXCEPTION_CAUSE_FP_INVALID_OPERATION,
+    MACH_EXCEPTION_CAUSE_FP_DIVIDE_BY_ZERO,
+    MACH_EXCEPTION_CAUSE_FP_DENORMAL_INPUT,
+    MACH_EXCEPTION_CAUSE_FP_INEXACT_RESULT,
+    MACH_EXCEPTION_CAUSE_FP_UNDEFINED,
+    MACH_EXCEPTION_CAUSE_DIVIDE_ERROR,
+    MACH_EXCEPTION_CAUSE_INTEGER_OVERFLOW,
+    MACH_EXCEPTION_CAUSE_NO_FPU,
+    MACH_EXCEPTION_CAUSE_FLOATING_POINT_ERROR,
+    MACH_EXCEPTION_CAUSE_SIMD_OPERATION_ERROR,
+
+    // EXC_BREAKPOINT
+    MACH_EXCEPTION_CAUSE_BREAKPOINT,
+    MACH_EXCEPTION_CAUSE_WATCHPOINT,
+    MACH_EXCEPTION_CAUSE_SINGLE_STEP,
+    MACH_EXCEPTION_CAUSE_DEBUG,
+    MACH_EXCEPTION_CAUSE_OUT_OF_BOUNDS,
+
+    // EXC_RESOURCE
+    MACH_EXCEPTION_CAUSE_RESOURCE_CPU,
+    MACH_EXCEPTION_CAUSE_RESOURCE_WAKEUPS,
+    MACH_EXCEPTION_CAUSE_RESOURCE_MEMORY,
+    MACH_EXCEPTION_CAUSE_RESOURCE_IO,
+    MACH_EXCEPTION_CAUSE_RESOURCE_THREADS,
+
+    // EXC_GUARD
+    MACH_EXCEPTION_CAUSE_GUARD_NONE,
+    MACH_EXCEPTION_CAUSE_GUARD_MACH_PORT,
+    MACH_EXCEPTION_CAUSE_GUARD_FD,
+    MACH_EXCEPTION_CAUSE_GUARD_USER,
+    MACH_EXCEPTION_CAUSE_GUARD_VNODE,
+    MACH_EXCEPTION_CAUSE_GUARD_VIRT_MEMORY,
+
+    MACH_EXCEPTION_CAUSE_COUNT,
+};
+
+// MARK: - Batches
+
+/// The decoded form of a batch of exception records, as a struct of arrays with one element per record. What each
+/// column holds depends on the record's cause:
+///
+/// | Cause             | flavor          | primary                           | secondary         | detail           |
+/// |-------------------|-----------------|-----------------------------------|-------------------|------------------|
+/// | VM_FAULT          | 0               | kern_return_t                     | 0                 | subcode          |
+/// | PAGE_FAULT        | 0               | kern_return_t                     | 0                 | subcode          |
+/// | RESOURCE_CPU      | resource flavor | interval (s)                      | limit (%)         | utilization (%)  |
+/// | RESOURCE_WAKEUPS  | resource flavor | interval (s)                      | permitted (per s) | observed (per s) |
+/// | RESOURCE_MEMORY   | resource flavor | high watermark (MB)               | 0                 | 0                |
+/// | RESOURCE_IO       | resource flavor | interval (s)                      | limit (MB)        | observed (MB)    |
+/// | RESOURCE_THREADS  | resource flavor | thread count                      | 0                 | 0                |
+/// | GUARD_*           | flavor / reason | port name, fd, pid or namespace   | 0                 | subcode          |
+/// | any other         | 0               | 0                                 | 0                 | subcode          |
+///
+/// The caller owns the columns, each of which must hold at least as many elements as the batches it decodes.
+typedef struct mach_exception_batch {
+    mach_exception_cause_t *cause;
+    uint32_t *flavor;
+    uint32_t *primary;
+    uint32_t *secondary;
+    uint64_t *detail;
+} mach_exception_batch_t;
+
+/// Decode a batch of exception records reported by a host of architecture `arch`.
+///
+/// The bit fields of resource and guard codes are extracted in a single branch-free pass over the batch, which the
+/// compiler vectorizes; only records of the per-architecture exception types take a branch, to classify their code.
+///
+/// - Parameters:
+///   - arch: The architecture of the host that reported the records.
+///   - type: The records' exception types.
+///   - code: The records' codes.
+///   - subcode: The records' subcodes.
+///   - count: The number of records.
+///   - batch: The columns receiving the decoded records.
+///
+/// - Returns: The number of records whose cause is known.
+size_t mach_exception_decode(mach_exception_arch_t arch,
+                             const int32_t *type,
+                             const int64_t *code,
+                             const int64_t *subcode,
+                             size_t count,
+                             const mach_exception_batch_t *batch);
+
+#endif /* mach_exception_decode_h */
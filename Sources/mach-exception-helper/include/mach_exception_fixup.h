@@ -0,0 +1,90 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// mach-exception
+// mach_exception_fixup.h
+// Created by Patrick Gili on 3/2/23.
+//
+
+#ifndef mach_exception_fixup_h
+#define mach_exception_fixup_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "mach_exception_resume.h"
+
+// Fault fixups and memory probes.
+//
+// The probes read memory that may be unmapped, or unmapped while they read it (e.g., another process's memory
+// mapped into this one, a racy shared mapping, or a sampled heap pointer), without entering a scope. Each probe is
+// a short assembly routine, whose instructions that may fault lie within ranges listed in the fixup table, sorted by
+// address, along with the address of the routine's fixup. When an instruction within a range raises a bad-access
+// fault, the handler finds the range with one binary search, and resumes the thread at the fixup, which returns
+// `EFAULT` from the probe. A probe that doesn't fault runs no code beyond the copy or comparison itself: there is no
+// recovery point to record, and no scope to push.
+//
+// The handler checks the fixup table before anything else, so a probe's fault is never recorded, published,
+// captured, passed to a resolver or forwarded, whether or not the thread is inside a scope. A fault writing to the
+// destination of `mach_exception_safe_memcpy` is fixed up as well.
+//
+// On Linux, the probes require the process-wide signal handlers; on Darwin, they require the calling thread's
+// exception context routing EXC_BAD_ACCESS to the listener. `mach_exception_fixup_prepare` installs either.
+
+// MARK: - Fixup table
+
+/// A range of instructions that may fault, from `begin` up to but excluding `end`, and the address at which a thread
+/// faulting within it resumes.
+typedef struct mach_exception_fixup {
+    uint64_t begin;
+    uint64_t end;
+    uint64_t fixup;
+} mach_exception_fixup_t;
+
+/// The fixup table, sorted by address, and the number of its entries.
+const mach_exception_fixup_t *mach_exception_fixup_table(size_t *count);
+
+/// The fixup of the range holding a faulting instruction's address, or 0 if no range holds it. This function is
+/// async-signal-safe.
+uint64_t mach_exception_fixup_find(uint64_t pc);
+
+/// Resume a thread that raised a bad-access fault at the fixup of the range holding its program counter, by
+/// rewriting the context the fault was delivered with, whose registers are laid out as `layout` describes. This
+/// function is async-signal-safe.
+///
+/// - Returns: `false`, leaving the context unchanged, if no range holds the thread's program counter.
+bool mach_exception_fixup_apply(const mach_exception_resume_layout_t *layout, void *context);
+
+/// Install what the probes require on the calling thread: the process-wide signal handlers on Linux, and on Darwin,
+/// the thread's exception context routing EXC_BAD_ACCESS to the listener. Only the first call does any work; on
+/// Darwin, each thread that probes must call it.
+///
+/// - Parameter error: Receives the reason the installation failed: an `errno` value on Linux, or a `kern_return_t`
+///   on Darwin.
+///
+/// - Returns: `false` if the installation failed.
+bool mach_exception_fixup_prepare(int *error);
+
+// MARK: - Probes
+
+/// Load the byte, or the naturally aligned 2-, 4- or 8-byte integer, at `address` into `value`.
+///
+/// - Returns: 0, or `EFAULT` if the address isn't readable.
+int mach_exception_safe_load8(const void *address, uint8_t *value);
+int mach_exception_safe_load16(const void *address, uint16_t *value);
+int mach_exception_safe_load32(const void *address, uint32_t *value);
+int mach_exception_safe_load64(const void *address, uint64_t *value);
+
+/// Copy `size` bytes from `source` to `destination`, which don't overlap.
+///
+/// - Returns: 0, or `EFAULT` if a byte of either buffer isn't accessible, in which case the destination holds a
+///   prefix of the bytes copied.
+int mach_exception_safe_memcpy(void *destination, const void *source, size_t size);
+
+/// Compare `size` bytes at `first` and `second`, as `memcmp` does, setting `result` to -1, 0 or 1.
+///
+/// - Returns: 0, or `EFAULT` if a byte of either buffer isn't readable, in which case `result` is unchanged.
+int mach_exception_safe_memcmp(const void *first, const void *second, size_t size, int *result);
+
+#endif /* mach_exception_fixup_h */
@@ -7,8 +7,8 @@
 // Created by Patrick Gili on 5/20/22.
 //
 
-#import <Foundation/Foundation.h>
 #ifdef __APPLE__
+#import <Foundation/Foundation.h>
 #import "TargetConditionals.h"
 #if TARGET_OS_OSX || TARGET_OS_IOS
 
@@ -17,6 +17,7 @@
 #import <mach/thread_act.h>
 #import <kern/exc_resource.h>
 #import <kern/exc_guard.h>
+#include "mach_exception_perform.h"
 
 // A Boolean-value that disables Swift's exclusivity checking (see the following Swift Blog entry
 // for further details: https://www.swift.org/blog/swift-5-exclusivity/).
@@ -159,8 +160,62 @@ FOUNDATION_EXTERN NSErrorUserInfoKey const MachExceptionSubcode;
          finally: (__attribute__((noescape)) void(^)(void)) finally
            error: (__autoreleasing NSError **) error;
 
+/// Try an operation in a scope of the calling thread's persistent exception context, catching Mach exceptions.
+///
+/// The first call on a thread creates the thread's exception context: a receive port served by a process-wide
+/// listener thread. The context remains installed until the thread exits, and widens the thread's exception ports
+/// only when a scope requests exception types it has not yet installed. Thereafter, entering and leaving a scope
+/// is a push and pop on a thread-local scope stack. A Mach exception is caught by the innermost scope whose mask
+/// includes its type, after the finally blocks of the scopes it encloses have executed. A Mach exception matching
+/// no scope is passed on to the task's exception port, as if this library did not exist.
+///
+/// - Parameters:
+///   - mask: The bit mask specifying the Mach exceptions this scope catches.
+///   - dependencies: An instance defining the dependencies required to create the exception context.
+///   - operation: The operation performed while listening for Mach exceptions.
+///   - finally: A closure executed after the the `operation` executes to completion, or after catching a Mach
+///     exception.
+///   - error: An error representing the Mach exception, if one was caught, or the error that occurred during the
+///     attempt to create or widen the exception context.
+///
+/// - Returns: A Boolean-value indicating whether `operation` executed to completion.
++ (BOOL) performWithMask: (exception_mask_t) mask
+            dependencies: (id<MachExceptionHelperDependencies>) dependencies
+               operation: (__attribute__((noescape)) void(^)(void)) operation
+                 finally: (__attribute__((noescape)) void(^)(void)) finally
+                   error: (__autoreleasing NSError **) error;
+
+/// The bit mask specifying the Mach exceptions routed to the calling thread's exception context, which is zero
+/// until the thread first enters a scope.
+@property (class, readonly) exception_mask_t installedMask;
+
+/// The bit mask specifying the Mach exceptions caught by the calling thread's active scopes.
+@property (class, readonly) exception_mask_t activeMask;
+
+/// The number of times the process-wide exception listener has woken to receive a message. The listener blocks
+/// without a timeout, and only wakes to handle an exception or to stop when the last exception context is destroyed.
+@property (class, readonly) uint64_t listenerWakeups;
+
 @end
 
+// MARK: - mach_exception_perform_with_dependencies
+
+/// Perform an operation as `mach_exception_perform` does, creating or widening the calling thread's exception
+/// context with the given dependencies. `mach_exception_perform` passes `nil`, which selects the default
+/// dependencies, so a thread's first scope is the only one that uses the Objective-C runtime.
+///
+/// - Returns: `MACH_EXCEPTION_COMPLETED`, `MACH_EXCEPTION_CAUGHT`, or `MACH_EXCEPTION_FAILURE`, with `error` set to
+///   the `kern_return_t` returned by the failing kernel call.
+mach_exception_result_t mach_exception_perform_with_dependencies(exception_mask_t mask,
+                                                                 id<MachExceptionHelperDependencies> _Nullable
+                                                                     dependencies,
+                                                                 void (*operation)(void * _Nullable context),
+                                                                 void (*finally)(void * _Nullable context),
+                                                                 void * _Nullable context,
+                                                                 mach_exception_record_t * record,
+                                                                 mach_exception_state_t * _Nullable state,
+                                                                 int * error);
+
 // Expose access to this function strictly for unit testing code coverage.
 kern_return_t catch_mach_exception_raise(mach_port_t exception_port,
                                          mach_port_t thread,
@@ -184,3 +239,22 @@ NS_ASSUME_NONNULL_END
 
 #endif /* TARGET_OS_OSX || TARGET_OS_IOS */
 #endif /* __APPLE__ */
+
+#include "mach_exception_compat.h"
+#include "mach_exception_record.h"
+#include "mach_signal_handler.h"
+#include "mach_exc_dispatch.h"
+#include "mach_exception_decode.h"
+#include "mach_exception_log.h"
+#include "mach_exception_ring.h"
+#include "mach_exception_perform.h"
+#include "mach_fp_traps.h"
+#include "mach_exception_lanes.h"
+#include "mach_exception_resolver.h"
+#include "mach_exception_arena.h"
+#include "mach_userfault.h"
+#include "mach_guarded_buffer.h"
+#include "mach_exception_metrics.h"
+#include "mach_exception_capture.h"
+#include "mach_exception_resume.h"
+#include "mach_exception_fixup.h"
@@ -0,0 +1,73 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// mach-exception
+// mach_exception_lanes.h
+// Created by Patrick Gili on 2/16/23.
+//
+
+#ifndef mach_exception_lanes_h
+#define mach_exception_lanes_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Lane attribution of SIMD floating-point traps.
+//
+// When lane attribution is enabled and a thread traps on a floating-point exception, the fault path decodes the
+// faulting instruction, reads its operands from the thread's captured registers (or from memory), and re-executes
+// the instruction one lane at a time with every exception masked, to learn which lanes raise which exceptions. The
+// instructions decoded are the packed and scalar forms of add, subtract, multiply, divide and square root: on
+// x86_64, the SSE and VEX-encoded AVX forms, up to 256 bits wide; on arm64, the Advanced SIMD and scalar forms. Any
+// other instruction is left unattributed.
+
+/// The number of lanes in the widest instruction attributed.
+#define MACH_EXCEPTION_LANES_MAX 8
+
+/// The floating-point exceptions each lane of a faulting instruction raised, as bit masks in which bit `i` stands
+/// for lane `i`. `count` is the number of lanes the instruction operated on (1 for a scalar instruction), and
+/// `width` the number of bits in each lane; both are 0 if the instruction wasn't attributed. The masks include
+/// exceptions raised while masked, which didn't themselves trap.
+typedef struct mach_exception_lanes {
+    uint32_t count;
+    uint32_t width;
+    uint32_t invalid;
+    uint32_t divide_by_zero;
+    uint32_t overflow;
+    uint32_t underflow;
+    uint32_t inexact;
+} mach_exception_lanes_t;
+
+/// The registers lane attribution reads. On x86_64, the general-purpose registers are in ModRM encoding order (rax,
+/// rcx, rdx, rbx, rsp, rbp, rsi, rdi, r8-r15), the vector registers are ymm0-ymm15, and the control register is
+/// MXCSR. On arm64, the general-purpose registers are x0-x30 and sp, the vector registers are v0-v31 in their low 16
+/// bytes, and the control register is FPCR. `wide` tells whether the upper halves of the ymm registers are valid.
+typedef struct mach_exception_simd_state {
+    uint64_t pc;
+    uint64_t gpr[32];
+    uint8_t vector[32][32];
+    uint64_t control;
+    bool wide;
+} mach_exception_simd_state_t;
+
+/// Enable or disable lane attribution for every thread. Attribution is disabled by default, as it adds the cost of
+/// capturing the vector registers and decoding the instruction to each floating-point trap.
+void mach_exception_lanes_set_enabled(bool enabled);
+
+/// Whether lane attribution is enabled.
+bool mach_exception_lanes_enabled(void);
+
+/// Copy the lanes of the last exception the calling thread caught into `lanes`. Returns `false`, and clears `lanes`,
+/// if the exception wasn't attributed.
+bool mach_exception_last_lanes(mach_exception_lanes_t *lanes);
+
+/// Attribute the exceptions the instruction at `state->pc` raised to its lanes. This function is async-signal-safe:
+/// it only reads the instruction and its memory operand, and saves and restores the floating-point control and status
+/// registers around the lanes it re-executes.
+///
+/// - Returns: `false`, and clears `lanes`, if the instruction isn't one lane attribution decodes.
+bool mach_exception_lanes_attribute(const mach_exception_simd_state_t *state, mach_exception_lanes_t *lanes);
+
+#endif /* mach_exception_lanes_h */
@@ -0,0 +1,162 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// mach-exception
+// mach_exception_log.h
+// Created by Patrick Gili on 2/8/23.
+//
+
+#ifndef mach_exception_log_h
+#define mach_exception_log_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "mach_exception_record.h"
+
+// An append-only event log of caught exceptions, stored as fixed-size binary records in memory-mapped files.
+//
+// A log is a sequence of files named `<path>.<sequence>`, each of which holds a fixed number of records. Writers
+// reserve a record by incrementing the file's tail with an atomic add, fill it in, and publish it by storing its
+// state last, so appending makes no system calls; only rotating to the next file, once one fills up, does. The
+// files are shared mappings, so the records a process appended survive the process crashing, and readers map the
+// same files to iterate the records in place, even while writers append to them. A record a writer reserved but
+// never published (e.g., because the writer crashed) stays pending forever, and readers skip it.
+//
+// Records are stored in the byte order of the host that wrote them.
+
+// MARK: - File format
+
+/// The first four bytes of a log file ("MXLG", read as a little-endian integer).
+#define MACH_EXCEPTION_LOG_MAGIC            0x474c584du
+
+/// The version of the file format this library writes.
+#define MACH_EXCEPTION_LOG_VERSION          1
+
+/// The size of a file's header, and of each record, in bytes.
+#define MACH_EXCEPTION_LOG_HEADER_SIZE      128
+#define MACH_EXCEPTION_LOG_RECORD_SIZE      128
+
+/// The number of return addresses a backtrace holds.
+#define MACH_EXCEPTION_BACKTRACE_DEPTH      9
+
+/// The state of a record whose writer finished filling it in.
+#define MACH_EXCEPTION_LOG_COMMITTED        0x54494d43u
+
+/// The header at the start of each log file. The capacity is the number of records the file holds. The tail is the
+/// number of records writers have reserved, which keeps counting after the file fills up; only the first
+/// `min(tail, capacity)` records are valid.
+typedef struct mach_exception_log_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;
+    uint32_t record_size;
+    uint32_t reserved;
+    uint64_t capacity;
+    uint64_t sequence;
+    uint64_t created;
+    uint64_t tail;
+    uint8_t padding[MACH_EXCEPTION_LOG_HEADER_SIZE - 48];
+} mach_exception_log_header_t;
+
+/// A caught exception, as recorded in a log file. The state is `MACH_EXCEPTION_LOG_COMMITTED` once the record is
+/// complete. The timestamp is in nanoseconds since the Unix epoch. The thread is the operating system's identifier
+/// for the thread that caught the exception. The PC is the address of the faulting instruction (0 if unknown), and
+/// the first `depth` frames are the return addresses of the frames that led to it, innermost first.
+typedef struct mach_exception_log_record {
+    uint32_t state;
+    uint16_t version;
+    uint16_t depth;
+    int32_t type;
+    uint32_t reserved;
+    uint64_t timestamp;
+    uint64_t thread;
+    int64_t code;
+    int64_t subcode;
+    uint64_t pc;
+    uint64_t frames[MACH_EXCEPTION_BACKTRACE_DEPTH];
+} mach_exception_log_record_t;
+
+// MARK: - Backtraces
+
+/// The address of a faulting instruction, and the return addresses of the first `depth` frames that led to it,
+/// innermost first.
+typedef struct mach_exception_backtrace {
+    uint64_t pc;
+    uint32_t depth;
+    uint64_t frames[MACH_EXCEPTION_BACKTRACE_DEPTH];
+} mach_exception_backtrace_t;
+
+/// Capture the backtrace of a faulting thread by following its frame pointers, starting with the frame `fp`, and
+/// reading only the thread's stack, `[stack_low, stack_high)`. Frames compiled without a frame pointer end the
+/// backtrace early, but never make the walk read outside the stack, so the function is safe to call from a signal
+/// handler, or on behalf of a suspended thread.
+void mach_exception_backtrace_capture(mach_exception_backtrace_t *backtrace,
+                                      uint64_t pc,
+                                      uint64_t fp,
+                                      uint64_t stack_low,
+                                      uint64_t stack_high);
+
+/// Copy the backtrace of the last exception the calling thread caught into `backtrace`. Returns `false`, and
+/// clears `backtrace`, if the thread hasn't caught an exception, or the backend couldn't capture its backtrace.
+bool mach_exception_last_backtrace(mach_exception_backtrace_t *backtrace);
+
+// MARK: - Writing
+
+/// An open log, to which any number of threads may append concurrently.
+typedef struct mach_exception_log mach_exception_log_t;
+
+/// Open the log stored in the files `<path>.<sequence>`. Appending continues in the most recent file, if it has
+/// room, or in a new file otherwise. When a file fills up, the log rotates to a new file of `file_size` bytes.
+///
+/// - Returns: The log, or `NULL` with `errno` set, if the log's first file cannot be opened or created.
+mach_exception_log_t *mach_exception_log_open(const char *path, size_t file_size);
+
+/// Close a log, unmapping its current file.
+void mach_exception_log_close(mach_exception_log_t *log);
+
+/// Append a caught exception to a log. The backtrace may be `NULL`.
+///
+/// - Returns: `false` if the log filled up a file, and could not create the next one.
+bool mach_exception_log_append(mach_exception_log_t *log,
+                               const mach_exception_record_t *record,
+                               const mach_exception_backtrace_t *backtrace);
+
+/// The sequence number of the file to which a log is appending.
+uint64_t mach_exception_log_sequence(mach_exception_log_t *log);
+
+/// Format the name of a log's file with sequence number `sequence` into `buffer`, as `snprintf` does.
+int mach_exception_log_file_name(char *buffer, size_t size, const char *path, uint64_t sequence);
+
+// MARK: - Reading
+
+/// A log file mapped for reading.
+typedef struct mach_exception_log_reader {
+    const mach_exception_log_header_t *header;
+    size_t size;
+} mach_exception_log_reader_t;
+
+/// Map a log file for reading.
+///
+/// - Returns: `false`, with `errno` set, if the file cannot be mapped, or isn't a log file of a version this
+///   library reads (`EINVAL`).
+bool mach_exception_log_reader_open(mach_exception_log_reader_t *reader, const char *file);
+
+/// Unmap a log file.
+void mach_exception_log_reader_close(mach_exception_log_reader_t *reader);
+
+/// The next committed record at or after `*cursor`, which advances past it, or `NULL` if there are no more. The
+/// record lives in the mapped file, and stays valid until the reader is closed.
+///
+/// Writers commit records out of order, so a reader following a file as it grows may find a record still pending.
+/// If `skip_pending` is `false`, the reader stops at it, and a later call resumes there once it is committed. If
+/// `true`, the reader skips it, as it should for a file whose writer is gone.
+const mach_exception_log_record_t *mach_exception_log_reader_next(const mach_exception_log_reader_t *reader,
+                                                                  uint64_t *cursor,
+                                                                  bool skip_pending);
+
+/// Whether every record of a log file has been reserved, so the file will never grow.
+bool mach_exception_log_reader_full(const mach_exception_log_reader_t *reader);
+
+#endif /* mach_exception_log_h */
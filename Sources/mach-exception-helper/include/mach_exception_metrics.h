@@ -0,0 +1,139 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// mach-exception
+// mach_exception_metrics.h
+// Created by Patrick Gili on 2/24/23.
+//
+
+#ifndef mach_exception_metrics_h
+#define mach_exception_metrics_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "mach_exception_decode.h"
+#include "mach_exception_record.h"
+
+// Process-wide counters and latency histograms of exception handling.
+//
+// Each thread that enters scopes or handles faults (on Linux, each thread that enters a scope; on Darwin, those
+// threads and the listener thread) owns a shard of the metrics, allocated before any fault arrives. Only the owning
+// thread writes its shard, with plain relaxed stores, so counting takes no lock, no atomic read-modify-write and no
+// write to a cache line another thread writes, and is async-signal-safe. A snapshot sums every shard. A thread
+// without a shard counts into a shared shard with atomic additions instead.
+//
+// Faults are counted by family: the architecture-independent cause `mach_exception_decode` assigns the record, or,
+// for a record of no known cause, its exception type. The kernel doesn't timestamp faults, so the handler latency
+// starts when the handler first runs: the signal handler on Linux, and the listener's exception routine on Darwin.
+
+/// The number of buckets of a latency histogram. Bucket `i` counts the latencies greater than 2^(i-1) ns and at most
+/// 2^i ns; the last bucket counts every latency greater than 2^(MACH_EXCEPTION_METRICS_BUCKETS-2) ns.
+#define MACH_EXCEPTION_METRICS_BUCKETS 32
+
+/// The number of fault families: a family per known cause, followed by a family per exception type, for the records
+/// whose cause is unknown.
+#define MACH_EXCEPTION_METRICS_FAMILIES (MACH_EXCEPTION_CAUSE_COUNT + EXC_TYPES_COUNT)
+
+/// A histogram of latencies, in nanoseconds.
+typedef struct mach_exception_histogram {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t buckets[MACH_EXCEPTION_METRICS_BUCKETS];
+} mach_exception_histogram_t;
+
+/// The metrics of exception handling.
+///
+/// - scopes_entered: The scopes entered with `mach_exception_perform` or `performWithMask:`.
+/// - listener_wakeups: The times the listener returned from receiving a message on Darwin, or the fault handler took
+///   a fault a scope owns on Linux, where the handler plays the listener's part.
+/// - caught: The faults a scope caught, by family.
+/// - forwarded: The faults passed on to the handler this library replaced, by family.
+/// - handler_latency: The time from the handler starting to handle a fault it catches to its resuming the faulting
+///   thread, by exception type.
+/// - resume_latency: The time from the handler resuming the faulting thread to the thread reaching its scope's
+///   recovery point, by exception type.
+typedef struct mach_exception_metrics {
+    uint64_t scopes_entered;
+    uint64_t listener_wakeups;
+    uint64_t caught[MACH_EXCEPTION_METRICS_FAMILIES];
+    uint64_t forwarded[MACH_EXCEPTION_METRICS_FAMILIES];
+    mach_exception_histogram_t handler_latency[EXC_TYPES_COUNT];
+    mach_exception_histogram_t resume_latency[EXC_TYPES_COUNT];
+} mach_exception_metrics_t;
+
+/// An opaque server exposing the metrics on a Unix-domain socket.
+typedef struct mach_exception_metrics_server mach_exception_metrics_server_t;
+
+// MARK: - Counting
+
+/// Give the calling thread a shard, if it doesn't have one. The shard is folded into the totals once the thread
+/// exits. A thread whose shard cannot be allocated counts into the shared shard.
+///
+/// - Returns: `false`, with `errno` set, if the shard cannot be allocated.
+bool mach_exception_metrics_prepare(void);
+
+/// The current time, in nanoseconds of the monotonic clock. This function is async-signal-safe.
+uint64_t mach_exception_metrics_now(void);
+
+/// Count a scope entered.
+void mach_exception_metrics_scope_entered(void);
+
+/// Count a listener wakeup. This function is async-signal-safe.
+void mach_exception_metrics_wakeup(void);
+
+/// Count a fault a scope caught, which the handler took `nanoseconds` to handle. This function is
+/// async-signal-safe.
+void mach_exception_metrics_caught(const mach_exception_record_t *record, uint64_t nanoseconds);
+
+/// Count a fault passed on to the handler this library replaced. This function is async-signal-safe.
+void mach_exception_metrics_forwarded(const mach_exception_record_t *record);
+
+/// Count a faulting thread reaching its scope's recovery point, `nanoseconds` after the handler resumed it.
+void mach_exception_metrics_resumed(exception_type_t type, uint64_t nanoseconds);
+
+// MARK: - Reading
+
+/// Sum the shards of every thread into `metrics`.
+void mach_exception_metrics_snapshot(mach_exception_metrics_t *metrics);
+
+/// The family of an exception record.
+size_t mach_exception_metrics_family(const mach_exception_record_t *record);
+
+/// The exception type of the faults of a family.
+exception_type_t mach_exception_metrics_family_type(size_t family);
+
+/// The name of a family, such as "vm_fault", or "other" for the records of a type whose cause is unknown.
+const char *mach_exception_metrics_family_name(size_t family);
+
+/// The name of an exception type, such as "bad_access", or `NULL` if the type is unknown.
+const char *mach_exception_metrics_type_name(exception_type_t type);
+
+// MARK: - Exposition
+
+/// Format metrics in the Prometheus text exposition format into `buffer`, as `snprintf` does.
+///
+/// Counters are named `mach_exception_<name>_total`; the fault counters carry `type` and `family` labels, and only
+/// the families with a nonzero count are listed. The latency histograms carry a `type` label, are in seconds, and
+/// are listed for the types with at least one sample.
+///
+/// - Returns: The length of the exposition, excluding the terminating null character, which may exceed `size`.
+size_t mach_exception_metrics_format(const mach_exception_metrics_t *metrics, char *buffer, size_t size);
+
+/// Write the exposition of a snapshot of the metrics to the file at `path`, replacing it atomically, so a scraper
+/// never reads a partial exposition.
+///
+/// - Returns: `false`, with `errno` set, if the file cannot be written.
+bool mach_exception_metrics_write(const char *path);
+
+/// Listen on a Unix-domain socket at `path`, on a thread of its own, and write the exposition of a snapshot of the
+/// metrics to each connection it accepts, then close it. An existing socket at `path` is replaced.
+///
+/// - Returns: The server, or `NULL`, with `errno` set, if the socket cannot be created.
+mach_exception_metrics_server_t *mach_exception_metrics_server_start(const char *path);
+
+/// Stop a server, join its thread, and remove its socket.
+void mach_exception_metrics_server_stop(mach_exception_metrics_server_t *server);
+
+#endif /* mach_exception_metrics_h */
@@ -0,0 +1,58 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// mach-exception
+// mach_exception_perform.h
+// Created by Patrick Gili on 2/12/23.
+//
+
+#ifndef mach_exception_perform_h
+#define mach_exception_perform_h
+
+#include "mach_exception_record.h"
+
+/// The result of performing an operation with `mach_exception_perform`.
+typedef enum mach_exception_result {
+    /// The operation failed to start, because the backend could not prepare the calling thread. The error
+    /// describes the failure.
+    MACH_EXCEPTION_FAILURE = -1,
+
+    /// The operation executed to completion.
+    MACH_EXCEPTION_COMPLETED = 0,
+
+    /// The operation raised an exception of one of the requested types, which the record describes.
+    MACH_EXCEPTION_CAUGHT = 1,
+} mach_exception_result_t;
+
+/// Perform an operation, catching the Mach exceptions in `mask`, then perform a "finally block".
+///
+/// Unlike `+[MachExceptionHelper performWithMask:dependencies:operation:finally:error:]`, the result path involves
+/// neither Foundation nor the Objective-C runtime, and allocates nothing: a caught exception resumes the function at
+/// the resume point it recorded with `mach_exception_resume_enter`, and the function writes the exception, and the
+/// faulting thread's machine state, into the caller's storage. On Linux, this is the signal backend's
+/// `mach_signal_perform`, whose handler rewrites the context it returns to. On Darwin, the listener rewrites the
+/// faulting thread's state to resume the innermost scope. Scopes entered with this function and with
+/// `performWithMask:` nest, in either order.
+///
+/// - Parameters:
+///   - mask: The bit mask specifying the Mach exceptions to catch.
+///   - operation: The operation to perform.
+///   - finally: The operation performed after `operation` completes, or after catching an exception.
+///   - context: The argument passed to `operation` and `finally`.
+///   - record: Receives the exception caught, if any.
+///   - state: Receives the machine state of the thread when it faulted, if the function caught an exception, with
+///     any value the backend couldn't determine set to 0. May be `NULL`.
+///   - error: Receives the reason the operation failed to start: an `errno` value on Linux, or a `kern_return_t`
+///     on Darwin.
+///
+/// - Returns: `MACH_EXCEPTION_COMPLETED`, `MACH_EXCEPTION_CAUGHT`, or `MACH_EXCEPTION_FAILURE`.
+mach_exception_result_t mach_exception_perform(exception_mask_t mask,
+                                               void (*operation)(void *context),
+                                               void (*finally)(void *context),
+                                               void *context,
+                                               mach_exception_record_t *record,
+                                               mach_exception_state_t *state,
+                                               int *error);
+
+#endif /* mach_exception_perform_h */
@@ -0,0 +1,44 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// mach-exception
+// mach_exception_record.h
+// Created by Patrick Gili on 1/28/23.
+//
+
+#ifndef mach_exception_record_h
+#define mach_exception_record_h
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __APPLE__
+#include <mach/exception_types.h>
+#else
+#include "mach_exception_compat.h"
+#endif
+
+/// A record describing a caught exception in terms of the Mach exception model: the exception type, together
+/// with the code and subcode the kernel associates with it.
+typedef struct mach_exception_record {
+    exception_type_t type;
+    mach_exception_data_type_t code;
+    mach_exception_data_type_t subcode;
+} mach_exception_record_t;
+
+/// The machine state of a thread when it raised an exception: the address of the faulting instruction, the stack
+/// pointer, the return address (the link register on arm64, or the faulting frame's return address on x86_64), and
+/// the address whose access faulted, for EXC_BAD_ACCESS. A value the backend couldn't determine is 0.
+typedef struct mach_exception_state {
+    uint64_t pc;
+    uint64_t sp;
+    uint64_t lr;
+    uint64_t fault_address;
+} mach_exception_state_t;
+
+/// Copy the machine state of the last exception the calling thread caught into `state`. Returns `false`, and
+/// clears `state`, if the thread hasn't caught an exception.
+bool mach_exception_last_state(mach_exception_state_t *state);
+
+#endif /* mach_exception_record_h */
@@ -0,0 +1,52 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// mach-exception
+// mach_exception_resolver.h
+// Created by Patrick Gili on 2/18/23.
+//
+
+#ifndef mach_exception_resolver_h
+#define mach_exception_resolver_h
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Fault resolvers.
+//
+// A resolver repairs bad-access faults within a range of addresses it owns, for example by committing the page that
+// faulted. When a thread inside a scope catching EXC_BAD_ACCESS faults within a resolver's range, the fault path
+// calls the resolver before anything else; if it repairs the fault, the thread resumes at the faulting instruction,
+// which executes again, and no exception is raised or recorded. Faults raised outside such a scope never reach a
+// resolver, as the library doesn't own them.
+//
+// On Linux, a resolver runs in the faulting thread's signal handler; on Darwin, it runs on the listener thread while
+// the faulting thread is suspended. Either way, it must be async-signal-safe.
+
+/// The number of resolvers that can be registered at once.
+#define MACH_EXCEPTION_RESOLVERS_MAX 16
+
+/// A resolver, called with the address whose access faulted and the context it was registered with. Returns `true`
+/// if it repaired the fault, so the faulting instruction can execute again.
+typedef bool (*mach_exception_resolver_t)(uint64_t address, void *context);
+
+/// Register a resolver for bad-access faults within `size` bytes from `base`.
+///
+/// - Returns: `false`, with `errno` set to `ENOSPC`, if `MACH_EXCEPTION_RESOLVERS_MAX` resolvers are registered.
+bool mach_exception_resolver_register(uint64_t base,
+                                      uint64_t size,
+                                      mach_exception_resolver_t resolver,
+                                      void *context);
+
+/// Unregister the resolver registered for the range starting at `base`. The caller must ensure no fault within the
+/// range is being resolved.
+void mach_exception_resolver_unregister(uint64_t base);
+
+/// Resolve a bad-access fault at `address`, with the resolver whose range holds it. This function is
+/// async-signal-safe, and doesn't take a lock.
+///
+/// - Returns: `true` if a resolver repaired the fault.
+bool mach_exception_resolve(uint64_t address);
+
+#endif /* mach_exception_resolver_h */
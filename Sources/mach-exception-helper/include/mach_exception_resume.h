@@ -0,0 +1,95 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// mach-exception
+// mach_exception_resume.h
+// Created by Patrick Gili on 3/1/23.
+//
+
+#ifndef mach_exception_resume_h
+#define mach_exception_resume_h
+
+#include <stdint.h>
+#include "mach_exception_record.h"
+
+// Resuming a faulting thread by rewriting its context.
+//
+// A scope records a resume point on entry: the return address and stack pointer of a call, and the registers the
+// ABI requires the call to preserve. Recording one is a handful of stores, saves no signal mask, and makes no system
+// call. To resume a faulting thread, the handler rewrites the thread's saved context (the `ucontext_t` a Linux
+// signal handler receives, or the `new_state` the Darwin listener replies with) so the thread continues at the
+// landing pad with the resume point, and the exception record, in its argument registers, and its stack pointer at
+// the resume point's. The landing pad stores the record in the resume point, restores the preserved registers, and
+// returns from the call that recorded the point a second time, with the exception type as its result.
+//
+// Nothing unwinds the faulting thread's frames, and on Linux the handler returns normally, so the kernel restores
+// the thread's signal mask and floating-point state along with the rewritten registers.
+//
+// The layouts describe where the registers the rewrite sets live in each kind of context, so the rewrite of any
+// context can be exercised on any host.
+
+// MARK: - Resume points
+
+/// The number of preserved registers a resume point holds: rbx, rbp and r12-r15 on x86_64; x19-x29 and d8-d15 on
+/// arm64.
+#define MACH_EXCEPTION_RESUME_REGISTERS 19
+
+/// A resume point. The landing pad fills in the record when it resumes the point.
+typedef struct mach_exception_resume_point {
+    uint64_t pc;
+    uint64_t sp;
+    uint64_t registers[MACH_EXCEPTION_RESUME_REGISTERS];
+    mach_exception_record_t record;
+} mach_exception_resume_point_t;
+
+/// Record a resume point in the calling function, like `_setjmp`.
+///
+/// - Returns: 0 when recording the point, and the type of the exception when the thread resumes it, which is never
+///   0. The variables the function modifies after recording the point must be `volatile` to keep their values.
+__attribute__((returns_twice))
+exception_type_t mach_exception_resume_enter(mach_exception_resume_point_t *point);
+
+/// The landing pad, where a rewritten context resumes a thread. Calling it resumes a point directly, e.g., to pass an
+/// exception on to an enclosing scope. The point's frame must still be active.
+__attribute__((noreturn))
+void mach_exception_resume_landing(mach_exception_resume_point_t *point,
+                                   exception_type_t type,
+                                   mach_exception_data_type_t code,
+                                   mach_exception_data_type_t subcode);
+
+// MARK: - Context layouts
+
+/// The byte offsets, within a kind of context, of the registers a rewrite sets: the program counter, the stack
+/// pointer, and the first four argument registers.
+typedef struct mach_exception_resume_layout {
+    uint16_t pc;
+    uint16_t sp;
+    uint16_t arguments[4];
+} mach_exception_resume_layout_t;
+
+/// A Linux `ucontext_t` on x86_64.
+extern const mach_exception_resume_layout_t mach_exception_resume_linux_x86_64;
+
+/// A Linux `ucontext_t` on arm64.
+extern const mach_exception_resume_layout_t mach_exception_resume_linux_arm64;
+
+/// A Darwin `x86_THREAD_STATE64` thread state.
+extern const mach_exception_resume_layout_t mach_exception_resume_darwin_x86_64;
+
+/// A Darwin `ARM_THREAD_STATE64` thread state.
+extern const mach_exception_resume_layout_t mach_exception_resume_darwin_arm64;
+
+/// The layout of the context the host's handler rewrites: a `ucontext_t` on Linux, and the thread state the
+/// listener replies with on Darwin.
+extern const mach_exception_resume_layout_t *const mach_exception_resume_host_layout;
+
+/// Rewrite a context, whose registers are laid out as `layout` describes, so the thread resumes at the landing pad
+/// with `point` and `record`, and the point's stack pointer. Every other register keeps its value. This function is
+/// async-signal-safe.
+void mach_exception_resume_rewrite(const mach_exception_resume_layout_t *layout,
+                                   void *context,
+                                   const mach_exception_resume_point_t *point,
+                                   const mach_exception_record_t *record);
+
+#endif /* mach_exception_resume_h */
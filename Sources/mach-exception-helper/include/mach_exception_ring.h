@@ -0,0 +1,71 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// mach-exception
+// mach_exception_ring.h
+// Created by Patrick Gili on 2/10/23.
+//
+
+#ifndef mach_exception_ring_h
+#define mach_exception_ring_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "mach_exception_record.h"
+
+// Per-thread event rings, into which the fault path records the exceptions it catches.
+//
+// Each thread that handles faults (on Linux, each thread that enters a scope; on Darwin, the listener thread) owns
+// a single-producer, single-consumer ring of fixed-size events, allocated before any fault arrives. Publishing an
+// event copies it into the ring's next slot and releases the ring's head, without allocating, taking a lock or
+// making a system call, so it is async-signal-safe. A collector drains every ring in batches. When a ring is full,
+// the event is counted as dropped rather than blocking the fault path; so is an event published on a thread
+// without a ring.
+
+/// The number of events each thread's ring holds.
+#define MACH_EXCEPTION_RING_CAPACITY 256
+
+/// An exception caught on the fault path. The sequence number counts the events published on the ring, including
+/// those dropped, so a gap between consecutive events of a ring shows how many were dropped. The timestamp is in
+/// nanoseconds since the Unix epoch, and the thread is the operating system's identifier for the faulting thread.
+typedef struct mach_exception_event {
+    uint64_t sequence;
+    uint64_t timestamp;
+    uint64_t thread;
+    int32_t type;
+    uint32_t reserved;
+    int64_t code;
+    int64_t subcode;
+    uint64_t pc;
+} mach_exception_event_t;
+
+/// Give the calling thread a ring, if it doesn't have one. The ring is released once the thread exits and the
+/// collector has drained it.
+///
+/// - Returns: `false`, with `errno` set, if the ring cannot be allocated.
+bool mach_exception_ring_prepare(void);
+
+/// Publish an exception on the calling thread's ring. This function is async-signal-safe.
+///
+/// - Parameters:
+///   - record: The exception.
+///   - pc: The address of the faulting instruction, or 0 if unknown.
+///   - thread: The faulting thread's identifier, or 0 if the calling thread faulted.
+///
+/// - Returns: `false` if the event was dropped, because the ring was full or the thread has no ring.
+bool mach_exception_ring_publish(const mach_exception_record_t *record, uint64_t pc, uint64_t thread);
+
+/// Drain up to `capacity` events from the rings of every thread into `events`, in order of publication on each
+/// ring. Calls are serialized, so any thread may drain.
+///
+/// - Parameters:
+///   - events: Receives the events.
+///   - capacity: The number of events `events` can hold.
+///   - dropped: Receives the number of events dropped since the previous call. May be `NULL`.
+///
+/// - Returns: The number of events drained.
+size_t mach_exception_ring_drain(mach_exception_event_t *events, size_t capacity, uint64_t *dropped);
+
+#endif /* mach_exception_ring_h */
@@ -0,0 +1,93 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// mach-exception
+// mach_fp_traps.h
+// Created by Patrick Gili on 2/14/23.
+//
+
+#ifndef mach_fp_traps_h
+#define mach_fp_traps_h
+
+#include <fenv.h>
+#include <stdbool.h>
+#include "mach_exception_record.h"
+
+// Scoped floating-point traps.
+//
+// A trap scope enables traps for a set of floating-point exceptions on the calling thread, so an operation raising
+// one of them raises EXC_ARITHMETIC (SIGFPE on Linux) rather than quietly setting a status flag. The functions write
+// the SIMD control register directly (MXCSR on x86_64, FPCR on arm64), which governs the scalar floating-point
+// arithmetic Swift and C compile to; the x87 control word is left alone. Each thread caches its control register,
+// so only the outermost scope reads it, and a scope whose traps are already enabled writes nothing. Scopes nest:
+// leaving a scope restores the traps enabled when it was entered.
+
+/// The floating-point exceptions for which a scope can enable traps, as the `FE_*` flags of `<fenv.h>`.
+#define MACH_FP_TRAPS_ALL (FE_INVALID | FE_DIVBYZERO | FE_OVERFLOW | FE_UNDERFLOW | FE_INEXACT)
+
+/// Enter a scope enabling traps for the floating-point exceptions in `excepts`, in addition to those already
+/// enabled on the calling thread.
+///
+/// - Parameters:
+///   - excepts: The `FE_*` flags of the exceptions to trap.
+///   - previous: Receives the traps enabled before the call, to pass to `mach_fp_traps_leave`.
+///
+/// - Returns: `false`, with `errno` set to `ENOTSUP`, if the processor doesn't support trapping the exceptions (as
+///   arm64 processors may not), in which case the thread's traps and depth are unchanged.
+bool mach_fp_traps_enter(int excepts, int *previous);
+
+/// Leave the calling thread's innermost trap scope, restoring the traps enabled when it was entered.
+///
+/// - Parameters:
+///   - previous: The traps `mach_fp_traps_enter` returned when entering the scope.
+void mach_fp_traps_leave(int previous);
+
+/// The traps enabled on the calling thread, as `FE_*` flags.
+int mach_fp_traps_enabled(void);
+
+/// The number of trap scopes the calling thread is in.
+unsigned int mach_fp_traps_depth(void);
+
+/// Restore the calling thread's control register from its cache, so the traps of the scopes it is in remain
+/// enabled. Call this after leaving a signal handler with `siglongjmp`, as the thread then continues with the
+/// handler's floating-point state rather than its own. The signal backend resumes a thread by returning from its
+/// handler, which restores the thread's own state, and doesn't need it.
+void mach_fp_traps_restore(void);
+
+// Sticky-flag scopes.
+//
+// A sticky-flag scope traps nothing: it clears the calling thread's status flags for a set of floating-point
+// exceptions on entry and reads them on exit, so an operation runs at full speed and its caller learns afterwards
+// which of the exceptions it raised, but not where. Like trap scopes, sticky-flag scopes access the SIMD status
+// register (MXCSR on x86_64, FPSR on arm64) directly. Only flags already raised are written, so a scope entered with
+// its flags clear, as it usually is, only reads the register: reading it right after writing it costs far more than
+// the read alone. Scopes nest: leaving a scope restores the flags raised before it was entered, together with those
+// raised within it, so an enclosing scope sees them too.
+
+/// Enter a sticky-flag scope, clearing the calling thread's status flags for the floating-point exceptions in
+/// `excepts`.
+///
+/// - Parameters:
+///   - excepts: The `FE_*` flags of the exceptions to watch.
+///   - previous: Receives the flags in `excepts` raised before the call, to pass to `mach_fp_flags_leave`.
+void mach_fp_flags_enter(int excepts, int *previous);
+
+/// Leave the calling thread's innermost sticky-flag scope.
+///
+/// - Parameters:
+///   - excepts: The exceptions the scope watches, as passed to `mach_fp_flags_enter`.
+///   - previous: The flags `mach_fp_flags_enter` returned when entering the scope.
+///
+/// - Returns: The `FE_*` flags of the watched floating-point exceptions raised within the scope.
+int mach_fp_flags_leave(int excepts, int previous);
+
+/// Describe floating-point exceptions raised in a sticky-flag scope as the arithmetic exception a trap for them
+/// would have raised: on x86_64, `EXC_I386_SSEEXTERR` with an MXCSR image whose unmasked status flags are the
+/// exceptions; on arm64, the `EXC_ARM_FP_*` code of the first of the exceptions, in the order invalid operation,
+/// divide by zero, overflow, underflow and inexact, with no instruction.
+///
+/// - Returns: `false` if `raised` holds no exception.
+bool mach_fp_flags_record(int raised, mach_exception_record_t *record);
+
+#endif /* mach_fp_traps_h */
@@ -0,0 +1,54 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// mach-exception
+// mach_guarded_buffer.h
+// Created by Patrick Gili on 2/22/23.
+//
+
+#ifndef mach_guarded_buffer_h
+#define mach_guarded_buffer_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Buffers followed by an inaccessible guard region.
+//
+// A guarded buffer's storage ends where its guard region starts, so an access reaching up to the guard region's
+// size past the end of the buffer faults, raising EXC_BAD_ACCESS, rather than reading or writing memory that belongs
+// to something else. A loop can therefore access the buffer without checking bounds, as long as no access reaches
+// further past the end than the guard region: a forward scan whose stride is at most the guard region's size stops
+// at the first fault past the end. Accesses before the start of the buffer aren't guarded.
+
+/// A guarded buffer. `bytes` is aligned to the alignment requested, and `guard` is the first byte of the guard region,
+/// which `bytes + size` reaches, rounded up to the alignment.
+typedef struct mach_guarded_buffer {
+    uint8_t *bytes;
+    size_t size;
+    uint8_t *guard;
+    size_t guard_size;
+    uint8_t *mapping;
+    size_t mapping_size;
+} mach_guarded_buffer_t;
+
+/// Allocate a zero-filled guarded buffer.
+///
+/// - Parameters:
+///   - size: The size of the buffer.
+///   - alignment: The alignment of the buffer, a power of two no larger than the page size.
+///   - guard_size: The size of the guard region, rounded up to a multiple of the page size, and at least a page.
+///   - buffer: Receives the buffer.
+///
+/// - Returns: `false`, with `errno` set, if the buffer cannot be allocated.
+bool mach_guarded_buffer_allocate(size_t size, size_t alignment, size_t guard_size, mach_guarded_buffer_t *buffer);
+
+/// Release a guarded buffer.
+void mach_guarded_buffer_deallocate(mach_guarded_buffer_t *buffer);
+
+/// Whether `address` lies within a buffer's guard region. If it does, `offset` receives its offset from the start of
+/// the buffer.
+bool mach_guarded_buffer_guards(const mach_guarded_buffer_t *buffer, uint64_t address, uint64_t *offset);
+
+#endif /* mach_guarded_buffer_h */
@@ -0,0 +1,91 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// mach-exception
+// mach_signal_handler.h
+// Created by Patrick Gili on 1/28/23.
+//
+
+#ifndef mach_signal_handler_h
+#define mach_signal_handler_h
+
+#if defined(__linux__)
+
+#include <signal.h>
+#include <stdbool.h>
+#include "mach_exception_lanes.h"
+#include "mach_exception_record.h"
+
+/// The result of performing an operation with `mach_signal_perform`.
+typedef enum mach_signal_result {
+    /// The operation failed to start, because the signal handlers or the thread's alternate signal stack could not
+    /// be installed. `errno` describes the failure.
+    MACH_SIGNAL_FAILURE = -1,
+
+    /// The operation executed to completion.
+    MACH_SIGNAL_COMPLETED = 0,
+
+    /// The operation raised an exception of one of the requested types, which the record describes.
+    MACH_SIGNAL_CAUGHT = 1,
+} mach_signal_result_t;
+
+/// Perform an operation, catching the hardware faults corresponding to the Mach exception types in `mask`, then
+/// perform a "finally block".
+///
+/// The first call on a thread installs the process-wide handlers for SIGSEGV, SIGBUS, SIGILL, SIGFPE and SIGTRAP, and
+/// an alternate signal stack for the thread. Thereafter, entering a scope records a resume point with
+/// `mach_exception_resume_enter`, which saves no signal mask, and pushes it onto a thread-local scope stack, so the
+/// no-fault path makes no system calls and never involves a listener. When a fault arrives, the handler rewrites the
+/// context it returns to, so the thread resumes the innermost scope whose mask includes its exception type, after
+/// the finally blocks of the scopes it encloses have executed; any other fault goes to the handler installed before
+/// this library's.
+///
+/// - Parameters:
+///   - mask: The bit mask specifying the Mach exceptions to catch.
+///   - operation: The operation to perform.
+///   - finally: The operation performed after `operation` completes, or after catching an exception.
+///   - context: The argument passed to `operation` and `finally`.
+///   - record: Receives the exception caught, if any.
+///
+/// - Returns: `MACH_SIGNAL_COMPLETED`, `MACH_SIGNAL_CAUGHT`, or `MACH_SIGNAL_FAILURE`.
+mach_signal_result_t mach_signal_perform(exception_mask_t mask,
+                                         void (*operation)(void *context),
+                                         void (*finally)(void *context),
+                                         void *context,
+                                         mach_exception_record_t *record);
+
+// Expose access to this function strictly for unit testing code coverage. Translates a fault signal, and the
+// thread context it was delivered with (which may be `NULL`), into the Mach exception Darwin raises for the same
+// fault on the host architecture. Returns `false` if the signal does not correspond to a Mach exception.
+bool mach_signal_record_from_siginfo(int signal,
+                                     const siginfo_t *info,
+                                     const void *ucontext,
+                                     mach_exception_record_t *record);
+
+// Expose access to this function strictly for unit testing code coverage. Extracts the machine state of the thread
+// that received a fault signal from the context it was delivered with (which may be `NULL`), along with the
+// faulting frame's frame pointer. Only the fault address is known without a context, in which case the function
+// returns `false`. The link register is left 0 on x86_64, which has none.
+bool mach_signal_state_from_ucontext(int signal,
+                                     const siginfo_t *info,
+                                     const void *ucontext,
+                                     mach_exception_state_t *state,
+                                     uint64_t *fp);
+
+// Expose access to this function strictly for unit testing code coverage. Extracts the registers lane attribution
+// reads from the context a fault signal was delivered with. Returns `false` if the context holds no floating-point
+// state.
+bool mach_signal_simd_state_from_ucontext(const void *ucontext, mach_exception_simd_state_t *state);
+
+// Expose access to this function strictly for unit testing code coverage. Replaces the action to which the signal
+// handler forwards the faults it doesn't own, as if `action` had been installed before this library's handler, and
+// returns the replaced action in `previous`, which may be `NULL`. Returns `false` if the library doesn't handle
+// `signal`.
+bool mach_signal_exchange_previous_action(int signal,
+                                          const struct sigaction *action,
+                                          struct sigaction *previous);
+
+#endif /* defined(__linux__) */
+
+#endif /* mach_signal_handler_h */
@@ -0,0 +1,88 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// mach-exception
+// mach_userfault.h
+// Created by Patrick Gili on 2/20/23.
+//
+
+#ifndef mach_userfault_h
+#define mach_userfault_h
+
+#if defined(__linux__)
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Demand-paged regions, served with userfaultfd(2).
+//
+// A region reserves a range of anonymous memory and registers it with a userfault file descriptor, so creating one
+// costs the same whatever its size. The first touch of a page blocks the touching thread while the region's handler
+// thread asks a fill callback for the page's contents (e.g., by decompressing them from a file), copies them in with
+// UFFDIO_COPY and wakes the thread. Each fault is served a window of neighbouring pages at once (fault-around), and
+// may be followed by the pages after the window (prefetch), so a sequential scan takes a fault per window rather than
+// per page, and memory tracks the pages touched rather than the size of the region.
+//
+// If the fill callback fails, the handler makes the run of pages it failed to fill inaccessible before waking the
+// faulting thread, which then raises EXC_BAD_ACCESS, so a scope catching bad access surfaces the failure as a
+// `MachExceptionError`. Pages already served keep their contents.
+//
+// When vm.unprivileged_userfaultfd is 0, the default since Linux 5.11, an unprivileged process gets a descriptor
+// handling only the faults its threads take in user mode: a system call reading or writing an unserved page of the
+// region, such as read(2) into it, fails with EFAULT instead of waiting for the page.
+
+/// A demand-paged region.
+typedef struct mach_userfault_region mach_userfault_region_t;
+
+/// Fill `size` bytes of a region starting at `offset` (both multiples of the page size) into `buffer`. Called on the
+/// region's handler thread. Returns `false` if the contents cannot be produced.
+typedef bool (*mach_userfault_fill_t)(uint64_t offset, void *buffer, size_t size, void *context);
+
+/// The work a region's handler thread has done. The service time of a fault runs from reading the fault to waking
+/// the faulting thread, and includes the fill callback; prefetching happens after the thread is woken, and is
+/// accounted separately.
+typedef struct mach_userfault_statistics {
+    uint64_t faults;
+    uint64_t pages;
+    uint64_t prefetched_pages;
+    uint64_t failures;
+    uint64_t service_nanoseconds;
+    uint64_t max_service_nanoseconds;
+    uint64_t prefetch_nanoseconds;
+} mach_userfault_statistics_t;
+
+/// Create a demand-paged region and start its handler thread.
+///
+/// - Parameters:
+///   - size: The size of the region, rounded up to a multiple of the page size.
+///   - fault_around: The number of pages served per fault, rounded down to a power of two. The window is aligned to
+///     its size and holds the faulting page; pages in it already served are skipped.
+///   - prefetch: The number of pages after the window served once the faulting thread is woken, or 0.
+///   - fill: The callback producing the region's contents.
+///   - context: The context passed to `fill`.
+///
+/// - Returns: `NULL`, with `errno` set, if userfaultfd(2) isn't available to the process (`EPERM` or `ENOSYS`), or
+///   the region cannot be reserved.
+mach_userfault_region_t *mach_userfault_region_create(size_t size,
+                                                      size_t fault_around,
+                                                      size_t prefetch,
+                                                      mach_userfault_fill_t fill,
+                                                      void *context);
+
+/// Stop a region's handler thread and release the region. No thread may touch the region any longer.
+void mach_userfault_region_destroy(mach_userfault_region_t *region);
+
+/// The address of a region's first byte.
+void *mach_userfault_region_address(const mach_userfault_region_t *region);
+
+/// The size of a region.
+size_t mach_userfault_region_size(const mach_userfault_region_t *region);
+
+/// Copy the statistics of a region's handler thread into `statistics`.
+void mach_userfault_region_statistics(const mach_userfault_region_t *region, mach_userfault_statistics_t *statistics);
+
+#endif /* __linux__ */
+
+#endif /* mach_userfault_h */
@@ -0,0 +1,291 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// mach-exception
+// mach_exc_dispatch.c
+// Created by Patrick Gili on 2/4/23.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "mach_exc_dispatch.h"
+
+// MARK: - Wire format
+
+// The offsets of the fields of the messages mach_exc.defs describes, as MIG lays them out on 64-bit hosts: packed
+// on 4-byte boundaries, with the fields following a variable-length array shifting with the array's length.
+
+// mach_msg_header_t
+#define MACH_EXC_HEADER_BITS            0
+#define MACH_EXC_HEADER_SIZE            4
+#define MACH_EXC_HEADER_REMOTE_PORT     8
+#define MACH_EXC_HEADER_LOCAL_PORT      12
+#define MACH_EXC_HEADER_VOUCHER_PORT    16
+#define MACH_EXC_HEADER_ID              20
+#define MACH_EXC_HEADER_LENGTH          24
+
+#define MACH_EXC_BITS_COMPLEX           0x80000000u
+#define MACH_EXC_BITS_REMOTE_MASK       0x0000001fu
+
+// mach_msg_port_descriptor_t, whose disposition and type are the bit fields in its last two bytes.
+#define MACH_EXC_DESCRIPTOR_NAME        0
+#define MACH_EXC_DESCRIPTOR_DISPOSITION 10
+#define MACH_EXC_DESCRIPTOR_TYPE        11
+#define MACH_EXC_PORT_DESCRIPTOR        0
+#define MACH_EXC_MSG_TYPE_PORT_SEND     17
+
+// Requests carrying the thread and task (mach_exception_raise and mach_exception_raise_state_identity).
+#define MACH_EXC_IDENTITY_BODY          24
+#define MACH_EXC_IDENTITY_THREAD        28
+#define MACH_EXC_IDENTITY_TASK          40
+#define MACH_EXC_IDENTITY_CODE          68
+
+// Requests carrying neither (mach_exception_raise_state).
+#define MACH_EXC_STATE_CODE             40
+
+// The exception type and code count precede the codes.
+#define MACH_EXC_EXCEPTION(code_offset)     ((code_offset) - 8)
+#define MACH_EXC_CODE_COUNT(code_offset)    ((code_offset) - 4)
+
+// Replies, of which mig_reply_error_t is the prefix.
+#define MACH_EXC_REPLY_NDR              24
+#define MACH_EXC_REPLY_RETURN_CODE      32
+#define MACH_EXC_REPLY_FLAVOR           36
+#define MACH_EXC_REPLY_STATE_COUNT      40
+#define MACH_EXC_REPLY_STATE            44
+#define MACH_EXC_REPLY_ERROR_LENGTH     36
+
+// NDR_record for a little-endian host.
+static const uint8_t mach_exc_ndr_record[8] = { 0, 0, 0, 0, 1, 0, 0, 0 };
+
+static inline uint32_t mach_exc_load32(const uint8_t *buffer, size_t offset)
+{
+    uint32_t value;
+    memcpy(&value, buffer + offset, sizeof(value));
+    return value;
+}
+
+static inline void mach_exc_store32(uint8_t *buffer, size_t offset, uint32_t value)
+{
+    memcpy(buffer + offset, &value, sizeof(value));
+}
+
+static inline bool mach_exc_is_send_right(const uint8_t *descriptor)
+{
+    return descriptor[MACH_EXC_DESCRIPTOR_TYPE] == MACH_EXC_PORT_DESCRIPTOR &&
+           descriptor[MACH_EXC_DESCRIPTOR_DISPOSITION] == MACH_EXC_MSG_TYPE_PORT_SEND;
+}
+
+// MARK: - Routines
+
+static kern_return_t mach_exc_dispatch_raise(const mach_exc_dispatch_handlers_t *handlers,
+                                             uint8_t *in,
+                                             mach_msg_size_t size)
+{
+    if (!(mach_exc_load32(in, MACH_EXC_HEADER_BITS) & MACH_EXC_BITS_COMPLEX) ||
+        mach_exc_load32(in, MACH_EXC_IDENTITY_BODY) != 2 ||
+        size < MACH_EXC_IDENTITY_CODE ||
+        size > MACH_EXC_IDENTITY_CODE + 8 * MACH_EXC_DISPATCH_CODE_MAX) {
+        return MIG_BAD_ARGUMENTS;
+    }
+    if (!mach_exc_is_send_right(in + MACH_EXC_IDENTITY_THREAD) || !mach_exc_is_send_right(in + MACH_EXC_IDENTITY_TASK)) {
+        return MIG_TYPE_ERROR;
+    }
+
+    mach_msg_type_number_t codeCnt = mach_exc_load32(in, MACH_EXC_CODE_COUNT(MACH_EXC_IDENTITY_CODE));
+    if (codeCnt > MACH_EXC_DISPATCH_CODE_MAX || size != MACH_EXC_IDENTITY_CODE + 8 * codeCnt) {
+        return MIG_BAD_ARGUMENTS;
+    }
+
+    mach_exception_data_type_t code[MACH_EXC_DISPATCH_CODE_MAX];
+    memcpy(code, in + MACH_EXC_IDENTITY_CODE, 8 * codeCnt);
+    return handlers->raise(handlers->context,
+                           mach_exc_load32(in, MACH_EXC_HEADER_LOCAL_PORT),
+                           mach_exc_load32(in, MACH_EXC_IDENTITY_THREAD + MACH_EXC_DESCRIPTOR_NAME),
+                           mach_exc_load32(in, MACH_EXC_IDENTITY_TASK + MACH_EXC_DESCRIPTOR_NAME),
+                           (exception_type_t) mach_exc_load32(in, MACH_EXC_EXCEPTION(MACH_EXC_IDENTITY_CODE)),
+                           code,
+                           codeCnt);
+}
+
+// mach_exception_raise_state and mach_exception_raise_state_identity differ only in whether the thread and task
+// precede the exception.
+static kern_return_t mach_exc_dispatch_raise_state(const mach_exc_dispatch_handlers_t *handlers,
+                                                   uint8_t *in,
+                                                   mach_msg_size_t size,
+                                                   uint8_t *out,
+                                                   bool identity)
+{
+    size_t code_offset = identity ? MACH_EXC_IDENTITY_CODE : MACH_EXC_STATE_CODE;
+    size_t minimum = code_offset + 8;
+    size_t maximum = minimum + 8 * MACH_EXC_DISPATCH_CODE_MAX + 4 * MACH_EXC_DISPATCH_STATE_MAX;
+
+    if (identity) {
+        if (!(mach_exc_load32(in, MACH_EXC_HEADER_BITS) & MACH_EXC_BITS_COMPLEX) ||
+            mach_exc_load32(in, MACH_EXC_IDENTITY_BODY) != 2 ||
+            size < minimum || size > maximum) {
+            return MIG_BAD_ARGUMENTS;
+        }
+        if (!mach_exc_is_send_right(in + MACH_EXC_IDENTITY_THREAD) ||
+            !mach_exc_is_send_right(in + MACH_EXC_IDENTITY_TASK)) {
+            return MIG_TYPE_ERROR;
+        }
+    } else if ((mach_exc_load32(in, MACH_EXC_HEADER_BITS) & MACH_EXC_BITS_COMPLEX) || size < minimum || size > maximum) {
+        return MIG_BAD_ARGUMENTS;
+    }
+
+    mach_msg_type_number_t codeCnt = mach_exc_load32(in, MACH_EXC_CODE_COUNT(code_offset));
+    if (codeCnt > MACH_EXC_DISPATCH_CODE_MAX || size < minimum + 8 * codeCnt) {
+        return MIG_BAD_ARGUMENTS;
+    }
+
+    // The flavor and the state follow the codes the request actually carries.
+    size_t flavor_offset = code_offset + 8 * codeCnt;
+    mach_msg_type_number_t old_stateCnt = mach_exc_load32(in, flavor_offset + 4);
+    if (old_stateCnt > MACH_EXC_DISPATCH_STATE_MAX || size != flavor_offset + 8 + 4 * old_stateCnt) {
+        return MIG_BAD_ARGUMENTS;
+    }
+
+    mach_exception_data_type_t code[MACH_EXC_DISPATCH_CODE_MAX];
+    memcpy(code, in + code_offset, 8 * codeCnt);
+    int flavor = (int) mach_exc_load32(in, flavor_offset);
+    natural_t *old_state = (natural_t *)(void *)(in + flavor_offset + 8);
+    natural_t *new_state = (natural_t *)(void *)(out + MACH_EXC_REPLY_STATE);
+    mach_msg_type_number_t new_stateCnt = MACH_EXC_DISPATCH_STATE_MAX;
+    exception_type_t exception = (exception_type_t) mach_exc_load32(in, MACH_EXC_EXCEPTION(code_offset));
+    mach_port_name_t exception_port = mach_exc_load32(in, MACH_EXC_HEADER_LOCAL_PORT);
+
+    kern_return_t result;
+    if (identity) {
+        result = handlers->raise_state_identity(handlers->context,
+                                                exception_port,
+                                                mach_exc_load32(in, MACH_EXC_IDENTITY_THREAD + MACH_EXC_DESCRIPTOR_NAME),
+                                                mach_exc_load32(in, MACH_EXC_IDENTITY_TASK + MACH_EXC_DESCRIPTOR_NAME),
+                                                exception,
+                                                code,
+                                                codeCnt,
+                                                &flavor,
+                                                old_state,
+                                                old_stateCnt,
+                                                new_state,
+                                                &new_stateCnt);
+    } else {
+        result = handlers->raise_state(handlers->context,
+                                       exception_port,
+                                       exception,
+                                       code,
+                                       codeCnt,
+                                       &flavor,
+                                       old_state,
+                                       old_stateCnt,
+                                       new_state,
+                                       &new_stateCnt);
+    }
+    if (result != KERN_SUCCESS) {
+        return result;
+    }
+
+    mach_exc_store32(out, MACH_EXC_REPLY_FLAVOR, (uint32_t) flavor);
+    mach_exc_store32(out, MACH_EXC_REPLY_STATE_COUNT, new_stateCnt);
+    mach_exc_store32(out, MACH_EXC_HEADER_SIZE, MACH_EXC_REPLY_STATE + 4 * new_stateCnt);
+    return KERN_SUCCESS;
+}
+
+// MARK: - mach_exc_dispatch
+
+bool mach_exc_dispatch(const mach_exc_dispatch_handlers_t *handlers,
+                       void *request,
+                       size_t request_size,
+                       void *reply)
+{
+    uint8_t *in = request;
+    uint8_t *out = reply;
+
+    // Build the error reply's header, which a successful routine amends.
+    memset(out, 0, MACH_EXC_REPLY_ERROR_LENGTH);
+    memcpy(out + MACH_EXC_REPLY_NDR, mach_exc_ndr_record, sizeof(mach_exc_ndr_record));
+    mach_exc_store32(out, MACH_EXC_HEADER_SIZE, MACH_EXC_REPLY_ERROR_LENGTH);
+    if (request_size < MACH_EXC_HEADER_LENGTH) {
+        mach_exc_store32(out, MACH_EXC_REPLY_RETURN_CODE, (uint32_t) MIG_BAD_ARGUMENTS);
+        return false;
+    }
+
+    int32_t identifier = (int32_t) mach_exc_load32(in, MACH_EXC_HEADER_ID);
+    mach_exc_store32(out, MACH_EXC_HEADER_BITS, mach_exc_load32(in, MACH_EXC_HEADER_BITS) & MACH_EXC_BITS_REMOTE_MASK);
+    mach_exc_store32(out, MACH_EXC_HEADER_REMOTE_PORT, mach_exc_load32(in, MACH_EXC_HEADER_REMOTE_PORT));
+    mach_exc_store32(out, MACH_EXC_HEADER_ID, (uint32_t)(identifier + MACH_EXC_DISPATCH_REPLY_ID_OFFSET));
+
+    bool implemented = (identifier == MACH_EXC_DISPATCH_RAISE && handlers->raise != NULL) ||
+                       (identifier == MACH_EXC_DISPATCH_RAISE_STATE && handlers->raise_state != NULL) ||
+                       (identifier == MACH_EXC_DISPATCH_RAISE_STATE_IDENTITY && handlers->raise_state_identity != NULL);
+    if (!implemented) {
+        mach_exc_store32(out, MACH_EXC_REPLY_RETURN_CODE, (uint32_t) MIG_BAD_ID);
+        return false;
+    }
+
+    // The size the header claims must not exceed the bytes actually available.
+    mach_msg_size_t size = mach_exc_load32(in, MACH_EXC_HEADER_SIZE);
+    kern_return_t result;
+    if (size > request_size) {
+        result = MIG_BAD_ARGUMENTS;
+    } else if (identifier == MACH_EXC_DISPATCH_RAISE) {
+        result = mach_exc_dispatch_raise(handlers, in, size);
+    } else {
+        result = mach_exc_dispatch_raise_state(handlers,
+                                               in,
+                                               size,
+                                               out,
+                                               identifier == MACH_EXC_DISPATCH_RAISE_STATE_IDENTITY);
+    }
+
+    if (result != KERN_SUCCESS) {
+        mach_exc_store32(out, MACH_EXC_HEADER_SIZE, MACH_EXC_REPLY_ERROR_LENGTH);
+    }
+    mach_exc_store32(out, MACH_EXC_REPLY_RETURN_CODE, (uint32_t) result);
+    return true;
+}
+
+kern_return_t mach_exc_dispatch_reply_code(const void *reply)
+{
+    return (kern_return_t) mach_exc_load32(reply, MACH_EXC_REPLY_RETURN_CODE);
+}
+
+// MARK: - mach_exc_arena
+
+bool mach_exc_arena_init(mach_exc_arena_t *arena, size_t request_size)
+{
+    arena->request = malloc(request_size);
+    arena->reply = malloc(MACH_EXC_DISPATCH_REPLY_MAX);
+    if (arena->request == NULL || arena->reply == NULL) {
+        free(arena->request);
+        free(arena->reply);
+        memset(arena, 0, sizeof(*arena));
+        return false;
+    }
+    arena->request_size = request_size;
+    arena->reply_size = MACH_EXC_DISPATCH_REPLY_MAX;
+    return true;
+}
+
+bool mach_exc_arena_reserve(mach_exc_arena_t *arena, size_t request_size)
+{
+    if (request_size <= arena->request_size) {
+        return true;
+    }
+    void *request = malloc(request_size);
+    if (request == NULL) {
+        return false;
+    }
+    free(arena->request);
+    arena->request = request;
+    arena->request_size = request_size;
+    return true;
+}
+
+void mach_exc_arena_destroy(mach_exc_arena_t *arena)
+{
+    free(arena->request);
+    free(arena->reply);
+    memset(arena, 0, sizeof(*arena));
+}
@@ -0,0 +1,101 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// mach-exception
+// mach_exception_arena.c
+// Created by Patrick Gili on 2/18/23.
+//
+
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "mach_exception_arena.h"
+#include "mach_exception_resolver.h"
+
+static size_t mach_exception_arena_round(size_t size, size_t granule)
+{
+    return (size + granule - 1) / granule * granule;
+}
+
+// Commit the memory up to the chunk holding the faulting address. Faults below the committed memory were resolved
+// already; faults in the guard region are the arena's exhaustion, and are left to raise an exception.
+static bool mach_exception_arena_resolve(uint64_t address, void *context)
+{
+    mach_exception_arena_t *arena = context;
+    uint8_t *fault = (uint8_t *)(uintptr_t) address;
+    if (fault >= arena->limit) {
+        return false;
+    }
+    if (fault < arena->committed) {
+        return true;
+    }
+    size_t offset = mach_exception_arena_round((size_t) (fault - arena->base) + 1, arena->chunk_size);
+    uint8_t *committed = arena->base + offset;
+    if (committed > arena->limit) {
+        committed = arena->limit;
+    }
+    if (mprotect(arena->committed, (size_t) (committed - arena->committed), PROT_READ | PROT_WRITE) != 0) {
+        return false;
+    }
+    arena->committed = committed;
+    return true;
+}
+
+mach_exception_arena_t *mach_exception_arena_create(size_t capacity, size_t chunk_size)
+{
+    size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+    capacity = mach_exception_arena_round(capacity == 0 ? page_size : capacity, page_size);
+    chunk_size = mach_exception_arena_round(chunk_size == 0 ? page_size : chunk_size, page_size);
+    size_t reservation = capacity + MACH_EXCEPTION_ARENA_MAX_ALLOCATION;
+
+    mach_exception_arena_t *arena = malloc(sizeof(*arena));
+    if (arena == NULL) {
+        return NULL;
+    }
+    void *base = mmap(NULL, reservation, PROT_NONE, MAP_PRIVATE | MAP_ANON | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) {
+        int error = errno;
+        free(arena);
+        errno = error;
+        return NULL;
+    }
+    arena->base = base;
+    arena->top = base;
+    arena->committed = base;
+    arena->limit = arena->base + capacity;
+    arena->chunk_size = chunk_size;
+
+    if (!mach_exception_resolver_register((uint64_t)(uintptr_t) base,
+                                          reservation,
+                                          mach_exception_arena_resolve,
+                                          arena)) {
+        int error = errno;
+        munmap(base, reservation);
+        free(arena);
+        errno = error;
+        return NULL;
+    }
+    return arena;
+}
+
+void mach_exception_arena_destroy(mach_exception_arena_t *arena)
+{
+    if (arena == NULL) {
+        return;
+    }
+    mach_exception_resolver_unregister((uint64_t)(uintptr_t) arena->base);
+    munmap(arena->base, (size_t) (arena->limit - arena->base) + MACH_EXCEPTION_ARENA_MAX_ALLOCATION);
+    free(arena);
+}
+
+void mach_exception_arena_reset(mach_exception_arena_t *arena)
+{
+    arena->top = arena->base;
+}
+
+size_t mach_exception_arena_committed(const mach_exception_arena_t *arena)
+{
+    return (size_t) (arena->committed - arena->base);
+}
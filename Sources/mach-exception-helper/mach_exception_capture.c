@@ -0,0 +1,525 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// mach-exception
+// mach_exception_capture.c
+// Created by Patrick Gili on 2/28/23.
+//
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <ucontext.h>
+#include "mach_signal_handler.h"
+#endif
+#include "mach_exception_capture.h"
+
+_Static_assert(sizeof(mach_exception_capture_header_t) == MACH_EXCEPTION_CAPTURE_HEADER_SIZE,
+               "The capture file header must match the file format");
+_Static_assert(sizeof(mach_exception_capture_event_t) == 16, "The capture event must match the file format");
+_Static_assert(sizeof(mach_exception_capture_signal_t) == 32, "The captured signal must match the file format");
+
+#if defined(__x86_64__)
+#define MACH_EXCEPTION_CAPTURE_HOST_ARCH MACH_EXCEPTION_ARCH_X86_64
+#else
+#define MACH_EXCEPTION_CAPTURE_HOST_ARCH MACH_EXCEPTION_ARCH_ARM64
+#endif
+
+#if defined(__APPLE__)
+#define MACH_EXCEPTION_CAPTURE_HOST_SYSTEM MACH_EXCEPTION_CAPTURE_DARWIN
+#else
+#define MACH_EXCEPTION_CAPTURE_HOST_SYSTEM MACH_EXCEPTION_CAPTURE_LINUX
+#endif
+
+// The size of the legacy FXSAVE area at the start of an x86_64 signal frame's floating-point state, which holds
+// the x87 status word and MXCSR the signal backend reads.
+#define MACH_EXCEPTION_CAPTURE_FXSAVE_SIZE 512
+
+static uint64_t mach_exception_capture_now(clockid_t clock)
+{
+    struct timespec now;
+    clock_gettime(clock, &now);
+    return (uint64_t) now.tv_sec * 1000000000u + (uint64_t) now.tv_nsec;
+}
+
+static size_t mach_exception_capture_padding(size_t size)
+{
+    return (8 - size % 8) % 8;
+}
+
+// MARK: - mach_exception_capture
+
+struct mach_exception_capture {
+    int descriptor;
+    uint64_t origin;
+};
+
+// The capture the handlers append their inputs to, if any. Handlers count themselves as writers before they look
+// it up, and until they are done appending to it, so that closing a capture, once it is uninstalled, waits for
+// the handlers that may still have found it before closing its file.
+static mach_exception_capture_t *mach_exception_capture_current;
+static uint64_t mach_exception_capture_writers;
+
+mach_exception_capture_t *mach_exception_capture_open(const char *path)
+{
+    mach_exception_capture_t *capture = calloc(1, sizeof(mach_exception_capture_t));
+    if (capture == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    capture->descriptor = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (capture->descriptor < 0) {
+        free(capture);
+        return NULL;
+    }
+    capture->origin = mach_exception_capture_now(CLOCK_MONOTONIC);
+
+    mach_exception_capture_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.magic = MACH_EXCEPTION_CAPTURE_MAGIC;
+    header.version = MACH_EXCEPTION_CAPTURE_VERSION;
+    header.header_size = MACH_EXCEPTION_CAPTURE_HEADER_SIZE;
+    header.arch = MACH_EXCEPTION_CAPTURE_HOST_ARCH;
+    header.system = MACH_EXCEPTION_CAPTURE_HOST_SYSTEM;
+    header.created = mach_exception_capture_now(CLOCK_REALTIME);
+    header.origin = capture->origin;
+    if (write(capture->descriptor, &header, sizeof(header)) != (ssize_t) sizeof(header)) {
+        int error = errno == 0 ? EIO : errno;
+        close(capture->descriptor);
+        free(capture);
+        errno = error;
+        return NULL;
+    }
+    return capture;
+}
+
+void mach_exception_capture_close(mach_exception_capture_t *capture)
+{
+    mach_exception_capture_t *installed = capture;
+    __atomic_compare_exchange_n(&mach_exception_capture_current,
+                                &installed,
+                                NULL,
+                                false,
+                                __ATOMIC_SEQ_CST,
+                                __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&mach_exception_capture_writers, __ATOMIC_ACQUIRE) != 0) {
+        sched_yield();
+    }
+    close(capture->descriptor);
+    free(capture);
+}
+
+mach_exception_capture_t *mach_exception_capture_install(mach_exception_capture_t *capture)
+{
+    return __atomic_exchange_n(&mach_exception_capture_current, capture, __ATOMIC_SEQ_CST);
+}
+
+// Append an event made of the parts of its payload. The whole event goes out in a single write, which the file's
+// O_APPEND mode keeps from interleaving with the events of concurrent handlers. writev(2) isn't on POSIX's list of
+// async-signal-safe functions, but it is a plain system call on both platforms, as write(2) is.
+static bool mach_exception_capture_append(mach_exception_capture_t *capture,
+                                          uint32_t kind,
+                                          struct iovec *parts,
+                                          int count)
+{
+    static const uint8_t padding[8];
+    struct iovec iov[8];
+    size_t size = 0;
+    int used = 1;
+    for (int index = 0; index < count; index++) {
+        iov[used++] = parts[index];
+        size += parts[index].iov_len;
+        size_t pad = mach_exception_capture_padding(parts[index].iov_len);
+        if (pad != 0) {
+            iov[used++] = (struct iovec) { .iov_base = (void *) padding, .iov_len = pad };
+            size += pad;
+        }
+    }
+
+    mach_exception_capture_event_t event;
+    event.kind = kind;
+    event.size = (uint32_t)(size - mach_exception_capture_padding(parts[count - 1].iov_len));
+    event.timestamp = mach_exception_capture_now(CLOCK_MONOTONIC) - capture->origin;
+    iov[0] = (struct iovec) { .iov_base = &event, .iov_len = sizeof(event) };
+
+    ssize_t written = writev(capture->descriptor, iov, used);
+    if (written < 0) {
+        return false;
+    }
+    if ((size_t) written != sizeof(event) + size) {
+        errno = EIO;
+        return false;
+    }
+    return true;
+}
+
+bool mach_exception_capture_message(mach_exception_capture_t *capture, const void *message, size_t size)
+{
+    if (size > UINT32_MAX) {
+        errno = EINVAL;
+        return false;
+    }
+    struct iovec parts[] = { { .iov_base = (void *) message, .iov_len = size } };
+    return mach_exception_capture_append(capture, MACH_EXCEPTION_CAPTURE_MESSAGE, parts, 1);
+}
+
+void mach_exception_capture_installed_message(const void *message, size_t size)
+{
+    if (__atomic_load_n(&mach_exception_capture_current, __ATOMIC_RELAXED) == NULL) {
+        return;
+    }
+    __atomic_add_fetch(&mach_exception_capture_writers, 1, __ATOMIC_SEQ_CST);
+    mach_exception_capture_t *capture = __atomic_load_n(&mach_exception_capture_current, __ATOMIC_SEQ_CST);
+    if (capture != NULL) {
+        int error = errno;
+        mach_exception_capture_message(capture, message, size);
+        errno = error;
+    }
+    __atomic_sub_fetch(&mach_exception_capture_writers, 1, __ATOMIC_RELEASE);
+}
+
+#if defined(__linux__)
+bool mach_exception_capture_signal(mach_exception_capture_t *capture,
+                                   int signal,
+                                   const siginfo_t *info,
+                                   const void *ucontext)
+{
+    const ucontext_t *context = (const ucontext_t *) ucontext;
+    mach_exception_capture_signal_t captured;
+    memset(&captured, 0, sizeof(captured));
+    captured.signal = signal;
+    captured.code = info->si_code;
+    captured.address = (uint64_t)(uintptr_t) info->si_addr;
+
+    struct iovec parts[3];
+    int count = 0;
+    parts[count++] = (struct iovec) { .iov_base = &captured, .iov_len = sizeof(captured) };
+    if (context != NULL) {
+        // Only the machine context is read, and the kernel's ucontext may be smaller than the C library's.
+        captured.context_size = (uint32_t)(offsetof(ucontext_t, uc_mcontext) + sizeof(mcontext_t));
+        parts[count++] = (struct iovec) { .iov_base = (void *) context, .iov_len = captured.context_size };
+#if defined(__x86_64__)
+        if (context->uc_mcontext.fpregs != NULL) {
+            captured.fpstate_size = MACH_EXCEPTION_CAPTURE_FXSAVE_SIZE;
+            parts[count++] = (struct iovec) {
+                .iov_base = (void *) context->uc_mcontext.fpregs,
+                .iov_len = captured.fpstate_size,
+            };
+        }
+#elif defined(__aarch64__)
+        if (signal == SIGILL || signal == SIGFPE) {
+            memcpy(&captured.instruction, (const void *)(uintptr_t) context->uc_mcontext.pc, sizeof(uint32_t));
+        }
+#endif
+    }
+    return mach_exception_capture_append(capture, MACH_EXCEPTION_CAPTURE_SIGNAL, parts, count);
+}
+
+void mach_exception_capture_installed_signal(int signal, const siginfo_t *info, const void *ucontext)
+{
+    if (__atomic_load_n(&mach_exception_capture_current, __ATOMIC_RELAXED) == NULL) {
+        return;
+    }
+    __atomic_add_fetch(&mach_exception_capture_writers, 1, __ATOMIC_SEQ_CST);
+    mach_exception_capture_t *capture = __atomic_load_n(&mach_exception_capture_current, __ATOMIC_SEQ_CST);
+    if (capture != NULL) {
+        int error = errno;
+        mach_exception_capture_signal(capture, signal, info, ucontext);
+        errno = error;
+    }
+    __atomic_sub_fetch(&mach_exception_capture_writers, 1, __ATOMIC_RELEASE);
+}
+#endif
+
+// MARK: - mach_exception_replay
+
+static kern_return_t mach_exception_replay_accept_raise(void *context,
+                                                        mach_port_name_t exception_port,
+                                                        mach_port_name_t thread,
+                                                        mach_port_name_t task,
+                                                        exception_type_t exception,
+                                                        mach_exception_data_t code,
+                                                        mach_msg_type_number_t codeCnt)
+{
+    (void) context;
+    (void) exception_port;
+    (void) thread;
+    (void) task;
+    (void) exception;
+    (void) code;
+    (void) codeCnt;
+    return KERN_SUCCESS;
+}
+
+static kern_return_t mach_exception_replay_accept_raise_state(void *context,
+                                                              mach_port_name_t exception_port,
+                                                              exception_type_t exception,
+                                                              mach_exception_data_t code,
+                                                              mach_msg_type_number_t codeCnt,
+                                                              int *flavor,
+                                                              natural_t *old_state,
+                                                              mach_msg_type_number_t old_stateCnt,
+                                                              natural_t *new_state,
+                                                              mach_msg_type_number_t *new_stateCnt)
+{
+    (void) context;
+    (void) exception_port;
+    (void) exception;
+    (void) code;
+    (void) codeCnt;
+    (void) flavor;
+    memcpy(new_state, old_state, old_stateCnt * sizeof(natural_t));
+    *new_stateCnt = old_stateCnt;
+    return KERN_SUCCESS;
+}
+
+static kern_return_t mach_exception_replay_accept_raise_state_identity(void *context,
+                                                                       mach_port_name_t exception_port,
+                                                                       mach_port_name_t thread,
+                                                                       mach_port_name_t task,
+                                                                       exception_type_t exception,
+                                                                       mach_exception_data_t code,
+                                                                       mach_msg_type_number_t codeCnt,
+                                                                       int *flavor,
+                                                                       natural_t *old_state,
+                                                                       mach_msg_type_number_t old_stateCnt,
+                                                                       natural_t *new_state,
+                                                                       mach_msg_type_number_t *new_stateCnt)
+{
+    (void) context;
+    (void) exception_port;
+    (void) thread;
+    (void) task;
+    (void) exception;
+    (void) code;
+    (void) codeCnt;
+    (void) flavor;
+    memcpy(new_state, old_state, old_stateCnt * sizeof(natural_t));
+    *new_stateCnt = old_stateCnt;
+    return KERN_SUCCESS;
+}
+
+const mach_exc_dispatch_handlers_t mach_exception_replay_accepting_handlers = {
+    .raise = mach_exception_replay_accept_raise,
+    .raise_state = mach_exception_replay_accept_raise_state,
+    .raise_state_identity = mach_exception_replay_accept_raise_state_identity,
+    .context = NULL,
+};
+
+bool mach_exception_replay_open(mach_exception_replay_t *replay, const char *file)
+{
+    int descriptor = open(file, O_RDONLY | O_CLOEXEC);
+    if (descriptor < 0) {
+        return false;
+    }
+
+    struct stat status;
+    if (fstat(descriptor, &status) != 0) {
+        int error = errno;
+        close(descriptor);
+        errno = error;
+        return false;
+    }
+    if (status.st_size < MACH_EXCEPTION_CAPTURE_HEADER_SIZE) {
+        close(descriptor);
+        errno = EINVAL;
+        return false;
+    }
+
+    size_t size = (size_t) status.st_size;
+    void *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    int error = errno;
+    close(descriptor);
+    if (mapping == MAP_FAILED) {
+        errno = error;
+        return false;
+    }
+    const mach_exception_capture_header_t *header = mapping;
+    if (header->magic != MACH_EXCEPTION_CAPTURE_MAGIC ||
+        header->version != MACH_EXCEPTION_CAPTURE_VERSION ||
+        header->header_size < MACH_EXCEPTION_CAPTURE_HEADER_SIZE ||
+        header->header_size > size) {
+        munmap(mapping, size);
+        errno = EINVAL;
+        return false;
+    }
+    replay->header = header;
+    replay->size = size;
+    return true;
+}
+
+void mach_exception_replay_close(mach_exception_replay_t *replay)
+{
+    if (replay->header != NULL) {
+        munmap((void *) replay->header, replay->size);
+        replay->header = NULL;
+        replay->size = 0;
+    }
+}
+
+const mach_exception_capture_event_t *mach_exception_replay_next(const mach_exception_replay_t *replay,
+                                                                 uint64_t *cursor)
+{
+    uint64_t offset = *cursor < replay->header->header_size ? replay->header->header_size : *cursor;
+    if (offset > replay->size || replay->size - offset < sizeof(mach_exception_capture_event_t)) {
+        return NULL;
+    }
+    const mach_exception_capture_event_t *event =
+        (const mach_exception_capture_event_t *)((const char *) replay->header + offset);
+    uint64_t size = sizeof(*event) + event->size + mach_exception_capture_padding(event->size);
+    if (replay->size - offset < size) {
+        return NULL;
+    }
+    *cursor = offset + size;
+    return event;
+}
+
+bool mach_exception_replay_decode_fault(const mach_exception_replay_t *replay,
+                                        const mach_exception_capture_event_t *event,
+                                        mach_exception_replay_fault_t *fault)
+{
+    memset(fault, 0, sizeof(*fault));
+    if (event->kind != MACH_EXCEPTION_CAPTURE_SIGNAL ||
+        event->size < sizeof(mach_exception_capture_signal_t) ||
+        replay->header->system != MACH_EXCEPTION_CAPTURE_HOST_SYSTEM ||
+        replay->header->arch != MACH_EXCEPTION_CAPTURE_HOST_ARCH) {
+        return false;
+    }
+#if defined(__linux__) && (defined(__x86_64__) || defined(__aarch64__))
+    const uint8_t *payload = (const uint8_t *)(event + 1);
+    mach_exception_capture_signal_t captured;
+    memcpy(&captured, payload, sizeof(captured));
+    size_t context_offset = sizeof(captured);
+    size_t fpstate_offset = context_offset + captured.context_size;
+    fpstate_offset += mach_exception_capture_padding(captured.context_size);
+    if (captured.context_size > sizeof(ucontext_t) ||
+        captured.fpstate_size > MACH_EXCEPTION_CAPTURE_FXSAVE_SIZE ||
+        fpstate_offset + captured.fpstate_size > event->size) {
+        return false;
+    }
+
+    // Rebuild the siginfo and context the handler was delivered, pointing the context at copies of what it pointed
+    // to in the faulting process.
+    siginfo_t info;
+    memset(&info, 0, sizeof(info));
+    info.si_signo = captured.signal;
+    info.si_code = captured.code;
+    info.si_addr = (void *)(uintptr_t) captured.address;
+
+    ucontext_t context;
+    memset(&context, 0, sizeof(context));
+    memcpy(&context, payload + context_offset, captured.context_size);
+#if defined(__x86_64__)
+    _Alignas(16) uint8_t fpstate[MACH_EXCEPTION_CAPTURE_FXSAVE_SIZE];
+    memset(fpstate, 0, sizeof(fpstate));
+    memcpy(fpstate, payload + fpstate_offset, captured.fpstate_size);
+    context.uc_mcontext.fpregs = captured.fpstate_size == 0 ? NULL : (struct _libc_fpstate *) fpstate;
+#elif defined(__aarch64__)
+    uint32_t instruction = captured.instruction;
+    uint64_t pc = (uint64_t) context.uc_mcontext.pc;
+    if (captured.signal == SIGILL || captured.signal == SIGFPE) {
+        context.uc_mcontext.pc = (uint64_t)(uintptr_t) &instruction;
+    }
+#endif
+    const void *ucontext = captured.context_size == 0 ? NULL : &context;
+
+    fault->signal = captured.signal;
+    if (!mach_signal_record_from_siginfo(captured.signal, &info, ucontext, &fault->record)) {
+        return false;
+    }
+    uint64_t fp;
+    mach_signal_state_from_ucontext(captured.signal, &info, ucontext, &fault->state, &fp);
+#if defined(__aarch64__)
+    if (ucontext != NULL) {
+        fault->state.pc = pc;
+    }
+#endif
+    return true;
+#else
+    return false;
+#endif
+}
+
+// Wait until the monotonic time `deadline`.
+static void mach_exception_replay_wait(uint64_t deadline)
+{
+    for (;;) {
+        uint64_t now = mach_exception_capture_now(CLOCK_MONOTONIC);
+        if (now >= deadline) {
+            return;
+        }
+        uint64_t remaining = deadline - now;
+        struct timespec interval = {
+            .tv_sec = (time_t)(remaining / 1000000000u),
+            .tv_nsec = (long)(remaining % 1000000000u),
+        };
+        nanosleep(&interval, NULL);
+    }
+}
+
+bool mach_exception_replay_run(const mach_exception_replay_t *replay,
+                               const mach_exception_replay_receivers_t *receivers,
+                               double speed,
+                               mach_exception_replay_statistics_t *statistics)
+{
+    memset(statistics, 0, sizeof(*statistics));
+    mach_exc_arena_t arena;
+    if (!mach_exc_arena_init(&arena, MACH_EXC_DISPATCH_REQUEST_MAX)) {
+        errno = ENOMEM;
+        return false;
+    }
+
+    // At the recorded pace, each event is delivered as long after the first as it arrived after it. Concurrent
+    // handlers may have appended their events slightly out of order, in which case the later one goes right away.
+    uint64_t start = mach_exception_capture_now(CLOCK_MONOTONIC);
+    const mach_exception_capture_event_t *event;
+    const mach_exception_capture_event_t *first = NULL;
+    uint64_t cursor = 0;
+    while ((event = mach_exception_replay_next(replay, &cursor)) != NULL) {
+        first = first == NULL ? event : first;
+        if (speed > 0 && event->timestamp > first->timestamp) {
+            mach_exception_replay_wait(start + (uint64_t)((double)(event->timestamp - first->timestamp) / speed));
+        }
+
+        if (event->kind == MACH_EXCEPTION_CAPTURE_MESSAGE && receivers->handlers != NULL) {
+            // The dispatch core needs the request 4-byte aligned, and may write to its thread state, so each
+            // request is dispatched from a copy, as the listener dispatches it from its arena.
+            if (!mach_exc_arena_reserve(&arena, event->size)) {
+                mach_exc_arena_destroy(&arena);
+                errno = ENOMEM;
+                return false;
+            }
+            memcpy(arena.request, event + 1, event->size);
+            statistics->messages++;
+            if (mach_exc_dispatch(receivers->handlers, arena.request, event->size, arena.reply)) {
+                statistics->handled++;
+            }
+        } else if (event->kind == MACH_EXCEPTION_CAPTURE_SIGNAL && receivers->fault != NULL) {
+            mach_exception_replay_fault_t fault;
+            if (mach_exception_replay_decode_fault(replay, event, &fault)) {
+                statistics->faults++;
+                receivers->fault(receivers->context, &fault);
+            } else {
+                statistics->skipped++;
+            }
+        } else {
+            statistics->skipped++;
+        }
+    }
+    statistics->elapsed = mach_exception_capture_now(CLOCK_MONOTONIC) - start;
+    mach_exc_arena_destroy(&arena);
+    return true;
+}
@@ -0,0 +1,258 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// mach-exception
+// mach_exception_decode.c
+// Created by Patrick Gili on 2/6/23.
+//
+
+#include "mach_exception_decode.h"
+
+// MARK: - Constants
+
+// The decoder defines the constants of every architecture it decodes, rather than taking them from the host's
+// headers, which only describe the host's own architecture.
+
+// See darwin-xnu/osfmk/mach/exception_types.h.
+#define DECODE_EXC_BAD_ACCESS           1
+#define DECODE_EXC_BAD_INSTRUCTION      2
+#define DECODE_EXC_ARITHMETIC           3
+#define DECODE_EXC_BREAKPOINT           6
+#define DECODE_EXC_RESOURCE             11
+#define DECODE_EXC_GUARD                12
+
+// See darwin-xnu/osfmk/mach/kern_return.h and darwin-xnu/osfmk/mach/vm_prot.h.
+#define DECODE_KERN_RETURN_MAX          0x100
+#define DECODE_VM_PROT_READ_EXECUTE     0x05
+
+// See darwin-xnu/osfmk/mach/i386/exception.h.
+#define DECODE_EXC_I386_INVOP           1
+#define DECODE_EXC_I386_DIV             1
+#define DECODE_EXC_I386_INTO            2
+#define DECODE_EXC_I386_NOEXT           3
+#define DECODE_EXC_I386_EXTERR          5
+#define DECODE_EXC_I386_BOUND           7
+#define DECODE_EXC_I386_SSEEXTERR       8
+#define DECODE_EXC_I386_SGL             1
+#define DECODE_EXC_I386_BPT             2
+#define DECODE_EXC_I386_INVTSSFLT       10
+#define DECODE_EXC_I386_SEGNPFLT        11
+#define DECODE_EXC_I386_STKFLT          12
+#define DECODE_EXC_I386_GPFLT           13
+
+// See darwin-xnu/osfmk/mach/arm/exception.h.
+#define DECODE_EXC_ARM_UNDEFINED        1
+#define DECODE_EXC_ARM_FP_UNDEFINED     0
+#define DECODE_EXC_ARM_FP_IO            1
+#define DECODE_EXC_ARM_FP_DZ            2
+#define DECODE_EXC_ARM_FP_OF            3
+#define DECODE_EXC_ARM_FP_UF            4
+#define DECODE_EXC_ARM_FP_IX            5
+#define DECODE_EXC_ARM_FP_ID            6
+#define DECODE_EXC_ARM_DA_ALIGN         0x101
+#define DECODE_EXC_ARM_DA_DEBUG         0x102
+#define DECODE_EXC_ARM_SP_ALIGN         0x103
+#define DECODE_EXC_ARM_SWP              0x104
+#define DECODE_EXC_ARM_PAC_FAIL         0x105
+#define DECODE_EXC_ARM_BREAKPOINT       1
+
+// See darwin-xnu/osfmk/kern/exc_resource.h. The type and flavor occupy the code's top six bits for both resource
+// and guard exceptions; the remaining fields of a resource code lie in its low 32 bits.
+#define DECODE_RESOURCE_TYPE_CPU        1
+#define DECODE_RESOURCE_TYPE_WAKEUPS    2
+#define DECODE_RESOURCE_TYPE_MEMORY     3
+#define DECODE_RESOURCE_TYPE_IO         4
+#define DECODE_RESOURCE_TYPE_THREADS    5
+
+// See darwin-xnu/osfmk/kern/exc_guard.h.
+#define DECODE_GUARD_TYPE_MAX           5
+
+// MARK: - Per-architecture codes
+
+// All ones if condition holds, or zero otherwise.
+static inline uint32_t mach_exception_decode_mask(int condition)
+{
+    return 0u - (uint32_t) condition;
+}
+
+// The exception types whose codes depend on the reporting host's architecture, each of which has a row in the
+// tables below. Every other type maps to the first row, whose causes are all unknown.
+#define DECODE_ROW_OTHER                0
+#define DECODE_ROW_BAD_ACCESS           1
+#define DECODE_ROW_BAD_INSTRUCTION      2
+#define DECODE_ROW_ARITHMETIC           3
+#define DECODE_ROW_BREAKPOINT           4
+#define DECODE_ROWS                     5
+
+static const uint8_t mach_exception_decode_rows[16] = {
+    [DECODE_EXC_BAD_ACCESS] = DECODE_ROW_BAD_ACCESS,
+    [DECODE_EXC_BAD_INSTRUCTION] = DECODE_ROW_BAD_INSTRUCTION,
+    [DECODE_EXC_ARITHMETIC] = DECODE_ROW_ARITHMETIC,
+    [DECODE_EXC_BREAKPOINT] = DECODE_ROW_BREAKPOINT,
+};
+
+// The codes with a cause of their own lie in [0, 15] or [0x101, 0x105], which map onto the columns below; every
+// other code maps to the last column, whose causes are all unknown.
+#define DECODE_COLUMN_ARM_BASE          16
+#define DECODE_COLUMN_OTHER             21
+#define DECODE_COLUMNS                  22
+#define DECODE_ARM(code)                ((code) - DECODE_EXC_ARM_DA_ALIGN + DECODE_COLUMN_ARM_BASE)
+
+static const mach_exception_cause_t mach_exception_decode_causes[2][DECODE_ROWS][DECODE_COLUMNS] = {
+    [MACH_EXCEPTION_ARCH_X86_64] = {
+        [DECODE_ROW_BAD_ACCESS] = {
+            [DECODE_VM_PROT_READ_EXECUTE] = MACH_EXCEPTION_CAUSE_FPU_SEGMENT_FAULT,
+            [DECODE_EXC_I386_GPFLT] = MACH_EXCEPTION_CAUSE_GENERAL_PROTECTION_FAULT,
+        },
+        [DECODE_ROW_BAD_INSTRUCTION] = {
+            [DECODE_EXC_I386_INVTSSFLT] = MACH_EXCEPTION_CAUSE_INVALID_TSS,
+            [DECODE_EXC_I386_SEGNPFLT] = MACH_EXCEPTION_CAUSE_SEGMENT_NOT_PRESENT,
+            [DECODE_EXC_I386_STKFLT] = MACH_EXCEPTION_CAUSE_STACK_FAULT,
+            [DECODE_EXC_I386_INVOP] = MACH_EXCEPTION_CAUSE_INVALID_OPCODE,
+        },
+        [DECODE_ROW_ARITHMETIC] = {
+            [DECODE_EXC_I386_DIV] = MACH_EXCEPTION_CAUSE_DIVIDE_ERROR,
+            [DECODE_EXC_I386_INTO] = MACH_EXCEPTION_CAUSE_INTEGER_OVERFLOW,
+            [DECODE_EXC_I386_NOEXT] = MACH_EXCEPTION_CAUSE_NO_FPU,
+            [DECODE_EXC_I386_EXTERR] = MACH_EXCEPTION_CAUSE_FLOATING_POINT_ERROR,
+            [DECODE_EXC_I386_SSEEXTERR] = MACH_EXCEPTION_CAUSE_SIMD_OPERATION_ERROR,
+        },
+        [DECODE_ROW_BREAKPOINT] = {
+            [DECODE_EXC_I386_BOUND] = MACH_EXCEPTION_CAUSE_OUT_OF_BOUNDS,
+            [DECODE_EXC_I386_SGL] = MACH_EXCEPTION_CAUSE_DEBUG,
+            [DECODE_EXC_I386_BPT] = MACH_EXCEPTION_CAUSE_BREAKPOINT,
+        },
+    },
+    [MACH_EXCEPTION_ARCH_ARM64] = {
+        [DECODE_ROW_BAD_ACCESS] = {
+            [DECODE_ARM(DECODE_EXC_ARM_DA_ALIGN)] = MACH_EXCEPTION_CAUSE_DATA_ACCESS_ALIGNMENT,
+            [DECODE_ARM(DECODE_EXC_ARM_DA_DEBUG)] = MACH_EXCEPTION_CAUSE_DATA_ACCESS_DEBUG,
+            [DECODE_ARM(DECODE_EXC_ARM_SP_ALIGN)] = MACH_EXCEPTION_CAUSE_STACK_POINTER_ALIGNMENT,
+            [DECODE_ARM(DECODE_EXC_ARM_SWP)] = MACH_EXCEPTION_CAUSE_SWP_INSTRUCTION,
+            [DECODE_ARM(DECODE_EXC_ARM_PAC_FAIL)] = MACH_EXCEPTION_CAUSE_POINTER_AUTHENTICATION_FAILURE,
+        },
+        [DECODE_ROW_BAD_INSTRUCTION] = {
+            [DECODE_EXC_ARM_UNDEFINED] = MACH_EXCEPTION_CAUSE_UNDEFINED_INSTRUCTION,
+        },
+        [DECODE_ROW_ARITHMETIC] = {
+            [DECODE_EXC_ARM_FP_UF] = MACH_EXCEPTION_CAUSE_FP_UNDERFLOW,
+            [DECODE_EXC_ARM_FP_OF] = MACH_EXCEPTION_CAUSE_FP_OVERFLOW,
+            [DECODE_EXC_ARM_FP_IO] = MACH_EXCEPTION_CAUSE_FP_INVALID_OPERATION,
+            [DECODE_EXC_ARM_FP_DZ] = MACH_EXCEPTION_CAUSE_FP_DIVIDE_BY_ZERO,
+            [DECODE_EXC_ARM_FP_ID] = MACH_EXCEPTION_CAUSE_FP_DENORMAL_INPUT,
+            [DECODE_EXC_ARM_FP_IX] = MACH_EXCEPTION_CAUSE_FP_INEXACT_RESULT,
+            [DECODE_EXC_ARM_FP_UNDEFINED] = MACH_EXCEPTION_CAUSE_FP_UNDEFINED,
+        },
+        [DECODE_ROW_BREAKPOINT] = {
+            [DECODE_EXC_ARM_BREAKPOINT] = MACH_EXCEPTION_CAUSE_BREAKPOINT,
+            [DECODE_ARM(DECODE_EXC_ARM_DA_DEBUG)] = MACH_EXCEPTION_CAUSE_WATCHPOINT,
+        },
+    },
+};
+
+// The cause of a code in [0, KERN_RETURN_MAX] without a cause of its own, which the kernel reports as the result of
+// the failed VM operation.
+static const mach_exception_cause_t mach_exception_decode_kern_causes[2][DECODE_ROWS] = {
+    [MACH_EXCEPTION_ARCH_X86_64] = {
+        [DECODE_ROW_BAD_ACCESS] = MACH_EXCEPTION_CAUSE_VM_FAULT,
+        [DECODE_ROW_BAD_INSTRUCTION] = MACH_EXCEPTION_CAUSE_PAGE_FAULT,
+    },
+    [MACH_EXCEPTION_ARCH_ARM64] = {
+        [DECODE_ROW_BAD_ACCESS] = MACH_EXCEPTION_CAUSE_VM_FAULT,
+    },
+};
+
+// MARK: - mach_exception_decode
+
+// The number of records decoded by each pass before moving on to the next block.
+#define DECODE_BLOCK                    1024
+
+size_t mach_exception_decode(mach_exception_arch_t arch,
+                             const int32_t * restrict type,
+                             const int64_t * restrict code,
+                             const int64_t * restrict subcode,
+                             size_t count,
+                             const mach_exception_batch_t *batch)
+{
+    mach_exception_cause_t * restrict cause = batch->cause;
+    uint32_t * restrict flavor = batch->flavor;
+    uint32_t * restrict primary = batch->primary;
+    uint32_t * restrict secondary = batch->secondary;
+    uint64_t * restrict detail = batch->detail;
+
+    const mach_exception_cause_t (*causes)[DECODE_COLUMNS] = mach_exception_decode_causes[arch & 1];
+    const mach_exception_cause_t *kern_causes = mach_exception_decode_kern_causes[arch & 1];
+    uint32_t arm64 = mach_exception_decode_mask(arch == MACH_EXCEPTION_ARCH_ARM64);
+    size_t known = 0;
+
+    // Decode the batch in blocks, so the second pass finds the first pass's results in the cache.
+    for (size_t start = 0; start < count; start += DECODE_BLOCK) {
+        size_t end = count - start > DECODE_BLOCK ? start + DECODE_BLOCK : count;
+
+        // Pass 1: decode every record as if it were a resource or guard exception, combining the candidate fields
+        // with masks rather than branching on the record's type and kind, so the loop vectorizes. Every other record
+        // keeps only its subcode.
+        for (size_t index = start; index < end; index++) {
+            uint32_t high = (uint32_t)((uint64_t) code[index] >> 32);
+            uint32_t low = (uint32_t) code[index];
+            uint32_t observable = (uint32_t) subcode[index];
+            uint32_t kind = high >> 29;
+            uint32_t cpu = mach_exception_decode_mask(kind == DECODE_RESOURCE_TYPE_CPU);
+            uint32_t wakeups = mach_exception_decode_mask(kind == DECODE_RESOURCE_TYPE_WAKEUPS);
+            uint32_t memory = mach_exception_decode_mask(kind == DECODE_RESOURCE_TYPE_MEMORY);
+            uint32_t io = mach_exception_decode_mask(kind == DECODE_RESOURCE_TYPE_IO);
+            uint32_t threads = mach_exception_decode_mask(kind == DECODE_RESOURCE_TYPE_THREADS);
+            uint32_t resource = mach_exception_decode_mask(type[index] == DECODE_EXC_RESOURCE) &
+                                (cpu | wakeups | memory | io | threads);
+            uint32_t guard = mach_exception_decode_mask(type[index] == DECODE_EXC_GUARD &&
+                                                        kind <= DECODE_GUARD_TYPE_MAX);
+
+            uint32_t interval = (cpu & ((low >> 7) & 0x1ffffff)) |
+                                (wakeups & ((low >> 20) & 0xfff)) |
+                                (memory & (low & 0x1fff)) |
+                                (io & ((low >> 15) & 0x1ffff)) |
+                                (threads & (low & 0x7fffffff));
+            uint32_t limit = (cpu & (low & 0x7f)) | (wakeups & (low & 0xfffff)) | (io & (low & 0x7fff));
+            uint32_t observed = ((cpu | wakeups) & (observable & 0x7f)) | (io & (observable & 0x7fff));
+            uint64_t keep_subcode = ~((uint64_t) 0 - (resource & 1));
+
+            cause[index] = (mach_exception_cause_t)((resource & (MACH_EXCEPTION_CAUSE_RESOURCE_CPU - 1 + kind)) |
+                                                    (guard & (MACH_EXCEPTION_CAUSE_GUARD_NONE + kind)));
+            flavor[index] = (resource & ((high >> 26) & 0x7)) | (guard & (high & 0x1fffffff));
+            primary[index] = (resource & interval) | (guard & low);
+            secondary[index] = resource & limit;
+            detail[index] = (keep_subcode & (uint64_t) subcode[index]) | (~keep_subcode & observed);
+        }
+
+        // Pass 2: classify the records whose codes depend on the reporting host's architecture, by table lookup
+        // rather than by branching on the type and code, since a batch usually mixes exception types.
+        for (size_t index = start; index < end; index++) {
+            uint32_t row = mach_exception_decode_rows[(uint32_t) type[index] & 15] &
+                           mach_exception_decode_mask((uint32_t) type[index] < 16);
+            uint64_t value = (uint64_t) code[index];
+            uint32_t low_code = mach_exception_decode_mask(value < 16);
+            uint32_t arm_code = mach_exception_decode_mask(value - DECODE_EXC_ARM_DA_ALIGN <=
+                                                           DECODE_EXC_ARM_PAC_FAIL - DECODE_EXC_ARM_DA_ALIGN);
+            uint32_t column = (low_code & (uint32_t) value) |
+                              (arm_code & DECODE_ARM((uint32_t) value)) |
+                              (~(low_code | arm_code) & DECODE_COLUMN_OTHER);
+
+            uint32_t cause_of_code = causes[row][column];
+            cause_of_code |= mach_exception_decode_mask(cause_of_code == MACH_EXCEPTION_CAUSE_UNKNOWN &&
+                                                        value <= DECODE_KERN_RETURN_MAX) & kern_causes[row];
+            // An arm64 breakpoint exception without an address is a single step.
+            uint32_t single_step = mach_exception_decode_mask(cause_of_code == MACH_EXCEPTION_CAUSE_BREAKPOINT &&
+                                                              subcode[index] == 0) & arm64;
+            cause_of_code ^= single_step & (MACH_EXCEPTION_CAUSE_BREAKPOINT ^ MACH_EXCEPTION_CAUSE_SINGLE_STEP);
+
+            uint32_t classified = mach_exception_decode_mask(row != DECODE_ROW_OTHER);
+            uint32_t fault = mach_exception_decode_mask(cause_of_code == MACH_EXCEPTION_CAUSE_VM_FAULT ||
+                                                        cause_of_code == MACH_EXCEPTION_CAUSE_PAGE_FAULT);
+            cause[index] = (mach_exception_cause_t)((classified & cause_of_code) | (~classified & cause[index]));
+            primary[index] = (fault & (uint32_t) value) | (~fault & primary[index]);
+            known += cause[index] != MACH_EXCEPTION_CAUSE_UNKNOWN;
+        }
+    }
+    return known;
+}
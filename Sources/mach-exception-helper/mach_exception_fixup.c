@@ -0,0 +1,531 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// mach-exception
+// mach_exception_fixup.c
+// Created by Patrick Gili on 3/2/23.
+//
+
+#include <errno.h>
+#include <string.h>
+#if defined(__x86_64__)
+#include <cpuid.h>
+#endif
+#include "mach_exception_fixup.h"
+
+// The probes are written in assembly, so that their faulting instructions lie at addresses the fixup table can list.
+// They are leaf routines that use no stack, so their fixups only set the result and return. The bounds of
+// the ranges are assembler-local labels, which don't split the probes into pieces the linker may reorder, so the
+// assembler emits the table itself, like a kernel's exception table.
+
+#define MACH_EXCEPTION_FIXUP_STRING(value) #value
+#define MACH_EXCEPTION_FIXUP_VALUE(value) MACH_EXCEPTION_FIXUP_STRING(value)
+
+#if defined(__APPLE__)
+#define MACH_EXCEPTION_FIXUP_TEXT ".text\n"
+#define MACH_EXCEPTION_FIXUP_FUNCTION(name)                                                                           \
+    ".globl _" #name "\n"                                                                                              \
+    ".p2align 4\n"                                                                                                     \
+    "_" #name ":\n"
+#define MACH_EXCEPTION_FIXUP_END(name)
+#define MACH_EXCEPTION_FIXUP_LOCAL(name) "Lmach_exception_fixup_" #name
+#define MACH_EXCEPTION_FIXUP_SYMBOL(name) "_" #name
+#define MACH_EXCEPTION_FIXUP_TABLE                                                                                    \
+    ".section __DATA,__const\n"                                                                                        \
+    ".p2align 3\n"                                                                                                     \
+    ".private_extern _mach_exception_fixups\n"                                                                         \
+    ".globl _mach_exception_fixups\n"                                                                                  \
+    "_mach_exception_fixups:\n"
+#define MACH_EXCEPTION_FIXUP_TABLE_END
+#else
+#define MACH_EXCEPTION_FIXUP_TEXT ".pushsection .text\n"
+#define MACH_EXCEPTION_FIXUP_FUNCTION(name)                                                                           \
+    ".globl " #name "\n"                                                                                               \
+    ".type " #name ", %function\n"                                                                                     \
+    ".p2align 4\n"                                                                                                     \
+    #name ":\n"
+#define MACH_EXCEPTION_FIXUP_END(name)                                                                                \
+    ".size " #name ", . - " #name "\n"
+#define MACH_EXCEPTION_FIXUP_LOCAL(name) ".Lmach_exception_fixup_" #name
+#define MACH_EXCEPTION_FIXUP_SYMBOL(name) #name
+#define MACH_EXCEPTION_FIXUP_TABLE                                                                                    \
+    ".popsection\n"                                                                                                    \
+    ".pushsection .data.rel.ro,\"aw\"\n"                                                                               \
+    ".p2align 3\n"                                                                                                     \
+    ".hidden mach_exception_fixups\n"                                                                                  \
+    ".globl mach_exception_fixups\n"                                                                                   \
+    "mach_exception_fixups:\n"
+#define MACH_EXCEPTION_FIXUP_TABLE_END ".popsection\n"
+#endif
+
+#define MACH_EXCEPTION_FIXUP_LABEL(name) MACH_EXCEPTION_FIXUP_LOCAL(name) ":\n"
+
+// The entry of the range from the label `name_begin` up to `name_end`, whose faults resume at the label `fixup`.
+#define MACH_EXCEPTION_FIXUP_RANGE(name, fixup)                                                                       \
+    "    .quad " MACH_EXCEPTION_FIXUP_LOCAL(name##_begin) ", " MACH_EXCEPTION_FIXUP_LOCAL(name##_end) ", "             \
+    MACH_EXCEPTION_FIXUP_LOCAL(fixup) "\n"
+
+// The table lists the ranges in the order the probes are assembled, which is address order. On x86_64, the AVX and
+// AVX-512 part of the copy is a range of its own, whose fixup clears the upper halves of the vector registers first.
+#if defined(__x86_64__)
+#define MACH_EXCEPTION_FIXUP_VECTOR_RANGES MACH_EXCEPTION_FIXUP_RANGE(memcpy_vector, efault_vector)
+#define MACH_EXCEPTION_FIXUP_COUNT 7
+#else
+#define MACH_EXCEPTION_FIXUP_VECTOR_RANGES
+#define MACH_EXCEPTION_FIXUP_COUNT 6
+#endif
+
+#define MACH_EXCEPTION_FIXUP_ENTRIES                                                                                  \
+    MACH_EXCEPTION_FIXUP_TABLE                                                                                        \
+    MACH_EXCEPTION_FIXUP_RANGE(load8, efault)                                                                         \
+    MACH_EXCEPTION_FIXUP_RANGE(load16, efault)                                                                        \
+    MACH_EXCEPTION_FIXUP_RANGE(load32, efault)                                                                        \
+    MACH_EXCEPTION_FIXUP_RANGE(load64, efault)                                                                        \
+    MACH_EXCEPTION_FIXUP_RANGE(memcpy, efault)                                                                        \
+    MACH_EXCEPTION_FIXUP_VECTOR_RANGES                                                                                \
+    MACH_EXCEPTION_FIXUP_RANGE(memcmp, efault)                                                                        \
+    MACH_EXCEPTION_FIXUP_TABLE_END
+
+extern const mach_exception_fixup_t mach_exception_fixups[MACH_EXCEPTION_FIXUP_COUNT];
+
+#if defined(__x86_64__)
+
+// The widest vector registers the copy uses: 0 for the SSE2 registers, 1 for the AVX registers, or 2 for the
+// AVX-512 registers. The copy tests it on each call; it is set before main runs, so it never changes under a probe.
+__attribute__((visibility("hidden"))) uint8_t mach_exception_fixup_vector = 0;
+
+__attribute__((constructor)) static void mach_exception_fixup_detect(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_OSXSAVE) || !(ecx & bit_AVX)) {
+        return;
+    }
+    // The operating system saves a register file's state only if XCR0 enables it. Darwin enables the AVX-512 state
+    // on a thread's first use of it, so there the copy stays with the AVX registers.
+    uint32_t low, high;
+    __asm__("xgetbv" : "=a"(low), "=d"(high) : "c"(0));
+    if ((low & 0x6) != 0x6) {
+        return;
+    }
+    mach_exception_fixup_vector = 1;
+    if ((low & 0xe6) == 0xe6 && __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & bit_AVX512F)) {
+        mach_exception_fixup_vector = 2;
+    }
+}
+
+__asm__(
+    MACH_EXCEPTION_FIXUP_TEXT
+    MACH_EXCEPTION_FIXUP_FUNCTION(mach_exception_safe_load8)
+    MACH_EXCEPTION_FIXUP_LABEL(load8_begin)
+    "    movb (%rdi), %al\n"
+    MACH_EXCEPTION_FIXUP_LABEL(load8_end)
+    "    movb %al, (%rsi)\n"
+    "    xorl %eax, %eax\n"
+    "    ret\n"
+    MACH_EXCEPTION_FIXUP_END(mach_exception_safe_load8)
+
+    MACH_EXCEPTION_FIXUP_FUNCTION(mach_exception_safe_load16)
+    MACH_EXCEPTION_FIXUP_LABEL(load16_begin)
+    "    movw (%rdi), %ax\n"
+    MACH_EXCEPTION_FIXUP_LABEL(load16_end)
+    "    movw %ax, (%rsi)\n"
+    "    xorl %eax, %eax\n"
+    "    ret\n"
+    MACH_EXCEPTION_FIXUP_END(mach_exception_safe_load16)
+
+    MACH_EXCEPTION_FIXUP_FUNCTION(mach_exception_safe_load32)
+    MACH_EXCEPTION_FIXUP_LABEL(load32_begin)
+    "    movl (%rdi), %eax\n"
+    MACH_EXCEPTION_FIXUP_LABEL(load32_end)
+    "    movl %eax, (%rsi)\n"
+    "    xorl %eax, %eax\n"
+    "    ret\n"
+    MACH_EXCEPTION_FIXUP_END(mach_exception_safe_load32)
+
+    MACH_EXCEPTION_FIXUP_FUNCTION(mach_exception_safe_load64)
+    MACH_EXCEPTION_FIXUP_LABEL(load64_begin)
+    "    movq (%rdi), %rax\n"
+    MACH_EXCEPTION_FIXUP_LABEL(load64_end)
+    "    movq %rax, (%rsi)\n"
+    "    xorl %eax, %eax\n"
+    "    ret\n"
+    MACH_EXCEPTION_FIXUP_END(mach_exception_safe_load64)
+
+    // Copy as libc's memcpy does, with the widest vector registers the processor has. Up to 32 bytes take two
+    // overlapping moves of the widest size that fits; larger copies take two or four overlapping vector moves, or
+    // blocks of four vectors followed by the overlapping last four. From 4 KB (2 KB with only SSE2), the string
+    // instruction is faster still on processors with ERMS. Each path stores in address order, so a fault leaves a
+    // prefix of the bytes copied. The AVX-512 path uses only registers 16 to 19, whose upper halves need no clearing.
+    MACH_EXCEPTION_FIXUP_FUNCTION(mach_exception_safe_memcpy)
+    MACH_EXCEPTION_FIXUP_LABEL(memcpy_begin)
+    "    cmpq $16, %rdx\n"
+    "    jb 5f\n"
+    "    cmpq $32, %rdx\n"
+    "    ja 1f\n"
+    "    movdqu (%rsi), %xmm0\n"
+    "    movdqu -16(%rsi,%rdx), %xmm1\n"
+    "    movdqu %xmm0, (%rdi)\n"
+    "    movdqu %xmm1, -16(%rdi,%rdx)\n"
+    "    jmp 9f\n"
+    "1:  cmpq $4096, %rdx\n"
+    "    jae 8f\n"
+    "    movzbl " MACH_EXCEPTION_FIXUP_SYMBOL(mach_exception_fixup_vector) "(%rip), %eax\n"
+    "    testl %eax, %eax\n"
+    "    jne 10f\n"
+    "    cmpq $64, %rdx\n"
+    "    ja 2f\n"
+    "    movdqu (%rsi), %xmm0\n"
+    "    movdqu 16(%rsi), %xmm1\n"
+    "    movdqu -32(%rsi,%rdx), %xmm2\n"
+    "    movdqu -16(%rsi,%rdx), %xmm3\n"
+    "    movdqu %xmm0, (%rdi)\n"
+    "    movdqu %xmm1, 16(%rdi)\n"
+    "    movdqu %xmm2, -32(%rdi,%rdx)\n"
+    "    movdqu %xmm3, -16(%rdi,%rdx)\n"
+    "    jmp 9f\n"
+    "2:  cmpq $2048, %rdx\n"
+    "    jae 8f\n"
+    "    leaq -64(%rsi,%rdx), %r8\n"
+    "    leaq -64(%rdi,%rdx), %r9\n"
+    "3:  movdqu (%rsi), %xmm0\n"
+    "    movdqu 16(%rsi), %xmm1\n"
+    "    movdqu 32(%rsi), %xmm2\n"
+    "    movdqu 48(%rsi), %xmm3\n"
+    "    movdqu %xmm0, (%rdi)\n"
+    "    movdqu %xmm1, 16(%rdi)\n"
+    "    movdqu %xmm2, 32(%rdi)\n"
+    "    movdqu %xmm3, 48(%rdi)\n"
+    "    addq $64, %rsi\n"
+    "    addq $64, %rdi\n"
+    "    cmpq %r8, %rsi\n"
+    "    jb 3b\n"
+    "    movdqu (%r8), %xmm0\n"
+    "    movdqu 16(%r8), %xmm1\n"
+    "    movdqu 32(%r8), %xmm2\n"
+    "    movdqu 48(%r8), %xmm3\n"
+    "    movdqu %xmm0, (%r9)\n"
+    "    movdqu %xmm1, 16(%r9)\n"
+    "    movdqu %xmm2, 32(%r9)\n"
+    "    movdqu %xmm3, 48(%r9)\n"
+    "    jmp 9f\n"
+    "5:  cmpq $8, %rdx\n"
+    "    jb 6f\n"
+    "    movq (%rsi), %rax\n"
+    "    movq -8(%rsi,%rdx), %rcx\n"
+    "    movq %rax, (%rdi)\n"
+    "    movq %rcx, -8(%rdi,%rdx)\n"
+    "    jmp 9f\n"
+    "6:  cmpq $4, %rdx\n"
+    "    jb 7f\n"
+    "    movl (%rsi), %eax\n"
+    "    movl -4(%rsi,%rdx), %ecx\n"
+    "    movl %eax, (%rdi)\n"
+    "    movl %ecx, -4(%rdi,%rdx)\n"
+    "    jmp 9f\n"
+    "7:  cmpq $2, %rdx\n"
+    "    jb 4f\n"
+    "    movzwl (%rsi), %eax\n"
+    "    movzwl -2(%rsi,%rdx), %ecx\n"
+    "    movw %ax, (%rdi)\n"
+    "    movw %cx, -2(%rdi,%rdx)\n"
+    "    jmp 9f\n"
+    "4:  testq %rdx, %rdx\n"
+    "    je 9f\n"
+    "    movb (%rsi), %al\n"
+    "    movb %al, (%rdi)\n"
+    "    jmp 9f\n"
+    "8:  movq %rdx, %rcx\n"
+    "    rep movsb\n"
+    "    jmp 9f\n"
+    MACH_EXCEPTION_FIXUP_LABEL(memcpy_end)
+    MACH_EXCEPTION_FIXUP_LABEL(memcpy_vector_begin)
+    "10: cmpq $64, %rdx\n"
+    "    ja 11f\n"
+    "    vmovdqu (%rsi), %ymm0\n"
+    "    vmovdqu -32(%rsi,%rdx), %ymm1\n"
+    "    vmovdqu %ymm0, (%rdi)\n"
+    "    vmovdqu %ymm1, -32(%rdi,%rdx)\n"
+    "    jmp 13f\n"
+    "11: cmpq $128, %rdx\n"
+    "    ja 12f\n"
+    "    vmovdqu (%rsi), %ymm0\n"
+    "    vmovdqu 32(%rsi), %ymm1\n"
+    "    vmovdqu -64(%rsi,%rdx), %ymm2\n"
+    "    vmovdqu -32(%rsi,%rdx), %ymm3\n"
+    "    vmovdqu %ymm0, (%rdi)\n"
+    "    vmovdqu %ymm1, 32(%rdi)\n"
+    "    vmovdqu %ymm2, -64(%rdi,%rdx)\n"
+    "    vmovdqu %ymm3, -32(%rdi,%rdx)\n"
+    "    jmp 13f\n"
+    "12: cmpl $2, %eax\n"
+    "    je 15f\n"
+    "    leaq -128(%rsi,%rdx), %r8\n"
+    "    leaq -128(%rdi,%rdx), %r9\n"
+    "14: vmovdqu (%rsi), %ymm0\n"
+    "    vmovdqu 32(%rsi), %ymm1\n"
+    "    vmovdqu 64(%rsi), %ymm2\n"
+    "    vmovdqu 96(%rsi), %ymm3\n"
+    "    vmovdqu %ymm0, (%rdi)\n"
+    "    vmovdqu %ymm1, 32(%rdi)\n"
+    "    vmovdqu %ymm2, 64(%rdi)\n"
+    "    vmovdqu %ymm3, 96(%rdi)\n"
+    "    subq $-128, %rsi\n"
+    "    subq $-128, %rdi\n"
+    "    cmpq %r8, %rsi\n"
+    "    jb 14b\n"
+    "    vmovdqu (%r8), %ymm0\n"
+    "    vmovdqu 32(%r8), %ymm1\n"
+    "    vmovdqu 64(%r8), %ymm2\n"
+    "    vmovdqu 96(%r8), %ymm3\n"
+    "    vmovdqu %ymm0, (%r9)\n"
+    "    vmovdqu %ymm1, 32(%r9)\n"
+    "    vmovdqu %ymm2, 64(%r9)\n"
+    "    vmovdqu %ymm3, 96(%r9)\n"
+    "    jmp 13f\n"
+    "15: cmpq $256, %rdx\n"
+    "    ja 16f\n"
+    "    vmovdqu64 (%rsi), %zmm16\n"
+    "    vmovdqu64 64(%rsi), %zmm17\n"
+    "    vmovdqu64 -128(%rsi,%rdx), %zmm18\n"
+    "    vmovdqu64 -64(%rsi,%rdx), %zmm19\n"
+    "    vmovdqu64 %zmm16, (%rdi)\n"
+    "    vmovdqu64 %zmm17, 64(%rdi)\n"
+    "    vmovdqu64 %zmm18, -128(%rdi,%rdx)\n"
+    "    vmovdqu64 %zmm19, -64(%rdi,%rdx)\n"
+    "    jmp 9f\n"
+    "16: leaq -256(%rsi,%rdx), %r8\n"
+    "    leaq -256(%rdi,%rdx), %r9\n"
+    "17: vmovdqu64 (%rsi), %zmm16\n"
+    "    vmovdqu64 64(%rsi), %zmm17\n"
+    "    vmovdqu64 128(%rsi), %zmm18\n"
+    "    vmovdqu64 192(%rsi), %zmm19\n"
+    "    vmovdqu64 %zmm16, (%rdi)\n"
+    "    vmovdqu64 %zmm17, 64(%rdi)\n"
+    "    vmovdqu64 %zmm18, 128(%rdi)\n"
+    "    vmovdqu64 %zmm19, 192(%rdi)\n"
+    "    addq $256, %rsi\n"
+    "    addq $256, %rdi\n"
+    "    cmpq %r8, %rsi\n"
+    "    jb 17b\n"
+    "    vmovdqu64 (%r8), %zmm16\n"
+    "    vmovdqu64 64(%r8), %zmm17\n"
+    "    vmovdqu64 128(%r8), %zmm18\n"
+    "    vmovdqu64 192(%r8), %zmm19\n"
+    "    vmovdqu64 %zmm16, (%r9)\n"
+    "    vmovdqu64 %zmm17, 64(%r9)\n"
+    "    vmovdqu64 %zmm18, 128(%r9)\n"
+    "    vmovdqu64 %zmm19, 192(%r9)\n"
+    "    jmp 9f\n"
+    MACH_EXCEPTION_FIXUP_LABEL(memcpy_vector_end)
+    "13: vzeroupper\n"
+    "9:  xorl %eax, %eax\n"
+    "    ret\n"
+    MACH_EXCEPTION_FIXUP_END(mach_exception_safe_memcpy)
+
+    // Compare 16-byte blocks with SSE2, then the rest a byte at a time. The result is that of the first differing
+    // bytes, compared unsigned.
+    MACH_EXCEPTION_FIXUP_FUNCTION(mach_exception_safe_memcmp)
+    "    xorl %r8d, %r8d\n"
+    MACH_EXCEPTION_FIXUP_LABEL(memcmp_begin)
+    "    jmp 2f\n"
+    "1:  movdqu (%rdi), %xmm0\n"
+    "    movdqu (%rsi), %xmm1\n"
+    "    pcmpeqb %xmm1, %xmm0\n"
+    "    pmovmskb %xmm0, %eax\n"
+    "    xorl $0xffff, %eax\n"
+    "    jnz 5f\n"
+    "    addq $16, %rdi\n"
+    "    addq $16, %rsi\n"
+    "    subq $16, %rdx\n"
+    "2:  cmpq $16, %rdx\n"
+    "    jae 1b\n"
+    "    jmp 4f\n"
+    "3:  movzbl (%rdi), %eax\n"
+    "    movzbl (%rsi), %r9d\n"
+    "    cmpl %r9d, %eax\n"
+    "    jne 6f\n"
+    "    incq %rdi\n"
+    "    incq %rsi\n"
+    "    decq %rdx\n"
+    "4:  testq %rdx, %rdx\n"
+    "    jnz 3b\n"
+    "    jmp 7f\n"
+    "5:  bsfl %eax, %edx\n"
+    "    movzbl (%rdi,%rdx), %eax\n"
+    "    movzbl (%rsi,%rdx), %r9d\n"
+    "    cmpl %r9d, %eax\n"
+    MACH_EXCEPTION_FIXUP_LABEL(memcmp_end)
+    "6:  movl $1, %r8d\n"
+    "    movl $-1, %eax\n"
+    "    cmovbl %eax, %r8d\n"
+    "7:  movl %r8d, (%rcx)\n"
+    "    xorl %eax, %eax\n"
+    "    ret\n"
+    MACH_EXCEPTION_FIXUP_LABEL(efault_vector)
+    "    vzeroupper\n"
+    MACH_EXCEPTION_FIXUP_LABEL(efault)
+    "    movl $" MACH_EXCEPTION_FIXUP_VALUE(EFAULT) ", %eax\n"
+    "    ret\n"
+    MACH_EXCEPTION_FIXUP_END(mach_exception_safe_memcmp)
+
+    MACH_EXCEPTION_FIXUP_ENTRIES
+);
+
+#elif defined(__aarch64__) || defined(__arm64__)
+
+__asm__(
+    MACH_EXCEPTION_FIXUP_TEXT
+    MACH_EXCEPTION_FIXUP_FUNCTION(mach_exception_safe_load8)
+    MACH_EXCEPTION_FIXUP_LABEL(load8_begin)
+    "    ldrb w8, [x0]\n"
+    MACH_EXCEPTION_FIXUP_LABEL(load8_end)
+    "    strb w8, [x1]\n"
+    "    mov w0, #0\n"
+    "    ret\n"
+    MACH_EXCEPTION_FIXUP_END(mach_exception_safe_load8)
+
+    MACH_EXCEPTION_FIXUP_FUNCTION(mach_exception_safe_load16)
+    MACH_EXCEPTION_FIXUP_LABEL(load16_begin)
+    "    ldrh w8, [x0]\n"
+    MACH_EXCEPTION_FIXUP_LABEL(load16_end)
+    "    strh w8, [x1]\n"
+    "    mov w0, #0\n"
+    "    ret\n"
+    MACH_EXCEPTION_FIXUP_END(mach_exception_safe_load16)
+
+    MACH_EXCEPTION_FIXUP_FUNCTION(mach_exception_safe_load32)
+    MACH_EXCEPTION_FIXUP_LABEL(load32_begin)
+    "    ldr w8, [x0]\n"
+    MACH_EXCEPTION_FIXUP_LABEL(load32_end)
+    "    str w8, [x1]\n"
+    "    mov w0, #0\n"
+    "    ret\n"
+    MACH_EXCEPTION_FIXUP_END(mach_exception_safe_load32)
+
+    MACH_EXCEPTION_FIXUP_FUNCTION(mach_exception_safe_load64)
+    MACH_EXCEPTION_FIXUP_LABEL(load64_begin)
+    "    ldr x8, [x0]\n"
+    MACH_EXCEPTION_FIXUP_LABEL(load64_end)
+    "    str x8, [x1]\n"
+    "    mov w0, #0\n"
+    "    ret\n"
+    MACH_EXCEPTION_FIXUP_END(mach_exception_safe_load64)
+
+    // Copy 64-byte blocks with pairs of vector registers, then the rest in 16-, 8- and 1-byte moves.
+    MACH_EXCEPTION_FIXUP_FUNCTION(mach_exception_safe_memcpy)
+    MACH_EXCEPTION_FIXUP_LABEL(memcpy_begin)
+    "    b 2f\n"
+    "1:  ldp q0, q1, [x1]\n"
+    "    ldp q2, q3, [x1, #32]\n"
+    "    stp q0, q1, [x0]\n"
+    "    stp q2, q3, [x0, #32]\n"
+    "    add x1, x1, #64\n"
+    "    add x0, x0, #64\n"
+    "    sub x2, x2, #64\n"
+    "2:  cmp x2, #64\n"
+    "    b.hs 1b\n"
+    "    b 4f\n"
+    "3:  ldr q0, [x1], #16\n"
+    "    str q0, [x0], #16\n"
+    "    sub x2, x2, #16\n"
+    "4:  cmp x2, #16\n"
+    "    b.hs 3b\n"
+    "    cmp x2, #8\n"
+    "    b.lo 6f\n"
+    "    ldr x8, [x1], #8\n"
+    "    str x8, [x0], #8\n"
+    "    sub x2, x2, #8\n"
+    "    b 6f\n"
+    "5:  ldrb w8, [x1], #1\n"
+    "    strb w8, [x0], #1\n"
+    "    sub x2, x2, #1\n"
+    "6:  cbnz x2, 5b\n"
+    MACH_EXCEPTION_FIXUP_LABEL(memcpy_end)
+    "    mov w0, #0\n"
+    "    ret\n"
+    MACH_EXCEPTION_FIXUP_END(mach_exception_safe_memcpy)
+
+    // Compare 16-byte blocks as pairs of 8-byte words, then the rest a byte at a time. The words of a difference are
+    // byte-reversed, so that comparing them unsigned compares their first differing bytes.
+    MACH_EXCEPTION_FIXUP_FUNCTION(mach_exception_safe_memcmp)
+    "    mov w9, #0\n"
+    MACH_EXCEPTION_FIXUP_LABEL(memcmp_begin)
+    "    b 2f\n"
+    "1:  ldp x10, x12, [x0], #16\n"
+    "    ldp x11, x13, [x1], #16\n"
+    "    sub x2, x2, #16\n"
+    "    cmp x10, x11\n"
+    "    b.ne 5f\n"
+    "    mov x10, x12\n"
+    "    mov x11, x13\n"
+    "    cmp x10, x11\n"
+    "    b.ne 5f\n"
+    "2:  cmp x2, #16\n"
+    "    b.hs 1b\n"
+    "    b 4f\n"
+    "3:  ldrb w10, [x0], #1\n"
+    "    ldrb w11, [x1], #1\n"
+    "    sub x2, x2, #1\n"
+    "    cmp w10, w11\n"
+    "    b.ne 6f\n"
+    "4:  cbnz x2, 3b\n"
+    "    b 7f\n"
+    MACH_EXCEPTION_FIXUP_LABEL(memcmp_end)
+    "5:  rev x10, x10\n"
+    "    rev x11, x11\n"
+    "    cmp x10, x11\n"
+    "6:  mov w9, #1\n"
+    "    cneg w9, w9, lo\n"
+    "7:  str w9, [x3]\n"
+    "    mov w0, #0\n"
+    "    ret\n"
+    MACH_EXCEPTION_FIXUP_LABEL(efault)
+    "    mov w0, #" MACH_EXCEPTION_FIXUP_VALUE(EFAULT) "\n"
+    "    ret\n"
+    MACH_EXCEPTION_FIXUP_END(mach_exception_safe_memcmp)
+
+    MACH_EXCEPTION_FIXUP_ENTRIES
+);
+
+#else
+#error Unsupported architecture
+#endif
+
+// MARK: - Fixup table
+
+const mach_exception_fixup_t *mach_exception_fixup_table(size_t *count)
+{
+    *count = MACH_EXCEPTION_FIXUP_COUNT;
+    return mach_exception_fixups;
+}
+
+uint64_t mach_exception_fixup_find(uint64_t pc)
+{
+    size_t low = 0;
+    size_t high = MACH_EXCEPTION_FIXUP_COUNT;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        const mach_exception_fixup_t *range = &mach_exception_fixups[middle];
+        if (pc < range->begin) {
+            high = middle;
+        } else if (pc >= range->end) {
+            low = middle + 1;
+        } else {
+            return range->fixup;
+        }
+    }
+    return 0;
+}
+
+bool mach_exception_fixup_apply(const mach_exception_resume_layout_t *layout, void *context)
+{
+    uint64_t pc;
+    memcpy(&pc, (const char *) context + layout->pc, sizeof(pc));
+    uint64_t fixup = mach_exception_fixup_find(pc);
+    if (fixup == 0) {
+        return false;
+    }
+    memcpy((char *) context + layout->pc, &fixup, sizeof(fixup));
+    return true;
+}
@@ -13,10 +13,21 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
 #include <pthread/pthread.h>
 #include "mach_msg_server_once.h"
+#include "mach_exception_capture.h"
+#include "mach_exception_fixup.h"
 #include "mach_excServer.h"
 #include "mach_exception_helper.h"
+#include "mach_exception_lanes.h"
+#include "mach_exception_log.h"
+#include "mach_exception_metrics.h"
+#include "mach_exception_resolver.h"
+#include "mach_exception_perform.h"
+#include "mach_exception_resume.h"
+#include "mach_exception_ring.h"
 
 NSErrorDomain const MachExceptionErrorDomain = @"com.gili-labs.machException";
 NSErrorUserInfoKey const MachExceptionType = @"type";
@@ -26,17 +37,397 @@ NSErrorUserInfoKey const MachExceptionSubcode = @"subcode";
 @implementation MachException
 @end
 
-// MARK: - exc_handler
+// MARK: - mach_exception_context
 
-static void exc_handler(exception_type_t type, mach_exception_data_type_t code, mach_exception_data_t subcode) {
-    MachException * mach_exception = [[MachException alloc]
-                                      initWithName: MachExceptionErrorDomain
-                                      reason: @"Mach exception"
-                                      userInfo: nil];
-    mach_exception.type = type;
-    mach_exception.code = code;
-    mach_exception.subcode = subcode;
-    @throw mach_exception;
+// A scope pushed onto a thread's scope stack by performWithMask: or mach_exception_perform. Scopes live on the stack
+// of the function that created them. The combined mask is the union of the masks of this scope and the scopes
+// enclosing it, so deciding whether a thread catches an exception doesn't require walking its scope stack. The
+// listener resumes the faulting thread at the resume point of its innermost scope, which receives the exception.
+typedef struct mach_exception_scope {
+    exception_mask_t mask;
+    exception_mask_t combined_mask;
+    struct mach_exception_scope * previous;
+    mach_exception_resume_point_t point;
+} mach_exception_scope_t;
+
+// A thread's persistent exception context. The context is the port's context value, so the listener finds the
+// faulting thread's scope stack from the port on which it receives an exception. The previous masks, ports,
+// behaviors and flavors accumulate as the context widens the thread's exception ports.
+typedef struct mach_exception_context {
+    thread_t thread;
+    mach_port_t port;
+    exception_mask_t installed_mask;
+    mach_exception_scope_t * volatile scope;
+    mach_msg_type_number_t count;
+    exception_mask_t masks[EXC_TYPES_COUNT];
+    mach_port_t ports[EXC_TYPES_COUNT];
+    exception_behavior_t behaviors[EXC_TYPES_COUNT];
+    thread_state_flavor_t flavors[EXC_TYPES_COUNT];
+    mach_exception_state_t state;
+    mach_exception_backtrace_t backtrace;
+    mach_exception_lanes_t lanes;
+    uint64_t resumed_at;
+} mach_exception_context_t;
+
+// The calling thread's exception context, or `NULL` if the thread hasn't entered a scope.
+static __thread mach_exception_context_t * mach_exception_current_context;
+
+// The exception context owning the port that received an exception, whether a thread's or a MachExceptionHelper
+// object's, or `NULL` if the port has none.
+static mach_exception_context_t * mach_exception_port_context(mach_port_t exception_port)
+{
+    mach_port_context_t value = 0;
+    if (mach_port_get_context(mach_task_self_, exception_port, &value) != KERN_SUCCESS) {
+        return NULL;
+    }
+    return (mach_exception_context_t *) value;
+}
+
+// Whether the faulting thread is inside an active scope catching the exception. The faulting thread is suspended
+// while its exception is delivered, so its innermost scope can't change while the listener reads it, and the
+// scope's combined mask answers in constant time.
+static bool mach_exception_context_catches(mach_exception_context_t * context, exception_type_t exception)
+{
+    mach_exception_scope_t * scope = context->scope;
+    return scope != NULL && (scope->combined_mask & ((exception_mask_t) 1 << exception)) != 0;
+}
+
+// Attribute a floating-point trap to the lanes of the faulting instruction, from the general-purpose registers the
+// faulting thread faulted with, and its vector registers, which the listener reads while the thread is suspended.
+static void mach_exception_context_attribute(mach_exception_context_t * context,
+                                             mach_port_t thread,
+                                             const thread_state_t state)
+{
+    mach_exception_simd_state_t simd;
+    memset(&simd, 0, sizeof(simd));
+    simd.pc = context->state.pc;
+#if defined (__arm__) || defined (__arm64__)
+    const _STRUCT_ARM_THREAD_STATE64 * thread_state = (const _STRUCT_ARM_THREAD_STATE64 *)(const void *) state;
+    _STRUCT_ARM_NEON_STATE64 neon;
+    mach_msg_type_number_t count = ARM_NEON_STATE64_COUNT;
+    if (thread_get_state(thread, ARM_NEON_STATE64, (thread_state_t) &neon, &count) != KERN_SUCCESS) {
+        return;
+    }
+    for (int index = 0; index < 29; index++) {
+        simd.gpr[index] = thread_state->__x[index];
+    }
+    simd.gpr[29] = (uint64_t) arm_thread_state64_get_fp(*thread_state);
+    simd.gpr[30] = (uint64_t) arm_thread_state64_get_lr(*thread_state);
+    simd.gpr[31] = (uint64_t) arm_thread_state64_get_sp(*thread_state);
+    for (int index = 0; index < 32; index++) {
+        memcpy(simd.vector[index], &neon.__v[index], 16);
+    }
+    simd.control = neon.__fpcr;
+#elif defined (__i386__) || defined(__x86_64__)
+    const _STRUCT_X86_THREAD_STATE64 * thread_state = (const _STRUCT_X86_THREAD_STATE64 *)(const void *) state;
+    const uint64_t registers[16] = {
+        thread_state->__rax, thread_state->__rcx, thread_state->__rdx, thread_state->__rbx,
+        thread_state->__rsp, thread_state->__rbp, thread_state->__rsi, thread_state->__rdi,
+        thread_state->__r8, thread_state->__r9, thread_state->__r10, thread_state->__r11,
+        thread_state->__r12, thread_state->__r13, thread_state->__r14, thread_state->__r15,
+    };
+    memcpy(simd.gpr, registers, sizeof(registers));
+
+    // The AVX state extends the floating-point state with the upper halves of the ymm registers. The registers are
+    // consecutive members of both structures.
+    _STRUCT_X86_AVX_STATE64 avx;
+    mach_msg_type_number_t count = x86_AVX_STATE64_COUNT;
+    if (thread_get_state(thread, x86_AVX_STATE64, (thread_state_t) &avx, &count) == KERN_SUCCESS) {
+        const _STRUCT_XMM_REG * ymmh = &avx.__fpu_ymmh0;
+        for (int index = 0; index < 16; index++) {
+            memcpy(&simd.vector[index][16], &ymmh[index], 16);
+        }
+        simd.wide = true;
+    } else {
+        count = x86_FLOAT_STATE64_COUNT;
+        if (thread_get_state(thread, x86_FLOAT_STATE64, (thread_state_t) &avx, &count) != KERN_SUCCESS) {
+            return;
+        }
+    }
+    const _STRUCT_XMM_REG * xmm = &avx.__fpu_xmm0;
+    for (int index = 0; index < 16; index++) {
+        memcpy(simd.vector[index], &xmm[index], 16);
+    }
+    simd.control = avx.__fpu_mxcsr;
+#endif
+    mach_exception_lanes_attribute(&simd, &context->lanes);
+}
+
+// Capture the machine state and backtrace of a faulting thread from the state it faulted in, following its frame
+// pointers within its stack, which stays put while the thread is suspended.
+static void mach_exception_context_capture(mach_exception_context_t * context,
+                                           mach_port_t thread,
+                                           exception_type_t exception,
+                                           const mach_exception_data_t code,
+                                           mach_msg_type_number_t codeCnt,
+                                           const thread_state_t state)
+{
+    uint64_t stack_low = 0;
+    uint64_t stack_high = 0;
+    pthread_t pthread = pthread_from_mach_thread_np(thread);
+    if (pthread != NULL) {
+        stack_high = (uint64_t) pthread_get_stackaddr_np(pthread);
+        stack_low = stack_high - pthread_get_stacksize_np(pthread);
+    }
+#if defined (__arm__) || defined (__arm64__)
+    const _STRUCT_ARM_THREAD_STATE64 * thread_state = (const _STRUCT_ARM_THREAD_STATE64 *)(const void *) state;
+    context->state.pc = (uint64_t) arm_thread_state64_get_pc(*thread_state);
+    context->state.sp = (uint64_t) arm_thread_state64_get_sp(*thread_state);
+    context->state.lr = (uint64_t) arm_thread_state64_get_lr(*thread_state);
+    uint64_t fp = (uint64_t) arm_thread_state64_get_fp(*thread_state);
+#elif defined (__i386__) || defined(__x86_64__)
+    const _STRUCT_X86_THREAD_STATE64 * thread_state = (const _STRUCT_X86_THREAD_STATE64 *)(const void *) state;
+    context->state.pc = thread_state->__rip;
+    context->state.sp = thread_state->__rsp;
+    uint64_t fp = thread_state->__rbp;
+#endif
+    // The kernel reports the address whose access faulted as the subcode of EXC_BAD_ACCESS.
+    context->state.fault_address = exception == EXC_BAD_ACCESS && codeCnt > 1 ? (uint64_t) code[1] : 0;
+    mach_exception_backtrace_capture(&context->backtrace, context->state.pc, fp, stack_low, stack_high);
+#if defined (__i386__) || defined(__x86_64__)
+    // x86_64 has no link register, so report the return address the faulting frame's frame record holds.
+    context->state.lr = context->backtrace.frames[0];
+#endif
+
+    memset(&context->lanes, 0, sizeof(context->lanes));
+    if (exception == EXC_ARITHMETIC && mach_exception_lanes_enabled()) {
+        mach_exception_context_attribute(context, thread, state);
+    }
+}
+
+bool mach_exception_last_backtrace(mach_exception_backtrace_t * backtrace)
+{
+    mach_exception_context_t * context = mach_exception_current_context;
+    if (context == NULL) {
+        memset(backtrace, 0, sizeof(*backtrace));
+        return false;
+    }
+    *backtrace = context->backtrace;
+    return backtrace->pc != 0;
+}
+
+bool mach_exception_last_state(mach_exception_state_t * state)
+{
+    mach_exception_context_t * context = mach_exception_current_context;
+    if (context == NULL) {
+        memset(state, 0, sizeof(*state));
+        return false;
+    }
+    *state = context->state;
+    return state->pc != 0 || state->fault_address != 0;
+}
+
+bool mach_exception_last_lanes(mach_exception_lanes_t * lanes)
+{
+    mach_exception_context_t * context = mach_exception_current_context;
+    if (context == NULL) {
+        memset(lanes, 0, sizeof(*lanes));
+        return false;
+    }
+    *lanes = context->lanes;
+    return lanes->count != 0;
+}
+
+// MARK: - mach_exception_forward
+
+// Check the reply to a forwarded exception as the MIG-generated unpacker would, before trusting the counts in it: it
+// must answer the request, must not be complex, and, unless it reports an error, its size must match the state it
+// says it carries, which must fit both the reply and the caller's buffer of `capacity` words.
+static bool mach_exception_forward_reply_valid(const __Reply__mach_exception_raise_state_identity_t * reply,
+                                               mach_msg_id_t request_id,
+                                               exception_behavior_t behavior,
+                                               mach_msg_type_number_t capacity)
+{
+    mach_msg_size_t size = reply->Head.msgh_size;
+    if (reply->Head.msgh_id != request_id + 100 ||
+        (reply->Head.msgh_bits & MACH_MSGH_BITS_COMPLEX) ||
+        size < sizeof(mig_reply_error_t)) {
+        return false;
+    }
+    if (reply->RetCode != KERN_SUCCESS) {
+        return true;
+    }
+    if (behavior == EXCEPTION_DEFAULT) {
+        return size == sizeof(__Reply__mach_exception_raise_t);
+    }
+    mach_msg_size_t fixed = (mach_msg_size_t)(sizeof(*reply) - sizeof(reply->new_state));
+    return size >= fixed &&
+           reply->new_stateCnt <= sizeof(reply->new_state) / sizeof(natural_t) &&
+           reply->new_stateCnt <= capacity &&
+           size == fixed + reply->new_stateCnt * sizeof(natural_t);
+}
+
+// Raise an exception on the exception port a thread's exception context replaced, with the behavior and flavor the
+// port was registered with, and wait for its reply. This gives the handler installed before this library's (e.g.,
+// a debugger or a crash reporter) the semantics it would have without this library. Handlers registered without
+// MACH_EXCEPTION_CODES, and exceptions for which the thread had no handler, are left to the task's exception port.
+static kern_return_t mach_exception_forward(mach_exception_context_t * context,
+                                            mach_port_t thread,
+                                            mach_port_t task,
+                                            exception_type_t exception,
+                                            mach_exception_data_t code,
+                                            mach_msg_type_number_t codeCnt,
+                                            int *flavor,
+                                            thread_state_t old_state,
+                                            mach_msg_type_number_t old_stateCnt,
+                                            thread_state_t new_state,
+                                            mach_msg_type_number_t *new_stateCnt)
+{
+    mach_msg_type_number_t index = 0;
+    while (index < context->count && (context->masks[index] & ((exception_mask_t) 1 << exception)) == 0) {
+        index++;
+    }
+    if (index == context->count ||
+        !MACH_PORT_VALID(context->ports[index]) ||
+        (context->behaviors[index] & MACH_EXCEPTION_CODES) == 0) {
+        return KERN_FAILURE;
+    }
+
+    exception_behavior_t behavior = context->behaviors[index] & ~MACH_EXCEPTION_MASK;
+    thread_state_flavor_t forward_flavor = context->flavors[index];
+
+    // The request and the reply share a buffer, as mach_msg receives the reply in place.
+    union {
+        __Request__mach_exception_raise_t raise;
+        __Request__mach_exception_raise_state_t raise_state;
+        __Request__mach_exception_raise_state_identity_t raise_state_identity;
+        struct {
+            __Reply__mach_exception_raise_state_identity_t body;
+            mach_msg_max_trailer_t trailer;
+        } reply;
+    } message;
+    mach_msg_header_t * head = &message.raise.Head;
+    mach_msg_size_t size;
+
+    // The kernel always raises exceptions with two codes, which fixes the layout of the fields following them.
+    mach_exception_data_type_t codes[2] = { codeCnt > 0 ? code[0] : 0, codeCnt > 1 ? code[1] : 0 };
+
+    switch (behavior) {
+    case EXCEPTION_DEFAULT:
+        message.raise.msgh_body.msgh_descriptor_count = 2;
+        message.raise.thread = (mach_msg_port_descriptor_t) {
+            .name = thread, .disposition = MACH_MSG_TYPE_COPY_SEND, .type = MACH_MSG_PORT_DESCRIPTOR };
+        message.raise.task = (mach_msg_port_descriptor_t) {
+            .name = task, .disposition = MACH_MSG_TYPE_COPY_SEND, .type = MACH_MSG_PORT_DESCRIPTOR };
+        message.raise.NDR = NDR_record;
+        message.raise.exception = exception;
+        message.raise.codeCnt = 2;
+        memcpy(message.raise.code, codes, sizeof(codes));
+        head->msgh_bits = MACH_MSGH_BITS_COMPLEX;
+        head->msgh_id = 2405;
+        size = sizeof(message.raise);
+        break;
+
+    case EXCEPTION_STATE:
+    case EXCEPTION_STATE_IDENTITY: {
+        natural_t * state;
+        mach_msg_type_number_t * stateCnt;
+        int * state_flavor;
+        if (behavior == EXCEPTION_STATE) {
+            message.raise_state.NDR = NDR_record;
+            message.raise_state.exception = exception;
+            message.raise_state.codeCnt = 2;
+            memcpy(message.raise_state.code, codes, sizeof(codes));
+            state = message.raise_state.old_state;
+            stateCnt = &message.raise_state.old_stateCnt;
+            state_flavor = &message.raise_state.flavor;
+            head->msgh_bits = 0;
+            head->msgh_id = 2406;
+        } else {
+            message.raise_state_identity.msgh_body.msgh_descriptor_count = 2;
+            message.raise_state_identity.thread = (mach_msg_port_descriptor_t) {
+                .name = thread, .disposition = MACH_MSG_TYPE_COPY_SEND, .type = MACH_MSG_PORT_DESCRIPTOR };
+            message.raise_state_identity.task = (mach_msg_port_descriptor_t) {
+                .name = task, .disposition = MACH_MSG_TYPE_COPY_SEND, .type = MACH_MSG_PORT_DESCRIPTOR };
+            message.raise_state_identity.NDR = NDR_record;
+            message.raise_state_identity.exception = exception;
+            message.raise_state_identity.codeCnt = 2;
+            memcpy(message.raise_state_identity.code, codes, sizeof(codes));
+            state = message.raise_state_identity.old_state;
+            stateCnt = &message.raise_state_identity.old_stateCnt;
+            state_flavor = &message.raise_state_identity.flavor;
+            head->msgh_bits = MACH_MSGH_BITS_COMPLEX;
+            head->msgh_id = 2407;
+        }
+
+        // Send the state in the flavor the previous handler asked for.
+        *state_flavor = forward_flavor;
+        if (forward_flavor == *flavor) {
+            memcpy(state, old_state, old_stateCnt * sizeof(natural_t));
+            *stateCnt = old_stateCnt;
+        } else {
+            *stateCnt = sizeof(message.raise_state.old_state) / sizeof(natural_t);
+            kern_return_t code = thread_get_state(thread, forward_flavor, state, stateCnt);
+            if (code != KERN_SUCCESS) {
+                return code;
+            }
+        }
+        size = (mach_msg_size_t)((char *) (state + *stateCnt) - (char *) head);
+        break;
+    }
+
+    default:
+        return KERN_FAILURE;
+    }
+
+    mach_msg_id_t request_id = head->msgh_id;
+    mach_port_t reply_port = mig_get_reply_port();
+    head->msgh_bits |= MACH_MSGH_BITS(MACH_MSG_TYPE_COPY_SEND, MACH_MSG_TYPE_MAKE_SEND_ONCE);
+    head->msgh_size = size;
+    head->msgh_remote_port = context->ports[index];
+    head->msgh_local_port = reply_port;
+    head->msgh_voucher_port = MACH_PORT_NULL;
+
+    mach_msg_return_t result = mach_msg(head,
+                                        MACH_SEND_MSG | MACH_RCV_MSG,
+                                        size,
+                                        sizeof(message),
+                                        reply_port,
+                                        MACH_MSG_TIMEOUT_NONE,
+                                        MACH_PORT_NULL);
+    if (result != MACH_MSG_SUCCESS) {
+        if (result == MACH_RCV_PORT_DIED || result == MACH_RCV_INTERRUPTED || result == MACH_RCV_TIMED_OUT) {
+            mig_dealloc_reply_port(reply_port);
+        }
+        return KERN_FAILURE;
+    }
+
+    // The reply was received over the request, so its ID is checked against the one saved before sending.
+    __Reply__mach_exception_raise_state_identity_t * reply = &message.reply.body;
+    bool valid = mach_exception_forward_reply_valid(reply, request_id, behavior, *new_stateCnt);
+    if (!valid || reply->RetCode != KERN_SUCCESS) {
+        kern_return_t code = valid ? reply->RetCode : KERN_FAILURE;
+        mach_msg_destroy(&reply->Head);
+        return code;
+    }
+
+    // Apply the state the previous handler returned. When it uses a flavor other than ours, set its flavor on the
+    // thread, and return the resulting state in ours.
+    if (behavior == EXCEPTION_DEFAULT) {
+        memcpy(new_state, old_state, old_stateCnt * sizeof(natural_t));
+        *new_stateCnt = old_stateCnt;
+    } else if (reply->flavor == *flavor) {
+        memcpy(new_state, reply->new_state, reply->new_stateCnt * sizeof(natural_t));
+        *new_stateCnt = reply->new_stateCnt;
+    } else {
+        kern_return_t code = thread_set_state(thread, reply->flavor, reply->new_state, reply->new_stateCnt);
+        if (code == KERN_SUCCESS) {
+            code = thread_get_state(thread, *flavor, new_state, new_stateCnt);
+        }
+        if (code != KERN_SUCCESS) {
+            return code;
+        }
+    }
+    return KERN_SUCCESS;
+}
+
+// Count a thread reaching the resume point the listener rewrote its state to resume at.
+static void mach_exception_context_resumed(mach_exception_context_t * context, exception_type_t type)
+{
+    if (context->resumed_at != 0) {
+        mach_exception_metrics_resumed(type, mach_exception_metrics_now() - context->resumed_at);
+        context->resumed_at = 0;
+    }
 }
 
 // MARK: - catch_mach_exception_raise
@@ -46,7 +437,6 @@ kern_return_t catch_mach_exception_raise(mach_port_t exception_port,
                                          exception_type_t exception,
                                          mach_exception_data_t code,
                                          mach_msg_type_number_t codeCnt) {
-    fprintf(stderr, "catch_mach_exception_raise called\n");
     return KERN_NOT_SUPPORTED;
 }
 
@@ -61,7 +451,6 @@ kern_return_t catch_mach_exception_raise_state(mach_port_t exception_port,
                                                mach_msg_type_number_t old_stateCnt,
                                                thread_state_t new_state,
                                                mach_msg_type_number_t *new_stateCnt) {
-    fprintf(stderr, "catch_mach_exception_raise_state called\n");
     return KERN_NOT_SUPPORTED;
 }
 
@@ -89,35 +478,168 @@ kern_return_t catch_mach_exception_raise_state_identity(mach_port_t exception_po
                                                         thread_state_t new_state,
                                                         mach_msg_type_number_t *new_stateCnt)
 {
+    uint64_t start = mach_exception_metrics_now();
+    mach_exception_record_t record = { exception, code[0], codeCnt > 1 ? code[1] : 0 };
+
+    // A probe's fault resumes at its fixup, before anything else sees it, whether or not the thread is in a scope.
+    if (exception == EXC_BAD_ACCESS) {
+        memcpy((void *) new_state, (void *) old_state, old_stateCnt * 4);
+        if (mach_exception_fixup_apply(mach_exception_resume_host_layout, new_state)) {
+            *new_stateCnt = old_stateCnt;
+            mach_port_deallocate(mach_task_self_, thread);
+            mach_port_deallocate(mach_task_self_, task);
+            return KERN_SUCCESS;
+        }
+    }
+
+    // Every port this library listens on has an exception context, so a port without one isn't ours. Returning a
+    // failure passes the exception on to the task's exception port.
+    mach_exception_context_t * context = mach_exception_port_context(exception_port);
+    if (context == NULL) {
+        return KERN_FAILURE;
+    }
+
+    // Pass an exception the faulting thread doesn't catch on to the handler this library replaced.
+    if (!mach_exception_context_catches(context, exception)) {
+        mach_exception_metrics_forwarded(&record);
+        kern_return_t result = mach_exception_forward(context,
+                                                      thread,
+                                                      task,
+                                                      exception,
+                                                      code,
+                                                      codeCnt,
+                                                      flavor,
+                                                      old_state,
+                                                      old_stateCnt,
+                                                      new_state,
+                                                      new_stateCnt);
+        if (result == KERN_SUCCESS) {
+            mach_port_deallocate(mach_task_self_, thread);
+            mach_port_deallocate(mach_task_self_, task);
+        }
+        return result;
+    }
+
+    // A fault a resolver repairs (e.g., an arena growing into its reservation) isn't an exception: resuming the
+    // thread in the state it faulted in executes the faulting instruction again.
+    if (exception == EXC_BAD_ACCESS && codeCnt > 1 && mach_exception_resolve((uint64_t) code[1])) {
+        memcpy((void *) new_state, (void *) old_state, old_stateCnt * 4);
+        *new_stateCnt = old_stateCnt;
+        mach_port_deallocate(mach_task_self_, thread);
+        mach_port_deallocate(mach_task_self_, task);
+        return KERN_SUCCESS;
+    }
+
+    mach_exception_context_capture(context, thread, exception, code, codeCnt, old_state);
+    uint64_t thread_id = 0;
+    pthread_t pthread = pthread_from_mach_thread_np(thread);
+    if (pthread != NULL) {
+        pthread_threadid_np(pthread, &thread_id);
+    }
+    mach_exception_ring_publish(&record, context->state.pc, thread_id);
+
+    // A scope resumes at its resume point, with the exception in the landing pad's argument registers and the
+    // point's stack pointer, so nothing unwinds the faulting thread's frames.
+    memcpy((void *) new_state, (void *) old_state, old_stateCnt * 4);
+    *new_stateCnt = old_stateCnt;
+    mach_exception_resume_rewrite(mach_exception_resume_host_layout, new_state, &context->scope->point, &record);
 #if defined (__arm__) || defined (__arm64__)
-    _STRUCT_ARM_THREAD_STATE64 * old_thread_state = (_STRUCT_ARM_THREAD_STATE64 *)(void *) old_state;
+    // Set the program counter and stack pointer again with the accessors, which sign them where pointer
+    // authentication requires it.
     _STRUCT_ARM_THREAD_STATE64 * new_thread_state = (_STRUCT_ARM_THREAD_STATE64 *)(void *) new_state;
-    memcpy((void *) new_state, (void *) old_state, ARM_THREAD_STATE64_COUNT * 4);
-    *new_stateCnt = old_stateCnt;
-    new_thread_state->__lr = old_thread_state->__pc;
-    arm_thread_state64_set_pc_fptr(*new_thread_state, exc_handler);
-    new_thread_state->__x[0] = (__uint64_t) exception;
-    new_thread_state->__x[1] = (__uint64_t) code[0];
-    new_thread_state->__x[2] = (__uint64_t) code[1];
-    
-#elif defined (__i386__) || defined(__x86_64__)
-    _STRUCT_X86_THREAD_STATE64 * old_thread_state = (_STRUCT_X86_THREAD_STATE64 *)(void *) old_state;
-    _STRUCT_X86_THREAD_STATE64 * new_thread_state = (_STRUCT_X86_THREAD_STATE64 *)(void *) new_state;
-    // Note: stateCnt specifies the size of the state in 4-byte words.
-    memcpy((void *) new_state, (void *) old_state, x86_THREAD_STATE64_COUNT * 4);
-    *new_stateCnt = old_stateCnt;
-    // NEED TO TEST THIS ON A MACHINE WITH AN x86_64 PROCESSOR
-    new_thread_state->__rsp -= sizeof(__uint64_t);
-    __uint64_t * rsp = (__uint64_t *) new_thread_state->__rsp;
-    *rsp = old_thread_state->__rip;
-    new_thread_state->__rip = (__uint64_t) exc_handler;
-    new_thread_state->__rdi = (__uint64_t) exception;
-    new_thread_state->__rsi = (__uint64_t) code[0];
-    new_thread_state->__rdx = (__uint64_t) code[1];
+    arm_thread_state64_set_pc_fptr(*new_thread_state, mach_exception_resume_landing);
+    arm_thread_state64_set_sp(*new_thread_state, context->scope->point.sp);
 #endif
+
+    uint64_t resumed_at = mach_exception_metrics_now();
+    context->resumed_at = resumed_at;
+    mach_exception_metrics_caught(&record, resumed_at - start);
+
+    // On success, the server owns the send rights for the thread and task it received.
+    mach_port_deallocate(mach_task_self_, thread);
+    mach_port_deallocate(mach_task_self_, task);
     return KERN_SUCCESS;
 }
 
+// MARK: - mach_exception_server
+
+static kern_return_t mach_exception_dispatch_raise(void * context,
+                                                   mach_port_name_t exception_port,
+                                                   mach_port_name_t thread,
+                                                   mach_port_name_t task,
+                                                   exception_type_t exception,
+                                                   mach_exception_data_t code,
+                                                   mach_msg_type_number_t codeCnt)
+{
+    return catch_mach_exception_raise(exception_port, thread, task, exception, code, codeCnt);
+}
+
+static kern_return_t mach_exception_dispatch_raise_state(void * context,
+                                                         mach_port_name_t exception_port,
+                                                         exception_type_t exception,
+                                                         mach_exception_data_t code,
+                                                         mach_msg_type_number_t codeCnt,
+                                                         int *flavor,
+                                                         natural_t *old_state,
+                                                         mach_msg_type_number_t old_stateCnt,
+                                                         natural_t *new_state,
+                                                         mach_msg_type_number_t *new_stateCnt)
+{
+    return catch_mach_exception_raise_state(exception_port,
+                                            exception,
+                                            code,
+                                            codeCnt,
+                                            flavor,
+                                            old_state,
+                                            old_stateCnt,
+                                            new_state,
+                                            new_stateCnt);
+}
+
+static kern_return_t mach_exception_dispatch_raise_state_identity(void * context,
+                                                                  mach_port_name_t exception_port,
+                                                                  mach_port_name_t thread,
+                                                                  mach_port_name_t task,
+                                                                  exception_type_t exception,
+                                                                  mach_exception_data_t code,
+                                                                  mach_msg_type_number_t codeCnt,
+                                                                  int *flavor,
+                                                                  natural_t *old_state,
+                                                                  mach_msg_type_number_t old_stateCnt,
+                                                                  natural_t *new_state,
+                                                                  mach_msg_type_number_t *new_stateCnt)
+{
+    return catch_mach_exception_raise_state_identity(exception_port,
+                                                     thread,
+                                                     task,
+                                                     exception,
+                                                     code,
+                                                     codeCnt,
+                                                     flavor,
+                                                     old_state,
+                                                     old_stateCnt,
+                                                     new_state,
+                                                     new_stateCnt);
+}
+
+static const mach_exc_dispatch_handlers_t mach_exception_dispatch_handlers = {
+    .raise = mach_exception_dispatch_raise,
+    .raise_state = mach_exception_dispatch_raise_state,
+    .raise_state_identity = mach_exception_dispatch_raise_state_identity,
+    .context = NULL,
+};
+
+// The demux routine the listeners pass to mach_msg_server_once_with_timeout, which decodes requests and builds
+// replies with the portable dispatch core.
+static boolean_t mach_exception_server(mach_msg_header_t * request, mach_msg_header_t * reply)
+{
+    mach_exception_capture_installed_message(request, request->msgh_size);
+    return mach_exc_dispatch(&mach_exception_dispatch_handlers, request, request->msgh_size, reply);
+}
+
+// The size of a listener's request buffer, which holds the largest exception request and its trailer.
+#define MACH_EXCEPTION_REQUEST_SIZE (MACH_EXC_DISPATCH_REQUEST_MAX + MAX_TRAILER_SIZE)
+
 // MARK: - MachExceptionHelperDependenciesDefault
 
 @implementation MachExceptionHelperDependenciesDefault
@@ -167,17 +689,270 @@ kern_return_t catch_mach_exception_raise_state_identity(mach_port_t exception_po
 
 @end
 
+// The dependencies of exception contexts created by mach_exception_perform, which are created once, when the first
+// such context is.
+static pthread_once_t mach_exception_default_dependencies_once = PTHREAD_ONCE_INIT;
+static id<MachExceptionHelperDependencies> mach_exception_default_dependencies;
+
+static void mach_exception_default_dependencies_initialize(void)
+{
+    mach_exception_default_dependencies = [[MachExceptionHelperDependenciesDefault alloc] init];
+}
+
+// MARK: - mach_exception_listener
+
+static pthread_once_t mach_exception_listener_once = PTHREAD_ONCE_INIT;
+static kern_return_t mach_exception_listener_status;
+static pthread_key_t mach_exception_context_key;
+
+// The port set containing every thread's exception context port, served by the listener thread, and the port
+// used to wake the listener when it must stop.
+static mach_port_t mach_exception_port_set;
+static mach_port_t mach_exception_wake_port;
+
+// The listener thread runs while any thread has an exception context. The mutex serializes starting and stopping
+// it; the listener itself never takes the mutex.
+static pthread_mutex_t mach_exception_listener_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t mach_exception_listener_thread;
+static unsigned long mach_exception_context_count;
+static atomic_bool mach_exception_listener_stopping;
+
+// The buffers the listener receives requests and builds replies in.
+static mach_exc_arena_t mach_exception_listener_arena;
+
+// The number of times the listener returned from receiving a message.
+static atomic_uint_fast64_t mach_exception_listener_wakeup_count;
+
+// Block without a timeout until a message arrives, whether an exception or a request to stop. An idle listener
+// therefore never wakes.
+static void * mach_exception_listener(void * argument)
+{
+    // The listener is the thread that handles exceptions, so the events it publishes go to its ring, and it counts
+    // them in its shard of the metrics.
+    mach_exception_ring_prepare();
+    mach_exception_metrics_prepare();
+    while (!atomic_load_explicit(&mach_exception_listener_stopping, memory_order_acquire)) {
+        mach_msg_server_once_with_timeout(mach_exception_server,
+                                          &mach_exception_listener_arena,
+                                          mach_exception_port_set,
+                                          MACH_RCV_LARGE,
+                                          MACH_MSG_TIMEOUT_NONE);
+        atomic_fetch_add_explicit(&mach_exception_listener_wakeup_count, 1, memory_order_relaxed);
+        mach_exception_metrics_wakeup();
+    }
+    return NULL;
+}
+
+// Send an empty message to the wake port. The exception server rejects it, as its identifier isn't one of the
+// exception routines, and the listener then observes it must stop.
+static void mach_exception_listener_wake(void)
+{
+    mach_msg_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.msgh_bits = MACH_MSGH_BITS(MACH_MSG_TYPE_MAKE_SEND, 0);
+    header.msgh_size = sizeof(header);
+    header.msgh_remote_port = mach_exception_wake_port;
+    header.msgh_local_port = MACH_PORT_NULL;
+    mach_msg(&header, MACH_SEND_MSG, sizeof(header), 0, MACH_PORT_NULL, MACH_MSG_TIMEOUT_NONE, MACH_PORT_NULL);
+}
+
+// Count a new exception context, starting the listener if it is the only one.
+static kern_return_t mach_exception_listener_retain(void)
+{
+    kern_return_t code = KERN_SUCCESS;
+    pthread_mutex_lock(&mach_exception_listener_mutex);
+    if (mach_exception_context_count == 0) {
+        atomic_store_explicit(&mach_exception_listener_stopping, false, memory_order_relaxed);
+        if (pthread_create(&mach_exception_listener_thread, NULL, mach_exception_listener, NULL) != 0) {
+            code = KERN_RESOURCE_SHORTAGE;
+        }
+    }
+    if (code == KERN_SUCCESS) {
+        mach_exception_context_count++;
+    }
+    pthread_mutex_unlock(&mach_exception_listener_mutex);
+    return code;
+}
+
+// Count a destroyed exception context, stopping the listener if no other remains. The listener has exited by the
+// time this function returns.
+static void mach_exception_listener_release(void)
+{
+    pthread_mutex_lock(&mach_exception_listener_mutex);
+    if (--mach_exception_context_count == 0) {
+        atomic_store_explicit(&mach_exception_listener_stopping, true, memory_order_release);
+        mach_exception_listener_wake();
+        pthread_join(mach_exception_listener_thread, NULL);
+    }
+    pthread_mutex_unlock(&mach_exception_listener_mutex);
+}
+
+// Restore the exception ports the context replaced.
+static void mach_exception_context_restore(mach_exception_context_t * context)
+{
+    for (mach_msg_type_number_t index = 0; index < context->count; index++) {
+        if (MACH_PORT_VALID(context->ports[index])) {
+            thread_set_exception_ports(context->thread,
+                                       context->masks[index],
+                                       context->ports[index],
+                                       context->behaviors[index],
+                                       context->flavors[index]);
+            mach_port_deallocate(mach_task_self_, context->ports[index]);
+        } else {
+            thread_set_exception_ports(context->thread,
+                                       context->masks[index],
+                                       MACH_PORT_NULL,
+                                       EXCEPTION_DEFAULT,
+                                       THREAD_STATE_NONE);
+        }
+    }
+}
+
+// Restore the exception ports the context replaced, and destroy the context's port. This executes when the thread
+// owning the context exits.
+static void mach_exception_context_destroy(void * value)
+{
+    mach_exception_context_t * context = value;
+    mach_exception_context_restore(context);
+    mach_port_deallocate(mach_task_self_, context->port);
+    mach_port_mod_refs(mach_task_self_, context->port, MACH_PORT_RIGHT_RECEIVE, -1);
+    mach_port_deallocate(mach_task_self_, context->thread);
+    free(context);
+    mach_exception_listener_release();
+}
+
+static void mach_exception_listener_initialize(void)
+{
+    int error = pthread_key_create(&mach_exception_context_key, mach_exception_context_destroy);
+    if (error != 0) {
+        mach_exception_listener_status = KERN_RESOURCE_SHORTAGE;
+        return;
+    }
+
+    kern_return_t code = mach_port_allocate(mach_task_self_, MACH_PORT_RIGHT_PORT_SET, &mach_exception_port_set);
+    if (code != KERN_SUCCESS) {
+        mach_exception_listener_status = code;
+        return;
+    }
+
+    if (!mach_exc_arena_init(&mach_exception_listener_arena, MACH_EXCEPTION_REQUEST_SIZE)) {
+        mach_exception_listener_status = KERN_RESOURCE_SHORTAGE;
+        return;
+    }
+
+    code = mach_port_allocate(mach_task_self_, MACH_PORT_RIGHT_RECEIVE, &mach_exception_wake_port);
+    if (code == KERN_SUCCESS) {
+        code = mach_port_insert_member(mach_task_self_, mach_exception_wake_port, mach_exception_port_set);
+    }
+    mach_exception_listener_status = code;
+}
+
+// Create the calling thread's exception context, if necessary, and widen its exception ports to include the
+// exceptions in mask. Only the first call on a thread, and calls requesting exceptions not yet installed, make any
+// kernel calls. If dependencies is nil, those calls use the default dependencies.
+static kern_return_t mach_exception_context_prepare(exception_mask_t mask,
+                                                    id<MachExceptionHelperDependencies> _Nullable dependencies,
+                                                    mach_exception_context_t ** context_out)
+{
+    mach_exception_context_t * context = mach_exception_current_context;
+    kern_return_t code;
+
+    if (dependencies == nil && (context == NULL || (mask & ~context->installed_mask) != 0)) {
+        pthread_once(&mach_exception_default_dependencies_once, mach_exception_default_dependencies_initialize);
+        dependencies = mach_exception_default_dependencies;
+    }
+
+    if (context == NULL) {
+        pthread_once(&mach_exception_listener_once, mach_exception_listener_initialize);
+        if (mach_exception_listener_status != KERN_SUCCESS) {
+            return mach_exception_listener_status;
+        }
+
+        context = calloc(1, sizeof(mach_exception_context_t));
+        if (context == NULL) {
+            return KERN_RESOURCE_SHORTAGE;
+        }
+
+        code = [dependencies port_allocate: mach_task_self_
+                                     right: MACH_PORT_RIGHT_RECEIVE
+                                      name: &context->port];
+        if (code != KERN_SUCCESS) {
+            free(context);
+            return code;
+        }
+
+        code = [dependencies port_insert_right: mach_task_self_
+                                          name: context->port
+                                          port: context->port
+                                      polyPoly: MACH_MSG_TYPE_MAKE_SEND];
+        if (code != KERN_SUCCESS) {
+            mach_port_mod_refs(mach_task_self_, context->port, MACH_PORT_RIGHT_RECEIVE, -1);
+            free(context);
+            return code;
+        }
+
+        code = mach_port_set_context(mach_task_self_, context->port, (mach_port_context_t) context);
+        if (code == KERN_SUCCESS) {
+            code = mach_port_insert_member(mach_task_self_, context->port, mach_exception_port_set);
+        }
+        if (code == KERN_SUCCESS) {
+            code = mach_exception_listener_retain();
+        }
+        if (code != KERN_SUCCESS) {
+            mach_port_deallocate(mach_task_self_, context->port);
+            mach_port_mod_refs(mach_task_self_, context->port, MACH_PORT_RIGHT_RECEIVE, -1);
+            free(context);
+            return code;
+        }
+
+        context->thread = mach_thread_self();
+        mach_exception_current_context = context;
+        pthread_setspecific(mach_exception_context_key, context);
+
+        // Give the thread a shard of the metrics. Without one, the thread counts into the shared shard.
+        mach_exception_metrics_prepare();
+    }
+
+    exception_mask_t added = mask & ~context->installed_mask;
+    if (added != 0) {
+#if defined (__i386__) || defined(__x86_64__)
+        thread_state_flavor_t nativeThreadState = x86_THREAD_STATE64;
+#elif defined (__arm__) || defined (__arm64__)
+        thread_state_flavor_t nativeThreadState = ARM_THREAD_STATE64;
+#else
+#error Unsupported architecture
+#endif
+        mach_msg_type_number_t count = EXC_TYPES_COUNT - context->count;
+        code = [dependencies swap_exception_ports: context->thread
+                                   exception_mask: added
+                                         new_port: context->port
+                                     new_behavior: EXCEPTION_STATE_IDENTITY | MACH_EXCEPTION_CODES
+                                       new_flavor: nativeThreadState
+                                            masks: &context->masks[context->count]
+                                         CountCnt: &count
+                                            ports: &context->ports[context->count]
+                                        behaviors: &context->behaviors[context->count]
+                                          flavors: &context->flavors[context->count]];
+        if (code != KERN_SUCCESS) {
+            return code;
+        }
+        context->count += count;
+        context->installed_mask |= added;
+    }
+
+    *context_out = context;
+    return KERN_SUCCESS;
+}
+
 // MARK: - MachExceptionHelper
 
 @implementation MachExceptionHelper
 {
-    mach_port_t port;
-    mach_msg_type_number_t count;
-    exception_mask_t masks[EXC_TYPES_COUNT];
-    mach_port_t ports[EXC_TYPES_COUNT];
-    exception_behavior_t behaviors[EXC_TYPES_COUNT];
-    thread_state_flavor_t flavors[EXC_TYPES_COUNT];
+    // The object's exception context, whose port the object listens on. Unlike a thread's context, it isn't the
+    // calling thread's current context, and the object, rather than the thread's exit, destroys it.
+    mach_exception_context_t context;
     id<MachExceptionHelperDependencies> dependencies;
+    mach_exc_arena_t arena;
 }
 
 - (instancetype _Nullable) initWithMask: (exception_mask_t) mask
@@ -192,21 +967,34 @@ kern_return_t catch_mach_exception_raise_state_identity(mach_port_t exception_po
     if (self) {
         _mask = mask;
         
+        if (!mach_exc_arena_init(&arena, MACH_EXCEPTION_REQUEST_SIZE)) {
+            *error = [NSError errorWithDomain: NSMachErrorDomain code: KERN_RESOURCE_SHORTAGE userInfo: nil];
+            return nil;
+        }
+        
         kern_return_t code;
         code = [dependencies port_allocate: mach_task_self_
                                      right: MACH_PORT_RIGHT_RECEIVE
-                                      name: &port];
+                                      name: &context.port];
         if (code != KERN_SUCCESS) {
             *error = [NSError errorWithDomain: NSMachErrorDomain code:code userInfo: nil];
             return nil;
         }
         
         code = [dependencies port_insert_right: mach_task_self_
-                                          name: port
-                                          port: port
+                                          name: context.port
+                                          port: context.port
                                       polyPoly: MACH_MSG_TYPE_MAKE_SEND];
         if (code != KERN_SUCCESS) {
-            mach_port_deallocate(mach_task_self_, port);
+            mach_port_deallocate(mach_task_self_, context.port);
+            *error = [NSError errorWithDomain: NSMachErrorDomain code:code userInfo: nil];
+            return nil;
+        }
+
+        // The listener finds the context, and the scope to resume, from the port on which it receives an exception.
+        code = mach_port_set_context(mach_task_self_, context.port, (mach_port_context_t) &context);
+        if (code != KERN_SUCCESS) {
+            mach_port_deallocate(mach_task_self_, context.port);
             *error = [NSError errorWithDomain: NSMachErrorDomain code:code userInfo: nil];
             return nil;
         }
@@ -218,22 +1006,25 @@ kern_return_t catch_mach_exception_raise_state_identity(mach_port_t exception_po
 #else
 #error Unsupported architecture
 #endif
-        mach_msg_type_number_t count = EXC_TYPES_COUNT;
-        code = [dependencies swap_exception_ports: mach_thread_self()
+        context.thread = mach_thread_self();
+        context.count = EXC_TYPES_COUNT;
+        code = [dependencies swap_exception_ports: context.thread
                                    exception_mask: self.mask
-                                         new_port: port
+                                         new_port: context.port
                                      new_behavior: EXCEPTION_STATE_IDENTITY | MACH_EXCEPTION_CODES
                                        new_flavor: nativeThreadState
-                                            masks: masks
-                                         CountCnt: &count
-                                            ports: ports
-                                        behaviors: behaviors
-                                          flavors: flavors];
+                                            masks: context.masks
+                                         CountCnt: &context.count
+                                            ports: context.ports
+                                        behaviors: context.behaviors
+                                          flavors: context.flavors];
         if (code != KERN_SUCCESS) {
-            mach_port_deallocate(mach_task_self_, port);
+            context.count = 0;
+            mach_port_deallocate(mach_task_self_, context.port);
             *error = [NSError errorWithDomain: NSMachErrorDomain code:code userInfo: nil];
             return nil;
         }
+        context.installed_mask = self.mask;
         
         *error = nil;
     }
@@ -242,28 +1033,22 @@ kern_return_t catch_mach_exception_raise_state_identity(mach_port_t exception_po
 
 - (void) dealloc
 {
-    thread_swap_exception_ports(mach_thread_self(),
-                                self.mask,
-                                0,
-                                EXCEPTION_DEFAULT,
-                                THREAD_STATE_NONE,
-                                masks,
-                                &count,
-                                ports,
-                                behaviors,
-                                flavors);
-    
-    mach_port_deallocate(mach_task_self_, port);
+    if (context.thread != MACH_PORT_NULL) {
+        mach_exception_context_restore(&context);
+        mach_port_deallocate(mach_task_self_, context.thread);
+    }
+    mach_port_deallocate(mach_task_self_, context.port);
+    mach_exc_arena_destroy(&arena);
 }
 
 - (BOOL) listenWithTimeout: (mach_msg_timeout_t) timeout
                      error: (NSError **) error
 {
     mach_msg_return_t code;
-    code = mach_msg_server_once_with_timeout(mach_exc_server,
-                                             MACH_MSG_SIZE_RELIABLE,
-                                             port,
-                                             MACH_RCV_TIMEOUT,
+    code = mach_msg_server_once_with_timeout(mach_exception_server,
+                                             &arena,
+                                             context.port,
+                                             MACH_RCV_TIMEOUT | MACH_RCV_LARGE,
                                              timeout);
     if (code != MACH_MSG_SUCCESS) {
         *error = [NSError errorWithDomain: NSMachErrorDomain code: code userInfo: nil];
@@ -280,7 +1065,29 @@ kern_return_t catch_mach_exception_raise_state_identity(mach_port_t exception_po
          finally: (__attribute__((noescape)) void(^)(void)) finallyBlock
            error: (__autoreleasing NSError **) error
 {
-    //NSException * exception;
+    mach_exception_scope_t scope;
+    scope.mask = self.mask;
+    scope.previous = context.scope;
+    scope.combined_mask = scope.previous == NULL ? scope.mask : scope.mask | scope.previous->combined_mask;
+
+    // The listener resumes the faulting thread here, as it does a thread's scope, so no handler is pushed onto the
+    // faulting thread's stack and nothing unwinds its frames. The @catch below only sees exceptions raised with
+    // @throw.
+    if (mach_exception_resume_enter(&scope.point) != 0) {
+        mach_exception_record_t record = scope.point.record;
+        mach_exception_context_resumed(&context, record.type);
+        context.scope = scope.previous;
+        finallyBlock();
+        NSDictionary * userInfo = @{
+            MachExceptionCode : [NSNumber numberWithLongLong: record.code],
+            MachExceptionSubcode : [NSNumber numberWithLongLong: record.subcode]
+        };
+        *error = [NSError errorWithDomain: MachExceptionErrorDomain code: record.type userInfo: userInfo];
+        return NO;
+    }
+
+    context.scope = &scope;
+
     @try {
         tryBlock();
         return YES;
@@ -295,8 +1102,154 @@ kern_return_t catch_mach_exception_raise_state_identity(mach_port_t exception_po
         *error = [NSError errorWithDomain: exception.name code: 0 userInfo: nil];
         return NO;
     } @finally {
+        context.scope = scope.previous;
+        finallyBlock();
+    }
+}
+
++ (BOOL) performWithMask: (exception_mask_t) mask
+            dependencies: (id<MachExceptionHelperDependencies>) dependencies
+               operation: (__attribute__((noescape)) void(^)(void)) tryBlock
+                 finally: (__attribute__((noescape)) void(^)(void)) finallyBlock
+                   error: (__autoreleasing NSError **) error
+{
+    mach_exception_context_t * context;
+    kern_return_t code = mach_exception_context_prepare(mask, dependencies, &context);
+    if (code != KERN_SUCCESS) {
+        *error = [NSError errorWithDomain: NSMachErrorDomain code: code userInfo: nil];
+        return NO;
+    }
+
+    mach_exception_scope_t scope;
+    scope.mask = mask;
+    scope.previous = context->scope;
+    scope.combined_mask = scope.previous == NULL ? mask : mask | scope.previous->combined_mask;
+
+    // The listener resumes the faulting thread here, so catching a Mach exception involves neither the Objective-C
+    // runtime nor the unwinder. Only other exceptions reach the @catch below.
+    if (mach_exception_resume_enter(&scope.point) != 0) {
+        mach_exception_record_t record = scope.point.record;
+        mach_exception_context_resumed(context, record.type);
+        context->scope = scope.previous;
+        finallyBlock();
+
+        // Leave an exception this scope doesn't catch to the enclosing scope that does.
+        if ((mask & ((exception_mask_t) 1 << record.type)) == 0 && scope.previous != NULL) {
+            mach_exception_resume_landing(&scope.previous->point, record.type, record.code, record.subcode);
+        }
+        NSDictionary * userInfo = @{
+            MachExceptionCode : [NSNumber numberWithLongLong: record.code],
+            MachExceptionSubcode : [NSNumber numberWithLongLong: record.subcode]
+        };
+        *error = [NSError errorWithDomain: MachExceptionErrorDomain code: record.type userInfo: userInfo];
+        return NO;
+    }
+
+    mach_exception_metrics_scope_entered();
+    context->scope = &scope;
+
+    @try {
+        tryBlock();
+        return YES;
+    } @catch (NSException * exception) {
+        *error = [NSError errorWithDomain: exception.name code: 0 userInfo: nil];
+        return NO;
+    } @finally {
+        context->scope = scope.previous;
         finallyBlock();
     }
 }
 
++ (exception_mask_t) installedMask
+{
+    mach_exception_context_t * context = mach_exception_current_context;
+    return context == NULL ? 0 : context->installed_mask;
+}
+
++ (uint64_t) listenerWakeups
+{
+    return atomic_load_explicit(&mach_exception_listener_wakeup_count, memory_order_relaxed);
+}
+
++ (exception_mask_t) activeMask
+{
+    mach_exception_context_t * context = mach_exception_current_context;
+    return context == NULL || context->scope == NULL ? 0 : context->scope->combined_mask;
+}
+
 @end
+
+// MARK: - mach_exception_perform
+
+mach_exception_result_t mach_exception_perform_with_dependencies(exception_mask_t mask,
+                                                                 id<MachExceptionHelperDependencies> dependencies,
+                                                                 void (*operation)(void * context),
+                                                                 void (*finally)(void * context),
+                                                                 void * context,
+                                                                 mach_exception_record_t * record,
+                                                                 mach_exception_state_t * state,
+                                                                 int * error)
+{
+    mach_exception_context_t * exception_context;
+    kern_return_t code = mach_exception_context_prepare(mask, dependencies, &exception_context);
+    if (code != KERN_SUCCESS) {
+        *error = code;
+        return MACH_EXCEPTION_FAILURE;
+    }
+
+    mach_exception_scope_t scope;
+    scope.mask = mask;
+    scope.previous = exception_context->scope;
+    scope.combined_mask = scope.previous == NULL ? mask : mask | scope.previous->combined_mask;
+
+    // The listener suspends the faulting thread, rather than running a handler on it, and rewrites its state to
+    // resume here, so there is no signal mask to save or restore.
+    if (mach_exception_resume_enter(&scope.point) != 0) {
+        mach_exception_record_t caught = scope.point.record;
+        mach_exception_context_resumed(exception_context, caught.type);
+        exception_context->scope = scope.previous;
+        finally(context);
+
+        // The listener resumes the innermost scope, so that every scope's finally block executes. If this scope does
+        // not catch the exception, pass it on to the enclosing scope that does.
+        if (!(scope.mask & ((exception_mask_t) 1 << caught.type)) && scope.previous != NULL) {
+            mach_exception_resume_landing(&scope.previous->point, caught.type, caught.code, caught.subcode);
+        }
+        *record = caught;
+        if (state != NULL) {
+            *state = exception_context->state;
+        }
+        return MACH_EXCEPTION_CAUGHT;
+    }
+
+    mach_exception_metrics_scope_entered();
+    exception_context->scope = &scope;
+    operation(context);
+    exception_context->scope = scope.previous;
+    finally(context);
+    return MACH_EXCEPTION_COMPLETED;
+}
+
+// MARK: - mach_exception_fixup_prepare
+
+bool mach_exception_fixup_prepare(int * error)
+{
+    mach_exception_context_t * context;
+    kern_return_t code = mach_exception_context_prepare(EXC_MASK_BAD_ACCESS, nil, &context);
+    if (code != KERN_SUCCESS) {
+        *error = code;
+        return false;
+    }
+    return true;
+}
+
+mach_exception_result_t mach_exception_perform(exception_mask_t mask,
+                                               void (*operation)(void * context),
+                                               void (*finally)(void * context),
+                                               void * context,
+                                               mach_exception_record_t * record,
+                                               mach_exception_state_t * state,
+                                               int * error)
+{
+    return mach_exception_perform_with_dependencies(mask, nil, operation, finally, context, record, state, error);
+}
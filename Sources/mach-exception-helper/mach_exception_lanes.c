@@ -0,0 +1,388 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// mach-exception
+// mach_exception_lanes.c
+// Created by Patrick Gili on 2/16/23.
+//
+
+#include <string.h>
+#include "mach_exception_lanes.h"
+
+// The operations lane attribution re-executes.
+typedef enum mach_lanes_operation {
+    MACH_LANES_ADD,
+    MACH_LANES_SUBTRACT,
+    MACH_LANES_MULTIPLY,
+    MACH_LANES_DIVIDE,
+    MACH_LANES_SQUARE_ROOT,
+} mach_lanes_operation_t;
+
+// A decoded instruction. Lane `i` of the result is `first[i] operation second[i]`, or the square root of
+// `second[i]`.
+typedef struct mach_lanes_instruction {
+    mach_lanes_operation_t operation;
+    bool wide;
+    uint32_t count;
+    const uint8_t *first;
+    const uint8_t *second;
+} mach_lanes_instruction_t;
+
+static bool mach_exception_lanes_attribution;
+
+void mach_exception_lanes_set_enabled(bool enabled)
+{
+    __atomic_store_n(&mach_exception_lanes_attribution, enabled, __ATOMIC_RELAXED);
+}
+
+bool mach_exception_lanes_enabled(void)
+{
+    return __atomic_load_n(&mach_exception_lanes_attribution, __ATOMIC_RELAXED);
+}
+
+// MARK: - x86_64
+
+#if defined(__x86_64__)
+
+// The status flags of MXCSR, which occupy the same bits as the FE_* flags, and its mask bits.
+#define MACH_LANES_FLAG_INVALID      0x01u
+#define MACH_LANES_FLAG_DIVIDE       0x04u
+#define MACH_LANES_FLAG_OVERFLOW     0x08u
+#define MACH_LANES_FLAG_UNDERFLOW    0x10u
+#define MACH_LANES_FLAG_INEXACT      0x20u
+#define MACH_LANES_FLAGS             0x3fu
+#define MACH_LANES_MASKS             0x1f80u
+
+static inline uint32_t mach_lanes_read_control(void)
+{
+    uint32_t mxcsr;
+    __asm__ __volatile__("stmxcsr %0" : "=m"(mxcsr) : : "memory");
+    return mxcsr;
+}
+
+static inline void mach_lanes_write_control(uint32_t mxcsr)
+{
+    __asm__ __volatile__("ldmxcsr %0" : : "m"(mxcsr) : "memory");
+}
+
+// Re-execute one lane with every exception masked, keeping the faulting thread's rounding and denormal modes, and
+// return the status flags it raised.
+static uint32_t mach_lanes_execute(const mach_lanes_instruction_t *instruction,
+                                   const uint8_t *first,
+                                   const uint8_t *second,
+                                   uint64_t control)
+{
+    uint32_t saved = mach_lanes_read_control();
+    mach_lanes_write_control(((uint32_t) control | MACH_LANES_MASKS) & ~MACH_LANES_FLAGS);
+    if (instruction->wide) {
+        volatile double x, y, result;
+        memcpy((void *) &x, first, sizeof(double));
+        memcpy((void *) &y, second, sizeof(double));
+        double a = x, b = y, r;
+        switch (instruction->operation) {
+        case MACH_LANES_ADD: r = a + b; break;
+        case MACH_LANES_SUBTRACT: r = a - b; break;
+        case MACH_LANES_MULTIPLY: r = a * b; break;
+        case MACH_LANES_DIVIDE: r = a / b; break;
+        default: __asm__ __volatile__("sqrtsd %1, %0" : "=x"(r) : "x"(b)); break;
+        }
+        result = r;
+        (void) result;
+    } else {
+        volatile float x, y, result;
+        memcpy((void *) &x, first, sizeof(float));
+        memcpy((void *) &y, second, sizeof(float));
+        float a = x, b = y, r;
+        switch (instruction->operation) {
+        case MACH_LANES_ADD: r = a + b; break;
+        case MACH_LANES_SUBTRACT: r = a - b; break;
+        case MACH_LANES_MULTIPLY: r = a * b; break;
+        case MACH_LANES_DIVIDE: r = a / b; break;
+        default: __asm__ __volatile__("sqrtss %1, %0" : "=x"(r) : "x"(b)); break;
+        }
+        result = r;
+        (void) result;
+    }
+    uint32_t flags = mach_lanes_read_control() & MACH_LANES_FLAGS;
+    mach_lanes_write_control(saved);
+    return flags;
+}
+
+// Decode the SSE and VEX-encoded AVX forms of ADD, SUB, MUL, DIV and SQRT, packed and scalar, single and double
+// precision: 0F 58, 5C, 59, 5E and 51, with no prefix (ps), 66 (pd), F3 (ss) or F2 (sd).
+static bool mach_lanes_decode(const mach_exception_simd_state_t *state, mach_lanes_instruction_t *instruction)
+{
+    const uint8_t *p = (const uint8_t *)(uintptr_t) state->pc;
+    const uint8_t *end = p + 15;
+    unsigned pp = 0;
+    bool operand_size = false;
+    unsigned r = 0, x = 0, b = 0, vvvv = 0;
+    bool vex = false, ymm = false;
+
+    // Legacy prefixes. The FS and GS overrides, the address-size override and LOCK never precede these
+    // instructions in compiled code, so rather than handling them, leave such an instruction unattributed.
+    for (; p < end; p++) {
+        if (*p == 0x66) {
+            operand_size = true;
+        } else if (*p == 0xf3) {
+            pp = 2;
+        } else if (*p == 0xf2) {
+            pp = 3;
+        } else if (*p != 0x2e && *p != 0x36 && *p != 0x3e && *p != 0x26) {
+            break;
+        }
+    }
+    if (pp == 0 && operand_size) {
+        pp = 1;
+    }
+
+    if (*p == 0xc5) {
+        vex = true;
+        r = (~p[1] >> 7) & 1;
+        vvvv = (~p[1] >> 3) & 0xf;
+        ymm = (p[1] >> 2) & 1;
+        pp = p[1] & 3;
+        p += 2;
+    } else if (*p == 0xc4) {
+        // Only the 0F opcode map holds these instructions.
+        if ((p[1] & 0x1f) != 1) {
+            return false;
+        }
+        vex = true;
+        r = (~p[1] >> 7) & 1;
+        x = (~p[1] >> 6) & 1;
+        b = (~p[1] >> 5) & 1;
+        vvvv = (~p[2] >> 3) & 0xf;
+        ymm = (p[2] >> 2) & 1;
+        pp = p[2] & 3;
+        p += 3;
+    } else {
+        if ((*p & 0xf0) == 0x40) {
+            r = (*p >> 2) & 1;
+            x = (*p >> 1) & 1;
+            b = *p & 1;
+            p++;
+        }
+        if (*p != 0x0f) {
+            return false;
+        }
+        p++;
+    }
+
+    switch (*p++) {
+    case 0x58: instruction->operation = MACH_LANES_ADD; break;
+    case 0x5c: instruction->operation = MACH_LANES_SUBTRACT; break;
+    case 0x59: instruction->operation = MACH_LANES_MULTIPLY; break;
+    case 0x5e: instruction->operation = MACH_LANES_DIVIDE; break;
+    case 0x51: instruction->operation = MACH_LANES_SQUARE_ROOT; break;
+    default: return false;
+    }
+    if (ymm && !state->wide) {
+        return false;
+    }
+
+    uint8_t modrm = *p++;
+    unsigned mod = modrm >> 6;
+    unsigned reg = ((modrm >> 3) & 7) | (r << 3);
+    unsigned rm = (modrm & 7) | (b << 3);
+    if (mod == 3) {
+        instruction->second = state->vector[rm];
+    } else {
+        uint64_t address = 0;
+        bool relative = false;
+        if ((modrm & 7) == 4) {
+            uint8_t sib = *p++;
+            unsigned index = ((sib >> 3) & 7) | (x << 3);
+            unsigned base = (sib & 7) | (b << 3);
+            if (index != 4) {
+                address += state->gpr[index] << (sib >> 6);
+            }
+            if ((sib & 7) == 5 && mod == 0) {
+                mod = 2;
+            } else {
+                address += state->gpr[base];
+            }
+        } else if ((modrm & 7) == 5 && mod == 0) {
+            relative = true;
+            mod = 2;
+        } else {
+            address = state->gpr[rm];
+        }
+        if (mod == 1) {
+            address += (uint64_t)(int64_t)(int8_t) *p++;
+        } else if (mod == 2) {
+            int32_t displacement;
+            memcpy(&displacement, p, sizeof(displacement));
+            p += sizeof(displacement);
+            address += (uint64_t)(int64_t) displacement;
+        }
+        // These instructions take no immediate, so the instruction ends with the displacement.
+        if (relative) {
+            address += (uint64_t)(uintptr_t) p;
+        }
+        instruction->second = (const uint8_t *)(uintptr_t) address;
+    }
+    instruction->first = vex ? state->vector[vvvv] : state->vector[reg];
+    instruction->wide = pp == 1 || pp == 3;
+    instruction->count = pp >= 2 ? 1 : (ymm ? 32u : 16u) / (instruction->wide ? 8u : 4u);
+    return true;
+}
+
+// MARK: - arm64
+
+#elif defined(__aarch64__) || defined(__arm64__)
+
+// The cumulative exception bits of FPSR, and the trap enable bits of FPCR.
+#define MACH_LANES_FLAG_INVALID      0x01u
+#define MACH_LANES_FLAG_DIVIDE       0x02u
+#define MACH_LANES_FLAG_OVERFLOW     0x04u
+#define MACH_LANES_FLAG_UNDERFLOW    0x08u
+#define MACH_LANES_FLAG_INEXACT      0x10u
+#define MACH_LANES_FLAGS             0x9fu
+#define MACH_LANES_MASKS             0x9f00u
+
+// Re-execute one lane with every trap disabled, keeping the faulting thread's rounding and flush-to-zero modes, and
+// return the exceptions it raised.
+static uint32_t mach_lanes_execute(const mach_lanes_instruction_t *instruction,
+                                   const uint8_t *first,
+                                   const uint8_t *second,
+                                   uint64_t control)
+{
+    uint64_t saved_control, saved_status, status;
+    __asm__ __volatile__("mrs %0, fpcr" : "=r"(saved_control) : : "memory");
+    __asm__ __volatile__("mrs %0, fpsr" : "=r"(saved_status) : : "memory");
+    __asm__ __volatile__("msr fpcr, %0" : : "r"(control & ~(uint64_t) MACH_LANES_MASKS) : "memory");
+    __asm__ __volatile__("msr fpsr, %0" : : "r"((uint64_t) 0) : "memory");
+    if (instruction->wide) {
+        volatile double x, y, result;
+        memcpy((void *) &x, first, sizeof(double));
+        memcpy((void *) &y, second, sizeof(double));
+        double a = x, b = y, r;
+        switch (instruction->operation) {
+        case MACH_LANES_ADD: r = a + b; break;
+        case MACH_LANES_SUBTRACT: r = a - b; break;
+        case MACH_LANES_MULTIPLY: r = a * b; break;
+        case MACH_LANES_DIVIDE: r = a / b; break;
+        default: __asm__ __volatile__("fsqrt %d0, %d1" : "=w"(r) : "w"(b)); break;
+        }
+        result = r;
+        (void) result;
+    } else {
+        volatile float x, y, result;
+        memcpy((void *) &x, first, sizeof(float));
+        memcpy((void *) &y, second, sizeof(float));
+        float a = x, b = y, r;
+        switch (instruction->operation) {
+        case MACH_LANES_ADD: r = a + b; break;
+        case MACH_LANES_SUBTRACT: r = a - b; break;
+        case MACH_LANES_MULTIPLY: r = a * b; break;
+        case MACH_LANES_DIVIDE: r = a / b; break;
+        default: __asm__ __volatile__("fsqrt %s0, %s1" : "=w"(r) : "w"(b)); break;
+        }
+        result = r;
+        (void) result;
+    }
+    __asm__ __volatile__("mrs %0, fpsr" : "=r"(status) : : "memory");
+    __asm__ __volatile__("msr fpsr, %0" : : "r"(saved_status) : "memory");
+    __asm__ __volatile__("msr fpcr, %0" : : "r"(saved_control) : "memory");
+    return (uint32_t) status & MACH_LANES_FLAGS;
+}
+
+// Decode the Advanced SIMD and scalar forms of FADD, FSUB, FMUL, FDIV and FSQRT, single and double precision.
+static bool mach_lanes_decode(const mach_exception_simd_state_t *state, mach_lanes_instruction_t *instruction)
+{
+    uint32_t word;
+    memcpy(&word, (const void *)(uintptr_t) state->pc, sizeof(word));
+    unsigned n = (word >> 5) & 31;
+    unsigned m = (word >> 16) & 31;
+    bool q = (word >> 30) & 1;
+
+    if ((word & 0x9f200400u) == 0x0e200400u) {
+        // Three registers of the same type: 0 Q U 01110 a sz 1 Rm opcode 1 Rn Rd.
+        unsigned u = (word >> 29) & 1, a = (word >> 23) & 1, opcode = (word >> 11) & 0x1f;
+        if (u == 0 && a == 0 && opcode == 0x1a) {
+            instruction->operation = MACH_LANES_ADD;
+        } else if (u == 0 && a == 1 && opcode == 0x1a) {
+            instruction->operation = MACH_LANES_SUBTRACT;
+        } else if (u == 1 && a == 0 && opcode == 0x1b) {
+            instruction->operation = MACH_LANES_MULTIPLY;
+        } else if (u == 1 && a == 0 && opcode == 0x1f) {
+            instruction->operation = MACH_LANES_DIVIDE;
+        } else {
+            return false;
+        }
+        instruction->wide = (word >> 22) & 1;
+        instruction->first = state->vector[n];
+        instruction->second = state->vector[m];
+    } else if ((word & 0xbfbffc00u) == 0x2ea1f800u) {
+        // FSQRT (vector): 0 Q 1 01110 1 sz 10000 11111 10 Rn Rd.
+        instruction->operation = MACH_LANES_SQUARE_ROOT;
+        instruction->wide = (word >> 22) & 1;
+        instruction->first = state->vector[n];
+        instruction->second = state->vector[n];
+    } else if ((word & 0xff200c00u) == 0x1e200800u && ((word >> 22) & 3) <= 1 && ((word >> 12) & 0xf) <= 3) {
+        // Scalar, two sources: 000 11110 ftype 1 Rm opcode 10 Rn Rd.
+        static const mach_lanes_operation_t operations[] = {
+            MACH_LANES_MULTIPLY, MACH_LANES_DIVIDE, MACH_LANES_ADD, MACH_LANES_SUBTRACT,
+        };
+        instruction->operation = operations[(word >> 12) & 0xf];
+        instruction->wide = (word >> 22) & 1;
+        instruction->count = 1;
+        instruction->first = state->vector[n];
+        instruction->second = state->vector[m];
+        return true;
+    } else if ((word & 0xff3ffc00u) == 0x1e21c000u && ((word >> 22) & 3) <= 1) {
+        // FSQRT (scalar): 000 11110 ftype 1 000011 10000 Rn Rd.
+        instruction->operation = MACH_LANES_SQUARE_ROOT;
+        instruction->wide = (word >> 22) & 1;
+        instruction->count = 1;
+        instruction->first = state->vector[n];
+        instruction->second = state->vector[n];
+        return true;
+    } else {
+        return false;
+    }
+
+    // A vector of doubles fills the register.
+    if (instruction->wide && !q) {
+        return false;
+    }
+    instruction->count = (q ? 16u : 8u) / (instruction->wide ? 8u : 4u);
+    return true;
+}
+
+#endif
+
+// MARK: - mach_exception_lanes_attribute
+
+bool mach_exception_lanes_attribute(const mach_exception_simd_state_t *state, mach_exception_lanes_t *lanes)
+{
+    memset(lanes, 0, sizeof(*lanes));
+#if defined(__x86_64__) || defined(__aarch64__) || defined(__arm64__)
+    mach_lanes_instruction_t instruction;
+    if (state->pc == 0 || !mach_lanes_decode(state, &instruction)) {
+        return false;
+    }
+
+    size_t size = instruction.wide ? sizeof(double) : sizeof(float);
+    for (uint32_t lane = 0; lane < instruction.count; lane++) {
+        uint32_t flags = mach_lanes_execute(&instruction,
+                                            instruction.first + lane * size,
+                                            instruction.second + lane * size,
+                                            state->control);
+        uint32_t bit = (uint32_t) 1 << lane;
+        lanes->invalid |= (flags & MACH_LANES_FLAG_INVALID) ? bit : 0;
+        lanes->divide_by_zero |= (flags & MACH_LANES_FLAG_DIVIDE) ? bit : 0;
+        lanes->overflow |= (flags & MACH_LANES_FLAG_OVERFLOW) ? bit : 0;
+        lanes->underflow |= (flags & MACH_LANES_FLAG_UNDERFLOW) ? bit : 0;
+        lanes->inexact |= (flags & MACH_LANES_FLAG_INEXACT) ? bit : 0;
+    }
+    lanes->count = instruction.count;
+    lanes->width = (uint32_t) size * 8;
+    return true;
+#else
+    (void) state;
+    return false;
+#endif
+}
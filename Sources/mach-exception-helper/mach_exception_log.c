@@ -0,0 +1,459 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// mach-exception
+// mach_exception_log.c
+// Created by Patrick Gili on 2/8/23.
+//
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+#include "mach_exception_log.h"
+
+#ifndef __has_feature
+#define __has_feature(feature) 0
+#endif
+
+#if __has_feature(ptrauth_calls)
+#include <ptrauth.h>
+#endif
+
+_Static_assert(sizeof(mach_exception_log_header_t) == MACH_EXCEPTION_LOG_HEADER_SIZE,
+               "The log file header must match the file format");
+_Static_assert(sizeof(mach_exception_log_record_t) == MACH_EXCEPTION_LOG_RECORD_SIZE,
+               "The log record must match the file format");
+
+// MARK: - mach_exception_backtrace
+
+void mach_exception_backtrace_capture(mach_exception_backtrace_t *backtrace,
+                                      uint64_t pc,
+                                      uint64_t fp,
+                                      uint64_t stack_low,
+                                      uint64_t stack_high)
+{
+    backtrace->pc = pc;
+    backtrace->depth = 0;
+
+    // A frame record holds the caller's frame pointer, followed by the return address. The stack grows down, so
+    // each caller's frame record lies above its callee's; a frame pointer that doesn't is garbage, left by a frame
+    // compiled without one.
+    while (backtrace->depth < MACH_EXCEPTION_BACKTRACE_DEPTH &&
+           fp % sizeof(uint64_t) == 0 &&
+           fp >= stack_low &&
+           stack_high >= 2 * sizeof(uint64_t) &&
+           fp <= stack_high - 2 * sizeof(uint64_t)) {
+        const uint64_t *frame = (const uint64_t *)(uintptr_t) fp;
+        uint64_t address = frame[1];
+        if (address == 0) {
+            break;
+        }
+#if __has_feature(ptrauth_calls)
+        address = (uint64_t)(uintptr_t) ptrauth_strip((void *)(uintptr_t) address, ptrauth_key_return_address);
+#endif
+        backtrace->frames[backtrace->depth++] = address;
+        if (frame[0] <= fp) {
+            break;
+        }
+        fp = frame[0];
+    }
+
+    memset(&backtrace->frames[backtrace->depth],
+           0,
+           (MACH_EXCEPTION_BACKTRACE_DEPTH - backtrace->depth) * sizeof(uint64_t));
+}
+
+// MARK: - mach_exception_log
+
+// A mapped log file. Appending threads find the current file through the log, and count themselves as its writers
+// while they fill in a record, so rotating waits for them before unmapping the file. A thread may still count
+// itself as a writer of a file the log already retired, before noticing and moving on, so a file's descriptor
+// outlives its mapping, until the log is closed.
+typedef struct mach_exception_log_file {
+    mach_exception_log_header_t *header;
+    mach_exception_log_record_t *records;
+    size_t size;
+    uint64_t capacity;
+    uint64_t sequence;
+    uint64_t writers;
+    struct mach_exception_log_file *retired;
+} mach_exception_log_file_t;
+
+struct mach_exception_log {
+    char *path;
+    size_t file_size;
+    mach_exception_log_file_t *current;
+    mach_exception_log_file_t *retired;
+    pthread_mutex_t rotation;
+};
+
+int mach_exception_log_file_name(char *buffer, size_t size, const char *path, uint64_t sequence)
+{
+    return snprintf(buffer, size, "%s.%llu", path, (unsigned long long) sequence);
+}
+
+static bool mach_exception_log_header_valid(const mach_exception_log_header_t *header, size_t size)
+{
+    return __atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) == MACH_EXCEPTION_LOG_MAGIC &&
+           header->version == MACH_EXCEPTION_LOG_VERSION &&
+           header->header_size == MACH_EXCEPTION_LOG_HEADER_SIZE &&
+           header->record_size == MACH_EXCEPTION_LOG_RECORD_SIZE &&
+           header->capacity <= (size - MACH_EXCEPTION_LOG_HEADER_SIZE) / MACH_EXCEPTION_LOG_RECORD_SIZE;
+}
+
+// Map a log file, either for reading or for appending. Fails with `EINVAL` if the file isn't a valid log file.
+static void *mach_exception_log_map(const char *name, bool writable, size_t *size)
+{
+    int descriptor = open(name, (writable ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+    if (descriptor < 0) {
+        return NULL;
+    }
+
+    struct stat status;
+    if (fstat(descriptor, &status) != 0) {
+        int error = errno;
+        close(descriptor);
+        errno = error;
+        return NULL;
+    }
+    if (status.st_size < MACH_EXCEPTION_LOG_HEADER_SIZE) {
+        close(descriptor);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    *size = (size_t) status.st_size;
+    void *mapping = mmap(NULL, *size, PROT_READ | (writable ? PROT_WRITE : 0), MAP_SHARED, descriptor, 0);
+    int error = errno;
+    close(descriptor);
+    if (mapping == MAP_FAILED) {
+        errno = error;
+        return NULL;
+    }
+    if (!mach_exception_log_header_valid(mapping, *size)) {
+        munmap(mapping, *size);
+        errno = EINVAL;
+        return NULL;
+    }
+    return mapping;
+}
+
+static mach_exception_log_file_t *mach_exception_log_file_attach(mach_exception_log_header_t *header, size_t size)
+{
+    mach_exception_log_file_t *file = calloc(1, sizeof(mach_exception_log_file_t));
+    if (file == NULL) {
+        munmap(header, size);
+        errno = ENOMEM;
+        return NULL;
+    }
+    file->header = header;
+    file->records = (mach_exception_log_record_t *)((char *) header + MACH_EXCEPTION_LOG_HEADER_SIZE);
+    file->size = size;
+    file->capacity = header->capacity;
+    file->sequence = header->sequence;
+    return file;
+}
+
+// Where the platform allows, a new file's pages are mapped when it is created, so appending never takes a page fault.
+#if defined(MAP_POPULATE)
+#define MACH_EXCEPTION_LOG_POPULATE MAP_POPULATE
+#else
+#define MACH_EXCEPTION_LOG_POPULATE 0
+#endif
+
+// Create and map the log file with the given sequence number. The file's blocks are allocated up front, where the
+// platform allows, so appending never faults for lack of disk space. The magic number is stored last, so a reader
+// never sees a partially initialized header.
+static mach_exception_log_file_t *mach_exception_log_file_create(const mach_exception_log_t *log, uint64_t sequence)
+{
+    char name[PATH_MAX];
+    if (mach_exception_log_file_name(name, sizeof(name), log->path, sequence) >= (int) sizeof(name)) {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+
+    int descriptor = open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (descriptor < 0) {
+        return NULL;
+    }
+
+    int error = 0;
+    if (ftruncate(descriptor, (off_t) log->file_size) != 0) {
+        error = errno;
+    }
+#if defined(__linux__)
+    if (error == 0) {
+        error = posix_fallocate(descriptor, 0, (off_t) log->file_size);
+        if (error == EOPNOTSUPP || error == EINVAL) {
+            error = 0;
+        }
+    }
+#endif
+
+    void *mapping = MAP_FAILED;
+    if (error == 0) {
+        mapping = mmap(NULL, log->file_size, PROT_READ | PROT_WRITE, MAP_SHARED | MACH_EXCEPTION_LOG_POPULATE,
+                       descriptor, 0);
+        if (mapping == MAP_FAILED) {
+            error = errno;
+        }
+    }
+    close(descriptor);
+    if (error != 0) {
+        unlink(name);
+        errno = error;
+        return NULL;
+    }
+
+    mach_exception_log_header_t *header = mapping;
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    header->version = MACH_EXCEPTION_LOG_VERSION;
+    header->header_size = MACH_EXCEPTION_LOG_HEADER_SIZE;
+    header->record_size = MACH_EXCEPTION_LOG_RECORD_SIZE;
+    header->capacity = (log->file_size - MACH_EXCEPTION_LOG_HEADER_SIZE) / MACH_EXCEPTION_LOG_RECORD_SIZE;
+    header->sequence = sequence;
+    header->created = (uint64_t) now.tv_sec * 1000000000u + (uint64_t) now.tv_nsec;
+    __atomic_store_n(&header->magic, MACH_EXCEPTION_LOG_MAGIC, __ATOMIC_RELEASE);
+
+    return mach_exception_log_file_attach(header, log->file_size);
+}
+
+// Continue appending to the most recent of a log's files, if it has room, or start a new file after it.
+static mach_exception_log_file_t *mach_exception_log_file_resume(const mach_exception_log_t *log)
+{
+    char name[PATH_MAX];
+    uint64_t sequence = 0;
+    for (;;) {
+        if (mach_exception_log_file_name(name, sizeof(name), log->path, sequence) >= (int) sizeof(name)) {
+            errno = ENAMETOOLONG;
+            return NULL;
+        }
+        if (access(name, F_OK) != 0) {
+            break;
+        }
+        sequence++;
+    }
+
+    if (sequence > 0) {
+        mach_exception_log_file_name(name, sizeof(name), log->path, sequence - 1);
+        size_t size = 0;
+        mach_exception_log_header_t *header = mach_exception_log_map(name, true, &size);
+        if (header != NULL) {
+            if (__atomic_load_n(&header->tail, __ATOMIC_RELAXED) < header->capacity) {
+                return mach_exception_log_file_attach(header, size);
+            }
+            munmap(header, size);
+        }
+    }
+    return mach_exception_log_file_create(log, sequence);
+}
+
+mach_exception_log_t *mach_exception_log_open(const char *path, size_t file_size)
+{
+    if (file_size < MACH_EXCEPTION_LOG_HEADER_SIZE + MACH_EXCEPTION_LOG_RECORD_SIZE) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    mach_exception_log_t *log = calloc(1, sizeof(mach_exception_log_t));
+    if (log == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    log->path = strdup(path);
+    log->file_size = file_size;
+    if (log->path == NULL) {
+        free(log);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    log->current = mach_exception_log_file_resume(log);
+    if (log->current == NULL) {
+        int error = errno;
+        free(log->path);
+        free(log);
+        errno = error;
+        return NULL;
+    }
+    pthread_mutex_init(&log->rotation, NULL);
+    return log;
+}
+
+void mach_exception_log_close(mach_exception_log_t *log)
+{
+    munmap(log->current->header, log->current->size);
+    free(log->current);
+    mach_exception_log_file_t *file = log->retired;
+    while (file != NULL) {
+        mach_exception_log_file_t *retired = file->retired;
+        free(file);
+        file = retired;
+    }
+    pthread_mutex_destroy(&log->rotation);
+    free(log->path);
+    free(log);
+}
+
+uint64_t mach_exception_log_sequence(mach_exception_log_t *log)
+{
+    return __atomic_load_n(&log->current, __ATOMIC_ACQUIRE)->sequence;
+}
+
+// Replace a full file with the next one. Only the first of the threads that found the file full creates the next
+// one; the others find it already replaced. The full file is unmapped once its last writer finishes its record.
+static bool mach_exception_log_rotate(mach_exception_log_t *log, mach_exception_log_file_t *full)
+{
+    bool rotated = true;
+    pthread_mutex_lock(&log->rotation);
+    if (__atomic_load_n(&log->current, __ATOMIC_RELAXED) == full) {
+        mach_exception_log_file_t *file = mach_exception_log_file_create(log, full->sequence + 1);
+        if (file == NULL) {
+            rotated = false;
+        } else {
+            __atomic_store_n(&log->current, file, __ATOMIC_SEQ_CST);
+            while (__atomic_load_n(&full->writers, __ATOMIC_ACQUIRE) != 0) {
+                sched_yield();
+            }
+            munmap(full->header, full->size);
+            full->header = NULL;
+            full->records = NULL;
+            full->retired = log->retired;
+            log->retired = full;
+        }
+    }
+    pthread_mutex_unlock(&log->rotation);
+    return rotated;
+}
+
+// The operating system's identifier for the calling thread, which costs a system call on Linux, so each thread
+// looks it up once.
+static __thread uint64_t mach_exception_log_thread;
+
+static uint64_t mach_exception_log_thread_id(void)
+{
+    if (mach_exception_log_thread == 0) {
+#if defined(__APPLE__)
+        pthread_threadid_np(NULL, &mach_exception_log_thread);
+#else
+        mach_exception_log_thread = (uint64_t) syscall(SYS_gettid);
+#endif
+    }
+    return mach_exception_log_thread;
+}
+
+bool mach_exception_log_append(mach_exception_log_t *log,
+                               const mach_exception_record_t *record,
+                               const mach_exception_backtrace_t *backtrace)
+{
+    // Both platforms read the real-time clock without entering the kernel (through the vDSO on Linux, and the
+    // commpage on Darwin), so appending makes no system calls unless it rotates the log.
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    uint64_t thread = mach_exception_log_thread_id();
+
+    for (;;) {
+        // Announce the writer before checking that the file is still current, so that a rotation either sees the
+        // writer and waits for it, or the writer sees the rotation and retries with the next file.
+        mach_exception_log_file_t *file = __atomic_load_n(&log->current, __ATOMIC_ACQUIRE);
+        __atomic_add_fetch(&file->writers, 1, __ATOMIC_SEQ_CST);
+        if (file != __atomic_load_n(&log->current, __ATOMIC_SEQ_CST)) {
+            __atomic_sub_fetch(&file->writers, 1, __ATOMIC_RELEASE);
+            continue;
+        }
+
+        uint64_t slot = __atomic_fetch_add(&file->header->tail, 1, __ATOMIC_RELAXED);
+        if (slot < file->capacity) {
+            mach_exception_log_record_t *entry = &file->records[slot];
+            entry->version = MACH_EXCEPTION_LOG_VERSION;
+            entry->type = record->type;
+            entry->timestamp = (uint64_t) now.tv_sec * 1000000000u + (uint64_t) now.tv_nsec;
+            entry->thread = thread;
+            entry->code = record->code;
+            entry->subcode = record->subcode;
+            if (backtrace != NULL) {
+                entry->depth = (uint16_t) backtrace->depth;
+                entry->pc = backtrace->pc;
+                memcpy(entry->frames, backtrace->frames, sizeof(entry->frames));
+            }
+            __atomic_store_n(&entry->state, MACH_EXCEPTION_LOG_COMMITTED, __ATOMIC_RELEASE);
+            __atomic_sub_fetch(&file->writers, 1, __ATOMIC_RELEASE);
+            return true;
+        }
+
+        __atomic_sub_fetch(&file->writers, 1, __ATOMIC_RELEASE);
+        if (!mach_exception_log_rotate(log, file)) {
+            return false;
+        }
+    }
+}
+
+// MARK: - mach_exception_log_reader
+
+bool mach_exception_log_reader_open(mach_exception_log_reader_t *reader, const char *file)
+{
+    size_t size = 0;
+    const mach_exception_log_header_t *header = mach_exception_log_map(file, false, &size);
+    if (header == NULL) {
+        return false;
+    }
+    reader->header = header;
+    reader->size = size;
+    return true;
+}
+
+void mach_exception_log_reader_close(mach_exception_log_reader_t *reader)
+{
+    if (reader->header != NULL) {
+        munmap((void *) reader->header, reader->size);
+        reader->header = NULL;
+        reader->size = 0;
+    }
+}
+
+const mach_exception_log_record_t *mach_exception_log_reader_next(const mach_exception_log_reader_t *reader,
+                                                                  uint64_t *cursor,
+                                                                  bool skip_pending)
+{
+    const mach_exception_log_header_t *header = reader->header;
+    const mach_exception_log_record_t *records =
+        (const mach_exception_log_record_t *)((const char *) header + header->header_size);
+    uint64_t tail = __atomic_load_n(&header->tail, __ATOMIC_ACQUIRE);
+    uint64_t limit = tail < header->capacity ? tail : header->capacity;
+
+    while (*cursor < limit) {
+        const mach_exception_log_record_t *record = &records[*cursor];
+        if (__atomic_load_n(&record->state, __ATOMIC_ACQUIRE) == MACH_EXCEPTION_LOG_COMMITTED) {
+            *cursor += 1;
+            return record;
+        }
+        if (!skip_pending) {
+            return NULL;
+        }
+        *cursor += 1;
+    }
+    return NULL;
+}
+
+bool mach_exception_log_reader_full(const mach_exception_log_reader_t *reader)
+{
+    return __atomic_load_n(&reader->header->tail, __ATOMIC_ACQUIRE) >= reader->header->capacity;
+}
@@ -0,0 +1,679 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// mach-exception
+// mach_exception_metrics.c
+// Created by Patrick Gili on 2/24/23.
+//
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#include "mach_exception_metrics.h"
+
+#if defined(__aarch64__) || defined(__arm64__)
+#define MACH_EXCEPTION_METRICS_ARCH MACH_EXCEPTION_ARCH_ARM64
+#else
+#define MACH_EXCEPTION_METRICS_ARCH MACH_EXCEPTION_ARCH_X86_64
+#endif
+
+// A thread's shard. A retired shard belongs to a thread that exited, and the next snapshot folds it into the
+// retired totals and frees it.
+typedef struct mach_exception_metrics_shard {
+    mach_exception_metrics_t metrics;
+    bool retired;
+    struct mach_exception_metrics_shard *next;
+} __attribute__((aligned(64))) mach_exception_metrics_shard_t;
+
+// The thread-local shard pointer uses the initial-exec model on Linux, so a signal handler reads it with a single
+// load, rather than a call to __tls_get_addr, which isn't async-signal-safe.
+#if defined(__linux__)
+#define MACH_EXCEPTION_METRICS_THREAD_LOCAL __thread __attribute__((tls_model("initial-exec")))
+#else
+#define MACH_EXCEPTION_METRICS_THREAD_LOCAL __thread
+#endif
+
+// The calling thread's shard, or `NULL` if it has none.
+static MACH_EXCEPTION_METRICS_THREAD_LOCAL mach_exception_metrics_shard_t *mach_exception_metrics_current;
+
+// Every thread's shard. Threads push their shards onto the head of the list, and only snapshots unlink them.
+static mach_exception_metrics_shard_t *mach_exception_metrics_shards;
+
+// The shard of the threads without one, which they update with atomic additions.
+static mach_exception_metrics_t mach_exception_metrics_shared;
+
+// The sum of the shards of the threads that exited. Only snapshots touch it, holding the mutex.
+static mach_exception_metrics_t mach_exception_metrics_retired;
+
+static pthread_mutex_t mach_exception_metrics_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t mach_exception_metrics_once = PTHREAD_ONCE_INIT;
+static pthread_key_t mach_exception_metrics_key;
+static int mach_exception_metrics_key_error;
+
+// MARK: - Counting
+
+static void mach_exception_metrics_retire(void *value)
+{
+    mach_exception_metrics_shard_t *shard = value;
+    mach_exception_metrics_current = NULL;
+    __atomic_store_n(&shard->retired, true, __ATOMIC_RELEASE);
+}
+
+static void mach_exception_metrics_initialize(void)
+{
+    mach_exception_metrics_key_error = pthread_key_create(&mach_exception_metrics_key, mach_exception_metrics_retire);
+}
+
+bool mach_exception_metrics_prepare(void)
+{
+    if (mach_exception_metrics_current != NULL) {
+        return true;
+    }
+    pthread_once(&mach_exception_metrics_once, mach_exception_metrics_initialize);
+    if (mach_exception_metrics_key_error != 0) {
+        errno = mach_exception_metrics_key_error;
+        return false;
+    }
+
+    mach_exception_metrics_shard_t *shard = NULL;
+    if (posix_memalign((void **) &shard, 64, sizeof(mach_exception_metrics_shard_t)) != 0) {
+        errno = ENOMEM;
+        return false;
+    }
+    memset(shard, 0, sizeof(mach_exception_metrics_shard_t));
+
+    shard->next = __atomic_load_n(&mach_exception_metrics_shards, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&mach_exception_metrics_shards,
+                                        &shard->next,
+                                        shard,
+                                        true,
+                                        __ATOMIC_RELEASE,
+                                        __ATOMIC_RELAXED)) {
+    }
+    pthread_setspecific(mach_exception_metrics_key, shard);
+    mach_exception_metrics_current = shard;
+    return true;
+}
+
+uint64_t mach_exception_metrics_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000u + (uint64_t) now.tv_nsec;
+}
+
+// Add to a counter of the calling thread's shard, which only the calling thread writes, or, if the thread has no
+// shard, to the counter at the same offset in the shared shard.
+static void mach_exception_metrics_add(uint64_t *counter, uint64_t value)
+{
+    if (mach_exception_metrics_current != NULL) {
+        __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + value, __ATOMIC_RELAXED);
+    } else {
+        __atomic_add_fetch(counter, value, __ATOMIC_RELAXED);
+    }
+}
+
+// The calling thread's metrics, or the shared metrics if it has no shard.
+static mach_exception_metrics_t *mach_exception_metrics_local(void)
+{
+    mach_exception_metrics_shard_t *shard = mach_exception_metrics_current;
+    return shard != NULL ? &shard->metrics : &mach_exception_metrics_shared;
+}
+
+static size_t mach_exception_metrics_bucket(uint64_t nanoseconds)
+{
+    if (nanoseconds <= 1) {
+        return 0;
+    }
+    size_t bucket = (size_t) (64 - __builtin_clzll(nanoseconds - 1));
+    return bucket < MACH_EXCEPTION_METRICS_BUCKETS ? bucket : MACH_EXCEPTION_METRICS_BUCKETS - 1;
+}
+
+static void mach_exception_metrics_sample(mach_exception_histogram_t *histogram, uint64_t nanoseconds)
+{
+    mach_exception_metrics_add(&histogram->count, 1);
+    mach_exception_metrics_add(&histogram->sum, nanoseconds);
+    mach_exception_metrics_add(&histogram->buckets[mach_exception_metrics_bucket(nanoseconds)], 1);
+}
+
+static bool mach_exception_metrics_valid_type(exception_type_t type)
+{
+    return type > 0 && type < EXC_TYPES_COUNT;
+}
+
+void mach_exception_metrics_scope_entered(void)
+{
+    mach_exception_metrics_add(&mach_exception_metrics_local()->scopes_entered, 1);
+}
+
+void mach_exception_metrics_wakeup(void)
+{
+    mach_exception_metrics_add(&mach_exception_metrics_local()->listener_wakeups, 1);
+}
+
+void mach_exception_metrics_caught(const mach_exception_record_t *record, uint64_t nanoseconds)
+{
+    if (!mach_exception_metrics_valid_type(record->type)) {
+        return;
+    }
+    mach_exception_metrics_t *metrics = mach_exception_metrics_local();
+    mach_exception_metrics_add(&metrics->caught[mach_exception_metrics_family(record)], 1);
+    mach_exception_metrics_sample(&metrics->handler_latency[record->type], nanoseconds);
+}
+
+void mach_exception_metrics_forwarded(const mach_exception_record_t *record)
+{
+    if (!mach_exception_metrics_valid_type(record->type)) {
+        return;
+    }
+    mach_exception_metrics_add(&mach_exception_metrics_local()->forwarded[mach_exception_metrics_family(record)], 1);
+}
+
+void mach_exception_metrics_resumed(exception_type_t type, uint64_t nanoseconds)
+{
+    if (!mach_exception_metrics_valid_type(type)) {
+        return;
+    }
+    mach_exception_metrics_sample(&mach_exception_metrics_local()->resume_latency[type], nanoseconds);
+}
+
+// MARK: - Reading
+
+// Add every counter of `metrics` to `sum`. The metrics are an array of counters, which the owning thread updates
+// one at a time.
+static void mach_exception_metrics_accumulate(mach_exception_metrics_t *sum, const mach_exception_metrics_t *metrics)
+{
+    uint64_t *total = (uint64_t *) sum;
+    const uint64_t *counter = (const uint64_t *) metrics;
+    for (size_t index = 0; index < sizeof(mach_exception_metrics_t) / sizeof(uint64_t); index++) {
+        total[index] += __atomic_load_n(&counter[index], __ATOMIC_RELAXED);
+    }
+}
+
+// Unlink a shard whose thread exited. Threads only push shards onto the head of the list, so only unlinking the
+// head races with them.
+static void mach_exception_metrics_unlink(mach_exception_metrics_shard_t *previous,
+                                          mach_exception_metrics_shard_t *shard)
+{
+    if (previous != NULL) {
+        previous->next = shard->next;
+    } else {
+        mach_exception_metrics_shard_t *expected = shard;
+        if (!__atomic_compare_exchange_n(&mach_exception_metrics_shards,
+                                         &expected,
+                                         shard->next,
+                                         false,
+                                         __ATOMIC_ACQ_REL,
+                                         __ATOMIC_ACQUIRE)) {
+            // Shards were pushed in front of this one, so it now has a predecessor.
+            previous = expected;
+            while (previous->next != shard) {
+                previous = previous->next;
+            }
+            previous->next = shard->next;
+        }
+    }
+    free(shard);
+}
+
+void mach_exception_metrics_snapshot(mach_exception_metrics_t *metrics)
+{
+    memset(metrics, 0, sizeof(*metrics));
+    pthread_mutex_lock(&mach_exception_metrics_mutex);
+
+    mach_exception_metrics_shard_t *previous = NULL;
+    mach_exception_metrics_shard_t *shard = __atomic_load_n(&mach_exception_metrics_shards, __ATOMIC_ACQUIRE);
+    while (shard != NULL) {
+        mach_exception_metrics_shard_t *next = shard->next;
+        if (__atomic_load_n(&shard->retired, __ATOMIC_ACQUIRE)) {
+            mach_exception_metrics_accumulate(&mach_exception_metrics_retired, &shard->metrics);
+            mach_exception_metrics_unlink(previous, shard);
+        } else {
+            mach_exception_metrics_accumulate(metrics, &shard->metrics);
+            previous = shard;
+        }
+        shard = next;
+    }
+    mach_exception_metrics_accumulate(metrics, &mach_exception_metrics_retired);
+    mach_exception_metrics_accumulate(metrics, &mach_exception_metrics_shared);
+
+    pthread_mutex_unlock(&mach_exception_metrics_mutex);
+}
+
+size_t mach_exception_metrics_family(const mach_exception_record_t *record)
+{
+    mach_exception_cause_t cause = MACH_EXCEPTION_CAUSE_UNKNOWN;
+    uint32_t flavor, primary, secondary;
+    uint64_t detail;
+    const mach_exception_batch_t batch = { &cause, &flavor, &primary, &secondary, &detail };
+    int32_t type = record->type;
+    int64_t code = record->code;
+    int64_t subcode = record->subcode;
+    mach_exception_decode(MACH_EXCEPTION_METRICS_ARCH, &type, &code, &subcode, 1, &batch);
+    if (cause != MACH_EXCEPTION_CAUSE_UNKNOWN) {
+        return cause;
+    }
+    return MACH_EXCEPTION_CAUSE_COUNT + (mach_exception_metrics_valid_type(type) ? (size_t) type : 0);
+}
+
+exception_type_t mach_exception_metrics_family_type(size_t family)
+{
+    if (family >= MACH_EXCEPTION_CAUSE_COUNT) {
+        return (exception_type_t) (family - MACH_EXCEPTION_CAUSE_COUNT);
+    }
+    if (family >= MACH_EXCEPTION_CAUSE_GUARD_NONE) {
+        return EXC_GUARD;
+    }
+    if (family >= MACH_EXCEPTION_CAUSE_RESOURCE_CPU) {
+        return EXC_RESOURCE;
+    }
+    if (family >= MACH_EXCEPTION_CAUSE_BREAKPOINT) {
+        return EXC_BREAKPOINT;
+    }
+    if (family >= MACH_EXCEPTION_CAUSE_FP_UNDERFLOW) {
+        return EXC_ARITHMETIC;
+    }
+    if (family >= MACH_EXCEPTION_CAUSE_UNDEFINED_INSTRUCTION) {
+        return EXC_BAD_INSTRUCTION;
+    }
+    return family >= MACH_EXCEPTION_CAUSE_VM_FAULT ? EXC_BAD_ACCESS : 0;
+}
+
+static const char *const mach_exception_metrics_cause_names[MACH_EXCEPTION_CAUSE_COUNT] = {
+    [MACH_EXCEPTION_CAUSE_UNKNOWN] = "other",
+    [MACH_EXCEPTION_CAUSE_VM_FAULT] = "vm_fault",
+    [MACH_EXCEPTION_CAUSE_FPU_SEGMENT_FAULT] = "fpu_segment_fault",
+    [MACH_EXCEPTION_CAUSE_GENERAL_PROTECTION_FAULT] = "general_protection_fault",
+    [MACH_EXCEPTION_CAUSE_DATA_ACCESS_ALIGNMENT] = "data_access_alignment",
+    [MACH_EXCEPTION_CAUSE_DATA_ACCESS_DEBUG] = "data_access_debug",
+    [MACH_EXCEPTION_CAUSE_STACK_POINTER_ALIGNMENT] = "stack_pointer_alignment",
+    [MACH_EXCEPTION_CAUSE_SWP_INSTRUCTION] = "swp_instruction",
+    [MACH_EXCEPTION_CAUSE_POINTER_AUTHENTICATION_FAILURE] = "pointer_authentication_failure",
+    [MACH_EXCEPTION_CAUSE_UNDEFINED_INSTRUCTION] = "undefined_instruction",
+    [MACH_EXCEPTION_CAUSE_INVALID_TSS] = "invalid_tss",
+    [MACH_EXCEPTION_CAUSE_SEGMENT_NOT_PRESENT] = "segment_not_present",
+    [MACH_EXCEPTION_CAUSE_STACK_FAULT] = "stack_fault",
+    [MACH_EXCEPTION_CAUSE_INVALID_OPCODE] = "invalid_opcode",
+    [MACH_EXCEPTION_CAUSE_PAGE_FAULT] = "page_fault",
+    [MACH_EXCEPTION_CAUSE_FP_UNDERFLOW] = "fp_underflow",
+    [MACH_EXCEPTION_CAUSE_FP_OVERFLOW] = "fp_overflow",
+    [MACH_EXCEPTION_CAUSE_FP_INVALID_OPERATION] = "fp_invalid_operation",
+    [MACH_EXCEPTION_CAUSE_FP_DIVIDE_BY_ZERO] = "fp_divide_by_zero",
+    [MACH_EXCEPTION_CAUSE_FP_DENORMAL_INPUT] = "fp_denormal_input",
+    [MACH_EXCEPTION_CAUSE_FP_INEXACT_RESULT] = "fp_inexact_result",
+    [MACH_EXCEPTION_CAUSE_FP_UNDEFINED] = "fp_undefined",
+    [MACH_EXCEPTION_CAUSE_DIVIDE_ERROR] = "divide_error",
+    [MACH_EXCEPTION_CAUSE_INTEGER_OVERFLOW] = "integer_overflow",
+    [MACH_EXCEPTION_CAUSE_NO_FPU] = "no_fpu",
+    [MACH_EXCEPTION_CAUSE_FLOATING_POINT_ERROR] = "floating_point_error",
+    [MACH_EXCEPTION_CAUSE_SIMD_OPERATION_ERROR] = "simd_operation_error",
+    [MACH_EXCEPTION_CAUSE_BREAKPOINT] = "breakpoint",
+    [MACH_EXCEPTION_CAUSE_WATCHPOINT] = "watchpoint",
+    [MACH_EXCEPTION_CAUSE_SINGLE_STEP] = "single_step",
+    [MACH_EXCEPTION_CAUSE_DEBUG] = "debug",
+    [MACH_EXCEPTION_CAUSE_OUT_OF_BOUNDS] = "out_of_bounds",
+    [MACH_EXCEPTION_CAUSE_RESOURCE_CPU] = "resource_cpu",
+    [MACH_EXCEPTION_CAUSE_RESOURCE_WAKEUPS] = "resource_wakeups",
+    [MACH_EXCEPTION_CAUSE_RESOURCE_MEMORY] = "resource_memory",
+    [MACH_EXCEPTION_CAUSE_RESOURCE_IO] = "resource_io",
+    [MACH_EXCEPTION_CAUSE_RESOURCE_THREADS] = "resource_threads",
+    [MACH_EXCEPTION_CAUSE_GUARD_NONE] = "guard_none",
+    [MACH_EXCEPTION_CAUSE_GUARD_MACH_PORT] = "guard_mach_port",
+    [MACH_EXCEPTION_CAUSE_GUARD_FD] = "guard_fd",
+    [MACH_EXCEPTION_CAUSE_GUARD_USER] = "guard_user",
+    [MACH_EXCEPTION_CAUSE_GUARD_VNODE] = "guard_vnode",
+    [MACH_EXCEPTION_CAUSE_GUARD_VIRT_MEMORY] = "guard_virt_memory",
+};
+
+const char *mach_exception_metrics_family_name(size_t family)
+{
+    return family < MACH_EXCEPTION_CAUSE_COUNT ? mach_exception_metrics_cause_names[family] : "other";
+}
+
+static const char *const mach_exception_metrics_type_names[EXC_TYPES_COUNT] = {
+    [EXC_BAD_ACCESS] = "bad_access",
+    [EXC_BAD_INSTRUCTION] = "bad_instruction",
+    [EXC_ARITHMETIC] = "arithmetic",
+    [EXC_EMULATION] = "emulation",
+    [EXC_SOFTWARE] = "software",
+    [EXC_BREAKPOINT] = "breakpoint",
+    [EXC_SYSCALL] = "syscall",
+    [EXC_MACH_SYSCALL] = "mach_syscall",
+    [EXC_RPC_ALERT] = "rpc_alert",
+    [EXC_CRASH] = "crash",
+    [EXC_RESOURCE] = "resource",
+    [EXC_GUARD] = "guard",
+    [EXC_CORPSE_NOTIFY] = "corpse_notify",
+};
+
+const char *mach_exception_metrics_type_name(exception_type_t type)
+{
+    return mach_exception_metrics_valid_type(type) ? mach_exception_metrics_type_names[type] : NULL;
+}
+
+// MARK: - Exposition
+
+// An output buffer that, like snprintf, counts the characters that don't fit.
+typedef struct mach_exception_metrics_output {
+    char *buffer;
+    size_t size;
+    size_t length;
+} mach_exception_metrics_output_t;
+
+__attribute__((format(printf, 2, 3)))
+static void mach_exception_metrics_print(mach_exception_metrics_output_t *output, const char *format, ...)
+{
+    va_list arguments;
+    va_start(arguments, format);
+    size_t available = output->length < output->size ? output->size - output->length : 0;
+    int length = vsnprintf(available > 0 ? output->buffer + output->length : NULL, available, format, arguments);
+    va_end(arguments);
+    if (length > 0) {
+        output->length += (size_t) length;
+    }
+}
+
+static void mach_exception_metrics_print_families(mach_exception_metrics_output_t *output,
+                                                  const char *name,
+                                                  const char *help,
+                                                  const uint64_t *counts)
+{
+    mach_exception_metrics_print(output, "# HELP mach_exception_%s_total %s\n", name, help);
+    mach_exception_metrics_print(output, "# TYPE mach_exception_%s_total counter\n", name);
+    for (size_t family = 0; family < MACH_EXCEPTION_METRICS_FAMILIES; family++) {
+        const char *type = mach_exception_metrics_type_name(mach_exception_metrics_family_type(family));
+        if (counts[family] != 0 && type != NULL) {
+            mach_exception_metrics_print(output,
+                                         "mach_exception_%s_total{type=\"%s\",family=\"%s\"} %llu\n",
+                                         name,
+                                         type,
+                                         mach_exception_metrics_family_name(family),
+                                         (unsigned long long) counts[family]);
+        }
+    }
+}
+
+static void mach_exception_metrics_print_histograms(mach_exception_metrics_output_t *output,
+                                                    const char *name,
+                                                    const char *help,
+                                                    const mach_exception_histogram_t *histograms)
+{
+    mach_exception_metrics_print(output, "# HELP mach_exception_%s_seconds %s\n", name, help);
+    mach_exception_metrics_print(output, "# TYPE mach_exception_%s_seconds histogram\n", name);
+    for (exception_type_t type = 1; type < EXC_TYPES_COUNT; type++) {
+        const mach_exception_histogram_t *histogram = &histograms[type];
+        if (histogram->count == 0) {
+            continue;
+        }
+        const char *type_name = mach_exception_metrics_type_name(type);
+        uint64_t cumulative = 0;
+        for (size_t bucket = 0; bucket < MACH_EXCEPTION_METRICS_BUCKETS - 1; bucket++) {
+            cumulative += histogram->buckets[bucket];
+            mach_exception_metrics_print(output,
+                                         "mach_exception_%s_seconds_bucket{type=\"%s\",le=\"%.9g\"} %llu\n",
+                                         name,
+                                         type_name,
+                                         (double) ((uint64_t) 1 << bucket) / 1e9,
+                                         (unsigned long long) cumulative);
+        }
+        mach_exception_metrics_print(output,
+                                     "mach_exception_%s_seconds_bucket{type=\"%s\",le=\"+Inf\"} %llu\n",
+                                     name,
+                                     type_name,
+                                     (unsigned long long) histogram->count);
+        mach_exception_metrics_print(output,
+                                     "mach_exception_%s_seconds_sum{type=\"%s\"} %.9f\n",
+                                     name,
+                                     type_name,
+                                     (double) histogram->sum / 1e9);
+        mach_exception_metrics_print(output,
+                                     "mach_exception_%s_seconds_count{type=\"%s\"} %llu\n",
+                                     name,
+                                     type_name,
+                                     (unsigned long long) histogram->count);
+    }
+}
+
+size_t mach_exception_metrics_format(const mach_exception_metrics_t *metrics, char *buffer, size_t size)
+{
+    mach_exception_metrics_output_t output = { buffer, size, 0 };
+    if (size > 0) {
+        buffer[0] = '\0';
+    }
+    mach_exception_metrics_print(&output,
+                                 "# HELP mach_exception_scopes_entered_total Scopes entered.\n"
+                                 "# TYPE mach_exception_scopes_entered_total counter\n"
+                                 "mach_exception_scopes_entered_total %llu\n",
+                                 (unsigned long long) metrics->scopes_entered);
+    mach_exception_metrics_print(&output,
+                                 "# HELP mach_exception_listener_wakeups_total Times the exception handler woke.\n"
+                                 "# TYPE mach_exception_listener_wakeups_total counter\n"
+                                 "mach_exception_listener_wakeups_total %llu\n",
+                                 (unsigned long long) metrics->listener_wakeups);
+    mach_exception_metrics_print_families(&output, "faults_caught", "Faults a scope caught.", metrics->caught);
+    mach_exception_metrics_print_families(&output,
+                                          "faults_forwarded",
+                                          "Faults passed on to the previous handler.",
+                                          metrics->forwarded);
+    mach_exception_metrics_print_histograms(&output,
+                                            "handler_latency",
+                                            "Time from the handler starting to handle a fault to its resuming the "
+                                            "faulting thread.",
+                                            metrics->handler_latency);
+    mach_exception_metrics_print_histograms(&output,
+                                            "resume_latency",
+                                            "Time from the handler resuming the faulting thread to the thread "
+                                            "reaching its scope.",
+                                            metrics->resume_latency);
+    return output.length;
+}
+
+// Format a snapshot of the metrics into a buffer allocated with malloc, which the caller frees.
+static char *mach_exception_metrics_exposition(size_t *length)
+{
+    mach_exception_metrics_t metrics;
+    mach_exception_metrics_snapshot(&metrics);
+    size_t size = mach_exception_metrics_format(&metrics, NULL, 0) + 1;
+    char *buffer = malloc(size);
+    if (buffer == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    *length = mach_exception_metrics_format(&metrics, buffer, size);
+    return buffer;
+}
+
+// A peer closing its connection early must not raise SIGPIPE in the process.
+#if defined(MSG_NOSIGNAL)
+#define MACH_EXCEPTION_METRICS_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define MACH_EXCEPTION_METRICS_SEND_FLAGS 0
+#endif
+
+// Write a buffer to a file, or, if `flags` isn't 0, send it on a socket with those flags.
+static bool mach_exception_metrics_write_all(int descriptor, const char *buffer, size_t length, int flags)
+{
+    while (length > 0) {
+        ssize_t written = flags != 0 ? send(descriptor, buffer, length, flags) : write(descriptor, buffer, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        buffer += written;
+        length -= (size_t) written;
+    }
+    return true;
+}
+
+bool mach_exception_metrics_write(const char *path)
+{
+    size_t length;
+    char *exposition = mach_exception_metrics_exposition(&length);
+    if (exposition == NULL) {
+        return false;
+    }
+
+    // Write a temporary file beside the destination, then rename it over the destination.
+    size_t path_length = strlen(path);
+    char *temporary = malloc(path_length + sizeof(".XXXXXX"));
+    if (temporary == NULL) {
+        free(exposition);
+        errno = ENOMEM;
+        return false;
+    }
+    memcpy(temporary, path, path_length);
+    memcpy(temporary + path_length, ".XXXXXX", sizeof(".XXXXXX"));
+
+    int descriptor = mkstemp(temporary);
+    bool written = descriptor >= 0 &&
+                   fchmod(descriptor, 0644) == 0 &&
+                   mach_exception_metrics_write_all(descriptor, exposition, length, 0);
+    if (descriptor >= 0) {
+        written = close(descriptor) == 0 && written;
+        written = written && rename(temporary, path) == 0;
+        if (!written) {
+            int error = errno;
+            unlink(temporary);
+            errno = error;
+        }
+    }
+    free(temporary);
+    free(exposition);
+    return written;
+}
+
+// MARK: - Server
+
+struct mach_exception_metrics_server {
+    int socket;
+    int stop[2];
+    pthread_t thread;
+    struct sockaddr_un address;
+};
+
+static void * mach_exception_metrics_server_thread(void *argument)
+{
+    mach_exception_metrics_server_t *server = argument;
+    struct pollfd descriptors[2] = {
+        { .fd = server->socket, .events = POLLIN },
+        { .fd = server->stop[0], .events = POLLIN },
+    };
+
+    for (;;) {
+        if (poll(descriptors, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (descriptors[1].revents & POLLIN) {
+            break;
+        }
+        int connection = accept(server->socket, NULL, NULL);
+        if (connection < 0) {
+            continue;
+        }
+        // A connection accepted on Darwin inherits the listening socket's O_NONBLOCK.
+        fcntl(connection, F_SETFL, 0);
+#if defined(SO_NOSIGPIPE)
+        int enable = 1;
+        setsockopt(connection, SOL_SOCKET, SO_NOSIGPIPE, &enable, sizeof(enable));
+#endif
+        size_t length;
+        char *exposition = mach_exception_metrics_exposition(&length);
+        if (exposition != NULL) {
+            mach_exception_metrics_write_all(connection, exposition, length, MACH_EXCEPTION_METRICS_SEND_FLAGS);
+            free(exposition);
+        }
+        close(connection);
+    }
+    return NULL;
+}
+
+mach_exception_metrics_server_t *mach_exception_metrics_server_start(const char *path)
+{
+    mach_exception_metrics_server_t *server = calloc(1, sizeof(*server));
+    if (server == NULL) {
+        return NULL;
+    }
+    server->socket = -1;
+    server->stop[0] = -1;
+    server->stop[1] = -1;
+    server->address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(server->address.sun_path)) {
+        free(server);
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+    strcpy(server->address.sun_path, path);
+
+    int error;
+    server->socket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server->socket < 0) {
+        goto failed;
+    }
+    fcntl(server->socket, F_SETFD, FD_CLOEXEC);
+    // Accepting a connection whose client already went away must not block the server.
+    fcntl(server->socket, F_SETFL, O_NONBLOCK);
+    unlink(path);
+    if (bind(server->socket, (const struct sockaddr *) &server->address, sizeof(server->address)) != 0 ||
+        listen(server->socket, 16) != 0) {
+        goto failed;
+    }
+    if (pipe(server->stop) != 0) {
+        goto failed;
+    }
+    error = pthread_create(&server->thread, NULL, mach_exception_metrics_server_thread, server);
+    if (error != 0) {
+        errno = error;
+        goto failed;
+    }
+    return server;
+
+failed:
+    error = errno;
+    if (server->stop[0] >= 0) {
+        close(server->stop[0]);
+        close(server->stop[1]);
+    }
+    if (server->socket >= 0) {
+        close(server->socket);
+        unlink(path);
+    }
+    free(server);
+    errno = error;
+    return NULL;
+}
+
+void mach_exception_metrics_server_stop(mach_exception_metrics_server_t *server)
+{
+    if (server == NULL) {
+        return;
+    }
+    char stop = 1;
+    if (write(server->stop[1], &stop, sizeof(stop)) == sizeof(stop)) {
+        pthread_join(server->thread, NULL);
+    }
+    close(server->stop[0]);
+    close(server->stop[1]);
+    close(server->socket);
+    unlink(server->address.sun_path);
+    free(server);
+}
@@ -0,0 +1,78 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// mach-exception
+// mach_exception_resolver.c
+// Created by Patrick Gili on 2/18/23.
+//
+
+#include <errno.h>
+#include <pthread.h>
+#include <stddef.h>
+#include "mach_exception_resolver.h"
+
+// A registered resolver. A slot is free while its size is 0. Registration fills in the other fields before it
+// releases the size, so the fault path, which acquires the size, sees a complete slot.
+typedef struct mach_exception_resolver_slot {
+    uint64_t base;
+    uint64_t size;
+    mach_exception_resolver_t resolver;
+    void *context;
+} mach_exception_resolver_slot_t;
+
+static mach_exception_resolver_slot_t mach_exception_resolvers[MACH_EXCEPTION_RESOLVERS_MAX];
+
+// Serializes registration; the fault path never takes it.
+static pthread_mutex_t mach_exception_resolver_lock = PTHREAD_MUTEX_INITIALIZER;
+
+bool mach_exception_resolver_register(uint64_t base,
+                                      uint64_t size,
+                                      mach_exception_resolver_t resolver,
+                                      void *context)
+{
+    if (size == 0 || resolver == NULL) {
+        errno = EINVAL;
+        return false;
+    }
+    pthread_mutex_lock(&mach_exception_resolver_lock);
+    for (size_t index = 0; index < MACH_EXCEPTION_RESOLVERS_MAX; index++) {
+        mach_exception_resolver_slot_t *slot = &mach_exception_resolvers[index];
+        if (__atomic_load_n(&slot->size, __ATOMIC_RELAXED) == 0) {
+            slot->base = base;
+            slot->resolver = resolver;
+            slot->context = context;
+            __atomic_store_n(&slot->size, size, __ATOMIC_RELEASE);
+            pthread_mutex_unlock(&mach_exception_resolver_lock);
+            return true;
+        }
+    }
+    pthread_mutex_unlock(&mach_exception_resolver_lock);
+    errno = ENOSPC;
+    return false;
+}
+
+void mach_exception_resolver_unregister(uint64_t base)
+{
+    pthread_mutex_lock(&mach_exception_resolver_lock);
+    for (size_t index = 0; index < MACH_EXCEPTION_RESOLVERS_MAX; index++) {
+        mach_exception_resolver_slot_t *slot = &mach_exception_resolvers[index];
+        if (__atomic_load_n(&slot->size, __ATOMIC_RELAXED) != 0 && slot->base == base) {
+            __atomic_store_n(&slot->size, 0, __ATOMIC_RELEASE);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&mach_exception_resolver_lock);
+}
+
+bool mach_exception_resolve(uint64_t address)
+{
+    for (size_t index = 0; index < MACH_EXCEPTION_RESOLVERS_MAX; index++) {
+        mach_exception_resolver_slot_t *slot = &mach_exception_resolvers[index];
+        uint64_t size = __atomic_load_n(&slot->size, __ATOMIC_ACQUIRE);
+        if (size != 0 && address - slot->base < size) {
+            return slot->resolver(address, slot->context);
+        }
+    }
+    return false;
+}
@@ -0,0 +1,200 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// mach-exception
+// mach_exception_resume.c
+// Created by Patrick Gili on 3/1/23.
+//
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include <stddef.h>
+#include <string.h>
+#if defined(__linux__)
+#include <ucontext.h>
+#elif defined(__APPLE__)
+#include <mach/mach.h>
+#endif
+#include "mach_exception_resume.h"
+
+// The landing pad stores the record at a fixed offset in the resume point.
+_Static_assert(offsetof(mach_exception_resume_point_t, record) == 168, "resume point layout");
+_Static_assert(offsetof(mach_exception_record_t, code) == 8, "exception record layout");
+
+// MARK: - Context layouts
+
+const mach_exception_resume_layout_t mach_exception_resume_linux_x86_64 = {
+    .pc = 168,                                  // uc_mcontext.gregs[REG_RIP]
+    .sp = 160,                                  // uc_mcontext.gregs[REG_RSP]
+    .arguments = { 104, 112, 136, 152 },        // REG_RDI, REG_RSI, REG_RDX, REG_RCX
+};
+
+const mach_exception_resume_layout_t mach_exception_resume_linux_arm64 = {
+    .pc = 440,                                  // uc_mcontext.pc
+    .sp = 432,                                  // uc_mcontext.sp
+    .arguments = { 184, 192, 200, 208 },        // uc_mcontext.regs[0...3]
+};
+
+const mach_exception_resume_layout_t mach_exception_resume_darwin_x86_64 = {
+    .pc = 128,                                  // __rip
+    .sp = 56,                                   // __rsp
+    .arguments = { 32, 40, 24, 16 },            // __rdi, __rsi, __rdx, __rcx
+};
+
+const mach_exception_resume_layout_t mach_exception_resume_darwin_arm64 = {
+    .pc = 256,                                  // __pc
+    .sp = 248,                                  // __sp
+    .arguments = { 0, 8, 16, 24 },              // __x[0...3]
+};
+
+// Check the host's layout against its headers.
+#if defined(__linux__) && defined(__x86_64__)
+#define MACH_EXCEPTION_RESUME_HOST mach_exception_resume_linux_x86_64
+_Static_assert(offsetof(ucontext_t, uc_mcontext.gregs[REG_RIP]) == 168, "ucontext_t layout");
+_Static_assert(offsetof(ucontext_t, uc_mcontext.gregs[REG_RSP]) == 160, "ucontext_t layout");
+_Static_assert(offsetof(ucontext_t, uc_mcontext.gregs[REG_RDI]) == 104, "ucontext_t layout");
+_Static_assert(offsetof(ucontext_t, uc_mcontext.gregs[REG_RCX]) == 152, "ucontext_t layout");
+#elif defined(__linux__) && defined(__aarch64__)
+#define MACH_EXCEPTION_RESUME_HOST mach_exception_resume_linux_arm64
+_Static_assert(offsetof(ucontext_t, uc_mcontext.pc) == 440, "ucontext_t layout");
+_Static_assert(offsetof(ucontext_t, uc_mcontext.sp) == 432, "ucontext_t layout");
+_Static_assert(offsetof(ucontext_t, uc_mcontext.regs) == 184, "ucontext_t layout");
+#elif defined(__APPLE__) && defined(__x86_64__)
+#define MACH_EXCEPTION_RESUME_HOST mach_exception_resume_darwin_x86_64
+_Static_assert(offsetof(_STRUCT_X86_THREAD_STATE64, __rip) == 128, "x86_THREAD_STATE64 layout");
+_Static_assert(offsetof(_STRUCT_X86_THREAD_STATE64, __rsp) == 56, "x86_THREAD_STATE64 layout");
+_Static_assert(offsetof(_STRUCT_X86_THREAD_STATE64, __rdi) == 32, "x86_THREAD_STATE64 layout");
+_Static_assert(offsetof(_STRUCT_X86_THREAD_STATE64, __rcx) == 16, "x86_THREAD_STATE64 layout");
+#elif defined(__APPLE__) && defined(__arm64__)
+#define MACH_EXCEPTION_RESUME_HOST mach_exception_resume_darwin_arm64
+_Static_assert(offsetof(_STRUCT_ARM_THREAD_STATE64, __pc) == 256, "ARM_THREAD_STATE64 layout");
+_Static_assert(offsetof(_STRUCT_ARM_THREAD_STATE64, __sp) == 248, "ARM_THREAD_STATE64 layout");
+_Static_assert(offsetof(_STRUCT_ARM_THREAD_STATE64, __x) == 0, "ARM_THREAD_STATE64 layout");
+#else
+#error Unsupported architecture
+#endif
+
+const mach_exception_resume_layout_t *const mach_exception_resume_host_layout = &MACH_EXCEPTION_RESUME_HOST;
+
+// MARK: - mach_exception_resume_rewrite
+
+static void mach_exception_resume_store(void *context, uint16_t offset, uint64_t value)
+{
+    memcpy((char *) context + offset, &value, sizeof(value));
+}
+
+void mach_exception_resume_rewrite(const mach_exception_resume_layout_t *layout,
+                                   void *context,
+                                   const mach_exception_resume_point_t *point,
+                                   const mach_exception_record_t *record)
+{
+    mach_exception_resume_store(context, layout->pc, (uint64_t)(uintptr_t) mach_exception_resume_landing);
+    mach_exception_resume_store(context, layout->sp, point->sp);
+    mach_exception_resume_store(context, layout->arguments[0], (uint64_t)(uintptr_t) point);
+    mach_exception_resume_store(context, layout->arguments[1], (uint64_t)(uint32_t) record->type);
+    mach_exception_resume_store(context, layout->arguments[2], (uint64_t) record->code);
+    mach_exception_resume_store(context, layout->arguments[3], (uint64_t) record->subcode);
+}
+
+// MARK: - Resume point and landing pad
+
+// The functions are written in assembly, as no C function can record its caller's preserved registers, or return
+// from a call a second time. Both leave the platform register (x18 on arm64) alone.
+#if defined(__APPLE__)
+#define MACH_EXCEPTION_RESUME_FUNCTION(name)                                                                          \
+    ".globl _" #name "\n"                                                                                              \
+    ".p2align 4\n"                                                                                                     \
+    "_" #name ":\n"
+#define MACH_EXCEPTION_RESUME_END(name)
+#else
+#define MACH_EXCEPTION_RESUME_FUNCTION(name)                                                                          \
+    ".globl " #name "\n"                                                                                               \
+    ".type " #name ", %function\n"                                                                                     \
+    ".p2align 4\n"                                                                                                     \
+    #name ":\n"
+#define MACH_EXCEPTION_RESUME_END(name)                                                                               \
+    ".size " #name ", . - " #name "\n"
+#endif
+
+#if defined(__x86_64__)
+
+// The point's pc is the call's return address, and its sp the stack pointer after returning.
+__asm__(
+    ".text\n"
+    MACH_EXCEPTION_RESUME_FUNCTION(mach_exception_resume_enter)
+    "    movq (%rsp), %rax\n"
+    "    movq %rax, 0(%rdi)\n"
+    "    leaq 8(%rsp), %rax\n"
+    "    movq %rax, 8(%rdi)\n"
+    "    movq %rbx, 16(%rdi)\n"
+    "    movq %rbp, 24(%rdi)\n"
+    "    movq %r12, 32(%rdi)\n"
+    "    movq %r13, 40(%rdi)\n"
+    "    movq %r14, 48(%rdi)\n"
+    "    movq %r15, 56(%rdi)\n"
+    "    xorl %eax, %eax\n"
+    "    ret\n"
+    MACH_EXCEPTION_RESUME_END(mach_exception_resume_enter)
+
+    MACH_EXCEPTION_RESUME_FUNCTION(mach_exception_resume_landing)
+    "    movq 8(%rdi), %rsp\n"
+    "    movl %esi, 168(%rdi)\n"
+    "    movq %rdx, 176(%rdi)\n"
+    "    movq %rcx, 184(%rdi)\n"
+    "    movq 16(%rdi), %rbx\n"
+    "    movq 24(%rdi), %rbp\n"
+    "    movq 32(%rdi), %r12\n"
+    "    movq 40(%rdi), %r13\n"
+    "    movq 48(%rdi), %r14\n"
+    "    movq 56(%rdi), %r15\n"
+    "    movl %esi, %eax\n"
+    "    jmpq *0(%rdi)\n"
+    MACH_EXCEPTION_RESUME_END(mach_exception_resume_landing)
+);
+
+#elif defined(__aarch64__) || defined(__arm64__)
+
+// The point's pc is the link register, and its sp the stack pointer of the call.
+__asm__(
+    ".text\n"
+    MACH_EXCEPTION_RESUME_FUNCTION(mach_exception_resume_enter)
+    "    mov x16, sp\n"
+    "    stp x30, x16, [x0, #0]\n"
+    "    stp x19, x20, [x0, #16]\n"
+    "    stp x21, x22, [x0, #32]\n"
+    "    stp x23, x24, [x0, #48]\n"
+    "    stp x25, x26, [x0, #64]\n"
+    "    stp x27, x28, [x0, #80]\n"
+    "    str x29, [x0, #96]\n"
+    "    stp d8, d9, [x0, #104]\n"
+    "    stp d10, d11, [x0, #120]\n"
+    "    stp d12, d13, [x0, #136]\n"
+    "    stp d14, d15, [x0, #152]\n"
+    "    mov w0, #0\n"
+    "    ret\n"
+    MACH_EXCEPTION_RESUME_END(mach_exception_resume_enter)
+
+    MACH_EXCEPTION_RESUME_FUNCTION(mach_exception_resume_landing)
+    "    ldp x30, x16, [x0, #0]\n"
+    "    mov sp, x16\n"
+    "    str w1, [x0, #168]\n"
+    "    stp x2, x3, [x0, #176]\n"
+    "    ldp x19, x20, [x0, #16]\n"
+    "    ldp x21, x22, [x0, #32]\n"
+    "    ldp x23, x24, [x0, #48]\n"
+    "    ldp x25, x26, [x0, #64]\n"
+    "    ldp x27, x28, [x0, #80]\n"
+    "    ldr x29, [x0, #96]\n"
+    "    ldp d8, d9, [x0, #104]\n"
+    "    ldp d10, d11, [x0, #120]\n"
+    "    ldp d12, d13, [x0, #136]\n"
+    "    ldp d14, d15, [x0, #152]\n"
+    "    mov w0, w1\n"
+    "    ret\n"
+    MACH_EXCEPTION_RESUME_END(mach_exception_resume_landing)
+);
+
+#endif
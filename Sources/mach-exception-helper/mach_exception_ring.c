@@ -0,0 +1,204 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// mach-exception
+// mach_exception_ring.c
+// Created by Patrick Gili on 2/10/23.
+//
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+#include "mach_exception_ring.h"
+
+#define MACH_EXCEPTION_RING_MASK (MACH_EXCEPTION_RING_CAPACITY - 1)
+
+_Static_assert((MACH_EXCEPTION_RING_CAPACITY & MACH_EXCEPTION_RING_MASK) == 0,
+               "The ring's capacity must be a power of two");
+
+// A thread's ring. The producer owns the head and the published count, and the collector owns the tail; each sits
+// on its own cache line, so the producer and the collector don't contend for them. A retired ring belongs to a
+// thread that exited, and the collector frees it once it is empty.
+typedef struct mach_exception_ring {
+    uint64_t head __attribute__((aligned(64)));
+    uint64_t published;
+    uint64_t thread;
+    uint64_t tail __attribute__((aligned(64)));
+    bool retired;
+    struct mach_exception_ring *next;
+    mach_exception_event_t events[MACH_EXCEPTION_RING_CAPACITY] __attribute__((aligned(64)));
+} mach_exception_ring_t;
+
+// The thread-local ring pointer uses the initial-exec model on Linux, so a signal handler reads it with a single
+// load, rather than a call to __tls_get_addr, which isn't async-signal-safe.
+#if defined(__linux__)
+#define MACH_EXCEPTION_RING_THREAD_LOCAL __thread __attribute__((tls_model("initial-exec")))
+#else
+#define MACH_EXCEPTION_RING_THREAD_LOCAL __thread
+#endif
+
+// The calling thread's ring, or `NULL` if it has none.
+static MACH_EXCEPTION_RING_THREAD_LOCAL mach_exception_ring_t *mach_exception_ring_current;
+
+// Every thread's ring. Threads push their rings onto the head of the list, and only the collector unlinks them.
+static mach_exception_ring_t *mach_exception_rings;
+
+// The events dropped since the collector last drained.
+static uint64_t mach_exception_ring_dropped;
+
+static pthread_mutex_t mach_exception_ring_collector = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t mach_exception_ring_once = PTHREAD_ONCE_INIT;
+static pthread_key_t mach_exception_ring_key;
+static int mach_exception_ring_key_error;
+
+// MARK: - Producers
+
+static void mach_exception_ring_retire(void *value)
+{
+    mach_exception_ring_t *ring = value;
+    mach_exception_ring_current = NULL;
+    __atomic_store_n(&ring->retired, true, __ATOMIC_RELEASE);
+}
+
+static void mach_exception_ring_initialize(void)
+{
+    mach_exception_ring_key_error = pthread_key_create(&mach_exception_ring_key, mach_exception_ring_retire);
+}
+
+bool mach_exception_ring_prepare(void)
+{
+    if (mach_exception_ring_current != NULL) {
+        return true;
+    }
+    pthread_once(&mach_exception_ring_once, mach_exception_ring_initialize);
+    if (mach_exception_ring_key_error != 0) {
+        errno = mach_exception_ring_key_error;
+        return false;
+    }
+
+    mach_exception_ring_t *ring = NULL;
+    if (posix_memalign((void **) &ring, 64, sizeof(mach_exception_ring_t)) != 0) {
+        errno = ENOMEM;
+        return false;
+    }
+    memset(ring, 0, sizeof(mach_exception_ring_t));
+#if defined(__APPLE__)
+    pthread_threadid_np(NULL, &ring->thread);
+#else
+    ring->thread = (uint64_t) syscall(SYS_gettid);
+#endif
+
+    ring->next = __atomic_load_n(&mach_exception_rings, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&mach_exception_rings,
+                                        &ring->next,
+                                        ring,
+                                        true,
+                                        __ATOMIC_RELEASE,
+                                        __ATOMIC_RELAXED)) {
+    }
+    pthread_setspecific(mach_exception_ring_key, ring);
+    mach_exception_ring_current = ring;
+    return true;
+}
+
+bool mach_exception_ring_publish(const mach_exception_record_t *record, uint64_t pc, uint64_t thread)
+{
+    mach_exception_ring_t *ring = mach_exception_ring_current;
+    if (ring == NULL) {
+        __atomic_add_fetch(&mach_exception_ring_dropped, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+
+    uint64_t sequence = ring->published++;
+    uint64_t head = ring->head;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == MACH_EXCEPTION_RING_CAPACITY) {
+        __atomic_add_fetch(&mach_exception_ring_dropped, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    mach_exception_event_t *event = &ring->events[head & MACH_EXCEPTION_RING_MASK];
+    event->sequence = sequence;
+    event->timestamp = (uint64_t) now.tv_sec * 1000000000u + (uint64_t) now.tv_nsec;
+    event->thread = thread != 0 ? thread : ring->thread;
+    event->type = record->type;
+    event->reserved = 0;
+    event->code = record->code;
+    event->subcode = record->subcode;
+    event->pc = pc;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+// MARK: - Collector
+
+// Unlink an empty ring whose thread exited. Threads only push rings onto the head of the list, so only unlinking
+// the head races with them.
+static void mach_exception_ring_unlink(mach_exception_ring_t *previous, mach_exception_ring_t *ring)
+{
+    if (previous != NULL) {
+        previous->next = ring->next;
+    } else {
+        mach_exception_ring_t *expected = ring;
+        if (!__atomic_compare_exchange_n(&mach_exception_rings,
+                                         &expected,
+                                         ring->next,
+                                         false,
+                                         __ATOMIC_ACQ_REL,
+                                         __ATOMIC_ACQUIRE)) {
+            // Rings were pushed in front of this one, so it now has a predecessor.
+            previous = expected;
+            while (previous->next != ring) {
+                previous = previous->next;
+            }
+            previous->next = ring->next;
+        }
+    }
+    free(ring);
+}
+
+size_t mach_exception_ring_drain(mach_exception_event_t *events, size_t capacity, uint64_t *dropped)
+{
+    size_t count = 0;
+    pthread_mutex_lock(&mach_exception_ring_collector);
+
+    mach_exception_ring_t *previous = NULL;
+    mach_exception_ring_t *ring = __atomic_load_n(&mach_exception_rings, __ATOMIC_ACQUIRE);
+    while (ring != NULL) {
+        // Read whether the thread exited before reading the head, so a retired ring found empty stays empty.
+        bool retired = __atomic_load_n(&ring->retired, __ATOMIC_ACQUIRE);
+        uint64_t tail = ring->tail;
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        while (tail != head && count < capacity) {
+            events[count++] = ring->events[tail & MACH_EXCEPTION_RING_MASK];
+            tail++;
+        }
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+        mach_exception_ring_t *next = ring->next;
+        if (retired && tail == head) {
+            mach_exception_ring_unlink(previous, ring);
+        } else {
+            previous = ring;
+        }
+        ring = next;
+    }
+
+    if (dropped != NULL) {
+        *dropped = __atomic_exchange_n(&mach_exception_ring_dropped, 0, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&mach_exception_ring_collector);
+    return count;
+}
@@ -49,7 +49,7 @@ __uint64_t fedisableexception(unsigned int excepts) {
     
 #if (DEFINED_ARM==1)
     old_excepts = fenv.__fpcr;
-    fenv.__fpcr &= !(new_excepts << FE_EXCEPT_SHIFT);
+    fenv.__fpcr &= ~(new_excepts << FE_EXCEPT_SHIFT);
 #else
     old_excepts = fenv.__control & FE_ALL_EXCEPT;
     fenv.__control |= new_excepts;
@@ -0,0 +1,302 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// mach-exception
+// mach_fp_traps.c
+// Created by Patrick Gili on 2/14/23.
+//
+
+#include <errno.h>
+#include <stdint.h>
+#include "mach_fp_traps.h"
+
+// The thread-local cache uses the initial-exec model on Linux, so reading it is a single load.
+#if defined(__linux__)
+#define MACH_FP_TRAPS_THREAD_LOCAL __thread __attribute__((tls_model("initial-exec")))
+#else
+#define MACH_FP_TRAPS_THREAD_LOCAL __thread
+#endif
+
+// A thread's cached control register, which is valid while the thread is in a scope, and the number of scopes the
+// thread is in.
+typedef struct mach_fp_traps_cache {
+    uint64_t control;
+    unsigned int depth;
+} mach_fp_traps_cache_t;
+
+static MACH_FP_TRAPS_THREAD_LOCAL mach_fp_traps_cache_t mach_fp_traps_cache;
+
+// MARK: - Control register
+
+#if defined(__x86_64__)
+
+// MXCSR masks an exception while its mask bit (7 for invalid operation through 12 for precision) is set, in the
+// same order as the FE_* flags.
+#define MACH_FP_TRAPS_SHIFT 7
+
+// MXCSR holds the sticky status flags in its low six bits, next to the control bits.
+#define MACH_FP_FLAGS_MASK 0x3fu
+
+static inline uint32_t mach_fp_mxcsr_read(void)
+{
+    uint32_t mxcsr;
+    __asm__ __volatile__("stmxcsr %0" : "=m"(mxcsr));
+    return mxcsr;
+}
+
+static inline void mach_fp_mxcsr_write(uint32_t mxcsr)
+{
+    __asm__ __volatile__("ldmxcsr %0" : : "m"(mxcsr));
+}
+
+// The cache holds only the control bits, because the flags change under it as the thread computes.
+static inline uint64_t mach_fp_traps_read(void)
+{
+    return mach_fp_mxcsr_read() & ~MACH_FP_FLAGS_MASK;
+}
+
+// Write the control bits, keeping the flags MXCSR holds now, so a scope never clears a flag raised inside it.
+static inline void mach_fp_traps_write(uint64_t control)
+{
+    uint32_t flags = mach_fp_mxcsr_read() & MACH_FP_FLAGS_MASK;
+    mach_fp_mxcsr_write(((uint32_t) control & ~MACH_FP_FLAGS_MASK) | flags);
+}
+
+static inline int mach_fp_traps_from_control(uint64_t control)
+{
+    return (int) (~control >> MACH_FP_TRAPS_SHIFT) & MACH_FP_TRAPS_ALL;
+}
+
+static inline uint64_t mach_fp_traps_to_control(uint64_t control, int excepts)
+{
+    control |= (uint64_t) MACH_FP_TRAPS_ALL << MACH_FP_TRAPS_SHIFT;
+    return control & ~((uint64_t) excepts << MACH_FP_TRAPS_SHIFT);
+}
+
+// The status flags are in the same order as the FE_* flags. Writing them writes the live control bits back as read.
+static inline uint64_t mach_fp_flags_read(void)
+{
+    return mach_fp_mxcsr_read();
+}
+
+static inline void mach_fp_flags_write(uint64_t status)
+{
+    mach_fp_mxcsr_write((uint32_t) status);
+}
+
+#elif defined(__aarch64__) || defined(__arm64__)
+
+// FPCR traps an exception while its trap enable bit (8 for invalid operation through 12 for inexact) is set, in the
+// same order as the FE_* flags.
+#define MACH_FP_TRAPS_SHIFT 8
+
+static inline uint64_t mach_fp_traps_read(void)
+{
+    uint64_t fpcr;
+    __asm__ __volatile__("mrs %0, fpcr" : "=r"(fpcr));
+    return fpcr;
+}
+
+static inline void mach_fp_traps_write(uint64_t control)
+{
+    __asm__ __volatile__("msr fpcr, %0" : : "r"(control));
+}
+
+static inline int mach_fp_traps_from_control(uint64_t control)
+{
+    return (int) (control >> MACH_FP_TRAPS_SHIFT) & MACH_FP_TRAPS_ALL;
+}
+
+static inline uint64_t mach_fp_traps_to_control(uint64_t control, int excepts)
+{
+    control &= ~((uint64_t) MACH_FP_TRAPS_ALL << MACH_FP_TRAPS_SHIFT);
+    return control | ((uint64_t) excepts << MACH_FP_TRAPS_SHIFT);
+}
+
+// FPSR holds the cumulative status flags in its low bits, in the same order as the FE_* flags.
+static inline uint64_t mach_fp_flags_read(void)
+{
+    uint64_t fpsr;
+    __asm__ __volatile__("mrs %0, fpsr" : "=r"(fpsr));
+    return fpsr;
+}
+
+static inline void mach_fp_flags_write(uint64_t status)
+{
+    __asm__ __volatile__("msr fpsr, %0" : : "r"(status));
+}
+
+#endif
+
+// MARK: - Scopes
+
+#if defined(MACH_FP_TRAPS_SHIFT)
+
+// Set the thread's traps, skipping the write if they are already set. The trap enable bits of FPCR read as zero on
+// processors that don't support trapping, so verify them.
+static bool mach_fp_traps_set(int excepts)
+{
+    uint64_t control = mach_fp_traps_to_control(mach_fp_traps_cache.control, excepts);
+    if (control == mach_fp_traps_cache.control) {
+        return true;
+    }
+    mach_fp_traps_write(control);
+#if defined(__aarch64__) || defined(__arm64__)
+    uint64_t actual = mach_fp_traps_read();
+    if (actual != control) {
+        mach_fp_traps_write(mach_fp_traps_cache.control);
+        errno = ENOTSUP;
+        return false;
+    }
+#endif
+    mach_fp_traps_cache.control = control;
+    return true;
+}
+
+bool mach_fp_traps_enter(int excepts, int *previous)
+{
+    // Only the outermost scope reads the control register, in case code outside every scope changed it.
+    if (mach_fp_traps_cache.depth == 0) {
+        mach_fp_traps_cache.control = mach_fp_traps_read();
+    }
+    int enabled = mach_fp_traps_from_control(mach_fp_traps_cache.control);
+    if (!mach_fp_traps_set(enabled | (excepts & MACH_FP_TRAPS_ALL))) {
+        return false;
+    }
+    *previous = enabled;
+    mach_fp_traps_cache.depth++;
+    return true;
+}
+
+void mach_fp_traps_leave(int previous)
+{
+    // Restoring traps that were enabled before can't fail.
+    mach_fp_traps_set(previous & MACH_FP_TRAPS_ALL);
+    if (mach_fp_traps_cache.depth > 0) {
+        mach_fp_traps_cache.depth--;
+    }
+}
+
+int mach_fp_traps_enabled(void)
+{
+    if (mach_fp_traps_cache.depth > 0) {
+        return mach_fp_traps_from_control(mach_fp_traps_cache.control);
+    }
+    return mach_fp_traps_from_control(mach_fp_traps_read());
+}
+
+void mach_fp_traps_restore(void)
+{
+    if (mach_fp_traps_cache.depth > 0) {
+        mach_fp_traps_write(mach_fp_traps_cache.control);
+    }
+}
+
+#else
+
+bool mach_fp_traps_enter(int excepts, int *previous)
+{
+    (void) excepts;
+    (void) previous;
+    errno = ENOTSUP;
+    return false;
+}
+
+void mach_fp_traps_leave(int previous)
+{
+    (void) previous;
+}
+
+int mach_fp_traps_enabled(void)
+{
+    return 0;
+}
+
+void mach_fp_traps_restore(void)
+{
+}
+
+#endif
+
+unsigned int mach_fp_traps_depth(void)
+{
+    return mach_fp_traps_cache.depth;
+}
+
+// MARK: - Sticky flags
+
+#if defined(MACH_FP_TRAPS_SHIFT)
+
+void mach_fp_flags_enter(int excepts, int *previous)
+{
+    uint64_t status = mach_fp_flags_read();
+    int raised = (int) status & excepts & MACH_FP_TRAPS_ALL;
+    if (raised != 0) {
+        mach_fp_flags_write(status & ~(uint64_t) raised);
+    }
+    *previous = raised;
+}
+
+int mach_fp_flags_leave(int excepts, int previous)
+{
+    uint64_t status = mach_fp_flags_read();
+    int raised = (int) status & excepts & MACH_FP_TRAPS_ALL;
+    if ((previous & ~raised) != 0) {
+        mach_fp_flags_write(status | (uint64_t) previous);
+    }
+    return raised;
+}
+
+#else
+
+void mach_fp_flags_enter(int excepts, int *previous)
+{
+    *previous = fetestexcept(excepts & MACH_FP_TRAPS_ALL);
+    if (*previous != 0) {
+        feclearexcept(*previous);
+    }
+}
+
+int mach_fp_flags_leave(int excepts, int previous)
+{
+    int raised = fetestexcept(excepts & MACH_FP_TRAPS_ALL);
+    if ((previous & ~raised) != 0) {
+        feraiseexcept(previous & ~raised);
+    }
+    return raised;
+}
+
+#endif
+
+bool mach_fp_flags_record(int raised, mach_exception_record_t *record)
+{
+    raised &= MACH_FP_TRAPS_ALL;
+    if (raised == 0) {
+        return false;
+    }
+    record->type = EXC_ARITHMETIC;
+#if defined(__x86_64__)
+    // Mask every exception but those raised, as MXCSR would read had they been the traps that fired. The six
+    // exceptions MXCSR knows include the denormal operand, which FE_* flags leave out.
+    record->code = EXC_I386_SSEEXTERR;
+    record->subcode = (mach_exception_data_type_t) (raised | ((0x3f & ~raised) << MACH_FP_TRAPS_SHIFT));
+#elif defined(__aarch64__) || defined(__arm64__)
+    if (raised & FE_INVALID) {
+        record->code = EXC_ARM_FP_IO;
+    } else if (raised & FE_DIVBYZERO) {
+        record->code = EXC_ARM_FP_DZ;
+    } else if (raised & FE_OVERFLOW) {
+        record->code = EXC_ARM_FP_OF;
+    } else if (raised & FE_UNDERFLOW) {
+        record->code = EXC_ARM_FP_UF;
+    } else {
+        record->code = EXC_ARM_FP_IX;
+    }
+    record->subcode = 0;
+#else
+    record->code = 0;
+    record->subcode = 0;
+#endif
+    return true;
+}
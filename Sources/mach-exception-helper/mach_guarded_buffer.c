@@ -0,0 +1,71 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// mach-exception
+// mach_guarded_buffer.c
+// Created by Patrick Gili on 2/22/23.
+//
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "mach_guarded_buffer.h"
+
+static size_t mach_guarded_buffer_round(size_t size, size_t granule)
+{
+    return (size + granule - 1) / granule * granule;
+}
+
+bool mach_guarded_buffer_allocate(size_t size, size_t alignment, size_t guard_size, mach_guarded_buffer_t *buffer)
+{
+    size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0 || alignment > page_size) {
+        errno = EINVAL;
+        return false;
+    }
+    size_t storage_size = mach_guarded_buffer_round(mach_guarded_buffer_round(size, alignment), page_size);
+    guard_size = mach_guarded_buffer_round(guard_size == 0 ? page_size : guard_size, page_size);
+
+    // Map the storage and the guard region together, then revoke access to the guard region, so nothing else can
+    // be mapped between them.
+    void *mapping = mmap(NULL, storage_size + guard_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+    uint8_t *guard = (uint8_t *) mapping + storage_size;
+    if (mprotect(guard, guard_size, PROT_NONE) != 0) {
+        int error = errno;
+        munmap(mapping, storage_size + guard_size);
+        errno = error;
+        return false;
+    }
+
+    memset(buffer, 0, sizeof(*buffer));
+    buffer->bytes = guard - mach_guarded_buffer_round(size, alignment);
+    buffer->size = size;
+    buffer->guard = guard;
+    buffer->guard_size = guard_size;
+    buffer->mapping = mapping;
+    buffer->mapping_size = storage_size + guard_size;
+    return true;
+}
+
+void mach_guarded_buffer_deallocate(mach_guarded_buffer_t *buffer)
+{
+    if (buffer->mapping != NULL) {
+        munmap(buffer->mapping, buffer->mapping_size);
+    }
+    memset(buffer, 0, sizeof(*buffer));
+}
+
+bool mach_guarded_buffer_guards(const mach_guarded_buffer_t *buffer, uint64_t address, uint64_t *offset)
+{
+    uint64_t guard = (uint64_t)(uintptr_t) buffer->guard;
+    if (address - guard >= buffer->guard_size) {
+        return false;
+    }
+    *offset = address - (uint64_t)(uintptr_t) buffer->bytes;
+    return true;
+}
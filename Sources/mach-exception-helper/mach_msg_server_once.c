@@ -7,6 +7,8 @@
 // Created by Patrick Gili on 6/15/22.
 //
 
+#ifdef __APPLE__
+
 #include <stdlib.h>
 #include <mach/mach.h>
 #include <mach/boolean.h>
@@ -15,6 +17,7 @@
 #include <mach/mig_errors.h>
 #include <mach/vm_statistics.h>
 #include <TargetConditionals.h>
+#include "mach_exc_dispatch.h"
 
 static inline boolean_t
 mach_msg_server_is_recoverable_send_error(kern_return_t kr)
@@ -76,76 +79,43 @@ mach_msg_server_consume_unsent_message(mach_msg_header_t *hdr)
  *        failing error from mach_msg calls will be returned
  *        (though errors from the demux routine or the routine it
  *        calls will not be).
+ *
+ *        The request and reply are built in the listener's arena,
+ *        which is reused across messages, rather than in pages
+ *        allocated for each message.  With MACH_RCV_LARGE, the arena
+ *        grows to receive a larger request.
  */
 mach_msg_return_t
 mach_msg_server_once_with_timeout(boolean_t (*demux)(mach_msg_header_t *, mach_msg_header_t *),
-                                  mach_msg_size_t max_size,
+                                  mach_exc_arena_t *arena,
                                   mach_port_t rcv_name,
                                   mach_msg_options_t options,
                                   mach_msg_timeout_t timeout)
 {
     mig_reply_error_t *bufRequest, *bufReply;
-    mach_msg_size_t request_size;
-    mach_msg_size_t request_alloc;
     mach_msg_size_t trailer_alloc;
-    mach_msg_size_t reply_alloc;
     mach_msg_return_t mr;
-    kern_return_t kr;
-    mach_port_t self = mach_task_self_;
     voucher_mach_msg_state_t old_state = VOUCHER_MACH_MSG_STATE_UNCHANGED;
 
-    options &= ~(MACH_SEND_MSG | MACH_RCV_MSG | MACH_RCV_VOUCHER);
+    options &= ~(MACH_SEND_MSG | MACH_RCV_MSG | MACH_RCV_VOUCHER | MACH_SEND_TRAILER);
 
     trailer_alloc = REQUESTED_TRAILER_SIZE(options);
-    request_alloc = (mach_msg_size_t)round_page(max_size + trailer_alloc);
-
-    request_size = (options & MACH_RCV_LARGE) ?
-        request_alloc : max_size + trailer_alloc;
-
-    reply_alloc = (mach_msg_size_t)round_page((options & MACH_SEND_TRAILER) ?
-        (max_size + MAX_TRAILER_SIZE) :
-        max_size);
-
-    kr = vm_allocate(self,
-        (vm_address_t *)&bufReply,
-        reply_alloc,
-        VM_MAKE_TAG(VM_MEMORY_MACH_MSG) | TRUE);
-    if (kr != KERN_SUCCESS) {
-        return kr;
-    }
+    bufReply = arena->reply;
 
     for (;;) {
-        mach_msg_size_t new_request_alloc;
-
-        kr = vm_allocate(self,
-            (vm_address_t *)&bufRequest,
-            request_alloc,
-            VM_MAKE_TAG(VM_MEMORY_MACH_MSG) | TRUE);
-        if (kr != KERN_SUCCESS) {
-            vm_deallocate(self,
-                (vm_address_t)bufReply,
-                reply_alloc);
-            return kr;
-        }
+        bufRequest = arena->request;
 
         mr = mach_msg(&bufRequest->Head, MACH_RCV_MSG | MACH_RCV_VOUCHER | options,
-            0, request_size, rcv_name,
+            0, (mach_msg_size_t)arena->request_size, rcv_name,
             timeout, MACH_PORT_NULL);
 
-        if (mr == MACH_RCV_TIMED_OUT) {
-            break;
-        }
-        
         if (!((mr == MACH_RCV_TOO_LARGE) && (options & MACH_RCV_LARGE))) {
             break;
         }
-        
-        new_request_alloc = (mach_msg_size_t)round_page(bufRequest->Head.msgh_size +
-            trailer_alloc);
-        vm_deallocate(self,
-            (vm_address_t) bufRequest,
-            request_alloc);
-        request_size = request_alloc = new_request_alloc;
+
+        if (!mach_exc_arena_reserve(arena, bufRequest->Head.msgh_size + trailer_alloc)) {
+            return KERN_RESOURCE_SHORTAGE;
+        }
     }
 
     if (mr == MACH_MSG_SUCCESS) {
@@ -196,12 +166,7 @@ mach_msg_server_once_with_timeout(boolean_t (*demux)(mach_msg_header_t *, mach_m
     }
 
     voucher_mach_msg_revert(old_state);
-
-    (void)vm_deallocate(self,
-        (vm_address_t) bufRequest,
-        request_alloc);
-    (void)vm_deallocate(self,
-        (vm_address_t) bufReply,
-        reply_alloc);
     return mr;
 }
+
+#endif /* __APPLE__ */
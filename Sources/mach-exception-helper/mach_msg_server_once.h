@@ -10,9 +10,11 @@
 #ifndef mach_msg_server_once_h
 #define mach_msg_server_once_h
 
+#include "mach_exc_dispatch.h"
+
 mach_msg_return_t
 mach_msg_server_once_with_timeout(boolean_t (*demux)(mach_msg_header_t *, mach_msg_header_t *),
-                                  mach_msg_size_t max_size,
+                                  mach_exc_arena_t *arena,
                                   mach_port_t rcv_name,
                                   mach_msg_options_t options,
                                   mach_msg_timeout_t timeout);
@@ -0,0 +1,720 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// mach-exception
+// mach_signal_handler.c
+// Created by Patrick Gili on 1/28/23.
+//
+
+#if defined(__linux__)
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+#include "mach_exception_capture.h"
+#include "mach_exception_fixup.h"
+#include "mach_exception_lanes.h"
+#include "mach_exception_log.h"
+#include "mach_exception_metrics.h"
+#include "mach_exception_perform.h"
+#include "mach_exception_resolver.h"
+#include "mach_exception_resume.h"
+#include "mach_exception_ring.h"
+#include "mach_signal_handler.h"
+
+// The size of the alternate signal stack installed on each thread that enters a scope.
+#define MACH_SIGNAL_ALTSTACK_SIZE (64 * 1024)
+
+// The fault signals corresponding to the Mach exception types the signal backend catches.
+static const int mach_signal_signals[] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGTRAP };
+
+#define MACH_SIGNAL_COUNT (sizeof(mach_signal_signals) / sizeof(mach_signal_signals[0]))
+
+// A scope pushed onto a thread's scope stack by mach_signal_perform. Scopes live on the stack of the
+// mach_signal_perform frame that created them. The combined mask is the union of the masks of this scope and the
+// scopes enclosing it, so the handler decides whether any scope catches a fault without walking the stack. The
+// resume point receives the exception the scope resumes with.
+typedef struct mach_signal_scope {
+    mach_exception_resume_point_t point;
+    exception_mask_t mask;
+    exception_mask_t combined_mask;
+    struct mach_signal_scope *previous;
+} mach_signal_scope_t;
+
+static pthread_once_t mach_signal_install_once = PTHREAD_ONCE_INIT;
+static int mach_signal_install_error;
+static pthread_key_t mach_signal_altstack_key;
+static struct sigaction mach_signal_previous_actions[MACH_SIGNAL_COUNT];
+
+// The thread-local variables use the initial-exec model, so that the signal handler reads them with a single load,
+// rather than a call to __tls_get_addr, which isn't async-signal-safe.
+#define MACH_SIGNAL_THREAD_LOCAL __thread __attribute__((tls_model("initial-exec")))
+
+// The innermost scope of the calling thread, or `NULL` if the thread is not inside a scope.
+static MACH_SIGNAL_THREAD_LOCAL mach_signal_scope_t * volatile mach_signal_current_scope;
+
+// Whether the calling thread has an alternate signal stack suitable for running the fault handler.
+static MACH_SIGNAL_THREAD_LOCAL bool mach_signal_thread_prepared;
+
+// The bounds of the calling thread's stack, which confine the handler's walk of the faulting thread's frames.
+static MACH_SIGNAL_THREAD_LOCAL uint64_t mach_signal_stack_low;
+static MACH_SIGNAL_THREAD_LOCAL uint64_t mach_signal_stack_high;
+
+// The machine state and backtrace of the last fault the calling thread caught.
+static MACH_SIGNAL_THREAD_LOCAL mach_exception_state_t mach_signal_state;
+static MACH_SIGNAL_THREAD_LOCAL mach_exception_backtrace_t mach_signal_backtrace;
+
+// The lanes of the last floating-point trap the calling thread caught, if lane attribution is enabled.
+static MACH_SIGNAL_THREAD_LOCAL mach_exception_lanes_t mach_signal_lanes;
+
+// When the handler resumed the calling thread at its innermost scope, or 0 once the scope has counted the resume.
+static MACH_SIGNAL_THREAD_LOCAL uint64_t mach_signal_resumed_at;
+
+// MARK: - mach_signal_record_from_siginfo
+
+#if defined(__aarch64__)
+static mach_exception_data_type_t mach_signal_instruction(const ucontext_t *context)
+{
+    if (context == NULL) {
+        return 0;
+    }
+    return (mach_exception_data_type_t) *(const uint32_t *)(uintptr_t) context->uc_mcontext.pc;
+}
+
+static mach_exception_data_type_t mach_signal_pc(const ucontext_t *context)
+{
+    return context == NULL ? 0 : (mach_exception_data_type_t) context->uc_mcontext.pc;
+}
+#endif
+
+bool mach_signal_record_from_siginfo(int signal,
+                                     const siginfo_t *info,
+                                     const void *ucontext,
+                                     mach_exception_record_t *record)
+{
+    const ucontext_t *context = (const ucontext_t *) ucontext;
+    mach_exception_data_type_t address = (mach_exception_data_type_t)(uintptr_t) info->si_addr;
+    (void) context;
+
+    switch (signal) {
+    case SIGSEGV:
+        record->type = EXC_BAD_ACCESS;
+        record->subcode = address;
+        switch (info->si_code) {
+        case SEGV_MAPERR:
+            record->code = KERN_INVALID_ADDRESS;
+            break;
+#if defined(__x86_64__) || defined(__i386__)
+        case SI_KERNEL:
+            // A general protection fault (e.g., a non-canonical address), for which the kernel reports no address.
+            record->code = EXC_I386_GPFLT;
+            record->subcode = 0;
+            break;
+#endif
+        default:
+            record->code = KERN_PROTECTION_FAILURE;
+            break;
+        }
+        return true;
+
+    case SIGBUS:
+        record->type = EXC_BAD_ACCESS;
+        record->subcode = address;
+#if defined(__aarch64__)
+        record->code = info->si_code == BUS_ADRALN ? EXC_ARM_DA_ALIGN : KERN_MEMORY_ERROR;
+#else
+        record->code = KERN_MEMORY_ERROR;
+#endif
+        return true;
+
+    case SIGILL:
+        record->type = EXC_BAD_INSTRUCTION;
+#if defined(__aarch64__)
+        record->code = EXC_ARM_UNDEFINED;
+        record->subcode = mach_signal_instruction(context);
+#else
+        record->code = EXC_I386_INVOP;
+        record->subcode = 0;
+#endif
+        return true;
+
+    case SIGFPE:
+        record->type = EXC_ARITHMETIC;
+#if defined(__aarch64__)
+        switch (info->si_code) {
+        case FPE_FLTINV: record->code = EXC_ARM_FP_IO; break;
+        case FPE_FLTDIV: record->code = EXC_ARM_FP_DZ; break;
+        case FPE_FLTOVF: record->code = EXC_ARM_FP_OF; break;
+        case FPE_FLTUND: record->code = EXC_ARM_FP_UF; break;
+        case FPE_FLTRES: record->code = EXC_ARM_FP_IX; break;
+        default: record->code = EXC_ARM_FP_UNDEFINED; break;
+        }
+        record->subcode = mach_signal_instruction(context);
+#elif defined(__x86_64__)
+        // The trap number distinguishes divide errors (#DE), x87 errors (#MF) and SIMD errors (#XM) the same way
+        // Darwin's EXC_I386_* codes do. Without a context, fall back on the signal code.
+        if (context != NULL) {
+            switch (context->uc_mcontext.gregs[REG_TRAPNO]) {
+            case 0:
+                record->code = EXC_I386_DIV;
+                record->subcode = 0;
+                return true;
+            case 4:
+                record->code = EXC_I386_INTO;
+                record->subcode = 0;
+                return true;
+            case 16:
+                record->code = EXC_I386_EXTERR;
+                record->subcode = context->uc_mcontext.fpregs == NULL ? 0 : context->uc_mcontext.fpregs->swd;
+                return true;
+            case 19:
+                record->code = EXC_I386_SSEEXTERR;
+                record->subcode = context->uc_mcontext.fpregs == NULL ? 0 : context->uc_mcontext.fpregs->mxcsr;
+                return true;
+            }
+        }
+        switch (info->si_code) {
+        case FPE_INTDIV: record->code = EXC_I386_DIV; break;
+        case FPE_INTOVF: record->code = EXC_I386_INTO; break;
+        default: record->code = EXC_I386_SSEEXTERR; break;
+        }
+        record->subcode = 0;
+#else
+        record->code = 0;
+        record->subcode = address;
+#endif
+        return true;
+
+    case SIGTRAP:
+        record->type = EXC_BREAKPOINT;
+#if defined(__aarch64__)
+        switch (info->si_code) {
+        case TRAP_TRACE:
+            record->code = EXC_ARM_BREAKPOINT;
+            record->subcode = 0;
+            break;
+        case TRAP_HWBKPT:
+            record->code = EXC_ARM_DA_DEBUG;
+            record->subcode = address;
+            break;
+        default:
+            record->code = EXC_ARM_BREAKPOINT;
+            record->subcode = mach_signal_pc(context);
+            break;
+        }
+#else
+        record->code = info->si_code == TRAP_TRACE || info->si_code == TRAP_HWBKPT ? EXC_I386_SGL : EXC_I386_BPT;
+        record->subcode = 0;
+#endif
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+// MARK: - mach_signal_handler
+
+static const struct sigaction * mach_signal_previous_action(int signal)
+{
+    for (size_t index = 0; index < MACH_SIGNAL_COUNT; index++) {
+        if (mach_signal_signals[index] == signal) {
+            return &mach_signal_previous_actions[index];
+        }
+    }
+    return NULL;
+}
+
+// Hand a fault this library does not own to the handler installed before this library's, with the semantics it was
+// installed with. This handler runs with the signal blocked and nothing else, so the previous handler's mask and
+// flags only cost system calls when they ask for something different.
+static void mach_signal_forward(int signal, siginfo_t *info, void *ucontext)
+{
+    const struct sigaction *previous = mach_signal_previous_action(signal);
+    if (previous != NULL && previous->sa_handler != SIG_DFL) {
+        if (previous->sa_handler == SIG_IGN) {
+            // The kernel doesn't let a process ignore a fault, so only a signal sent by another process is ignored.
+            if (info->si_code <= 0) {
+                return;
+            }
+        } else {
+            if (previous->sa_flags & SA_RESETHAND) {
+                struct sigaction action;
+                memset(&action, 0, sizeof(action));
+                action.sa_handler = SIG_DFL;
+                sigemptyset(&action.sa_mask);
+                sigaction(signal, &action, NULL);
+            }
+
+            bool masked = !sigisemptyset(&previous->sa_mask) || (previous->sa_flags & SA_NODEFER);
+            sigset_t saved;
+            if (masked) {
+                pthread_sigmask(SIG_SETMASK, NULL, &saved);
+                sigset_t signals = saved;
+                sigorset(&signals, &signals, &previous->sa_mask);
+                if (previous->sa_flags & SA_NODEFER) {
+                    sigdelset(&signals, signal);
+                }
+                pthread_sigmask(SIG_SETMASK, &signals, NULL);
+            }
+
+            if (previous->sa_flags & SA_SIGINFO) {
+                previous->sa_sigaction(signal, info, ucontext);
+            } else {
+                previous->sa_handler(signal);
+            }
+
+            if (masked) {
+                pthread_sigmask(SIG_SETMASK, &saved, NULL);
+            }
+            return;
+        }
+    }
+
+    // Restore the default disposition. Returning re-executes a faulting instruction, which then terminates the
+    // process exactly as it would have without this library; a signal sent by another process is raised again.
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = SIG_DFL;
+    sigemptyset(&action.sa_mask);
+    sigaction(signal, &action, NULL);
+    if (info->si_code <= 0) {
+        raise(signal);
+    }
+}
+
+bool mach_signal_state_from_ucontext(int signal,
+                                     const siginfo_t *info,
+                                     const void *ucontext,
+                                     mach_exception_state_t *state,
+                                     uint64_t *fp)
+{
+    const ucontext_t *context = (const ucontext_t *) ucontext;
+    memset(state, 0, sizeof(*state));
+    *fp = 0;
+    if (signal == SIGSEGV || signal == SIGBUS) {
+        state->fault_address = (uint64_t)(uintptr_t) info->si_addr;
+    }
+    if (context == NULL) {
+        return false;
+    }
+#if defined(__x86_64__)
+    state->pc = (uint64_t) context->uc_mcontext.gregs[REG_RIP];
+    state->sp = (uint64_t) context->uc_mcontext.gregs[REG_RSP];
+    *fp = (uint64_t) context->uc_mcontext.gregs[REG_RBP];
+#elif defined(__aarch64__)
+    state->pc = (uint64_t) context->uc_mcontext.pc;
+    state->sp = (uint64_t) context->uc_mcontext.sp;
+    state->lr = (uint64_t) context->uc_mcontext.regs[30];
+    *fp = (uint64_t) context->uc_mcontext.regs[29];
+#else
+    return false;
+#endif
+    return true;
+}
+
+#if defined(__aarch64__)
+// The floating-point and SIMD record in the reserved area of an arm64 signal frame's context.
+#define MACH_SIGNAL_FPSIMD_MAGIC 0x46508001u
+
+typedef struct mach_signal_fpsimd {
+    uint32_t magic;
+    uint32_t size;
+    uint32_t fpsr;
+    uint32_t fpcr;
+    __uint128_t vregs[32];
+} mach_signal_fpsimd_t;
+#elif defined(__x86_64__)
+// The software-reserved bytes of an x86_64 signal frame's floating-point state, which tell whether the XSAVE area,
+// and with it the upper halves of the ymm registers, follows the legacy area.
+#define MACH_SIGNAL_XSTATE_MAGIC 0x46505853u
+#define MACH_SIGNAL_XSTATE_INFO 464
+#define MACH_SIGNAL_XSTATE_YMM 0x4u
+#define MACH_SIGNAL_XSTATE_HEADER 512
+#define MACH_SIGNAL_XSTATE_YMM_OFFSET 576
+
+typedef struct mach_signal_xstate_info {
+    uint32_t magic;
+    uint32_t extended_size;
+    uint64_t features;
+    uint32_t size;
+} mach_signal_xstate_info_t;
+#endif
+
+bool mach_signal_simd_state_from_ucontext(const void *ucontext, mach_exception_simd_state_t *state)
+{
+    const ucontext_t *context = (const ucontext_t *) ucontext;
+    memset(state, 0, sizeof(*state));
+    if (context == NULL) {
+        return false;
+    }
+#if defined(__x86_64__)
+    static const int registers[16] = {
+        REG_RAX, REG_RCX, REG_RDX, REG_RBX, REG_RSP, REG_RBP, REG_RSI, REG_RDI,
+        REG_R8, REG_R9, REG_R10, REG_R11, REG_R12, REG_R13, REG_R14, REG_R15,
+    };
+    const struct _libc_fpstate *fp = context->uc_mcontext.fpregs;
+    if (fp == NULL) {
+        return false;
+    }
+    state->pc = (uint64_t) context->uc_mcontext.gregs[REG_RIP];
+    for (int index = 0; index < 16; index++) {
+        state->gpr[index] = (uint64_t) context->uc_mcontext.gregs[registers[index]];
+        memcpy(state->vector[index], &fp->_xmm[index], 16);
+    }
+    state->control = fp->mxcsr;
+
+    const uint8_t *area = (const uint8_t *) fp;
+    mach_signal_xstate_info_t xstate;
+    memcpy(&xstate, area + MACH_SIGNAL_XSTATE_INFO, sizeof(xstate));
+    if (xstate.magic == MACH_SIGNAL_XSTATE_MAGIC && (xstate.features & MACH_SIGNAL_XSTATE_YMM)) {
+        // Upper halves the XSAVE header marks as being in their initial state are zero.
+        uint64_t present;
+        memcpy(&present, area + MACH_SIGNAL_XSTATE_HEADER, sizeof(present));
+        if (present & MACH_SIGNAL_XSTATE_YMM) {
+            for (int index = 0; index < 16; index++) {
+                memcpy(&state->vector[index][16], area + MACH_SIGNAL_XSTATE_YMM_OFFSET + index * 16, 16);
+            }
+        }
+        state->wide = true;
+    }
+    return true;
+#elif defined(__aarch64__)
+    state->pc = (uint64_t) context->uc_mcontext.pc;
+    for (int index = 0; index < 31; index++) {
+        state->gpr[index] = (uint64_t) context->uc_mcontext.regs[index];
+    }
+    state->gpr[31] = (uint64_t) context->uc_mcontext.sp;
+
+    // The reserved area holds a sequence of records, each starting with its magic number and size.
+    const uint8_t *record = (const uint8_t *) context->uc_mcontext.__reserved;
+    const uint8_t *end = record + sizeof(context->uc_mcontext.__reserved);
+    while (record + 8 <= end) {
+        uint32_t magic, size;
+        memcpy(&magic, record, sizeof(magic));
+        memcpy(&size, record + 4, sizeof(size));
+        if (magic == 0 || size == 0) {
+            break;
+        }
+        if (magic == MACH_SIGNAL_FPSIMD_MAGIC && record + sizeof(mach_signal_fpsimd_t) <= end) {
+            const mach_signal_fpsimd_t *fpsimd = (const mach_signal_fpsimd_t *) record;
+            for (int index = 0; index < 32; index++) {
+                memcpy(state->vector[index], &fpsimd->vregs[index], 16);
+            }
+            state->control = fpsimd->fpcr;
+            return true;
+        }
+        record += size;
+    }
+    return false;
+#else
+    return false;
+#endif
+}
+
+// Capture the machine state and backtrace of the faulting thread, which is the thread running the handler.
+static void mach_signal_capture(int signal, const siginfo_t *info, const void *ucontext)
+{
+    uint64_t fp = 0;
+    mach_signal_state_from_ucontext(signal, info, ucontext, &mach_signal_state, &fp);
+    mach_exception_backtrace_capture(&mach_signal_backtrace,
+                                     mach_signal_state.pc,
+                                     fp,
+                                     mach_signal_stack_low,
+                                     mach_signal_stack_high);
+#if defined(__x86_64__)
+    // x86_64 has no link register, so report the return address the faulting frame's frame record holds.
+    mach_signal_state.lr = mach_signal_backtrace.frames[0];
+#endif
+
+    memset(&mach_signal_lanes, 0, sizeof(mach_signal_lanes));
+    if (signal == SIGFPE && mach_exception_lanes_enabled()) {
+        mach_exception_simd_state_t simd;
+        if (mach_signal_simd_state_from_ucontext(ucontext, &simd)) {
+            mach_exception_lanes_attribute(&simd, &mach_signal_lanes);
+        }
+    }
+}
+
+bool mach_exception_last_backtrace(mach_exception_backtrace_t *backtrace)
+{
+    *backtrace = mach_signal_backtrace;
+    return backtrace->pc != 0;
+}
+
+bool mach_exception_last_state(mach_exception_state_t *state)
+{
+    *state = mach_signal_state;
+    return state->pc != 0 || state->fault_address != 0;
+}
+
+bool mach_exception_last_lanes(mach_exception_lanes_t *lanes)
+{
+    *lanes = mach_signal_lanes;
+    return lanes->count != 0;
+}
+
+// Rewrite the context a fault signal was delivered with, so returning from the handler resumes the thread at a
+// scope's resume point. The kernel restores the rest of the context, including the thread's signal mask and
+// floating-point state. The exception flags the faulting operation raised are cleared, as a pending x87 exception
+// would trap again at the thread's next floating-point instruction.
+static void mach_signal_resume(const mach_exception_resume_point_t *point,
+                               const mach_exception_record_t *record,
+                               void *ucontext)
+{
+    ucontext_t *context = (ucontext_t *) ucontext;
+    mach_exception_resume_rewrite(mach_exception_resume_host_layout, context, point, record);
+#if defined(__x86_64__)
+    if (context->uc_mcontext.fpregs != NULL) {
+        context->uc_mcontext.fpregs->mxcsr &= ~(uint32_t) 0x3f;
+        context->uc_mcontext.fpregs->swd &= (uint16_t) ~0x80ff;
+    }
+#endif
+}
+
+static void mach_signal_handler(int signal, siginfo_t *info, void *ucontext)
+{
+    // A probe's fault resumes at its fixup, before anything else sees it, whether or not the thread is in a scope.
+    if ((signal == SIGSEGV || signal == SIGBUS) && info->si_code > 0 &&
+        mach_exception_fixup_apply(mach_exception_resume_host_layout, ucontext)) {
+        return;
+    }
+
+    // A thread outside every scope doesn't own the fault, which the thread-local scope pointer tells in a single
+    // load, so faults other components rely on (e.g., a virtual machine's safepoint polls) pass straight through,
+    // counted as forwarded, but neither timed, captured, nor counted as wakeups.
+    mach_signal_scope_t *scope = mach_signal_current_scope;
+
+    // Only faults raised by the processor are exceptions; signals sent with kill(2) and friends are not.
+    mach_exception_record_t record;
+    bool fault = info->si_code > 0 && mach_signal_record_from_siginfo(signal, info, ucontext, &record);
+    if (scope == NULL || !fault || !(scope->combined_mask & ((exception_mask_t) 1 << record.type))) {
+        if (fault) {
+            mach_exception_metrics_forwarded(&record);
+        }
+        mach_signal_forward(signal, info, ucontext);
+        return;
+    }
+
+    uint64_t start = mach_exception_metrics_now();
+    mach_exception_metrics_wakeup();
+    mach_exception_capture_installed_signal(signal, info, ucontext);
+
+    // A fault a resolver repairs (e.g., an arena growing into its reservation) isn't an exception: returning from
+    // the handler executes the faulting instruction again.
+    if (record.type == EXC_BAD_ACCESS && mach_exception_resolve((uint64_t)(uintptr_t) info->si_addr)) {
+        return;
+    }
+    mach_signal_capture(signal, info, ucontext);
+    mach_exception_ring_publish(&record, mach_signal_state.pc, 0);
+    mach_signal_resume(&scope->point, &record, ucontext);
+    mach_signal_resumed_at = mach_exception_metrics_now();
+    mach_exception_metrics_caught(&record, mach_signal_resumed_at - start);
+}
+
+// MARK: - Installation
+
+static void mach_signal_release_altstack(void *altstack)
+{
+    stack_t disable;
+    memset(&disable, 0, sizeof(disable));
+    disable.ss_flags = SS_DISABLE;
+    sigaltstack(&disable, NULL);
+    munmap(altstack, MACH_SIGNAL_ALTSTACK_SIZE);
+}
+
+static void mach_signal_install(void)
+{
+    int error = pthread_key_create(&mach_signal_altstack_key, mach_signal_release_altstack);
+    if (error != 0) {
+        mach_signal_install_error = error;
+        return;
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = mach_signal_handler;
+    action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    sigemptyset(&action.sa_mask);
+
+    for (size_t index = 0; index < MACH_SIGNAL_COUNT; index++) {
+        if (sigaction(mach_signal_signals[index], &action, &mach_signal_previous_actions[index]) != 0) {
+            mach_signal_install_error = errno;
+            return;
+        }
+    }
+}
+
+// Install the process-wide signal handlers, if necessary, and give the calling thread an alternate signal stack,
+// so a stack overflow can still be reported. Only the first call on each thread does any work.
+static int mach_signal_prepare_thread(void)
+{
+    pthread_once(&mach_signal_install_once, mach_signal_install);
+    if (mach_signal_install_error != 0) {
+        errno = mach_signal_install_error;
+        return -1;
+    }
+
+    // Give the thread a ring, into which the handler publishes the faults it catches.
+    if (!mach_exception_ring_prepare()) {
+        return -1;
+    }
+
+    // Give the thread a shard of the metrics. Without one, the thread counts into the shared shard.
+    mach_exception_metrics_prepare();
+
+    // Record the bounds of the thread's stack, outside of which the handler never follows a frame pointer.
+    pthread_attr_t attributes;
+    if (pthread_getattr_np(pthread_self(), &attributes) == 0) {
+        void *stack_address = NULL;
+        size_t stack_size = 0;
+        if (pthread_attr_getstack(&attributes, &stack_address, &stack_size) == 0) {
+            mach_signal_stack_low = (uint64_t)(uintptr_t) stack_address;
+            mach_signal_stack_high = mach_signal_stack_low + stack_size;
+        }
+        pthread_attr_destroy(&attributes);
+    }
+
+    // Keep an alternate signal stack some other component (e.g., a sanitizer or a language runtime) installed.
+    stack_t current;
+    if (sigaltstack(NULL, &current) == 0 && !(current.ss_flags & SS_DISABLE)) {
+        mach_signal_thread_prepared = true;
+        return 0;
+    }
+
+    void *altstack = mmap(NULL,
+                          MACH_SIGNAL_ALTSTACK_SIZE,
+                          PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS,
+                          -1,
+                          0);
+    if (altstack == MAP_FAILED) {
+        return -1;
+    }
+
+    stack_t stack;
+    memset(&stack, 0, sizeof(stack));
+    stack.ss_sp = altstack;
+    stack.ss_size = MACH_SIGNAL_ALTSTACK_SIZE;
+    if (sigaltstack(&stack, NULL) != 0) {
+        int error = errno;
+        munmap(altstack, MACH_SIGNAL_ALTSTACK_SIZE);
+        errno = error;
+        return -1;
+    }
+    pthread_setspecific(mach_signal_altstack_key, altstack);
+
+    mach_signal_thread_prepared = true;
+    return 0;
+}
+
+bool mach_signal_exchange_previous_action(int signal,
+                                          const struct sigaction *action,
+                                          struct sigaction *previous)
+{
+    pthread_once(&mach_signal_install_once, mach_signal_install);
+    for (size_t index = 0; index < MACH_SIGNAL_COUNT; index++) {
+        if (mach_signal_signals[index] == signal) {
+            if (previous != NULL) {
+                *previous = mach_signal_previous_actions[index];
+            }
+            mach_signal_previous_actions[index] = *action;
+            return true;
+        }
+    }
+    return false;
+}
+
+// MARK: - mach_signal_perform
+
+mach_signal_result_t mach_signal_perform(exception_mask_t mask,
+                                         void (*operation)(void *context),
+                                         void (*finally)(void *context),
+                                         void *context,
+                                         mach_exception_record_t *record)
+{
+    if (!mach_signal_thread_prepared && mach_signal_prepare_thread() != 0) {
+        return MACH_SIGNAL_FAILURE;
+    }
+
+    mach_signal_scope_t scope;
+    scope.mask = mask;
+    scope.previous = mach_signal_current_scope;
+    scope.combined_mask = scope.previous == NULL ? mask : mask | scope.previous->combined_mask;
+
+    // Record a resume point rather than a sigjmp_buf: the handler resumes the thread by rewriting the context it
+    // returns to, so the kernel restores the signal mask, and entering a scope never saves it.
+    if (mach_exception_resume_enter(&scope.point) != 0) {
+        mach_signal_current_scope = scope.previous;
+        if (mach_signal_resumed_at != 0) {
+            mach_exception_metrics_resumed(scope.point.record.type,
+                                           mach_exception_metrics_now() - mach_signal_resumed_at);
+            mach_signal_resumed_at = 0;
+        }
+        finally(context);
+
+        // The handler resumes the innermost scope, so that every scope's finally block executes. If this scope
+        // does not catch the exception, pass it on to the enclosing scope that does.
+        mach_exception_record_t caught = scope.point.record;
+        if (!(scope.mask & ((exception_mask_t) 1 << caught.type)) && scope.previous != NULL) {
+            mach_exception_resume_landing(&scope.previous->point, caught.type, caught.code, caught.subcode);
+        }
+        *record = caught;
+        return MACH_SIGNAL_CAUGHT;
+    }
+
+    mach_exception_metrics_scope_entered();
+    mach_signal_current_scope = &scope;
+    operation(context);
+    mach_signal_current_scope = scope.previous;
+    finally(context);
+    return MACH_SIGNAL_COMPLETED;
+}
+
+// MARK: - mach_exception_perform
+
+mach_exception_result_t mach_exception_perform(exception_mask_t mask,
+                                               void (*operation)(void *context),
+                                               void (*finally)(void *context),
+                                               void *context,
+                                               mach_exception_record_t *record,
+                                               mach_exception_state_t *state,
+                                               int *error)
+{
+    switch (mach_signal_perform(mask, operation, finally, context, record)) {
+    case MACH_SIGNAL_COMPLETED:
+        return MACH_EXCEPTION_COMPLETED;
+    case MACH_SIGNAL_CAUGHT:
+        if (state != NULL) {
+            *state = mach_signal_state;
+        }
+        return MACH_EXCEPTION_CAUGHT;
+    default:
+        *error = errno;
+        return MACH_EXCEPTION_FAILURE;
+    }
+}
+
+// MARK: - mach_exception_fixup_prepare
+
+// The probes need only the process-wide handlers: they never overflow the stack, so they need no alternate stack.
+bool mach_exception_fixup_prepare(int *error)
+{
+    pthread_once(&mach_signal_install_once, mach_signal_install);
+    if (mach_signal_install_error != 0) {
+        *error = mach_signal_install_error;
+        return false;
+    }
+    return true;
+}
+
+#endif /* defined(__linux__) */
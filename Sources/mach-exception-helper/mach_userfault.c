@@ -0,0 +1,384 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// mach-exception
+// mach_userfault.c
+// Created by Patrick Gili on 2/20/23.
+//
+
+#if defined(__linux__)
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/userfaultfd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include "mach_userfault.h"
+
+// The number of fault messages the handler thread reads at once.
+#define MACH_USERFAULT_BATCH 16
+
+// Older headers lack the flag, which Linux 5.11 added.
+#ifndef UFFD_USER_MODE_ONLY
+#define UFFD_USER_MODE_ONLY 1
+#endif
+
+struct mach_userfault_region {
+    uint8_t *base;
+    size_t size;
+    size_t page_size;
+    size_t pages;
+    size_t fault_around;
+    size_t prefetch;
+    mach_userfault_fill_t fill;
+    void *context;
+
+    int descriptor;
+    int stop;
+    pthread_t thread;
+
+    // The staging buffer into which the fill callback writes, large enough for a window or a prefetch.
+    uint8_t *buffer;
+    size_t buffer_size;
+
+    // A bit per page, set once the page is served, so fault-around and prefetch skip it. Only the handler thread
+    // touches it.
+    uint64_t *served;
+
+    mach_userfault_statistics_t statistics;
+};
+
+static uint64_t mach_userfault_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000u + (uint64_t) now.tv_nsec;
+}
+
+static bool mach_userfault_is_served(const mach_userfault_region_t *region, size_t page)
+{
+    return (region->served[page / 64] >> (page % 64)) & 1;
+}
+
+static void mach_userfault_mark_served(mach_userfault_region_t *region, size_t first, size_t count)
+{
+    for (size_t page = first; page < first + count; page++) {
+        region->served[page / 64] |= (uint64_t) 1 << (page % 64);
+    }
+}
+
+static void mach_userfault_count(uint64_t *counter, uint64_t value)
+{
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + value, __ATOMIC_RELAXED);
+}
+
+// MARK: - Serving pages
+
+// Fill and copy in the pages from `first` up to, but excluding, `last` that haven't been served, a run of
+// consecutive pages at a time. The copies wake no thread: the caller wakes the threads waiting for the pages. Returns
+// the number of pages served, or -1 if a run couldn't be filled or copied, with the run in `failed_first` and
+// `failed_last`.
+static long mach_userfault_serve(mach_userfault_region_t *region,
+                                 size_t first,
+                                 size_t last,
+                                 size_t *failed_first,
+                                 size_t *failed_last)
+{
+    long served = 0;
+    size_t page = first;
+    while (page < last) {
+        if (mach_userfault_is_served(region, page)) {
+            page++;
+            continue;
+        }
+        size_t end = page + 1;
+        while (end < last && !mach_userfault_is_served(region, end)) {
+            end++;
+        }
+
+        size_t offset = page * region->page_size;
+        size_t length = (end - page) * region->page_size;
+        if (!region->fill(offset, region->buffer, length, region->context)) {
+            *failed_first = page;
+            *failed_last = end;
+            return -1;
+        }
+        struct uffdio_copy copy;
+        memset(&copy, 0, sizeof(copy));
+        copy.dst = (uint64_t)(uintptr_t) (region->base + offset);
+        copy.src = (uint64_t)(uintptr_t) region->buffer;
+        copy.len = length;
+        copy.mode = UFFDIO_COPY_MODE_DONTWAKE;
+        // A page a thread populated some other way (e.g., with madvise) already exists; keep it.
+        if (ioctl(region->descriptor, UFFDIO_COPY, &copy) != 0 && errno != EEXIST) {
+            *failed_first = page;
+            *failed_last = end;
+            return -1;
+        }
+        mach_userfault_mark_served(region, page, end - page);
+        served += (long) (end - page);
+        page = end;
+    }
+    return served;
+}
+
+// Wake the threads waiting for pages from `first` up to, but excluding, `last`.
+static void mach_userfault_wake(mach_userfault_region_t *region, size_t first, size_t last)
+{
+    struct uffdio_range range = {
+        .start = (uint64_t)(uintptr_t) (region->base + first * region->page_size),
+        .len = (last - first) * region->page_size,
+    };
+    ioctl(region->descriptor, UFFDIO_WAKE, &range);
+}
+
+// Serve the fault-around window holding the faulting page, then prefetch the pages following it. If a run of the
+// window cannot be served, make the run inaccessible, so the threads waiting for it raise a bad-access exception once
+// woken.
+static void mach_userfault_handle(mach_userfault_region_t *region, uint64_t address)
+{
+    uint64_t start = mach_userfault_now();
+    size_t page = (size_t) (address - (uint64_t)(uintptr_t) region->base) / region->page_size;
+    size_t first = page & ~(region->fault_around - 1);
+    size_t last = first + region->fault_around;
+    if (last > region->pages) {
+        last = region->pages;
+    }
+
+    size_t failed_first;
+    size_t failed_last;
+    long served = mach_userfault_serve(region, first, last, &failed_first, &failed_last);
+    if (served < 0) {
+        // Pages served before the run keep their contents; threads waiting for pages after it fault again.
+        mprotect(region->base + failed_first * region->page_size,
+                 (failed_last - failed_first) * region->page_size,
+                 PROT_NONE);
+        mach_userfault_wake(region, first, last);
+        mach_userfault_count(&region->statistics.failures, 1);
+        return;
+    }
+    // Wake the whole window, whether or not this fault served any of it: the faulting page may have been served
+    // already, by an earlier fault or by a prefetch, which wakes no thread, while the fault waited in the queue.
+    mach_userfault_wake(region, first, last);
+
+    uint64_t service = mach_userfault_now() - start;
+    mach_userfault_count(&region->statistics.faults, 1);
+    mach_userfault_count(&region->statistics.pages, (uint64_t) served);
+    mach_userfault_count(&region->statistics.service_nanoseconds, service);
+    if (service > __atomic_load_n(&region->statistics.max_service_nanoseconds, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&region->statistics.max_service_nanoseconds, service, __ATOMIC_RELAXED);
+    }
+
+    if (region->prefetch > 0 && last < region->pages) {
+        size_t end = last + region->prefetch;
+        if (end > region->pages) {
+            end = region->pages;
+        }
+        uint64_t prefetch_start = mach_userfault_now();
+        size_t failed_first;
+        size_t failed_last;
+        long prefetched = mach_userfault_serve(region, last, end, &failed_first, &failed_last);
+        if (prefetched > 0) {
+            mach_userfault_count(&region->statistics.prefetched_pages, (uint64_t) prefetched);
+        }
+        mach_userfault_count(&region->statistics.prefetch_nanoseconds, mach_userfault_now() - prefetch_start);
+    }
+}
+
+static void * mach_userfault_thread(void *argument)
+{
+    mach_userfault_region_t *region = argument;
+    struct pollfd descriptors[2] = {
+        { .fd = region->descriptor, .events = POLLIN },
+        { .fd = region->stop, .events = POLLIN },
+    };
+    struct uffd_msg messages[MACH_USERFAULT_BATCH];
+
+    for (;;) {
+        if (poll(descriptors, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (descriptors[1].revents & POLLIN) {
+            break;
+        }
+        ssize_t length = read(region->descriptor, messages, sizeof(messages));
+        if (length < 0) {
+            if (errno == EAGAIN || errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        for (size_t index = 0; index < (size_t) length / sizeof(messages[0]); index++) {
+            if (messages[index].event == UFFD_EVENT_PAGEFAULT) {
+                mach_userfault_handle(region, messages[index].arg.pagefault.address);
+            }
+        }
+    }
+    return NULL;
+}
+
+// MARK: - Regions
+
+static size_t mach_userfault_power_of_two(size_t value)
+{
+    size_t power = 1;
+    while (power * 2 <= value) {
+        power *= 2;
+    }
+    return power;
+}
+
+mach_userfault_region_t *mach_userfault_region_create(size_t size,
+                                                      size_t fault_around,
+                                                      size_t prefetch,
+                                                      mach_userfault_fill_t fill,
+                                                      void *context)
+{
+    if (size == 0 || fill == NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
+    mach_userfault_region_t *region = calloc(1, sizeof(*region));
+    if (region == NULL) {
+        return NULL;
+    }
+    int error;
+    region->page_size = (size_t) sysconf(_SC_PAGESIZE);
+    region->size = (size + region->page_size - 1) / region->page_size * region->page_size;
+    region->pages = region->size / region->page_size;
+    region->fault_around = mach_userfault_power_of_two(fault_around == 0 ? 1 : fault_around);
+    region->prefetch = prefetch;
+    region->fill = fill;
+    region->context = context;
+    region->descriptor = -1;
+    region->stop = -1;
+    region->base = MAP_FAILED;
+    region->buffer = MAP_FAILED;
+
+    size_t words = (region->pages + 63) / 64;
+    size_t window = region->fault_around > prefetch ? region->fault_around : prefetch;
+    region->buffer_size = window * region->page_size;
+    region->served = calloc(words, sizeof(uint64_t));
+    region->base = mmap(NULL,
+                        region->size,
+                        PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                        -1,
+                        0);
+    region->buffer = mmap(NULL, region->buffer_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (region->served == NULL || region->base == MAP_FAILED || region->buffer == MAP_FAILED) {
+        goto failed;
+    }
+
+    // Unless vm.unprivileged_userfaultfd is set, only a privileged process may handle faults the kernel takes, e.g.
+    // in a read(2) into the region; any process may handle the faults its own threads take.
+    region->descriptor = (int) syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+    if (region->descriptor < 0 && errno == EPERM) {
+        region->descriptor = (int) syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK | UFFD_USER_MODE_ONLY);
+        // Kernels before 5.11 reject the flag; report the original refusal.
+        if (region->descriptor < 0 && errno == EINVAL) {
+            errno = EPERM;
+        }
+    }
+    if (region->descriptor < 0) {
+        goto failed;
+    }
+    struct uffdio_api api = { .api = UFFD_API, .features = 0 };
+    if (ioctl(region->descriptor, UFFDIO_API, &api) != 0) {
+        goto failed;
+    }
+    struct uffdio_register registration = {
+        .range = { .start = (uint64_t)(uintptr_t) region->base, .len = region->size },
+        .mode = UFFDIO_REGISTER_MODE_MISSING,
+    };
+    if (ioctl(region->descriptor, UFFDIO_REGISTER, &registration) != 0) {
+        goto failed;
+    }
+
+    region->stop = eventfd(0, EFD_CLOEXEC);
+    if (region->stop < 0) {
+        goto failed;
+    }
+    error = pthread_create(&region->thread, NULL, mach_userfault_thread, region);
+    if (error != 0) {
+        errno = error;
+        goto failed;
+    }
+    return region;
+
+failed:
+    error = errno;
+    if (region->stop >= 0) {
+        close(region->stop);
+    }
+    if (region->descriptor >= 0) {
+        close(region->descriptor);
+    }
+    if (region->buffer != MAP_FAILED) {
+        munmap(region->buffer, region->buffer_size);
+    }
+    if (region->base != MAP_FAILED) {
+        munmap(region->base, region->size);
+    }
+    free(region->served);
+    free(region);
+    errno = error;
+    return NULL;
+}
+
+void mach_userfault_region_destroy(mach_userfault_region_t *region)
+{
+    if (region == NULL) {
+        return;
+    }
+    uint64_t stop = 1;
+    if (write(region->stop, &stop, sizeof(stop)) == sizeof(stop)) {
+        pthread_join(region->thread, NULL);
+    }
+    close(region->stop);
+    close(region->descriptor);
+    munmap(region->buffer, region->buffer_size);
+    munmap(region->base, region->size);
+    free(region->served);
+    free(region);
+}
+
+void *mach_userfault_region_address(const mach_userfault_region_t *region)
+{
+    return region->base;
+}
+
+size_t mach_userfault_region_size(const mach_userfault_region_t *region)
+{
+    return region->size;
+}
+
+void mach_userfault_region_statistics(const mach_userfault_region_t *region, mach_userfault_statistics_t *statistics)
+{
+    statistics->faults = __atomic_load_n(&region->statistics.faults, __ATOMIC_RELAXED);
+    statistics->pages = __atomic_load_n(&region->statistics.pages, __ATOMIC_RELAXED);
+    statistics->prefetched_pages = __atomic_load_n(&region->statistics.prefetched_pages, __ATOMIC_RELAXED);
+    statistics->failures = __atomic_load_n(&region->statistics.failures, __ATOMIC_RELAXED);
+    statistics->service_nanoseconds = __atomic_load_n(&region->statistics.service_nanoseconds, __ATOMIC_RELAXED);
+    statistics->max_service_nanoseconds = __atomic_load_n(&region->statistics.max_service_nanoseconds,
+                                                          __ATOMIC_RELAXED);
+    statistics->prefetch_nanoseconds = __atomic_load_n(&region->statistics.prefetch_nanoseconds, __ATOMIC_RELAXED);
+}
+
+#endif /* __linux__ */
@@ -9,69 +9,55 @@
 
 import Foundation
 
-public struct Field {
-    let name: String
-    let lsb: Int
-    let msb: Int
-    
-    init(_ name: String, _ lsb: Int, _ msb: Int) {
-        self.name = name
-        self.lsb = lsb
-        self.msb = msb
-    }
-}
+/// A bit field occupying bits `lsb` through `msb` of a value, read and written as a `U`.
+public struct Field<U: FixedWidthInteger> {
+    public let lsb: Int
+    public let width: Int
 
-public struct Fields {
-    
-    internal var store: [String : (lsb: Int, msb: Int)] = [:]
-    
-    init(@BitFieldsBuilder fields: () -> [String : (lsb: Int, msb: Int)]) {
-        self.store = fields()
+    @inlinable
+    public init(_ lsb: Int, _ msb: Int) {
+        self.lsb = lsb
+        self.width = msb - lsb + 1
     }
 }
 
-@dynamicMemberLookup
+/// A type whose value is a set of bit fields.
+///
+/// A conforming type declares each field as a static constant, and reads and writes it by subscripting its value
+/// with the field, so a field carries its own result type, and naming a field the type doesn't declare is a compile
+/// error. The subscript takes the field itself, rather than a key path to it, so an access with a constant field is
+/// a shift and a mask the optimizer can fold.
+///
+///     struct Nybbles: BitFields {
+///         var value: UInt8
+///
+///         static let low = Field<UInt8>(0, 3)
+///         static let high = Field<UInt8>(4, 7)
+///     }
+///
+///     var nybbles = Nybbles(value: 0x21)
+///     nybbles[Nybbles.high] = 3   // 0x31
 public protocol BitFields {
-    
+
     associatedtype Value: FixedWidthInteger
-    
+
     var value: Value { get set }
-    
-    static var fields: Fields { get }
-    
-    subscript<U: FixedWidthInteger>(dynamicMember member: String) -> U { get set }
 }
 
 extension BitFields {
-    
-    public subscript<U: FixedWidthInteger>(dynamicMember member: String) -> U {
-        
+
+    @inlinable
+    public subscript<U: FixedWidthInteger>(field: Field<U>) -> U {
+
         get {
-            guard let field = Self.fields.store[member] else { return 0 }
-            let width = field.msb - field.lsb + 1
-            let mask: Value = 1 << width &- 1
+            let mask: Value = 1 << field.width &- 1
             return U(truncatingIfNeeded: value >> field.lsb & mask)
         }
-        
+
         set {
-            guard let field = Self.fields.store[member] else { return }
-            let width = field.msb - field.lsb + 1
-            let mask: Value = 1 << width &- 1
+            let mask: Value = 1 << field.width &- 1
             value &= ~(mask << field.lsb)
             value |= (Value(truncatingIfNeeded: newValue) & mask) << field.lsb
         }
     }
 }
-
-@resultBuilder
-enum BitFieldsBuilder {
-    
-    static func buildBlock(_ components: Field...) -> [String : (lsb: Int, msb: Int)] {
-        let components: [Field] = components
-        var result = [String : (lsb: Int, msb: Int)]()
-        for component in components {
-            result[component.name] = (component.lsb, component.msb)
-        }
-        return result
-    }
-}
@@ -8,40 +8,127 @@
 //
 
 import Foundation
+#if canImport(Darwin)
 import Darwin
+#elseif canImport(Glibc)
+import Glibc
+#endif
 import mach_exception_helper
 
+#if canImport(Darwin)
 /// Execute an operation, catching Mach exceptions of specified types.
 ///
+/// The function performs the operation in a scope of the calling thread's persistent exception context. The first
+/// call on a thread creates the context, whose exception port a process-wide listener thread serves, and a call
+/// requesting exception types the context doesn't yet route widens the thread's exception ports. Otherwise, entering
+/// and leaving a scope makes no kernel calls, so nested calls and calls in a tight loop are inexpensive. Nested calls
+/// combine their types: an exception is caught by the innermost call whose types include it, after the finally
+/// blocks of the calls it encloses have executed.
+///
+/// The listener blocks until an exception arrives, so it never wakes while operations run without faulting, and
+/// stops as soon as the last thread with an exception context exits. It resumes the faulting thread in
+/// `mach_exception_perform`, which writes the exception and the thread's machine state into this function's stack,
+/// so catching an exception involves neither Foundation nor the Objective-C runtime.
+///
+/// If `MachExceptionLog.shared` is set, the function appends each exception it catches to that log.
+///
 /// Warning!
-/// Throwing an exception through a Swift frame can have undesirable side effects, such as leaking memory. The reason
-/// for this is Swift wasn't designed to handle exceptions, and hence stack unwinding becauses an issue due to language
-/// features. For example, simple stack unwinding ignores executing defer statements defined in the scope of a frame.
-/// Sometimes, it is possible to perform the necessary clean up in the finally block. However, there is no guarantee
-/// this works consistently with subsequent releases of the Swift language.
+/// Resuming after an exception skips the remainder of the operation's Swift frames, which can have undesirable side
+/// effects, such as leaking memory or skipping defer statements. Sometimes, it is possible to perform the necessary
+/// clean up in the finally block. However, there is no guarantee this works consistently with subsequent releases of
+/// the Swift language.
 ///
 /// - Parameters:
 ///   - types: The Mach exception types the function will catch, if thrown.
-///   - listenerTimeout: The frequency (in milliseconds) that the exception listener checks for cancellation, which
-///     occurs when the operation completes.
-///   - dependencies: The dependencies required by the Mach exception helper. By default, the function creates the
-///     necessary default dependencies. This parameter has the intent of providing dependency injection by software
-///     unit tests.
+///   - dependencies: The dependencies required to create the thread's exception context, or `nil` for the default
+///     dependencies. This parameter has the intent of providing dependency injection by software unit tests.
 ///   - operation: A closure executed by the function that may throw Mach exceptions.
 ///   - finally: A "finally block" executed after the operation and any subsequent exception have executed.
 ///
 /// - Throws: If the operation throws an Mach exception, then the function throws a `MachExceptionError`, which
-///   specifies the Mach exception type, the associated code, and associated sub-code. It is possible for the
-///   function to throw an `NSError` corresponding to errors returned by the Mach exception helper.
+///   specifies the Mach exception type, the associated code, associated sub-code, and the faulting thread's machine
+///   state. If the function cannot create or widen the thread's exception context, it throws an `NSError` in the
+///   Mach error domain.
 public func withUnsafeMachException(types: MachExceptionTypes,
-                                    listenerTimeout timeout: mach_msg_timeout_t = 10,
-                                    dependencies: MachExceptionHelperDependencies = MachExceptionHelperDependenciesDefault(),
+                                    dependencies: MachExceptionHelperDependencies? = nil,
                                     operation: @escaping () -> (),
                                     finally: @escaping () -> () = { () in }) throws
 {
-    // Create a Mach exception helper to listen for the specified Mach exception types.
-    let helper = try MachExceptionHelper(mask: types.exceptionMask, dependencies: dependencies)
-    
+    if let machExceptionError = try performUnsafeMachException(types, dependencies, operation, finally) {
+        throw machExceptionError
+    }
+}
+
+#elseif os(Linux)
+/// Execute an operation, catching Mach exceptions of specified types.
+///
+/// On Linux, the function catches the hardware faults (SIGSEGV, SIGBUS, SIGILL, SIGFPE and SIGTRAP) corresponding to
+/// the specified Mach exception types, and describes them using the codes Darwin uses for the same faults. The fault
+/// handler runs on a per-thread alternate signal stack and resumes the function directly, by rewriting the context it
+/// returns to, so unlike on Darwin there is no exception port and no listener task. Entering a scope only stores the
+/// registers it resumes with, and makes no system call: measured in C on an x86_64 Linux host, entering and leaving a
+/// scope costs 14-17 ns, against 7-8 ns for a bare `sigsetjmp(env, 0)` and 208-215 ns for `sigsetjmp(env, 1)`. Only
+/// the first call on each thread makes system calls, to install the handlers and the alternate signal stack.
+///
+/// If `MachExceptionLog.shared` is set, the function appends each exception it catches to that log.
+///
+/// Warning!
+/// Resuming after a fault skips the remainder of the operation's Swift frames, which can have undesirable side
+/// effects, such as leaking memory or skipping defer statements. Perform any necessary clean up in the finally block.
+///
+/// - Parameters:
+///   - types: The Mach exception types the function will catch, if thrown.
+///   - operation: A closure executed by the function that may throw Mach exceptions.
+///   - finally: A "finally block" executed after the operation and any subsequent exception have executed.
+///
+/// - Throws: If the operation throws an Mach exception, then the function throws a `MachExceptionError`, which
+///   specifies the Mach exception type, the associated code, associated sub-code, and the faulting thread's machine
+///   state. If the function cannot install its signal handlers, it throws an `NSError` in the POSIX error domain.
+public func withUnsafeMachException(types: MachExceptionTypes,
+                                    operation: @escaping () -> (),
+                                    finally: @escaping () -> () = { () in }) throws
+{
+    if let machExceptionError = try performUnsafeMachException(types, nil, operation, finally) {
+        throw machExceptionError
+    }
+}
+#endif
+
+/// Execute an operation, catching Mach exceptions of specified types, and return the exception caught.
+///
+/// The function behaves as `withUnsafeMachException`, but returns the exception it catches rather than throwing it.
+/// Throwing a `MachExceptionError` boxes it in a heap-allocated existential, so callers that catch exceptions on a
+/// hot path use this function, whose result path allocates nothing: the backend writes the exception and the
+/// faulting thread's machine state into this function's stack, and the function returns them inline.
+///
+/// - Parameters:
+///   - types: The Mach exception types the function will catch, if thrown.
+///   - operation: A closure executed by the function that may throw Mach exceptions.
+///   - finally: A "finally block" executed after the operation and any subsequent exception have executed.
+///
+/// - Returns: The Mach exception the operation threw, or `nil` if the operation executed to completion.
+///
+/// - Throws: An `NSError`, if the function cannot prepare the calling thread to catch exceptions: in the Mach error
+///   domain on Darwin, or in the POSIX error domain on Linux.
+public func withUnsafeMachExceptionResult(types: MachExceptionTypes,
+                                          operation: @escaping () -> (),
+                                          finally: @escaping () -> () = { () in }) throws -> MachExceptionError?
+{
+    return try performUnsafeMachException(types, nil, operation, finally)
+}
+
+#if canImport(Darwin)
+internal typealias MachExceptionDependencies = MachExceptionHelperDependencies
+#else
+internal typealias MachExceptionDependencies = Never
+#endif
+
+// Perform an operation with `mach_exception_perform`, and return the exception caught, if any.
+internal func performUnsafeMachException(_ types: MachExceptionTypes,
+                                         _ dependencies: MachExceptionDependencies?,
+                                         _ operation: @escaping () -> (),
+                                         _ finally: @escaping () -> ()) throws -> MachExceptionError?
+{
     // Save the current configuration flags for exclusivity checking and fatal error reporting.
     let previousExclusivity = _swift_disableExclusivityChecking
     let previousReporting = _swift_reportFatalErrorsToDebugger
@@ -55,58 +142,48 @@ public func withUnsafeMachException(types: MachExceptionTypes,
         _swift_reportFatalErrorsToDebugger = previousReporting
         _swift_disableExclusivityChecking = previousExclusivity
     }
-
-    // Start the listener task, which runs concurrently with the rest of this function. The listener task consists of
-    // a loop that executes until the task is cancelled. On each iteration of the loop, the listener task invokes the
-    // Mach exception handler's listener method, which can result in three cases:
-    //
-    //   - The Mach exception handler's listener method received a Mach exception, in which case it done.
-    //
-    //   - The Mach exception handler's listener method time's out, then the task simply checks if it is cancelled.
-    //     If not, then it continues listening.
-    //
-    //   - The Mach exception handler's listener method encountered an error, which causes the task to throw the error.
-    //
-    // FIXIT: The function does nothing with errors thrown by this task, which can result in undesirable behavior.
-    // Ideally, if the task throws an error, then it is desirable to terminate the operation and have this function
-    // rethrow the error. However, there are competing requirements at play. It isn't necessarily desirable for the
-    // operation to support asynchronous semantics, not to mention cancellation semantics. It may become necessary to
-    // spawn the operation is in own thread, which this thread could terminate.
-    let listenerTask = Task {
-        while Task.isCancelled == false {
-            do {
-                try helper.listen(withTimeout: timeout)
-                break
-            } catch let error as NSError where error.code == MACH_RCV_TIMED_OUT {
-                continue
-            } catch let error as NSError {
-                throw error
-            }
-        }
+    
+    // Perform the operation on this thread. If it faults, the backend resumes execution in `mach_exception_perform`,
+    // which executes the "finally block" and returns `MACH_EXCEPTION_CAUGHT` with the record describing the exception
+    // and the faulting thread's machine state.
+    typealias Blocks = (operation: () -> (), finally: () -> ())
+    var blocks: Blocks = (operation, finally)
+    var record = mach_exception_record_t()
+    var state = mach_exception_state_t()
+    var error: Int32 = 0
+    let result = withUnsafeMutablePointer(to: &blocks) { blocks in
+#if canImport(Darwin)
+        mach_exception_perform_with_dependencies(types.exceptionMask, dependencies, { context in
+            context!.assumingMemoryBound(to: Blocks.self).pointee.operation()
+        }, { context in
+            context!.assumingMemoryBound(to: Blocks.self).pointee.finally()
+        }, blocks, &record, &state, &error)
+#else
+        mach_exception_perform(types.exceptionMask, { context in
+            context!.assumingMemoryBound(to: Blocks.self).pointee.operation()
+        }, { context in
+            context!.assumingMemoryBound(to: Blocks.self).pointee.finally()
+        }, blocks, &record, &state, &error)
+#endif
     }
     
-    // Perform the operation, which results in the following cases:
-    //
-    //   - The operation completes without throwing a Mach exception. In this case, the "finally block" excecutes and
-    //     the listener task is cancelled.
-    //
-    //   - The operation throws a Mach exception. In this case, this function checks if the exception is indeed a Mach
-    //     exception, in which case it rethrows it. It isn't necessary to worry about the Mach exception helper's
-    //     listener, as in this case it will already have terminated.
-    //
-    //   - The operation throws some other exception, which causes the function to log the error and return.
-    do {
-        try helper.perform {
-            operation()
-        } finally: {
-            finally()
-        }
-        listenerTask.cancel()
-    } catch let error as NSError where error.domain == MachExceptionErrorDomain {
-        guard let machExceptionError = MachExceptionError(error) else {
+    switch result {
+    case MACH_EXCEPTION_COMPLETED:
+        return nil
+    case MACH_EXCEPTION_CAUGHT:
+        MachExceptionLog.appendCaught(record)
+        let captured = state.pc != 0 || state.fault_address != 0
+        let lanes = record.type == EXC_ARITHMETIC ? MachExceptionLanes.lastCaught : nil
+        guard let machExceptionError = MachExceptionError(record, state: captured ? state : nil, lanes: lanes) else {
             print("Unhandled exception") // FIXIT: Fix this to use log, instead of print
-            return
+            return nil
         }
-        throw machExceptionError
+        return machExceptionError
+    default:
+#if canImport(Darwin)
+        throw NSError(domain: NSMachErrorDomain, code: Int(error), userInfo: nil)
+#else
+        throw NSError(domain: NSPOSIXErrorDomain, code: Int(error), userInfo: nil)
+#endif
     }
 }
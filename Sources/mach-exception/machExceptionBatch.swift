@@ -0,0 +1,127 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// mach-exception
+// machExceptionBatch.swift
+// Created by Patrick Gili on 2/6/23.
+//
+
+import Foundation
+import mach_exception_helper
+
+/// The architecture of the host that reported a Mach exception.
+public enum MachExceptionArchitecture: Equatable {
+    case x86_64
+    case arm64
+
+    /// The architecture of the running host.
+    public static var host: MachExceptionArchitecture {
+#if arch(arm) || arch(arm64)
+        return .arm64
+#else
+        return .x86_64
+#endif
+    }
+
+    internal var arch: mach_exception_arch_t {
+        switch self {
+        case .x86_64: return MACH_EXCEPTION_ARCH_X86_64
+        case .arm64: return MACH_EXCEPTION_ARCH_ARM64
+        }
+    }
+}
+
+/// A batch of Mach exception records, decoded offline into a struct of arrays.
+///
+/// Unlike `MachExceptionError`, which decodes a single exception raised on the running host, a batch decodes the
+/// records reported by a host of any architecture, such as arm64 crash reports ingested on an x86_64 server. Each
+/// array holds one element per record; see `mach_exception_batch_t` for the meaning of each column, which depends
+/// on the record's cause (one of the `MACH_EXCEPTION_CAUSE_*` constants).
+public struct MachExceptionBatch {
+
+    /// The architecture of the host that reported the records.
+    public let architecture: MachExceptionArchitecture
+
+    /// The records' architecture-independent causes.
+    public private(set) var causes: [mach_exception_cause_t]
+
+    /// The flavors of resource and guard exceptions, and the reasons of Mach port guard exceptions.
+    public private(set) var flavors: [UInt32]
+
+    /// The result of a VM fault, the first field of a resource code, or the target of a guard exception.
+    public private(set) var primaries: [UInt32]
+
+    /// The second field of a resource code.
+    public private(set) var secondaries: [UInt32]
+
+    /// The usage a resource exception observed, or any other exception's subcode.
+    public private(set) var details: [UInt64]
+
+    /// The number of records whose cause is known.
+    public private(set) var knownCount: Int
+
+    /// The number of records in the batch.
+    public var count: Int {
+        return causes.count
+    }
+
+    /// Decode a batch of Mach exception records.
+    ///
+    /// - Parameters:
+    ///   - architecture: The architecture of the host that reported the records.
+    ///   - types: The records' exception types.
+    ///   - codes: The records' codes.
+    ///   - subcodes: The records' subcodes.
+    public init(architecture: MachExceptionArchitecture,
+                types: [exception_type_t],
+                codes: [mach_exception_data_type_t],
+                subcodes: [mach_exception_data_type_t]) {
+        precondition(types.count == codes.count && types.count == subcodes.count,
+                     "The types, codes and subcodes must describe the same number of records")
+        let count = types.count
+        var causes = [mach_exception_cause_t](repeating: 0, count: count)
+        var flavors = [UInt32](repeating: 0, count: count)
+        var primaries = [UInt32](repeating: 0, count: count)
+        var secondaries = [UInt32](repeating: 0, count: count)
+        var details = [UInt64](repeating: 0, count: count)
+
+        var batch = mach_exception_batch_t()
+        let knownCount = causes.withUnsafeMutableBufferPointer { cause in
+            flavors.withUnsafeMutableBufferPointer { flavor in
+                primaries.withUnsafeMutableBufferPointer { primary in
+                    secondaries.withUnsafeMutableBufferPointer { secondary in
+                        details.withUnsafeMutableBufferPointer { detail in
+                            batch.cause = cause.baseAddress
+                            batch.flavor = flavor.baseAddress
+                            batch.primary = primary.baseAddress
+                            batch.secondary = secondary.baseAddress
+                            batch.detail = detail.baseAddress
+                            return mach_exception_decode(architecture.arch, types, codes, subcodes, count, &batch)
+                        }
+                    }
+                }
+            }
+        }
+
+        self.architecture = architecture
+        self.causes = causes
+        self.flavors = flavors
+        self.primaries = primaries
+        self.secondaries = secondaries
+        self.details = details
+        self.knownCount = knownCount
+    }
+
+    /// Decode a batch of Mach exception records.
+    ///
+    /// - Parameters:
+    ///   - architecture: The architecture of the host that reported the records.
+    ///   - records: The records.
+    public init(architecture: MachExceptionArchitecture, records: [mach_exception_record_t]) {
+        self.init(architecture: architecture,
+                  types: records.map { $0.type },
+                  codes: records.map { $0.code },
+                  subcodes: records.map { $0.subcode })
+    }
+}
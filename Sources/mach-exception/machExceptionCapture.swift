@@ -0,0 +1,178 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// mach-exception
+// machExceptionCapture.swift
+// Created by Patrick Gili on 2/28/23.
+//
+
+import Foundation
+import mach_exception_helper
+
+/// A capture file recording the raw inputs of the exception handlers, with their timing: the request messages the
+/// Darwin listener receives, and the fault signals, with their siginfo and context, the Linux signal handler
+/// receives. Use `MachExceptionReplay` to feed a capture back through the handlers' decoding.
+///
+/// Installing a capture makes the handlers append to it. Appending an event costs a system call, so a capture is
+/// for reproducing a problem, rather than for leaving installed.
+public final class MachExceptionCapture {
+
+    private let capture: OpaquePointer
+
+    /// The path of the capture file.
+    public let path: String
+
+    /// Create a capture file, replacing any file at its path.
+    ///
+    /// - Parameter path: The path of the capture file.
+    ///
+    /// - Throws: An `NSError` in the POSIX error domain, if the file cannot be created.
+    public init(path: String) throws {
+        guard let capture = mach_exception_capture_open(path) else {
+            throw NSError(domain: NSPOSIXErrorDomain, code: Int(errno), userInfo: nil)
+        }
+        self.capture = capture
+        self.path = path
+    }
+
+    deinit {
+        mach_exception_capture_close(capture)
+    }
+
+    /// Make the handlers append their inputs to this capture, rather than to the capture installed, if any.
+    public func install() {
+        mach_exception_capture_install(capture)
+    }
+
+    /// Make the handlers stop appending their inputs to this capture, if it is installed.
+    public func uninstall() {
+        let previous = mach_exception_capture_install(nil)
+        if previous != nil && previous != capture {
+            mach_exception_capture_install(previous)
+        }
+    }
+
+    /// Append a request message to the capture, as the listener would have received it.
+    ///
+    /// - Throws: An `NSError` in the POSIX error domain, if the event could not be written.
+    public func append(message: UnsafeRawBufferPointer) throws {
+        guard mach_exception_capture_message(capture, message.baseAddress, message.count) else {
+            throw NSError(domain: NSPOSIXErrorDomain, code: Int(errno), userInfo: nil)
+        }
+    }
+}
+
+/// A capture file mapped for replaying, whose events are read in place.
+///
+/// Replaying a capture delivers its requests to the portable dispatch core, and decodes its fault signals as the
+/// signal handler does, without involving the kernel, at the recorded pace or as fast as possible. Iterating the
+/// replay visits the events themselves.
+public final class MachExceptionReplay: Sequence {
+
+    private var replay = mach_exception_replay_t()
+
+    /// Map a capture file for replaying.
+    ///
+    /// - Parameter file: The path of the capture file.
+    ///
+    /// - Throws: An `NSError` in the POSIX error domain, if the file cannot be mapped, or isn't a capture file.
+    public init(file: String) throws {
+        guard mach_exception_replay_open(&replay, file) else {
+            throw NSError(domain: NSPOSIXErrorDomain, code: Int(errno), userInfo: nil)
+        }
+    }
+
+    deinit {
+        mach_exception_replay_close(&replay)
+    }
+
+    /// The file's header.
+    public var header: mach_exception_capture_header_t {
+        return replay.header.pointee
+    }
+
+    /// The event at or after `cursor`, a byte offset in the file (0 for the first event), which advances past it, or
+    /// `nil` if there are no more.
+    public func next(_ cursor: inout UInt64) -> UnsafePointer<mach_exception_capture_event_t>? {
+        return withUnsafePointer(to: &replay) { mach_exception_replay_next($0, &cursor) }
+    }
+
+    /// Decode a fault signal's event as the signal handler would, or return `nil` if the event isn't a fault signal
+    /// this host can decode.
+    public func fault(_ event: UnsafePointer<mach_exception_capture_event_t>) -> mach_exception_replay_fault_t? {
+        var fault = mach_exception_replay_fault_t()
+        let decoded = withUnsafePointer(to: &replay) { mach_exception_replay_decode_fault($0, event, &fault) }
+        return decoded ? fault : nil
+    }
+
+    /// Deliver every event of the capture: the requests to handlers, whose replies are discarded, and the decoded
+    /// fault signals to a closure.
+    ///
+    /// - Parameters:
+    ///   - speed: The pace of the replay relative to the capture's (e.g., 2 replays twice as fast), or 0 to replay
+    ///     as fast as possible.
+    ///   - handlers: The routines handling the requests, which by default accept every request.
+    ///   - fault: The closure receiving the faults.
+    ///
+    /// - Returns: The number of events delivered, and the time the replay took.
+    @discardableResult
+    public func run(speed: Double = 0,
+                    handlers: mach_exc_dispatch_handlers_t = mach_exception_replay_accepting_handlers,
+                    fault: ((mach_exception_replay_fault_t) -> Void)? = nil) -> mach_exception_replay_statistics_t {
+        final class Receiver {
+            let fault: (mach_exception_replay_fault_t) -> Void
+
+            init(_ fault: @escaping (mach_exception_replay_fault_t) -> Void) {
+                self.fault = fault
+            }
+        }
+
+        var handlers = handlers
+        var statistics = mach_exception_replay_statistics_t()
+        withExtendedLifetime(fault.map(Receiver.init)) { receiver in
+            withUnsafePointer(to: &handlers) { handlers in
+                var receivers = mach_exception_replay_receivers_t()
+                receivers.handlers = handlers
+                if let receiver = receiver {
+                    receivers.context = Unmanaged.passUnretained(receiver).toOpaque()
+                    receivers.fault = { context, fault in
+                        Unmanaged<Receiver>.fromOpaque(context!).takeUnretainedValue().fault(fault!.pointee)
+                    }
+                }
+                // The arena the requests are dispatched in is all the replay allocates.
+                let replayed = withUnsafePointer(to: &replay) {
+                    mach_exception_replay_run($0, &receivers, speed, &statistics)
+                }
+                precondition(replayed, "cannot allocate the replay's buffers")
+            }
+        }
+        return statistics
+    }
+
+    public struct Iterator: IteratorProtocol {
+        fileprivate let replay: MachExceptionReplay
+        fileprivate var cursor: UInt64 = 0
+
+        public mutating func next() -> UnsafePointer<mach_exception_capture_event_t>? {
+            return replay.next(&cursor)
+        }
+    }
+
+    public func makeIterator() -> Iterator {
+        return Iterator(replay: self)
+    }
+}
+
+extension mach_exception_capture_event_t {
+
+    /// Whether the event is a request message.
+    public var isMessage: Bool {
+        return kind == UInt32(MACH_EXCEPTION_CAPTURE_MESSAGE)
+    }
+
+    /// Whether the event is a fault signal.
+    public var isSignal: Bool {
+        return kind == UInt32(MACH_EXCEPTION_CAPTURE_SIGNAL)
+    }
+}
@@ -21,6 +21,13 @@ public struct MachExceptionError: Error, Equatable {
     
     /// The subcode associated with the Mach exception thrown.
     public let subcode: mach_exception_data_type_t?
+
+    /// The machine state of the thread that raised the Mach exception, if the backend captured it.
+    public let state: MachExceptionState?
+
+    /// The lanes of the faulting instruction that raised each floating-point exception, for an arithmetic exception
+    /// raised while lane attribution was enabled. See `MachExceptionLanes`.
+    public let lanes: MachExceptionLanes?
     
     // Create a Mach exception error.
     //
@@ -32,16 +39,20 @@ public struct MachExceptionError: Error, Equatable {
         self.type = type
         self.code = code
         self.subcode = subcode
+        self.state = nil
+        self.lanes = nil
     }
     
     // Create a Mach exception error from a NSError object. The NSError object's `code`
     // should indicate the Mach exception type. The NSError's `userdict` should contain
     // two entries for the Mach exception's code and subcode.
-    internal init?(_ error: NSError) {
+    internal init?(_ error: NSError, state: mach_exception_state_t? = nil) {
         guard let type = MachExceptionType(rawValue: Int32(error.code)) else {
             return nil
         }
         self.type = type
+        self.state = state.map(MachExceptionState.init)
+        self.lanes = nil
         
         if let value: Int64 = error[MachExceptionCode] {
             self.code = mach_exception_data_type_t(value)
@@ -55,6 +66,23 @@ public struct MachExceptionError: Error, Equatable {
             self.subcode = nil
         }
     }
+    
+    /// Create a Mach exception error from a record, such as one written by the exception handler or read from a
+    /// `MachExceptionLog`, describing an exception raised on the running host. Returns `nil` if the record's type
+    /// isn't a Mach exception type.
+    public init?(_ record: mach_exception_record_t,
+                 state: mach_exception_state_t? = nil,
+                 lanes: mach_exception_lanes_t? = nil)
+    {
+        guard let type = MachExceptionType(rawValue: record.type) else {
+            return nil
+        }
+        self.type = type
+        self.code = record.code
+        self.subcode = record.subcode
+        self.state = state.map(MachExceptionState.init)
+        self.lanes = lanes.map(MachExceptionLanes.init)
+    }
 
     /// The information associated with a Mach bad access exception.
     public var badAccess: MachExceptionBadAccessInfo? {
@@ -123,6 +151,47 @@ public struct MachExceptionError: Error, Equatable {
     }
 }
 
+#if os(Linux)
+/// The predefined domain identifying a Mach exception.
+public let MachExceptionErrorDomain = "com.gili-labs.machException"
+
+/// A key identifying a Mach exception's code in an a NSError object's userinfo dictionary.
+public let MachExceptionCode = "code"
+
+/// A key identifying a Mach exception's subcode in an a NSError object's userinfo dictionary.
+public let MachExceptionSubcode = "subcode"
+#endif
+
+/// The machine state of a thread when it raised a Mach exception. The values are stored inline, so carrying them
+/// costs no allocation. A value the backend couldn't determine is 0.
+public struct MachExceptionState: Equatable {
+
+    /// The address of the faulting instruction.
+    public let pc: UInt64
+
+    /// The stack pointer.
+    public let sp: UInt64
+
+    /// The return address: the link register on arm64, or the faulting frame's return address on x86_64.
+    public let lr: UInt64
+
+    /// The address whose access faulted, for a bad access exception.
+    public let faultAddress: UInt64
+
+    internal init(_ state: mach_exception_state_t) {
+        self.pc = state.pc
+        self.sp = state.sp
+        self.lr = state.lr
+        self.faultAddress = state.fault_address
+    }
+
+    // The machine state of the last Mach exception the calling thread caught, if the backend captured it.
+    internal static var lastCaught: mach_exception_state_t? {
+        var state = mach_exception_state_t()
+        return mach_exception_last_state(&state) ? state : nil
+    }
+}
+
 extension NSError {
     
     internal subscript<T>(_ key: String) -> T? {
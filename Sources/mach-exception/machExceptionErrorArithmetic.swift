@@ -8,6 +8,7 @@
 //
 
 import Foundation
+import mach_exception_helper
 
 /// Type representing information associated with a Mach arithmetic exception
 public struct MachExceptionArithmeticInfo {
@@ -35,6 +36,28 @@ public struct MachExceptionArithmeticInfo {
         self.instruction = UInt64(subcode)
 #elseif arch(i386) || arch(x86_64)
         self.csr = UInt64(subcode)
+#endif
+    }
+
+    /// The floating-point exceptions that raised the arithmetic exception, if it was a floating-point trap.
+    public var floatingPointExceptions: FloatingPointTraps {
+#if arch(arm) || arch(arm64)
+        switch code {
+        case .invalidOperation: return .invalid
+        case .divideError: return .divideByZero
+        case .overflow: return .overflow
+        case .underflow: return .underflow
+        case .inexactResult: return .inexact
+        default: return []
+        }
+#elseif arch(i386) || arch(x86_64)
+        // The status flags of the SSE MXCSR and the x87 status word occupy the same bits as the FE_* flags. MXCSR
+        // also holds the masks, so report only the exceptions raised while unmasked.
+        switch code {
+        case .simdOperationError: return FloatingPointTraps(rawValue: Int32(truncatingIfNeeded: csr & ~(csr >> 7)))
+        case .floatingPointError: return FloatingPointTraps(rawValue: Int32(truncatingIfNeeded: csr))
+        default: return []
+        }
 #endif
     }
 }
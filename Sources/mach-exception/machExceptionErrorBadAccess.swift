@@ -8,6 +8,7 @@
 //
 
 import Foundation
+import mach_exception_helper
 
 /// Type representing information associated with a Mach bad access exception.
 public struct MachExceptionBadAccessInfo {
@@ -70,7 +71,10 @@ public enum MachExceptionBadAccessCode: Equatable {
     }
 }
 #elseif arch(i386) || arch(x86_64)
-public enum MachExceptionBadAccessCode {
+public enum MachExceptionBadAccessCode: Equatable {
+    
+    /// VM fault.
+    case vmFault(kernResult: Int32)
     
     /// FPU overran segment fault.
     case fpuSegmentFault
@@ -83,6 +87,7 @@ public enum MachExceptionBadAccessCode {
         switch code {
         case VM_PROT_READ | VM_PROT_EXECUTE: self = .fpuSegmentFault
         case EXC_I386_GPFLT: self = .generalProtectionFault
+        case KERN_SUCCESS...KERN_RETURN_MAX: self = .vmFault(kernResult: code)
         default: return nil
         }
     }
@@ -8,6 +8,7 @@
 //
 
 import Foundation
+import mach_exception_helper
 
 /// Type representing information associated with a Mach bad instruction exception.
 public struct MachExceptionBadInstructionInfo {
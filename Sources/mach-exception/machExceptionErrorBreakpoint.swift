@@ -8,6 +8,7 @@
 //
 
 import Foundation
+import mach_exception_helper
 
 public struct MachExceptionBreakpointInfo {
     
@@ -56,7 +57,7 @@ public enum MachExceptionBreakpointCodes: Equatable {
     }
 }
 #elseif arch(i386) || arch(x86_64)
-public enum MachExceptionBreakpointCode: Equatable {
+public enum MachExceptionBreakpointCodes: Equatable {
     
     /// BOUND instruction found an array index outside of specified bounds.
     case outOfBounds
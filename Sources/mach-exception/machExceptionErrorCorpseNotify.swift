@@ -8,6 +8,7 @@
 //
 
 import Foundation
+import mach_exception_helper
 
 ///
 public enum MachExceptionCorpseNotifyInfo: Equatable {
@@ -29,10 +30,10 @@ public enum MachExceptionCorpseNotifyInfo: Equatable {
         switch Int32(code) {
         case EXC_CRASH:
             let crashSubcode = Subcode(value: subcode)
-            guard let namespace = OSReasonNamespace(rawValue: crashSubcode.namespace) else {
+            guard let namespace = OSReasonNamespace(rawValue: crashSubcode[Subcode.namespace]) else {
                 return nil
             }
-            let reason: OSReason = crashSubcode.reason
+            let reason: OSReason = crashSubcode[Subcode.reason]
             self = .crash(namespace: namespace, reason: reason)
         case EXC_RESOURCE:
             guard let info = MachExceptionResourceInfo(subcode, 0) else { return nil }
@@ -49,9 +50,7 @@ public enum MachExceptionCorpseNotifyInfo: Equatable {
 
         public var value: mach_exception_data_type_t = 0
 
-        public static var fields = Fields {
-            Field("reason", 0, 31)
-            Field("namespace", 32, 63)
-        }
+        public static let reason = Field<OSReason>(0, 31)
+        public static let namespace = Field<Int32>(32, 63)
     }
 }
@@ -8,6 +8,7 @@
 //
 
 import Foundation
+import mach_exception_helper
 
 /// A type describing the information conveyed by the codes associated with
 /// a Mach crash exception.
@@ -25,9 +26,9 @@ public struct MachExceptionCrashInfo {
     internal init?(_ code: mach_exception_data_type_t?, _ subcode: mach_exception_data_type_t?) {
         guard let crashCode = code, let _ = subcode else { return nil }
         let code = Code(value: crashCode)
-        self.originalException = code.originalException
-        self.originalCode = code.originalCode
-        self.signalValue = code.signalValue
+        self.originalException = code[Code.originalException]
+        self.originalCode = code[Code.originalCode]
+        self.signalValue = code[Code.signalValue]
     }
     
     // See proc_prepareexit() in darwin-xnu/bsd/kern/kern_exit.c.
@@ -35,10 +36,8 @@ public struct MachExceptionCrashInfo {
         
         public var value: mach_exception_data_type_t = 0
         
-        public static var fields = Fields {
-            Field("originalException", 20, 23)
-            Field("originalCode", 0, 19)
-            Field("signalValue", 24, 31)
-        }
+        public static let originalException = Field<exception_type_t>(20, 23)
+        public static let originalCode = Field<mach_exception_data_type_t>(0, 19)
+        public static let signalValue = Field<Int64>(24, 31)
     }
 }
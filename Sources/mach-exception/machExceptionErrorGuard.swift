@@ -47,24 +47,24 @@ public enum MachExceptionGuardInfo: Equatable {
     internal init?(_ code: mach_exception_data_type_t?, _ subcode: mach_exception_data_type_t?) {
         guard let guardCode = code, let subcode = subcode else { return nil }
         let code = Code(value: guardCode)
-        let type: Int32 = code.type
+        let type: Int32 = code[Code.type]
         switch type {
         case GUARD_TYPE_NONE:
             self = .none
         case GUARD_TYPE_MACH_PORT:
-            let port: mach_port_name_t = code.portName
-            let reason = mach_port_guard_exception_codes(code.reason)
+            let port: mach_port_name_t = code[Code.portName]
+            let reason = mach_port_guard_exception_codes(code[Code.reason])
             self = .machPort(port: port, reason: reason, guardId: subcode)
         case GUARD_TYPE_FD:
-            let fileDescriptor: Int32 = code.fileDescriptor
-            let flavor = FileDescriptorFlavor(rawValue: code.flavor)
+            let fileDescriptor: Int32 = code[Code.fileDescriptor]
+            let flavor = FileDescriptorFlavor(rawValue: code[Code.flavor])
             self = .fileDescriptor(fileDescriptor: fileDescriptor, flavor: flavor, guardId: subcode)
         case GUARD_TYPE_USER:
-            guard let namespace = OSReasonNamespace(rawValue: code.namespace) else { return nil }
+            guard let namespace = OSReasonNamespace(rawValue: code[Code.namespace]) else { return nil }
             self = .user(namespace: namespace, reason: subcode)
         case GUARD_TYPE_VN:
             let guardId = VNodeGuardId(rawValue: subcode)
-            self = .vNode(pid: code.pid, guardId: guardId)
+            self = .vNode(pid: code[Code.pid], guardId: guardId)
         case GUARD_TYPE_VIRT_MEMORY:
             self = .virtualMemory(offset: subcode)
         default:
@@ -78,16 +78,14 @@ public enum MachExceptionGuardInfo: Equatable {
         
         public var value: mach_exception_data_type_t = 0
         
-        public static var fields = Fields {
-            Field("type", 61, 63)
-            Field("flavor", 32, 60)
-            Field("target", 0, 31)
-            Field("portName", 0, 31)
-            Field("reason", 32, 60)
-            Field("fileDescriptor", 0, 31)
-            Field("namespace", 0, 31)
-            Field("pid", 0, 31)
-        }
+        public static let type = Field<Int32>(61, 63)
+        public static let flavor = Field<Int32>(32, 60)
+        public static let target = Field<UInt32>(0, 31)
+        public static let portName = Field<mach_port_name_t>(0, 31)
+        public static let reason = Field<UInt32>(32, 60)
+        public static let fileDescriptor = Field<Int32>(0, 31)
+        public static let namespace = Field<Int32>(0, 31)
+        public static let pid = Field<Int32>(0, 31)
     }
     
     /// The flavor of a Mach file descriptor guard exception.
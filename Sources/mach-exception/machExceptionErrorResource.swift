@@ -49,32 +49,32 @@ public enum MachExceptionResourceInfo: Equatable {
         guard let resourceCode = code, let resourceSubcode = subcode else { return nil }
         let code = Code(value: resourceCode)
         let subcode = Subcode(value: resourceSubcode)
-        let type: Int32 = code.type
+        let type: Int32 = code[Code.type]
         switch type {
         case RESOURCE_TYPE_CPU:
-            guard let flavor = CpuFlavor(rawValue: code.flavor) else { return nil }
+            guard let flavor = CpuFlavor(rawValue: code[Code.flavor]) else { return nil }
             self = .cpu(flavor: flavor,
-                        interval: code.cpuInterval,
-                        limit: code.cpuLimit,
-                        utilization: subcode.cpuUtilization)
+                        interval: code[Code.cpuInterval],
+                        limit: code[Code.cpuLimit],
+                        utilization: subcode[Subcode.cpuUtilization])
         case RESOURCE_TYPE_WAKEUPS:
-            guard let flavor = WakeupsFlavor(rawValue: code.flavor) else { return nil }
+            guard let flavor = WakeupsFlavor(rawValue: code[Code.flavor]) else { return nil }
             self = .wakeups(flavor: flavor,
-                            interval: code.wakeupsInterval,
-                            permitted: code.wakeupsPermitted,
-                            wakeups: subcode.wakeupsObserved)
+                            interval: code[Code.wakeupsInterval],
+                            permitted: code[Code.wakeupsPermitted],
+                            wakeups: subcode[Subcode.wakeupsObserved])
         case RESOURCE_TYPE_MEMORY:
-            guard let flavor = MemoryFlavor(rawValue: code.flavor) else { return nil }
-            self = .memory(flavor: flavor, highWatermark: code.memoryHWMLimit)
+            guard let flavor = MemoryFlavor(rawValue: code[Code.flavor]) else { return nil }
+            self = .memory(flavor: flavor, highWatermark: code[Code.memoryHWMLimit])
         case RESOURCE_TYPE_IO:
-            guard let flavor = IOFlavor(rawValue: code.flavor) else { return nil }
+            guard let flavor = IOFlavor(rawValue: code[Code.flavor]) else { return nil }
             self = .io(flavor: flavor,
-                       interval: code.ioInterval,
-                       limit: code.ioLimit,
-                       count: subcode.ioCount)
+                       interval: code[Code.ioInterval],
+                       limit: code[Code.ioLimit],
+                       count: subcode[Subcode.ioCount])
         case RESOURCE_TYPE_THREADS:
-            guard let flavor = ThreadsFlavor(rawValue: code.flavor) else { return nil }
-            self = .threads(flavor: flavor, count: code.threadsCount)
+            guard let flavor = ThreadsFlavor(rawValue: code[Code.flavor]) else { return nil }
+            self = .threads(flavor: flavor, count: code[Code.threadsCount])
         default:
             return nil
         }
@@ -86,18 +86,16 @@ public enum MachExceptionResourceInfo: Equatable {
         
         public var value: mach_exception_data_type_t = 0
 
-        public static var fields = Fields {
-            Field("type", 61, 63)
-            Field("flavor", 58, 60)
-            Field("cpuInterval", 7, 31)
-            Field("cpuLimit", 0, 6)
-            Field("wakeupsInterval", 20, 31)
-            Field("wakeupsPermitted", 0, 19)
-            Field("memoryHWMLimit", 0, 12)
-            Field("ioInterval", 15, 31)
-            Field("ioLimit", 0, 14)
-            Field("threadsCount", 0, 30)
-        }
+        public static let type = Field<Int32>(61, 63)
+        public static let flavor = Field<Int64>(58, 60)
+        public static let cpuInterval = Field<Int64>(7, 31)
+        public static let cpuLimit = Field<Int64>(0, 6)
+        public static let wakeupsInterval = Field<Int64>(20, 31)
+        public static let wakeupsPermitted = Field<Int64>(0, 19)
+        public static let memoryHWMLimit = Field<Int64>(0, 12)
+        public static let ioInterval = Field<Int64>(15, 31)
+        public static let ioLimit = Field<Int64>(0, 14)
+        public static let threadsCount = Field<Int64>(0, 30)
     }
     
     /// The bit fields contained by a subcode associated with a Mach resource exception
@@ -106,11 +104,9 @@ public enum MachExceptionResourceInfo: Equatable {
         
         public var value: mach_exception_data_type_t = 0
 
-        public static var fields = Fields {
-            Field("cpuUtilization", 0, 6)
-            Field("wakeupsObserved", 0, 6)
-            Field("ioCount", 0, 14)
-        }
+        public static let cpuUtilization = Field<Int64>(0, 6)
+        public static let wakeupsObserved = Field<Int64>(0, 6)
+        public static let ioCount = Field<Int64>(0, 14)
     }
 
     /// The flavor of a Mach CPU resource exception.
@@ -0,0 +1,114 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// mach-exception
+// machExceptionEventCollector.swift
+// Created by Patrick Gili on 2/10/23.
+//
+
+import Foundation
+import mach_exception_helper
+
+/// A thread that drains the events the fault path publishes on each thread's ring (see `mach_exception_ring.h`),
+/// and hands them to a handler in batches.
+///
+/// The fault path never blocks on the collector: an event published while its ring is full is dropped, and the
+/// handler learns how many events were dropped with each batch. Draining more often, or in larger batches, drops
+/// fewer events.
+public final class MachExceptionEventCollector {
+
+    /// Receives a batch of events, in order of publication on each thread, and the number of events dropped since
+    /// the previous batch. The batch is only valid for the duration of the call.
+    public typealias Handler = (UnsafeBufferPointer<mach_exception_event_t>, UInt64) -> ()
+
+    private let interval: TimeInterval
+    private let handler: Handler
+    private var events: [mach_exception_event_t]
+    private let draining = NSLock()
+    private var thread: Thread?
+    private let stopped = NSCondition()
+    private var isStopped = false
+
+    /// Create a collector. Call `start()` to drain events periodically, or `drain()` to drain them on demand.
+    ///
+    /// - Parameters:
+    ///   - interval: The time between batches, in seconds.
+    ///   - batchSize: The largest number of events in a batch.
+    ///   - handler: Receives each batch of events.
+    public init(interval: TimeInterval = 0.01, batchSize: Int = 1024, handler: @escaping Handler) {
+        precondition(batchSize > 0, "A batch must hold at least one event")
+        self.interval = interval
+        self.handler = handler
+        self.events = [mach_exception_event_t](repeating: mach_exception_event_t(), count: batchSize)
+    }
+
+    deinit {
+        stop()
+    }
+
+    /// Drain every ring once, calling the handler with each batch, until the rings are empty.
+    ///
+    /// - Returns: The number of events drained.
+    @discardableResult
+    public func drain() -> Int {
+        draining.lock()
+        defer { draining.unlock() }
+        var total = 0
+        while true {
+            var dropped: UInt64 = 0
+            let count = events.withUnsafeMutableBufferPointer { events in
+                let count = mach_exception_ring_drain(events.baseAddress, events.count, &dropped)
+                if count > 0 || dropped > 0 {
+                    handler(UnsafeBufferPointer(rebasing: events[..<count]), dropped)
+                }
+                return count
+            }
+            total += count
+            if count < events.count {
+                return total
+            }
+        }
+    }
+
+    /// Start draining the rings on a collector thread, which keeps the collector alive until it is stopped.
+    public func start() {
+        stopped.lock()
+        defer { stopped.unlock() }
+        precondition(thread == nil, "The collector is already started")
+        let thread = Thread {
+            self.stopped.lock()
+            while !self.isStopped {
+                self.stopped.unlock()
+                self.drain()
+                self.stopped.lock()
+                _ = self.stopped.wait(until: Date(timeIntervalSinceNow: self.interval))
+            }
+            self.stopped.unlock()
+            self.drain()
+            self.stopped.lock()
+            self.thread = nil
+            self.stopped.broadcast()
+            self.stopped.unlock()
+        }
+        thread.name = "mach-exception-collector"
+        self.thread = thread
+        thread.start()
+    }
+
+    /// Stop the collector thread, after it drains the rings one last time.
+    public func stop() {
+        stopped.lock()
+        guard thread != nil else {
+            stopped.unlock()
+            return
+        }
+        isStopped = true
+        stopped.broadcast()
+        while thread != nil {
+            stopped.wait()
+        }
+        isStopped = false
+        stopped.unlock()
+    }
+}
@@ -0,0 +1,177 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// mach-exception
+// machExceptionExecutor.swift
+// Created by Patrick Gili on 2/25/23.
+//
+
+import Foundation
+import mach_exception_helper
+
+/// A pool of dedicated threads performing operations in exception scopes on behalf of asynchronous callers.
+///
+/// An exception scope lives on the stack of the thread that entered it, so an operation performed in a scope is
+/// synchronous, and may block for as long as it runs. Performed on a thread of Swift's cooperative pool, which has a
+/// thread per core, a handful of such operations would starve every other task in the process. The asynchronous
+/// `withUnsafeMachException` and `withUnsafeMachExceptionResult` instead suspend the calling task, and an executor
+/// performs the operation on one of its own threads, then resumes the task.
+///
+/// The executor starts a thread when an operation arrives and every thread it started is busy, up to
+/// `maximumThreadCount`; past that, operations wait in first-in, first-out order. A thread keeps its exception
+/// context between operations, so only its first operation prepares it to catch exceptions, and exits once it has
+/// been idle for `idleTimeout` seconds.
+public final class MachExceptionExecutor {
+
+    /// The executor the asynchronous functions use by default, with a thread per active processor.
+    public static let shared = MachExceptionExecutor()
+
+    /// The largest number of threads the executor runs at once.
+    public let maximumThreadCount: Int
+
+    /// The number of seconds an idle thread waits for an operation before exiting.
+    public let idleTimeout: TimeInterval
+
+    private let condition = NSCondition()
+    // The jobs from `next` on are waiting; those before it were taken, and cleared so as not to keep what they
+    // captured alive.
+    private var jobs: [(() -> ())?] = []
+    private var next = 0
+    private var threadCount = 0
+    private var idleCount = 0
+
+    /// Create an executor.
+    ///
+    /// - Parameters:
+    ///   - maximumThreadCount: The largest number of threads the executor runs at once.
+    ///   - idleTimeout: The number of seconds an idle thread waits for an operation before exiting.
+    public init(maximumThreadCount: Int = ProcessInfo.processInfo.activeProcessorCount,
+                idleTimeout: TimeInterval = 10) {
+        precondition(maximumThreadCount > 0, "An executor requires at least one thread")
+        self.maximumThreadCount = maximumThreadCount
+        self.idleTimeout = idleTimeout
+    }
+
+    /// The number of threads the executor is running.
+    public var threads: Int {
+        condition.lock()
+        defer { condition.unlock() }
+        return threadCount
+    }
+
+    /// Perform a job on one of the executor's threads.
+    public func execute(_ job: @escaping () -> ()) {
+        condition.lock()
+        jobs.append(job)
+        if jobs.count - next > idleCount && threadCount < maximumThreadCount {
+            threadCount += 1
+            let thread = Thread { [self] in
+                work()
+            }
+            thread.name = "mach-exception.executor"
+            thread.start()
+        }
+        if idleCount > 0 {
+            condition.signal()
+        }
+        condition.unlock()
+    }
+
+    // Perform jobs until none arrives for `idleTimeout` seconds.
+    private func work() {
+        condition.lock()
+        while true {
+            while next == jobs.count {
+                idleCount += 1
+                let signaled = condition.wait(until: Date(timeIntervalSinceNow: idleTimeout))
+                idleCount -= 1
+                if !signaled && next == jobs.count {
+                    threadCount -= 1
+                    condition.unlock()
+                    return
+                }
+            }
+            let job = jobs[next]!
+            jobs[next] = nil
+            next += 1
+            // Under sustained load the queue never drains, so compact it once most of it was taken, which moves
+            // fewer jobs than were taken since the last compaction.
+            if next == jobs.count {
+                jobs.removeAll(keepingCapacity: true)
+                next = 0
+            } else if next > jobs.count / 2 {
+                jobs.removeFirst(next)
+                next = 0
+            }
+            condition.unlock()
+            job()
+            condition.lock()
+        }
+    }
+}
+
+// MARK: - Asynchronous scopes
+
+/// Execute an operation, catching Mach exceptions of specified types, without blocking a thread of Swift's
+/// cooperative pool.
+///
+/// The function behaves as the synchronous `withUnsafeMachException`, but suspends the calling task while an executor
+/// performs the operation on a dedicated thread, so any number of concurrent calls occupy no thread of the cooperative
+/// pool. The operation and the finally block run on the executor's thread, not the calling task's.
+///
+/// A task cancelled before calling the function throws a `CancellationError`; once the operation starts, it executes
+/// to completion, or until it raises an exception.
+///
+/// - Parameters:
+///   - types: The Mach exception types the function will catch, if thrown.
+///   - executor: The executor performing the operation.
+///   - operation: A closure executed by the function that may throw Mach exceptions.
+///   - finally: A "finally block" executed after the operation and any subsequent exception have executed.
+///
+/// - Throws: A `MachExceptionError`, if the operation throws a Mach exception, a `CancellationError`, if the task was
+///   cancelled, or an `NSError`, if the executor's thread cannot be prepared to catch exceptions.
+public func withUnsafeMachException(types: MachExceptionTypes,
+                                    executor: MachExceptionExecutor = .shared,
+                                    operation: @escaping () -> (),
+                                    finally: @escaping () -> () = { () in }) async throws
+{
+    if let machExceptionError = try await withUnsafeMachExceptionResult(types: types,
+                                                                       executor: executor,
+                                                                       operation: operation,
+                                                                       finally: finally) {
+        throw machExceptionError
+    }
+}
+
+/// Execute an operation, catching Mach exceptions of specified types, and return the exception caught, without
+/// blocking a thread of Swift's cooperative pool.
+///
+/// The function behaves as the asynchronous `withUnsafeMachException`, but returns the exception it catches rather
+/// than throwing it.
+///
+/// - Parameters:
+///   - types: The Mach exception types the function will catch, if thrown.
+///   - executor: The executor performing the operation.
+///   - operation: A closure executed by the function that may throw Mach exceptions.
+///   - finally: A "finally block" executed after the operation and any subsequent exception have executed.
+///
+/// - Returns: The Mach exception the operation threw, or `nil` if the operation executed to completion.
+///
+/// - Throws: A `CancellationError`, if the task was cancelled, or an `NSError`, if the executor's thread cannot be
+///   prepared to catch exceptions.
+public func withUnsafeMachExceptionResult(types: MachExceptionTypes,
+                                          executor: MachExceptionExecutor = .shared,
+                                          operation: @escaping () -> (),
+                                          finally: @escaping () -> () = { () in }) async throws
+    -> MachExceptionError?
+{
+    try Task.checkCancellation()
+    return try await withCheckedThrowingContinuation { continuation in
+        executor.execute {
+            continuation.resume(with: Result {
+                try performUnsafeMachException(types, nil, operation, finally)
+            })
+        }
+    }
+}
@@ -0,0 +1,80 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// mach-exception
+// machExceptionLanes.swift
+// Created by Patrick Gili on 2/16/23.
+//
+
+import Foundation
+import mach_exception_helper
+
+/// The lanes of a SIMD instruction that raised each floating-point exception when the instruction trapped.
+///
+/// A trapping SIMD instruction reports the exceptions raised by all of its lanes together. When lane attribution is
+/// enabled, the fault path decodes the faulting instruction and re-executes it one lane at a time with every
+/// exception masked, so a numeric kernel can tell which element of a vector was bad without re-running the kernel
+/// in scalar form. The instructions decoded are the packed and scalar forms of add, subtract, multiply, divide and
+/// square root: SSE and AVX up to 256 bits wide on x86_64, and Advanced SIMD on arm64.
+///
+/// Each exception is a bit mask in which bit `i` stands for lane `i`, lane 0 being the lowest-addressed element.
+public struct MachExceptionLanes: Equatable {
+
+    /// The number of lanes the instruction operated on, 1 for a scalar instruction.
+    public let count: Int
+
+    /// The number of bits in each lane: 32 for single precision, 64 for double precision.
+    public let width: Int
+
+    /// The lanes that raised an invalid operation exception.
+    public let invalid: UInt32
+
+    /// The lanes that raised a divide by zero exception.
+    public let divideByZero: UInt32
+
+    /// The lanes that raised an overflow exception.
+    public let overflow: UInt32
+
+    /// The lanes that raised an underflow exception.
+    public let underflow: UInt32
+
+    /// The lanes that raised an inexact exception.
+    public let inexact: UInt32
+
+    internal init(_ lanes: mach_exception_lanes_t) {
+        self.count = Int(lanes.count)
+        self.width = Int(lanes.width)
+        self.invalid = lanes.invalid
+        self.divideByZero = lanes.divide_by_zero
+        self.overflow = lanes.overflow
+        self.underflow = lanes.underflow
+        self.inexact = lanes.inexact
+    }
+
+    /// The floating-point exceptions lane `lane` raised.
+    public func exceptions(inLane lane: Int) -> FloatingPointTraps {
+        guard lane >= 0 && lane < count else { return [] }
+        let bit = UInt32(1) << UInt32(lane)
+        var exceptions: FloatingPointTraps = []
+        if invalid & bit != 0 { exceptions.insert(.invalid) }
+        if divideByZero & bit != 0 { exceptions.insert(.divideByZero) }
+        if overflow & bit != 0 { exceptions.insert(.overflow) }
+        if underflow & bit != 0 { exceptions.insert(.underflow) }
+        if inexact & bit != 0 { exceptions.insert(.inexact) }
+        return exceptions
+    }
+
+    /// Whether the fault path attributes floating-point traps to lanes, for every thread. Attribution is disabled by
+    /// default, as it adds the cost of capturing the vector registers and decoding the instruction to each trap.
+    public static var isAttributionEnabled: Bool {
+        get { return mach_exception_lanes_enabled() }
+        set { mach_exception_lanes_set_enabled(newValue) }
+    }
+
+    // The lanes of the last Mach exception the calling thread caught, if the fault path attributed it.
+    internal static var lastCaught: mach_exception_lanes_t? {
+        var lanes = mach_exception_lanes_t()
+        return mach_exception_last_lanes(&lanes) ? lanes : nil
+    }
+}
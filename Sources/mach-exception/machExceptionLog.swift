@@ -0,0 +1,161 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// mach-exception
+// machExceptionLog.swift
+// Created by Patrick Gili on 2/8/23.
+//
+
+import Foundation
+import mach_exception_helper
+
+/// An append-only, on-disk event log of caught Mach exceptions.
+///
+/// The log stores fixed-size binary records (see `mach_exception_log_record_t`) in memory-mapped files named
+/// `<path>.<sequence>`, rotating to a new file whenever one fills up. Appending a record makes no system calls
+/// (except when rotating), and the records survive the process crashing. Use `MachExceptionLogReader` to read them,
+/// even while the log is being written.
+///
+/// Setting `shared` makes `withUnsafeMachException` append each exception it catches to the log, with the faulting
+/// instruction's address and the backtrace leading to it.
+public final class MachExceptionLog {
+
+    /// The default size of a log file, which holds 8191 records.
+    public static let defaultFileSize = 1 << 20
+
+    /// The log to which `withUnsafeMachException` appends the exceptions it catches, if any.
+    public static var shared: MachExceptionLog?
+
+    private let log: OpaquePointer
+
+    /// The path from which the log's file names derive.
+    public let path: String
+
+    /// Open a log, continuing in its most recent file, if that file has room.
+    ///
+    /// - Parameters:
+    ///   - path: The path from which the log's file names derive.
+    ///   - fileSize: The size of each of the log's files, in bytes.
+    ///
+    /// - Throws: An `NSError` in the POSIX error domain, if the log's file cannot be opened or created.
+    public init(path: String, fileSize: Int = MachExceptionLog.defaultFileSize) throws {
+        guard fileSize > 0, let log = mach_exception_log_open(path, fileSize) else {
+            throw NSError(domain: NSPOSIXErrorDomain, code: Int(fileSize > 0 ? errno : EINVAL), userInfo: nil)
+        }
+        self.log = log
+        self.path = path
+    }
+
+    deinit {
+        mach_exception_log_close(log)
+    }
+
+    /// The sequence number of the file to which the log is appending.
+    public var sequence: UInt64 {
+        return mach_exception_log_sequence(log)
+    }
+
+    /// Append a caught exception to the log.
+    ///
+    /// - Parameters:
+    ///   - record: The exception.
+    ///   - backtrace: The backtrace of the faulting thread, if known.
+    ///
+    /// - Returns: `false` if the log could not rotate to a new file.
+    @discardableResult
+    public func append(_ record: mach_exception_record_t, backtrace: mach_exception_backtrace_t? = nil) -> Bool {
+        var record = record
+        guard var backtrace = backtrace else {
+            return mach_exception_log_append(log, &record, nil)
+        }
+        return mach_exception_log_append(log, &record, &backtrace)
+    }
+
+    /// Append an exception the calling thread just caught to the shared log, if any, with its backtrace.
+    internal static func appendCaught(_ record: mach_exception_record_t) {
+        guard let log = shared else {
+            return
+        }
+        var backtrace = mach_exception_backtrace_t()
+        log.append(record, backtrace: mach_exception_last_backtrace(&backtrace) ? backtrace : nil)
+    }
+}
+
+/// A log file mapped for reading, whose records are read in place.
+///
+/// Iterating the reader visits the records committed so far, skipping any a writer never finished. The pointers
+/// the iterator produces point into the mapped file, and remain valid for the reader's lifetime.
+public final class MachExceptionLogReader: Sequence {
+
+    private var reader = mach_exception_log_reader_t()
+
+    /// Map a log file for reading.
+    ///
+    /// - Parameter file: The path of the log file.
+    ///
+    /// - Throws: An `NSError` in the POSIX error domain, if the file cannot be mapped, or isn't a log file.
+    public init(file: String) throws {
+        guard mach_exception_log_reader_open(&reader, file) else {
+            throw NSError(domain: NSPOSIXErrorDomain, code: Int(errno), userInfo: nil)
+        }
+    }
+
+    deinit {
+        mach_exception_log_reader_close(&reader)
+    }
+
+    /// The file's header.
+    public var header: mach_exception_log_header_t {
+        return reader.header.pointee
+    }
+
+    /// Whether every record of the file has been reserved, so the file will never grow.
+    public var isFull: Bool {
+        return withUnsafePointer(to: &reader) { mach_exception_log_reader_full($0) }
+    }
+
+    /// The next committed record at or after `cursor`, which advances past it, or `nil` if there are none yet.
+    ///
+    /// - Parameters:
+    ///   - cursor: The index of the record at which to start looking.
+    ///   - skipPending: Whether to skip records a writer hasn't finished, rather than stop at them.
+    public func next(_ cursor: inout UInt64, skipPending: Bool) -> UnsafePointer<mach_exception_log_record_t>? {
+        return withUnsafePointer(to: &reader) { mach_exception_log_reader_next($0, &cursor, skipPending) }
+    }
+
+    public struct Iterator: IteratorProtocol {
+        fileprivate let reader: MachExceptionLogReader
+        fileprivate var cursor: UInt64 = 0
+
+        public mutating func next() -> UnsafePointer<mach_exception_log_record_t>? {
+            return reader.next(&cursor, skipPending: true)
+        }
+    }
+
+    public func makeIterator() -> Iterator {
+        return Iterator(reader: self)
+    }
+
+    /// The path of a log's file.
+    ///
+    /// - Parameters:
+    ///   - path: The path from which the log's file names derive.
+    ///   - sequence: The file's sequence number.
+    public static func file(path: String, sequence: UInt64) -> String {
+        return "\(path).\(sequence)"
+    }
+}
+
+extension mach_exception_log_record_t {
+
+    /// The record's exception, in the form `MachExceptionError` decodes.
+    public var record: mach_exception_record_t {
+        return mach_exception_record_t(type: type, code: code, subcode: subcode)
+    }
+
+    /// The return addresses of the frames that led to the exception, innermost first.
+    public var backtrace: [UInt64] {
+        return withUnsafeBytes(of: frames) { Array($0.bindMemory(to: UInt64.self).prefix(Int(depth))) }
+    }
+}
@@ -0,0 +1,200 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// mach-exception
+// machExceptionMetrics.swift
+// Created by Patrick Gili on 2/24/23.
+//
+
+import Foundation
+import mach_exception_helper
+
+/// A snapshot of the process's exception-handling metrics: the scopes entered, the listener's wakeups, the faults
+/// caught and forwarded, and the latencies of handling and resuming from the faults caught.
+///
+/// Every thread that enters scopes or handles faults counts into a shard of its own, so counting writes no cache
+/// line another thread writes; on an x86_64 Linux host, the cost of entering and leaving a scope didn't measurably
+/// change. A snapshot sums the shards. Faults are counted by family: the architecture-independent cause of the
+/// fault, such as `vm_fault`, or `other` for a fault of no known cause. The kernel doesn't timestamp faults, so the
+/// handler latency starts when the handler first runs.
+///
+/// `exposition` formats the metrics for a Prometheus scraper, which `write(toFile:)` and `MachExceptionMetricsServer`
+/// publish in a local file or on a Unix-domain socket.
+public struct MachExceptionMetrics {
+
+    /// A family of faults of an exception type.
+    public struct Family: Hashable {
+
+        /// The exception type of the faults.
+        public let type: MachExceptionType
+
+        /// The name of the family, such as `vm_fault`, or `other` for the faults of no known cause.
+        public let name: String
+    }
+
+    /// A histogram of latencies.
+    public struct Histogram: Equatable {
+
+        /// The number of samples.
+        public let count: Int
+
+        /// The sum of the samples, in seconds.
+        public let sum: TimeInterval
+
+        /// The number of samples in each bucket. Bucket `i` holds the samples greater than 2^(i-1) ns and at most
+        /// 2^i ns, except the last, which holds every sample greater than the bound of the bucket before it.
+        public let buckets: [Int]
+
+        internal init(_ histogram: mach_exception_histogram_t) {
+            self.count = Int(histogram.count)
+            self.sum = Double(histogram.sum) / 1e9
+            self.buckets = withUnsafeBytes(of: histogram.buckets) { bytes in
+                bytes.bindMemory(to: UInt64.self).map { Int($0) }
+            }
+        }
+
+        /// The upper bound of a bucket, in seconds.
+        public static func upperBound(ofBucket bucket: Int) -> TimeInterval {
+            return bucket < Int(MACH_EXCEPTION_METRICS_BUCKETS) - 1 ? Double(UInt64(1) << bucket) / 1e9 : .infinity
+        }
+
+        /// The mean of the samples, in seconds.
+        public var mean: TimeInterval {
+            return count == 0 ? 0 : sum / Double(count)
+        }
+
+        /// An upper bound of a quantile of the samples, in seconds: the upper bound of the bucket holding it.
+        public func quantile(_ fraction: Double) -> TimeInterval {
+            let rank = Swift.max(Int((fraction * Double(count)).rounded(.up)), 1)
+            var cumulative = 0
+            for (bucket, samples) in buckets.enumerated() {
+                cumulative += samples
+                if cumulative >= rank {
+                    return Self.upperBound(ofBucket: bucket)
+                }
+            }
+            return 0
+        }
+    }
+
+    internal let metrics: mach_exception_metrics_t
+
+    /// The scopes entered.
+    public let scopesEntered: Int
+
+    /// The times the listener returned from receiving a message on Darwin, or the fault handler took a fault a scope
+    /// owns on Linux.
+    public let listenerWakeups: Int
+
+    /// The faults a scope caught, by family. Only families with faults are present.
+    public let caught: [Family: Int]
+
+    /// The faults passed on to the handler this library replaced, by family. Only families with faults are present.
+    public let forwarded: [Family: Int]
+
+    /// The time from the handler starting to handle a fault it catches to its resuming the faulting thread, by
+    /// exception type. Only types with samples are present.
+    public let handlerLatency: [MachExceptionType: Histogram]
+
+    /// The time from the handler resuming the faulting thread to the thread reaching its scope's recovery point, by
+    /// exception type. Only types with samples are present.
+    public let resumeLatency: [MachExceptionType: Histogram]
+
+    /// Take a snapshot of the metrics.
+    public init() {
+        var metrics = mach_exception_metrics_t()
+        mach_exception_metrics_snapshot(&metrics)
+        self.metrics = metrics
+        self.scopesEntered = Int(metrics.scopes_entered)
+        self.listenerWakeups = Int(metrics.listener_wakeups)
+        self.caught = Self.families(metrics.caught)
+        self.forwarded = Self.families(metrics.forwarded)
+        self.handlerLatency = Self.histograms(metrics.handler_latency)
+        self.resumeLatency = Self.histograms(metrics.resume_latency)
+    }
+
+    /// The faults of a type a scope caught.
+    public func caught(_ type: MachExceptionType) -> Int {
+        return caught.reduce(0) { $0 + ($1.key.type == type ? $1.value : 0) }
+    }
+
+    /// The faults of a type passed on to the handler this library replaced.
+    public func forwarded(_ type: MachExceptionType) -> Int {
+        return forwarded.reduce(0) { $0 + ($1.key.type == type ? $1.value : 0) }
+    }
+
+    /// The metrics in the Prometheus text exposition format. See `mach_exception_metrics_format`.
+    public var exposition: String {
+        var metrics = self.metrics
+        var buffer = [CChar](repeating: 0, count: mach_exception_metrics_format(&metrics, nil, 0) + 1)
+        mach_exception_metrics_format(&metrics, &buffer, buffer.count)
+        return String(cString: buffer)
+    }
+
+    /// Write the exposition of a snapshot of the metrics to a file, replacing it atomically, so a scraper never reads
+    /// a partial exposition.
+    ///
+    /// - Throws: An `NSError` in the POSIX error domain, if the file cannot be written.
+    public static func write(toFile path: String) throws {
+        guard mach_exception_metrics_write(path) else {
+            throw NSError(domain: NSPOSIXErrorDomain, code: Int(errno), userInfo: nil)
+        }
+    }
+
+    // The counts of the families with faults.
+    private static func families<T>(_ counts: T) -> [Family: Int] {
+        var families: [Family: Int] = [:]
+        withUnsafeBytes(of: counts) { bytes in
+            for (family, count) in bytes.bindMemory(to: UInt64.self).enumerated() where count != 0 {
+                guard let type = MachExceptionType(rawValue: mach_exception_metrics_family_type(family)) else {
+                    continue
+                }
+                let name = String(cString: mach_exception_metrics_family_name(family))
+                families[Family(type: type, name: name), default: 0] += Int(count)
+            }
+        }
+        return families
+    }
+
+    // The histograms with samples.
+    private static func histograms<T>(_ histograms: T) -> [MachExceptionType: Histogram] {
+        var result: [MachExceptionType: Histogram] = [:]
+        withUnsafeBytes(of: histograms) { bytes in
+            for (type, histogram) in bytes.bindMemory(to: mach_exception_histogram_t.self).enumerated()
+                where histogram.count != 0
+            {
+                if let type = MachExceptionType(rawValue: exception_type_t(type)) {
+                    result[type] = Histogram(histogram)
+                }
+            }
+        }
+        return result
+    }
+}
+
+/// A server publishing the exposition of the metrics on a Unix-domain socket: a scraper connecting to the socket
+/// reads a snapshot of the metrics, then the server closes the connection. The server runs on a thread of its own
+/// until it is released.
+public final class MachExceptionMetricsServer {
+
+    private let server: OpaquePointer
+
+    /// The path of the server's socket.
+    public let socketPath: String
+
+    /// Start a server listening on a Unix-domain socket, replacing any socket at the path.
+    ///
+    /// - Throws: An `NSError` in the POSIX error domain, if the socket cannot be created.
+    public init(socketPath: String) throws {
+        guard let server = mach_exception_metrics_server_start(socketPath) else {
+            throw NSError(domain: NSPOSIXErrorDomain, code: Int(errno), userInfo: nil)
+        }
+        self.server = server
+        self.socketPath = socketPath
+    }
+
+    deinit {
+        mach_exception_metrics_server_stop(server)
+    }
+}
@@ -8,6 +8,7 @@
 //
 
 import Foundation
+import mach_exception_helper
 
 // MARK: - Mach Exception Type
 
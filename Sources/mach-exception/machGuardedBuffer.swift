@@ -0,0 +1,169 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// mach-exception
+// machGuardedBuffer.swift
+// Created by Patrick Gili on 2/22/23.
+//
+
+import Foundation
+import mach_exception_helper
+
+/// An error describing an unchecked access past the end of a guarded buffer, which faulted in its guard region.
+public struct MachExceptionOutOfBoundsError: Error, Equatable {
+
+    /// The offset of the faulting access from the start of the buffer, in bytes.
+    public let offset: Int
+
+    /// The size of the buffer, in bytes.
+    public let byteCount: Int
+}
+
+/// A fixed-size buffer of bytes followed by an inaccessible guard region, so inner loops can access it without
+/// checking bounds.
+///
+/// An unchecked access up to `maximumStride` bytes past the end of the buffer faults in the guard region, and
+/// `withUncheckedAccess` turns the fault into a `MachExceptionOutOfBoundsError`, rather than letting the access read
+/// or write someone else's memory. A forward scan is therefore safe as long as its stride is at most the maximum
+/// stride declared when creating the buffer, as the first access past the end lands in the guard region. Accesses
+/// before the start of the buffer aren't guarded.
+public final class MachGuardedBuffer {
+
+    internal var buffer = mach_guarded_buffer_t()
+
+    /// The size of the buffer, in bytes.
+    public let byteCount: Int
+
+    /// The furthest past the end of the buffer an access may reach, in bytes.
+    public let maximumStride: Int
+
+    /// Allocate a zero-filled buffer.
+    ///
+    /// - Parameters:
+    ///   - byteCount: The size of the buffer, in bytes.
+    ///   - alignment: The alignment of the buffer, a power of two no larger than the page size.
+    ///   - maximumStride: The furthest past the end of the buffer an unchecked access may reach, in bytes. The
+    ///     guard region is this large, rounded up to a multiple of the page size.
+    ///
+    /// - Throws: An `NSError` in the POSIX error domain, if the buffer cannot be allocated.
+    public init(byteCount: Int, alignment: Int = MemoryLayout<Int>.alignment, maximumStride: Int) throws {
+        guard byteCount >= 0, alignment > 0, maximumStride > 0,
+              mach_guarded_buffer_allocate(byteCount, alignment, maximumStride, &buffer)
+        else {
+            let code = byteCount >= 0 && alignment > 0 && maximumStride > 0 ? errno : EINVAL
+            throw NSError(domain: NSPOSIXErrorDomain, code: Int(code), userInfo: nil)
+        }
+        self.byteCount = byteCount
+        self.maximumStride = maximumStride
+    }
+
+    deinit {
+        mach_guarded_buffer_deallocate(&buffer)
+    }
+
+    /// The buffer's first byte. Accessing the buffer through it checks no bounds.
+    public var baseAddress: UnsafeMutableRawPointer {
+        return UnsafeMutableRawPointer(buffer.bytes!)
+    }
+
+    /// Execute an operation accessing the buffer without checking bounds, turning a fault in the buffer's guard
+    /// region into an error.
+    ///
+    /// - Throws: A `MachExceptionOutOfBoundsError`, if the operation accessed the buffer's guard region, or a
+    ///   `MachExceptionError` of type `badAccess`, if it faulted anywhere else.
+    public func withUncheckedAccess<R>(_ operation: @escaping (UnsafeMutableRawPointer) -> R) throws -> R {
+        let baseAddress = self.baseAddress
+        var result: R?
+        guard let machExceptionError = try withUnsafeMachExceptionResult(types: [.badAccess], operation: {
+            result = operation(baseAddress)
+        }) else {
+            return result!
+        }
+        throw outOfBoundsError(machExceptionError) ?? machExceptionError
+    }
+
+    // The out-of-bounds error a bad-access exception faulting in the guard region describes.
+    internal func outOfBoundsError(_ machExceptionError: MachExceptionError) -> MachExceptionOutOfBoundsError? {
+        guard machExceptionError.type == .badAccess else {
+            return nil
+        }
+        // Prefer the fault address the backend captured, falling back on the subcode, which holds it for page faults.
+        var address = machExceptionError.state?.faultAddress ?? 0
+        if address == 0 {
+            address = UInt64(bitPattern: machExceptionError.subcode ?? 0)
+        }
+        var offset: UInt64 = 0
+        guard mach_guarded_buffer_guards(&buffer, address, &offset) else {
+            return nil
+        }
+        return MachExceptionOutOfBoundsError(offset: Int(offset), byteCount: byteCount)
+    }
+}
+
+/// A fixed-size array of trivial values, followed by an inaccessible guard region, so inner loops can access its
+/// elements without checking bounds. See `MachGuardedBuffer`.
+///
+/// The subscript checks no bounds: use it inside `withUncheckedAccess`, which turns an access past the end into a
+/// `MachExceptionOutOfBoundsError`, as long as it reaches at most `maximumStride` elements past the end.
+public final class MachGuardedArray<Element> {
+
+    private let storage: MachGuardedBuffer
+    private let elements: UnsafeMutablePointer<Element>
+
+    /// The number of elements.
+    public let count: Int
+
+    /// The furthest past the end of the array an access may reach, in elements.
+    public var maximumStride: Int {
+        return storage.maximumStride / MemoryLayout<Element>.stride
+    }
+
+    // Allocate the storage of an array, leaving its elements uninitialized.
+    private init(uninitializedCount count: Int, maximumStride: Int) throws {
+        precondition(_isPOD(Element.self), "A guarded array's elements must be trivial")
+        storage = try MachGuardedBuffer(byteCount: count * MemoryLayout<Element>.stride,
+                                        alignment: MemoryLayout<Element>.alignment,
+                                        maximumStride: Swift.max(maximumStride, 1) * MemoryLayout<Element>.stride)
+        elements = storage.baseAddress.bindMemory(to: Element.self, capacity: count)
+        self.count = count
+    }
+
+    /// Create an array.
+    ///
+    /// - Parameters:
+    ///   - repeatedValue: The value of every element.
+    ///   - count: The number of elements.
+    ///   - maximumStride: The furthest past the end of the array an unchecked access may reach, in elements, which
+    ///     is the largest stride with which a loop may scan it.
+    ///
+    /// - Throws: An `NSError` in the POSIX error domain, if the storage cannot be allocated.
+    public convenience init(repeating repeatedValue: Element, count: Int, maximumStride: Int = 1) throws {
+        try self.init(uninitializedCount: count, maximumStride: maximumStride)
+        elements.initialize(repeating: repeatedValue, count: count)
+    }
+
+    /// Create an array holding the elements of a collection.
+    public convenience init<C: Collection>(_ elements: C, maximumStride: Int = 1) throws where C.Element == Element {
+        try self.init(uninitializedCount: elements.count, maximumStride: maximumStride)
+        _ = UnsafeMutableBufferPointer(start: self.elements, count: count).initialize(from: elements)
+    }
+
+    /// The element at `index`, which isn't checked against the bounds of the array.
+    @inline(__always)
+    public subscript(index: Int) -> Element {
+        get { return elements[index] }
+        set { elements[index] = newValue }
+    }
+
+    /// Execute an operation accessing the array's elements without checking bounds, turning a fault in the array's
+    /// guard region into an error.
+    ///
+    /// - Throws: A `MachExceptionOutOfBoundsError`, whose offset is in bytes, if the operation accessed the array's
+    ///   guard region, or a `MachExceptionError` of type `badAccess`, if it faulted anywhere else.
+    public func withUncheckedAccess<R>(_ operation: @escaping (MachGuardedArray<Element>) -> R) throws -> R {
+        return try storage.withUncheckedAccess { _ in
+            operation(self)
+        }
+    }
+}
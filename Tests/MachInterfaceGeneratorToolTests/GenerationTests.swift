@@ -0,0 +1,150 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+//
+// GenerationTests.swift
+// Created by Patrick Gili on 2/27/23.
+//
+
+import Foundation
+import XCTest
+
+@testable import MachInterfaceGeneratorTool
+
+final class GenerationTests: XCTestCase {
+
+    // The number of definitions files generated, as in a package with many interfaces.
+    let count = 64
+
+    var directory: URL!
+    var inputPaths: [String] = []
+
+    var cachePath: String {
+        return directory.appendingPathComponent("generation-cache.json").path
+    }
+
+    override func setUpWithError() throws {
+        directory = FileManager.default.temporaryDirectory
+            .appendingPathComponent("GenerationTests-\(UUID().uuidString)")
+        try FileManager.default.createDirectory(at: directory, withIntermediateDirectories: true)
+
+        // Variants of the exception interface, each a subsystem of its own.
+        let definitions = try String(contentsOfFile: exceptionDefinitionsPath, encoding: .utf8)
+        inputPaths = try (0..<count).map { index in
+            let path = directory.appendingPathComponent("interface\(index).defs").path
+            try definitions
+                .replacingOccurrences(of: "mach_exc 2405;", with: "interface\(index) \(3000 + 100 * index);")
+                .write(toFile: path, atomically: true, encoding: .utf8)
+            return path
+        }
+    }
+
+    override func tearDownWithError() throws {
+        try FileManager.default.removeItem(at: directory)
+    }
+
+    func generate(_ options: [String] = []) throws -> MachInterfaceGeneratorTool.Summary {
+        let tool = try MachInterfaceGeneratorTool.parse(["--server", "--cache-path", cachePath] + options + inputPaths)
+        return try tool.generate()
+    }
+
+    func modificationDate(_ path: String) throws -> Date? {
+        return try FileManager.default.attributesOfItem(atPath: path)[.modificationDate] as? Date
+    }
+
+    func serverSourcePath(_ index: Int) -> String {
+        return directory.appendingPathComponent("interface\(index)Server.c").path
+    }
+
+    // MARK: - Cache
+
+    func testColdAndWarmGeneration() throws {
+        var start = Date()
+        let cold = try generate()
+        let coldTime = Date().timeIntervalSince(start)
+        XCTAssertEqual(cold.generated.count, count)
+        XCTAssert(FileManager.default.fileExists(atPath: serverSourcePath(count - 1)))
+
+        start = Date()
+        let warm = try generate()
+        let warmTime = Date().timeIntervalSince(start)
+        XCTAssertEqual(warm.cached.count, count)
+        XCTAssert(warm.generated.isEmpty)
+
+        print(String(format: "%d definitions files: cold %.1f ms, warm %.1f ms",
+                     count, coldTime * 1e3, warmTime * 1e3))
+    }
+
+    func testChangesThatCannotChangeTheOutputsRegenerateNothing() throws {
+        _ = try generate()
+        let path = inputPaths[0]
+        let definitions = try String(contentsOfFile: path, encoding: .utf8)
+        try ("/* A comment. */\n\n" + definitions).write(toFile: path, atomically: true, encoding: .utf8)
+        XCTAssertEqual(try generate().cached.count, count)
+    }
+
+    func testChangedDefinitionsRegenerate() throws {
+        _ = try generate()
+        let path = inputPaths[1]
+        let definitions = try String(contentsOfFile: path, encoding: .utf8)
+        try definitions
+            .replacingOccurrences(of: "ServerPrefix catch_;", with: "ServerPrefix handle_;")
+            .write(toFile: path, atomically: true, encoding: .utf8)
+
+        let summary = try generate()
+        XCTAssertEqual(summary.generated, [path])
+        XCTAssertEqual(summary.cached.count, count - 1)
+        let source = try String(contentsOfFile: serverSourcePath(1), encoding: .utf8)
+        XCTAssert(source.contains("handle_mach_exception_raise"))
+    }
+
+    func testChangedIncludedDefinitionsRegenerate() throws {
+        let path = inputPaths[4]
+        let included = directory.appendingPathComponent("prefix.defs").path
+        try "ServerPrefix catch_;\n".write(toFile: included, atomically: true, encoding: .utf8)
+        let definitions = try String(contentsOfFile: path, encoding: .utf8)
+        try definitions
+            .replacingOccurrences(of: "ServerPrefix catch_;", with: "#include \"prefix.defs\"")
+            .write(toFile: path, atomically: true, encoding: .utf8)
+        _ = try generate()
+
+        try "ServerPrefix handle_;\n".write(toFile: included, atomically: true, encoding: .utf8)
+        XCTAssertEqual(try generate().generated, [path])
+        let source = try String(contentsOfFile: serverSourcePath(4), encoding: .utf8)
+        XCTAssert(source.contains("handle_mach_exception_raise"))
+    }
+
+    func testChangedOptionsRegenerate() throws {
+        _ = try generate()
+        XCTAssertEqual(try generate(["--specialized"]).generated.count, count)
+        XCTAssertEqual(try generate(["--specialized"]).cached.count, count)
+    }
+
+    func testMissingOutputsRegenerate() throws {
+        _ = try generate()
+        try FileManager.default.removeItem(atPath: serverSourcePath(2))
+        XCTAssertEqual(try generate().generated, [inputPaths[2]])
+    }
+
+    func testUnchangedOutputsAreNotWritten() throws {
+        _ = try generate()
+        let modified = try modificationDate(serverSourcePath(0))
+        try FileManager.default.removeItem(atPath: cachePath)
+
+        let summary = try generate()
+        XCTAssertEqual(summary.unchanged.count, count)
+        XCTAssertEqual(try modificationDate(serverSourcePath(0)), modified)
+    }
+
+    func testFailuresAreNotCached() throws {
+        try "subsystem broken 100;\nroutine first(server : undeclared_t);"
+            .write(toFile: inputPaths[3], atomically: true, encoding: .utf8)
+        XCTAssertThrowsError(try generate())
+        XCTAssertThrowsError(try generate())
+
+        let cache = GenerationCache(contentsOfFile: cachePath)
+        XCTAssertNil(cache.keys[inputPaths[3]])
+        XCTAssertEqual(cache.keys.count, count - 1)
+    }
+}
@@ -0,0 +1,244 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+//
+// ParserTests.swift
+// Created by Patrick Gili on 2/26/23.
+//
+
+import Foundation
+import XCTest
+
+@testable import MachInterfaceGeneratorTool
+
+/// The package's exception interface definitions.
+let exceptionDefinitionsPath = URL(fileURLWithPath: #filePath)
+    .deletingLastPathComponent()
+    .deletingLastPathComponent()
+    .deletingLastPathComponent()
+    .appendingPathComponent("Sources/mach-exception-helper/mach_exc.defs")
+    .path
+
+/// Compile the package's exception interface definitions.
+func compileExceptionDefinitions(defines: [String: String] = [:]) throws -> Interface {
+    var lexer = Lexer(defines: defines)
+    var parser = Parser(tokens: try lexer.tokenize(file: exceptionDefinitionsPath))
+    return try parser.parse()
+}
+
+final class ParserTests: XCTestCase {
+
+    func compile(_ source: String, defines: [String: String] = [:]) throws -> Interface {
+        var lexer = Lexer(defines: defines)
+        var parser = Parser(tokens: try lexer.tokenize(source, file: "test.defs"))
+        return try parser.parse()
+    }
+
+    func assertError(_ source: String, _ message: String, line: Int? = nil, file: StaticString = #filePath,
+                     sourceLine: UInt = #line) {
+        XCTAssertThrowsError(try compile(source), file: file, line: sourceLine) { error in
+            guard let error = error as? InterfaceError else {
+                return XCTFail("unexpected error \(error)", file: file, line: sourceLine)
+            }
+            XCTAssert(error.message.contains(message), error.description, file: file, line: sourceLine)
+            if let line = line {
+                XCTAssertEqual(error.location?.line, line, file: file, line: sourceLine)
+            }
+        }
+    }
+
+    // MARK: - Exception interface
+
+    func testExceptionInterface() throws {
+        let interface = try compileExceptionDefinitions()
+        XCTAssertEqual(interface.subsystem, "mach_exc")
+        XCTAssertEqual(interface.base, 2405)
+        XCTAssertEqual(interface.serverPrefix, "catch_")
+        XCTAssertEqual(interface.routines.map { $0?.name }, [
+            "mach_exception_raise",
+            "mach_exception_raise_state",
+            "mach_exception_raise_state_identity",
+        ])
+
+        let raiseState = try XCTUnwrap(interface.routines[1])
+        XCTAssertEqual(interface.identifier(of: raiseState), 2406)
+        XCTAssertEqual(raiseState.arguments.map { $0.name },
+                       ["exception_port", "exception", "code", "flavor", "old_state", "new_state"])
+        XCTAssertEqual(raiseState.arguments.map { $0.direction }, [.requestPort, .in, .in, .inout, .in, .out])
+        XCTAssertEqual(raiseState.arguments.map { $0.isConst }, [false, false, true, false, true, false])
+        XCTAssertEqual(raiseState.arguments[2].type.type, .array(element: .integer(size: 8), count: 2, variable: true))
+        XCTAssertEqual(raiseState.arguments[2].type.cType, "mach_exception_data_t")
+        XCTAssertEqual(raiseState.arguments[2].type.elementCType, "int64_t")
+        XCTAssertEqual(raiseState.arguments[4].type.type,
+                       .array(element: .integer(size: 4), count: 1296, variable: true))
+    }
+
+    func testKernelUserExceptionInterface() throws {
+        // The kernel moves send rights, which the server receives as send rights all the same.
+        let interface = try compileExceptionDefinitions(defines: ["KERNEL_USER": "1"])
+        let raise = try XCTUnwrap(interface.routines[0])
+        XCTAssertEqual(raise.arguments[1].type.name, "mach_port_move_send_t")
+        XCTAssertEqual(raise.arguments[1].type.type, .port(receivedDisposition: 17))
+    }
+
+    func testRequestLayouts() throws {
+        let interface = try compileExceptionDefinitions()
+        let raise = MessageLayout(request: try XCTUnwrap(interface.routines[0]))
+        XCTAssertEqual(raise.descriptors.map { $0.name }, ["thread", "task"])
+        XCTAssertEqual(raise.items.map { $0.name }, ["exception", "code"])
+        XCTAssertEqual(raise.start, 60)
+        XCTAssertEqual(raise.minimumSize, 68)
+        XCTAssertEqual(raise.maximumSize, 84)
+
+        let raiseState = MessageLayout(request: try XCTUnwrap(interface.routines[1]))
+        XCTAssertFalse(raiseState.isComplex)
+        XCTAssertEqual(raiseState.items.map { $0.name }, ["exception", "code", "flavor", "old_state"])
+        XCTAssertEqual(raiseState.start, 32)
+        XCTAssertEqual(raiseState.minimumSize, 48)
+        XCTAssertEqual(raiseState.maximumSize, 48 + 8 * 2 + 4 * 1296)
+
+        let identity = MessageLayout(request: try XCTUnwrap(interface.routines[2]))
+        XCTAssert(identity.isComplex)
+        XCTAssertEqual(identity.start, 60)
+        XCTAssertEqual(identity.minimumSize, 76)
+        XCTAssertEqual(identity.maximumSize, 76 + 8 * 2 + 4 * 1296)
+    }
+
+    func testReplyLayouts() throws {
+        let interface = try compileExceptionDefinitions()
+        let raise = MessageLayout(reply: try XCTUnwrap(interface.routines[0]))
+        XCTAssert(raise.items.isEmpty)
+        XCTAssertEqual(raise.minimumSize, MessageLayout.errorReplySize)
+
+        let raiseState = MessageLayout(reply: try XCTUnwrap(interface.routines[1]))
+        XCTAssertEqual(raiseState.items.map { $0.name }, ["flavor", "new_state"])
+        XCTAssertEqual(raiseState.start, 36)
+        XCTAssertEqual(raiseState.minimumSize, 44)
+        XCTAssertEqual(raiseState.maximumSize, 44 + 4 * 1296)
+    }
+
+    func testUnalignedArrays() throws {
+        let interface = try compile("""
+            subsystem test 100;
+            type byte = MACH_MSG_TYPE_BYTE;
+            type port = MACH_MSG_TYPE_COPY_SEND;
+            type name_t = array[*:10] of byte;
+            type tag_t = array[3] of byte;
+            routine named(server : port; name : name_t; tag : tag_t; out value : byte);
+            """)
+        let named = try XCTUnwrap(interface.routines[0])
+        let request = MessageLayout(request: named)
+        XCTAssertEqual(request.start, 32)
+        XCTAssertEqual(request.minimumSize, 32 + 4 + 4)
+        XCTAssertEqual(request.maximumSize, 32 + 4 + 12 + 4)
+        XCTAssertEqual(MessageLayout(reply: named).maximumSize, 40)
+    }
+
+    // MARK: - Preprocessor
+
+    func testConditionalSections() throws {
+        let source = """
+            subsystem test 100;
+            type port = MACH_MSG_TYPE_COPY_SEND;
+            #if FIRST
+            routine first(server : port);
+            #elif !defined(SECOND)
+            routine neither(server : port);
+            #else
+            #ifdef FIRST
+            routine never(server : port);
+            #endif
+            routine second(server : port);
+            #endif
+            """
+        XCTAssertEqual(try compile(source).routines.map { $0?.name }, ["neither"])
+        XCTAssertEqual(try compile(source, defines: ["FIRST": ""]).routines.map { $0?.name }, ["first"])
+        XCTAssertEqual(try compile(source, defines: ["SECOND": ""]).routines.map { $0?.name }, ["second"])
+    }
+
+    func testCommentsAndContinuationsKeepLineNumbers() {
+        assertError("""
+            subsystem test 100; /* a comment
+            spanning lines */
+            // a comment
+            type port = \\
+                MACH_MSG_TYPE_COPY_SEND;
+            routine first(server : undeclared_t);
+            """, "undeclared type undeclared_t", line: 6)
+    }
+
+    func testSkip() throws {
+        let interface = try compile("""
+            subsystem test 100;
+            type port = MACH_MSG_TYPE_COPY_SEND;
+            skip;
+            simpleroutine second(server : port);
+            """)
+        XCTAssertNil(interface.routines[0])
+        XCTAssertEqual(interface.routines[1]?.isSimple, true)
+        XCTAssertEqual(interface.identifier(of: try XCTUnwrap(interface.routines[1])), 101)
+    }
+
+    // MARK: - Errors
+
+    func testErrors() {
+        assertError("type port = MACH_MSG_TYPE_COPY_SEND;", "no subsystem")
+        assertError("subsystem test 100;\nimport <test.h>;\nserverdemux test;", "unsupported statement", line: 3)
+        assertError("subsystem test 100;\n#pragma once", "unsupported preprocessor directive", line: 2)
+        assertError("subsystem test 100;\n#if X", "#if without #endif")
+        assertError("subsystem test 100;\n#include <missing.defs>", "cannot find included file", line: 2)
+        assertError("""
+            subsystem test 100;
+            type port = MACH_MSG_TYPE_COPY_SEND;
+            type buffer_t = array[] of MACH_MSG_TYPE_BYTE;
+            """, "expected a number", line: 3)
+        assertError("""
+            subsystem test 100;
+            type buffer_t = array[*] of MACH_MSG_TYPE_BYTE;
+            """, "out of line", line: 2)
+        assertError("""
+            subsystem test 100;
+            type ports_t = array[2] of MACH_MSG_TYPE_COPY_SEND;
+            """, "arrays of MACH_MSG_TYPE_COPY_SEND", line: 2)
+        assertError("""
+            subsystem test 100;
+            type int = MACH_MSG_TYPE_INTEGER_32;
+            routine first(value : int);
+            """, "the request port value is not a port", line: 3)
+        assertError("""
+            subsystem test 100;
+            type port = MACH_MSG_TYPE_COPY_SEND;
+            routine first(server : port; out other : port);
+            """, "port rights in replies", line: 3)
+        assertError("""
+            subsystem test 100;
+            type port = MACH_MSG_TYPE_COPY_SEND;
+            type words_t = array[*:4] of MACH_MSG_TYPE_INTEGER_32;
+            routine first(server : port; inout words : words_t);
+            """, "inout arrays", line: 4)
+        assertError("""
+            subsystem test 100;
+            type port = MACH_MSG_TYPE_COPY_SEND;
+            type int = MACH_MSG_TYPE_INTEGER_32;
+            simpleroutine first(server : port; out value : int);
+            """, "simple routine first has a reply argument", line: 4)
+        assertError("""
+            subsystem test 100;
+            type port = MACH_MSG_TYPE_COPY_SEND;
+            type int = MACH_MSG_TYPE_INTEGER_32;
+            type words_t = array[*:4] of int;
+            routine first(server : port; out words : words_t; out value : int);
+            """, "must be the last reply argument", line: 5)
+        assertError("""
+            subsystem test 100;
+            type port = MACH_MSG_TYPE_COPY_SEND;
+            routine first(server : port; value : array[4] of MACH_MSG_TYPE_BYTE);
+            """, "must be named", line: 3)
+        assertError("""
+            subsystem test 100;
+            type port = MACH_MSG_TYPE_COPY_SEND;
+            routine first(server : port; other : port, dealloc);
+            """, "unsupported argument flag dealloc", line: 3)
+    }
+}
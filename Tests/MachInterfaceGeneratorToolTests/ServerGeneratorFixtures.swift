@@ -0,0 +1,148 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+//
+// ServerGeneratorFixtures.swift
+// Created by Patrick Gili on 2/26/23.
+//
+
+import Foundation
+
+/// A request, in hex, and the reply a server built for it.
+struct Fixture {
+    var name: String
+    var request: String
+    var handled: Bool
+    var reply: String
+}
+
+/// Exception requests, and the replies recorded from the package's dispatch core given handlers that succeed unless
+/// the exception is `EXC_CRASH`, returning the old state with each word and the flavor incremented. The requests name
+/// the reply port 0x103, the exception port 0x207, the thread 0x303 and the task 0x403.
+let exceptionFixtures: [Fixture] = [
+    Fixture(
+        name: "raise",
+        request: """
+            121100805400000003010000070200000000000065090000020000000303000000000000000011000304000000000000
+            000011000000000001000000010000000200000001000000010000001100000002000000
+            """,
+        handled: true,
+        reply: """
+            1200000024000000030100000000000000000000c9090000000000000100000000000000
+            """),
+    Fixture(
+        name: "raise failing",
+        request: """
+            121100804400000003010000070200000000000065090000020000000303000000000000000011000304000000000000
+            0000110000000000010000000a00000000000000
+            """,
+        handled: true,
+        reply: """
+            1200000024000000030100000000000000000000c9090000000000000100000005000000
+            """),
+    Fixture(
+        name: "raise_state",
+        request: """
+            121100004c00000003010000070200000000000066090000000000000100000002000000020000000100000001000000
+            110000000200000007000000030000000a000000140000001e000000
+            """,
+        handled: true,
+        reply: """
+            1200000038000000030100000000000000000000ca09000000000000010000000000000008000000030000000b000000
+            150000001f000000
+            """),
+    Fixture(
+        name: "raise_state_identity",
+        request: """
+            121100806400000003010000070200000000000067090000020000000303000000000000000011000304000000000000
+            0000110000000000010000000100000001000000010000000100000007000000040000000a000000140000001e000000
+            28000000
+            """,
+        handled: true,
+        reply: """
+            120000003c000000030100000000000000000000cb09000000000000010000000000000008000000040000000b000000
+            150000001f00000029000000
+            """),
+    Fixture(
+        name: "raise_state_identity without codes or state",
+        request: """
+            121100804c00000003010000070200000000000067090000020000000303000000000000000011000304000000000000
+            00001100000000000100000003000000000000000700000000000000
+            """,
+        handled: true,
+        reply: """
+            120000002c000000030100000000000000000000cb0900000000000001000000000000000800000000000000
+            """),
+    Fixture(
+        name: "raise_state_identity failing",
+        request: """
+            121100806400000003010000070200000000000067090000020000000303000000000000000011000304000000000000
+            0000110000000000010000000a000000020000000100000001000000110000000200000007000000020000000a000000
+            14000000
+            """,
+        handled: true,
+        reply: """
+            1200000024000000030100000000000000000000cb090000000000000100000005000000
+            """),
+    Fixture(
+        name: "unknown identifier",
+        request: """
+            121100805c00000003010000070200000000000064090000020000000303000000000000000011000304000000000000
+            0000110000000000010000000100000002000000010000000100000011000000020000000700000000000000
+            """,
+        handled: false,
+        reply: """
+            1200000024000000030100000000000000000000c80900000000000001000000d1feffff
+            """),
+    Fixture(
+        name: "send-once thread",
+        request: """
+            121100806400000003010000070200000000000067090000020000000303000000000000000012000304000000000000
+            00001100000000000100000001000000020000000100000001000000110000000200000007000000020000000a000000
+            14000000
+            """,
+        handled: true,
+        reply: """
+            1200000024000000030100000000000000000000cb0900000000000001000000d4feffff
+            """),
+    Fixture(
+        name: "too many codes",
+        request: """
+            121100004800000003010000070200000000000066090000000000000100000001000000030000000100000001000000
+            110000000200000007000000020000000a00000014000000
+            """,
+        handled: true,
+        reply: """
+            1200000024000000030100000000000000000000ca0900000000000001000000d0feffff
+            """),
+    Fixture(
+        name: "state overrunning the message",
+        request: """
+            121100004400000003010000070200000000000066090000000000000100000001000000020000000100000001000000
+            110000000200000007000000020000000a000000
+            """,
+        handled: true,
+        reply: """
+            1200000024000000030100000000000000000000ca0900000000000001000000d0feffff
+            """),
+    Fixture(
+        name: "truncated",
+        request: """
+            121100805400000003010000070200000000000065090000020000000303000000000000000011000304000000000000
+            00001100000000000100000001000000020000000100000001000000
+            """,
+        handled: true,
+        reply: """
+            1200000024000000030100000000000000000000c90900000000000001000000d0feffff
+            """),
+    Fixture(
+        name: "shorter than a header",
+        request: """
+            1211008054000000030100000702000000000000
+            """,
+        handled: false,
+        reply: """
+            0000000024000000000000000000000000000000000000000000000001000000d0feffff
+            """),
+]
@@ -0,0 +1,380 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+//
+// ServerGeneratorTests.swift
+// Created by Patrick Gili on 2/26/23.
+//
+
+import Foundation
+import XCTest
+
+@testable import MachInterfaceGeneratorTool
+
+final class ServerGeneratorTests: XCTestCase {
+
+    // The package's headers, among which the portable header declaring the Mach types on hosts other than Apple's.
+    let includePath = URL(fileURLWithPath: exceptionDefinitionsPath)
+        .deletingLastPathComponent()
+        .appendingPathComponent("include")
+        .path
+
+    // The server mig generated from the exception interface, for comparison on Apple's hosts.
+    let migServerPath = URL(fileURLWithPath: exceptionDefinitionsPath)
+        .deletingLastPathComponent()
+        .appendingPathComponent("mach_excServer.c")
+        .path
+
+    var directory: URL!
+
+    override func setUpWithError() throws {
+        directory = FileManager.default.temporaryDirectory
+            .appendingPathComponent("ServerGeneratorTests-\(UUID().uuidString)")
+        try FileManager.default.createDirectory(at: directory, withIntermediateDirectories: true)
+    }
+
+    override func tearDownWithError() throws {
+        try FileManager.default.removeItem(at: directory)
+    }
+
+    func generator(specialized: Bool = false, routines: Set<String>? = nil) throws -> ServerGenerator {
+        let options = ServerGenerator.Options(specialized: specialized,
+                                              routines: routines,
+                                              portableHeader: "mach_exception_compat.h")
+        return try ServerGenerator(interface: try compileExceptionDefinitions(),
+                                   options: options,
+                                   definitionsName: "mach_exc.defs",
+                                   headerName: "mach_excServer.h")
+    }
+
+    // MARK: - Source
+
+    func testHeader() throws {
+        let header = try generator().header()
+        XCTAssert(header.contains("#include \"mach_exception_compat.h\""))
+        XCTAssert(header.contains("#define mach_exc_MSG_COUNT 3"))
+        XCTAssert(header.contains("#define MACH_EXC_SERVER_REQUEST_MAX 5276"))
+        XCTAssert(header.contains("#define MACH_EXC_SERVER_REPLY_MAX 5228"))
+        XCTAssert(header.contains("""
+            kern_return_t catch_mach_exception_raise_state(mach_port_t exception_port,
+                                                           exception_type_t exception,
+                                                           const mach_exception_data_t code,
+                                                           mach_msg_type_number_t codeCnt,
+                                                           int *flavor,
+                                                           const thread_state_t old_state,
+                                                           mach_msg_type_number_t old_stateCnt,
+                                                           thread_state_t new_state,
+                                                           mach_msg_type_number_t *new_stateCnt);
+            """))
+        XCTAssert(header.contains("bool mach_exc_server_dispatch(void *request, size_t request_size, void *reply);"))
+    }
+
+    func testGenericServerDispatchesThroughATable() throws {
+        let source = try generator().source()
+        XCTAssert(source.contains("static kern_return_t _Xmach_exception_raise(uint8_t *in,"))
+        XCTAssert(source.contains("""
+            static const mach_exc_routine_t mach_exc_routines[3] = {
+                _Xmach_exception_raise,
+                _Xmach_exception_raise_state,
+                _Xmach_exception_raise_state_identity,
+            };
+            """))
+        XCTAssertFalse(source.contains("switch"))
+    }
+
+    func testSpecializedServerServesOnlyItsRoutines() throws {
+        let generator = try generator(specialized: true, routines: ["mach_exception_raise_state_identity"])
+        let source = generator.source()
+        XCTAssert(source.contains("static inline __attribute__((always_inline)) kern_return_t "
+                                  + "_Xmach_exception_raise_state_identity("))
+        XCTAssert(source.contains("""
+            static const uint8_t _Xmach_exception_raise_state_identity_reply[36] = {
+                0x00, 0x00, 0x00, 0x00, 0x24, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+                0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xcb, 0x09, 0x00, 0x00,
+                0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+            };
+            """))
+        XCTAssert(source.contains("case 2407:"))
+        XCTAssertFalse(source.contains("case 2405:"))
+        XCTAssertFalse(source.contains("_Xmach_exception_raise("))
+
+        // The program needn't implement the handlers of the routines not served.
+        let header = generator.header()
+        XCTAssert(header.contains("catch_mach_exception_raise_state_identity("))
+        XCTAssertFalse(header.contains("catch_mach_exception_raise("))
+        XCTAssertFalse(header.contains("catch_mach_exception_raise_state("))
+        XCTAssert(header.contains("#define MACH_EXC_SERVER_REQUEST_MAX 5276"))
+    }
+
+    func testUnknownRoutine() throws {
+        XCTAssertThrowsError(try generator(routines: ["mach_exception_raise_identity"])) { error in
+            XCTAssertEqual((error as? InterfaceError)?.message,
+                           "the subsystem mach_exc has no routine mach_exception_raise_identity")
+        }
+    }
+
+    // MARK: - Recorded messages
+
+    // Compile a server, and a driver dispatching the requests it reads to handlers behaving as those the fixtures
+    // were recorded with, and writing the replies.
+    func build(_ generator: ServerGenerator, withMig: Bool = false) throws -> URL {
+        let compiler = "/usr/bin/cc"
+        guard FileManager.default.isExecutableFile(atPath: compiler) else {
+            throw XCTSkip("There is no C compiler at \(compiler).")
+        }
+        let source = directory.appendingPathComponent("mach_excServer.c")
+        let driver = directory.appendingPathComponent("driver.c")
+        let executable = directory.appendingPathComponent("driver")
+        try generator.source().write(to: source, atomically: true, encoding: .utf8)
+        try generator.header().write(to: directory.appendingPathComponent("mach_excServer.h"),
+                                     atomically: true,
+                                     encoding: .utf8)
+        try Self.driver.write(to: driver, atomically: true, encoding: .utf8)
+
+        var arguments = ["-std=gnu11", "-O2", "-I", directory.path, "-I", includePath,
+                         "-o", executable.path, driver.path, source.path]
+        if withMig {
+            arguments += ["-DMACH_EXC_MIG", migServerPath]
+        }
+        let output = try execute(compiler, arguments)
+        XCTAssertEqual(output.status, 0, output.text)
+        return executable
+    }
+
+    func execute(_ executable: String, _ arguments: [String], input: String = "") throws
+        -> (status: Int32, text: String)
+    {
+        let process = Process()
+        process.executableURL = URL(fileURLWithPath: executable)
+        process.arguments = arguments
+        let inputPipe = Pipe()
+        let outputPipe = Pipe()
+        process.standardInput = inputPipe
+        process.standardOutput = outputPipe
+        process.standardError = outputPipe
+        try process.run()
+        inputPipe.fileHandleForWriting.write(Data(input.utf8))
+        try inputPipe.fileHandleForWriting.close()
+        let output = outputPipe.fileHandleForReading.readDataToEndOfFile()
+        process.waitUntilExit()
+        return (process.terminationStatus, String(decoding: output, as: UTF8.self))
+    }
+
+    func hex(_ text: String) -> String {
+        return text.filter { !$0.isWhitespace }
+    }
+
+    func bytes(_ text: String) -> [UInt8] {
+        let digits = Array(hex(text))
+        return stride(from: 0, to: digits.count, by: 2).map { UInt8(String(digits[$0 ..< $0 + 2]), radix: 16)! }
+    }
+
+    // The error reply to a request of a routine a server doesn't serve, whose return code is MIG_BAD_ID.
+    func badIdentifierReply(to request: [UInt8]) -> String {
+        var reply = [UInt8](repeating: 0, count: 36)
+        reply[0] = request[0] & 0x1f
+        reply[4] = 36
+        reply[8 ..< 12] = request[8 ..< 12]
+        let identifier = request[20 ..< 24].reversed().reduce(0) { $0 << 8 | Int($1) } + 100
+        for index in 0 ..< 4 {
+            reply[20 + index] = UInt8(truncatingIfNeeded: identifier >> (8 * index))
+        }
+        reply[28] = 1
+        reply[32 ..< 36] = [0xd1, 0xfe, 0xff, 0xff]
+        return reply.map { String(format: "%02x", $0) }.joined()
+    }
+
+    // Dispatch the fixtures' requests, and return a reply per request, preceded by whether it was handled.
+    func replies(of executable: URL) throws -> [String] {
+        let input = exceptionFixtures.map { hex($0.request) + "\n" }.joined()
+        let output = try execute(executable.path, [], input: input)
+        XCTAssertEqual(output.status, 0)
+        return output.text.split(separator: "\n").map(String.init)
+    }
+
+    func assertReplies(_ replies: [String], served: ([UInt8]) -> Bool = { _ in true },
+                       file: StaticString = #filePath, line: UInt = #line) {
+        XCTAssertEqual(replies.count, exceptionFixtures.count, file: file, line: line)
+        for (fixture, reply) in zip(exceptionFixtures, replies) {
+            let request = bytes(fixture.request)
+            let expected = served(request)
+                ? "\(fixture.handled ? 1 : 0) \(hex(fixture.reply))"
+                : "0 \(badIdentifierReply(to: request))"
+            XCTAssertEqual(reply, expected, fixture.name, file: file, line: line)
+        }
+    }
+
+    func testGenericServerMatchesRecordedMessages() throws {
+        assertReplies(try replies(of: try build(try generator())))
+    }
+
+    func testSpecializedServerMatchesRecordedMessages() throws {
+        assertReplies(try replies(of: try build(try generator(specialized: true))))
+    }
+
+    func testSpecializedServerAnswersOtherRoutinesWithBadIdentifier() throws {
+        let generator = try generator(specialized: true, routines: ["mach_exception_raise_state_identity"])
+        assertReplies(try replies(of: try build(generator))) { request in
+            // A request shorter than a header has no identifier, and is rejected as malformed.
+            return request.count < 24 || request[20 ..< 24] == [0x67, 0x09, 0x00, 0x00]
+        }
+    }
+
+    // MARK: - Performance
+
+    func testDemuxThroughput() throws {
+        let request = hex(try XCTUnwrap(exceptionFixtures.first { $0.name == "raise_state_identity" }).request)
+        let iterations = 1_000_000
+        #if canImport(Darwin)
+        let withMig = true
+        #else
+        let withMig = false
+        #endif
+        for specialized in [false, true] {
+            let executable = try build(try generator(specialized: specialized), withMig: withMig && !specialized)
+            let output = try execute(executable.path, ["bench", "\(iterations)"], input: request + "\n")
+            XCTAssertEqual(output.status, 0)
+            for line in output.text.split(separator: "\n") {
+                let parts = line.split(separator: " ")
+                let server = parts[0] == "mig" ? "mig" : specialized ? "specialized" : "generic"
+                print("\(server): \(parts[1]) ns per mach_exception_raise_state_identity")
+            }
+        }
+    }
+
+    // MARK: - Driver
+
+    static let driver = #"""
+        #include <stdio.h>
+        #include <stdlib.h>
+        #include <string.h>
+        #include <time.h>
+        #include "mach_excServer.h"
+
+        #ifdef MACH_EXC_MIG
+        #include <mach/message.h>
+        boolean_t mach_exc_server(mach_msg_header_t *request, mach_msg_header_t *reply);
+        #endif
+
+        // Deterministic handlers: each succeeds unless the exception is EXC_CRASH, and returns the old state, each word
+        // incremented, with the flavor incremented.
+        static kern_return_t state(exception_type_t exception,
+                                   int *flavor,
+                                   const natural_t *old_state,
+                                   mach_msg_type_number_t old_stateCnt,
+                                   natural_t *new_state,
+                                   mach_msg_type_number_t *new_stateCnt)
+        {
+            if (exception == EXC_CRASH) {
+                return KERN_FAILURE;
+            }
+            *flavor += 1;
+            for (mach_msg_type_number_t index = 0; index < old_stateCnt; index++) {
+                new_state[index] = old_state[index] + 1;
+            }
+            *new_stateCnt = old_stateCnt;
+            return KERN_SUCCESS;
+        }
+
+        kern_return_t catch_mach_exception_raise(mach_port_t exception_port,
+                                                 mach_port_t thread,
+                                                 mach_port_t task,
+                                                 exception_type_t exception,
+                                                 mach_exception_data_t code,
+                                                 mach_msg_type_number_t codeCnt)
+        {
+            return exception == EXC_CRASH ? KERN_FAILURE : KERN_SUCCESS;
+        }
+
+        kern_return_t catch_mach_exception_raise_state(mach_port_t exception_port,
+                                                       exception_type_t exception,
+                                                       const mach_exception_data_t code,
+                                                       mach_msg_type_number_t codeCnt,
+                                                       int *flavor,
+                                                       const thread_state_t old_state,
+                                                       mach_msg_type_number_t old_stateCnt,
+                                                       thread_state_t new_state,
+                                                       mach_msg_type_number_t *new_stateCnt)
+        {
+            return state(exception, flavor, old_state, old_stateCnt, new_state, new_stateCnt);
+        }
+
+        kern_return_t catch_mach_exception_raise_state_identity(mach_port_t exception_port,
+                                                                mach_port_t thread,
+                                                                mach_port_t task,
+                                                                exception_type_t exception,
+                                                                mach_exception_data_t code,
+                                                                mach_msg_type_number_t codeCnt,
+                                                                int *flavor,
+                                                                thread_state_t old_state,
+                                                                mach_msg_type_number_t old_stateCnt,
+                                                                thread_state_t new_state,
+                                                                mach_msg_type_number_t *new_stateCnt)
+        {
+            return state(exception, flavor, old_state, old_stateCnt, new_state, new_stateCnt);
+        }
+
+        static uint8_t request[MACH_EXC_SERVER_REQUEST_MAX + 64];
+        static uint8_t reply[MACH_EXC_SERVER_REPLY_MAX + 64];
+        static char line[4 * MACH_EXC_SERVER_REQUEST_MAX];
+
+        static size_t decode(const char *hex, uint8_t *bytes)
+        {
+            size_t size = 0;
+            unsigned int byte;
+            while (sscanf(hex, "%2x", &byte) == 1) {
+                bytes[size++] = (uint8_t) byte;
+                hex += 2;
+            }
+            return size;
+        }
+
+        static double elapsed(const struct timespec *start, long iterations)
+        {
+            struct timespec end;
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            return ((end.tv_sec - start->tv_sec) * 1e9 + (end.tv_nsec - start->tv_nsec)) / iterations;
+        }
+
+        // With no arguments, dispatch each request read, one per line in hex, and write its reply. With `bench N`,
+        // dispatch the first request read N times, and write the nanoseconds per dispatch.
+        int main(int argc, char **argv)
+        {
+            if (argc > 2 && strcmp(argv[1], "bench") == 0) {
+                long iterations = atol(argv[2]);
+                if (fgets(line, sizeof(line), stdin) == NULL) {
+                    return 1;
+                }
+                size_t size = decode(line, request);
+                struct timespec start;
+                clock_gettime(CLOCK_MONOTONIC, &start);
+                for (long iteration = 0; iteration < iterations; iteration++) {
+                    mach_exc_server_dispatch(request, size, reply);
+                }
+                printf("builtin %.1f\n", elapsed(&start, iterations));
+        #ifdef MACH_EXC_MIG
+                clock_gettime(CLOCK_MONOTONIC, &start);
+                for (long iteration = 0; iteration < iterations; iteration++) {
+                    mach_exc_server((mach_msg_header_t *) request, (mach_msg_header_t *) reply);
+                }
+                printf("mig %.1f\n", elapsed(&start, iterations));
+        #endif
+                return 0;
+            }
+
+            while (fgets(line, sizeof(line), stdin) != NULL) {
+                size_t size = decode(line, request);
+                bool handled = mach_exc_server_dispatch(request, size, reply);
+                uint32_t length;
+                memcpy(&length, reply + 4, sizeof(length));
+                printf("%d ", handled);
+                for (uint32_t index = 0; index < length; index++) {
+                    printf("%02x", reply[index]);
+                }
+                printf("\n");
+            }
+            return 0;
+        }
+        """#
+}
@@ -9,6 +9,8 @@
 
 import XCTest
 
+import mach_exception_helper
+
 @testable import mach_exception
 
 final class BitFieldsTests: XCTestCase {
@@ -18,30 +20,73 @@ final class BitFieldsTests: XCTestCase {
         XCTAssertEqual(example.value, 0)
 
         example.value = 0
-        example.nybble1 = 0xf
+        example[Nybbles.nybble1] = 0xf
         XCTAssertEqual(example.value, 0xf)
-        XCTAssertEqual(example.nybble1, 0xf)
+        XCTAssertEqual(example[Nybbles.nybble1], 0xf)
         
         example.value = 0
-        example.nybble2 = 0xf
+        example[Nybbles.nybble2] = 0xf
         XCTAssertEqual(example.value, 0xf0)
-        XCTAssertEqual(example.nybble2, 0xf)
+        XCTAssertEqual(example[Nybbles.nybble2], 0xf)
 
         example.value = 0
-        example.nybble3 = 0xf
+        example[Nybbles.nybble3] = 0xf
         XCTAssertEqual(example.value, 0xf00)
-        XCTAssertEqual(example.nybble3, 0xf)
+        XCTAssertEqual(example[Nybbles.nybble3], 0xf)
 
         example.value = 0
-        example.nybble4 = 0xf
+        example[Nybbles.nybble4] = 0xf
         XCTAssertEqual(example.value, 0xf000)
-        XCTAssertEqual(example.nybble4, 0xf)
+        XCTAssertEqual(example[Nybbles.nybble4], 0xf)
         
-        XCTAssertEqual(example.nybble5, 0)
+        // A field the type doesn't declare, such as Nybbles.nybble5, doesn't compile.
         
-        example.value = 0
-        example.nybble5 = 0xf
-        XCTAssertEqual(example.value, 0)
+        example.value = 0xffff
+        example[Nybbles.nybble2] = 0
+        XCTAssertEqual(example.value, 0xff0f)
+    }
+    
+    func testFullWidthField() throws {
+        var example = Halves(value: 0)
+        example[Halves.all] = -1
+        XCTAssertEqual(example.value, -1)
+        XCTAssertEqual(example[Halves.high], -1)
+        XCTAssertEqual(example[Halves.low], 0xffff_ffff)
+        
+        example[Halves.high] = 0x1234
+        XCTAssertEqual(example.value, 0x0000_1234_ffff_ffff)
+    }
+    
+    // MARK: - Performance
+    
+    // Decodes a resource exception's code and subcode, and a guard exception's code, through their bit fields.
+    func testPerformanceDecode() throws {
+        var resourceCode = MachExceptionResourceInfo.Code(value: 0)
+        resourceCode[MachExceptionResourceInfo.Code.type] = RESOURCE_TYPE_IO
+        resourceCode[MachExceptionResourceInfo.Code.flavor] = MachExceptionResourceInfo.IOFlavor.logicalWrites.rawValue
+        resourceCode[MachExceptionResourceInfo.Code.ioInterval] = 1
+        resourceCode[MachExceptionResourceInfo.Code.ioLimit] = 2
+        var resourceSubcode = MachExceptionResourceInfo.Subcode(value: 0)
+        resourceSubcode[MachExceptionResourceInfo.Subcode.ioCount] = 3
+        var guardCode = MachExceptionGuardInfo.Code(value: 0)
+        guardCode[MachExceptionGuardInfo.Code.type] = GUARD_TYPE_MACH_PORT
+        guardCode[MachExceptionGuardInfo.Code.portName] = 1
+        guardCode[MachExceptionGuardInfo.Code.reason] = 2
+        
+        var decoded = 0
+        measure {
+            for index in 0 ..< 1_000_000 {
+                // Vary the inputs, so the optimizer can't hoist the decoding out of the loop.
+                let subcode = resourceSubcode.value &+ Int64(index & 1)
+                if MachExceptionResourceInfo(resourceCode.value, subcode) != nil {
+                    decoded += 1
+                }
+                if MachExceptionGuardInfo(guardCode.value, subcode) != nil {
+                    decoded += 1
+                }
+            }
+        }
+        XCTAssertGreaterThan(decoded, 0)
     }
 }
 
@@ -49,10 +94,17 @@ struct Nybbles: BitFields {
 
     var value: UInt16
     
-    static var fields = Fields {
-        Field("nybble1", 0, 3)
-        Field("nybble2", 4, 7)
-        Field("nybble3", 8, 11)
-        Field("nybble4", 12, 15)
-    }
+    static let nybble1 = Field<UInt16>(0, 3)
+    static let nybble2 = Field<UInt16>(4, 7)
+    static let nybble3 = Field<UInt16>(8, 11)
+    static let nybble4 = Field<UInt16>(12, 15)
+}
+
+struct Halves: BitFields {
+    
+    var value: Int64
+    
+    static let all = Field<Int64>(0, 63)
+    static let high = Field<Int32>(32, 63)
+    static let low = Field<UInt32>(0, 31)
 }
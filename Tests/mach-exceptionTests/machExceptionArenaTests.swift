@@ -0,0 +1,136 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+//
+// machExceptionArenaTests.swift
+// Created by Patrick Gili on 2/18/23.
+//
+
+import Foundation
+import XCTest
+
+import mach_exception
+import mach_exception_helper
+
+@testable import mach_exception
+
+final class machExceptionArenaTests: XCTestCase {
+
+    func testArenaCommitsLazily() throws {
+        let arena = try MachExceptionArena(capacity: 16 << 20, chunkSize: 1 << 20)
+        XCTAssertEqual(arena.committedByteCount, 0)
+        var pointers: [UnsafeMutableRawPointer] = []
+        try arena.grow {
+            for _ in 0 ..< 1_000 {
+                let pointer = arena.allocate(byteCount: 3_000)!
+                pointer.storeBytes(of: 0xa5, as: UInt8.self)
+                pointers.append(pointer)
+            }
+        }
+        XCTAssertEqual(arena.committedByteCount, 3 << 20)
+        // The memory is committed, so it is accessible outside the scope.
+        for pointer in pointers {
+            XCTAssertEqual(pointer.load(as: UInt8.self), 0xa5)
+        }
+    }
+
+    func testAllocationsAreAligned() throws {
+        let arena = try MachExceptionArena(capacity: 1 << 20)
+        try arena.grow {
+            _ = arena.allocate(byteCount: 3, alignment: 1)
+            let pointer = arena.allocate(byteCount: 64, alignment: 64)!
+            XCTAssertEqual(Int(bitPattern: pointer) % 64, 0)
+        }
+    }
+
+    func testExhaustedArenaThrowsBadAccess() throws {
+        let arena = try MachExceptionArena(capacity: 1 << 20, chunkSize: 64 << 10)
+        var allocations = 0
+        XCTAssertThrowsError(try arena.grow {
+            while arena.allocate(byteCount: 4_096) != nil {
+                allocations += 1
+            }
+        }) { error in
+            XCTAssertEqual((error as? MachExceptionError)?.type, .badAccess)
+        }
+        XCTAssertEqual(allocations, 256)
+        XCTAssertEqual(arena.committedByteCount, 1 << 20)
+    }
+
+    func testResetReusesCommittedMemory() throws {
+        let arena = try MachExceptionArena(capacity: 4 << 20, chunkSize: 1 << 20)
+        try arena.grow {
+            _ = arena.allocate(byteCount: 1_500_000)
+        }
+        XCTAssertEqual(arena.committedByteCount, 2 << 20)
+        arena.reset()
+        try arena.grow {
+            _ = arena.allocate(byteCount: 1_500_000)
+        }
+        XCTAssertEqual(arena.committedByteCount, 2 << 20)
+    }
+
+    func testOversizedAllocationFails() throws {
+        let arena = try MachExceptionArena(capacity: 1 << 20)
+        try arena.grow {
+            XCTAssertNil(arena.allocate(byteCount: MachExceptionArena.maximumAllocation + 1))
+        }
+    }
+
+    func testFaultOutsideArenaIsNotResolved() throws {
+        let arena = try MachExceptionArena(capacity: 1 << 20)
+        XCTAssertThrowsError(try arena.grow {
+            UnsafeMutablePointer<UInt8>(bitPattern: 8)!.pointee = 0
+        }) { error in
+            XCTAssertEqual((error as? MachExceptionError)?.type, .badAccess)
+        }
+        XCTAssertEqual(arena.committedByteCount, 0)
+    }
+
+    // MARK: - Performance
+
+    // A bump allocator checking its capacity on every allocation, over memory committed up front.
+    private struct CheckedBumpAllocator {
+        var top: UnsafeMutableRawPointer
+        let limit: UnsafeMutableRawPointer
+
+        mutating func allocate(byteCount: Int, alignment: Int) -> UnsafeMutableRawPointer? {
+            let pointer = top.alignedUp(toMultipleOf: alignment)
+            guard limit - pointer >= byteCount else {
+                return nil
+            }
+            top = pointer + byteCount
+            return pointer
+        }
+    }
+
+    // The two tests below make 1,000,000 allocations of 48 bytes from committed memory, so the times they report
+    // compare the arena's probe against a capacity check.
+    func testPerformanceArenaAllocation() throws {
+        let arena = try MachExceptionArena(capacity: 64 << 20)
+        try arena.grow {
+            _ = arena.allocate(byteCount: 48_000_000)
+        }
+        measure {
+            arena.reset()
+            try? arena.grow {
+                for _ in 0 ..< 1_000_000 {
+                    arena.allocate(byteCount: 48, alignment: 16)!.storeBytes(of: 1, as: UInt8.self)
+                }
+            }
+        }
+    }
+
+    func testPerformanceCheckedBumpAllocation() throws {
+        let memory = UnsafeMutableRawPointer.allocate(byteCount: 64 << 20, alignment: 4_096)
+        defer { memory.deallocate() }
+        memory.initializeMemory(as: UInt8.self, repeating: 0, count: 64 << 20)
+        measure {
+            var allocator = CheckedBumpAllocator(top: memory, limit: memory + (64 << 20))
+            for _ in 0 ..< 1_000_000 {
+                allocator.allocate(byteCount: 48, alignment: 16)!.storeBytes(of: 1, as: UInt8.self)
+            }
+        }
+    }
+}
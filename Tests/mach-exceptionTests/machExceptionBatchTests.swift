@@ -0,0 +1,179 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+//
+// machExceptionBatchTests.swift
+// Created by Patrick Gili on 2/6/23.
+//
+
+import Foundation
+import XCTest
+
+import mach_exception
+import mach_exception_helper
+
+@testable import mach_exception
+
+final class machExceptionBatchTests: XCTestCase {
+
+    // The decoder defines its own constants, so these tests spell out the values each architecture reports, rather
+    // than using the host's.
+    let badAccess: exception_type_t = 1
+    let badInstruction: exception_type_t = 2
+    let arithmetic: exception_type_t = 3
+    let breakpoint: exception_type_t = 6
+    let resource: exception_type_t = 11
+    let `guard`: exception_type_t = 12
+
+    func cause(_ value: Int) -> mach_exception_cause_t {
+        return mach_exception_cause_t(value)
+    }
+
+    func testArm64() throws {
+        let batch = MachExceptionBatch(architecture: .arm64,
+                                       types: [badAccess, badAccess, badAccess, badInstruction, arithmetic,
+                                               breakpoint, breakpoint, breakpoint],
+                                       codes: [1, 0x101, 0x105, 1, 2, 1, 1, 0x102],
+                                       subcodes: [0x10, 0x20, 0x30, 0xe7ffdefe, 0, 0, 0x1000, 0x2000])
+        XCTAssertEqual(batch.count, 8)
+        XCTAssertEqual(batch.knownCount, 8)
+        XCTAssertEqual(batch.causes, [cause(MACH_EXCEPTION_CAUSE_VM_FAULT),
+                                      cause(MACH_EXCEPTION_CAUSE_DATA_ACCESS_ALIGNMENT),
+                                      cause(MACH_EXCEPTION_CAUSE_POINTER_AUTHENTICATION_FAILURE),
+                                      cause(MACH_EXCEPTION_CAUSE_UNDEFINED_INSTRUCTION),
+                                      cause(MACH_EXCEPTION_CAUSE_FP_DIVIDE_BY_ZERO),
+                                      cause(MACH_EXCEPTION_CAUSE_SINGLE_STEP),
+                                      cause(MACH_EXCEPTION_CAUSE_BREAKPOINT),
+                                      cause(MACH_EXCEPTION_CAUSE_WATCHPOINT)])
+        XCTAssertEqual(batch.primaries[0], 1)
+        XCTAssertEqual(batch.details, [0x10, 0x20, 0x30, 0xe7ffdefe, 0, 0, 0x1000, 0x2000])
+    }
+
+    func testX86_64() throws {
+        let batch = MachExceptionBatch(architecture: .x86_64,
+                                       types: [badAccess, badAccess, badAccess, badInstruction, badInstruction,
+                                               arithmetic, breakpoint],
+                                       codes: [2, 13, 0x101, 1, 14, 8, 2],
+                                       subcodes: [0x10, 0, 0, 0, 0x40, 0x1f80, 0])
+        XCTAssertEqual(batch.knownCount, 6)
+        XCTAssertEqual(batch.causes, [cause(MACH_EXCEPTION_CAUSE_VM_FAULT),
+                                      cause(MACH_EXCEPTION_CAUSE_GENERAL_PROTECTION_FAULT),
+                                      cause(MACH_EXCEPTION_CAUSE_UNKNOWN),
+                                      cause(MACH_EXCEPTION_CAUSE_INVALID_OPCODE),
+                                      cause(MACH_EXCEPTION_CAUSE_PAGE_FAULT),
+                                      cause(MACH_EXCEPTION_CAUSE_SIMD_OPERATION_ERROR),
+                                      cause(MACH_EXCEPTION_CAUSE_BREAKPOINT)])
+        XCTAssertEqual(batch.primaries[0], 2)
+        XCTAssertEqual(batch.primaries[4], 14)
+        XCTAssertEqual(batch.details[5], 0x1f80)
+    }
+
+    func testSameCodeDiffersByArchitecture() throws {
+        let arm64 = MachExceptionBatch(architecture: .arm64, types: [arithmetic], codes: [1], subcodes: [0])
+        let x86_64 = MachExceptionBatch(architecture: .x86_64, types: [arithmetic], codes: [1], subcodes: [0])
+        XCTAssertEqual(arm64.causes, [cause(MACH_EXCEPTION_CAUSE_FP_INVALID_OPERATION)])
+        XCTAssertEqual(x86_64.causes, [cause(MACH_EXCEPTION_CAUSE_DIVIDE_ERROR)])
+    }
+
+    func testResource() throws {
+        var cpu = MachExceptionResourceInfo.Code(value: 0)
+        cpu[MachExceptionResourceInfo.Code.type] = 1
+        cpu[MachExceptionResourceInfo.Code.flavor] = 2
+        cpu[MachExceptionResourceInfo.Code.cpuInterval] = 180
+        cpu[MachExceptionResourceInfo.Code.cpuLimit] = 50
+        var io = MachExceptionResourceInfo.Code(value: 0)
+        io[MachExceptionResourceInfo.Code.type] = 4
+        io[MachExceptionResourceInfo.Code.flavor] = 1
+        io[MachExceptionResourceInfo.Code.ioInterval] = 86400
+        io[MachExceptionResourceInfo.Code.ioLimit] = 2048
+        var memory = MachExceptionResourceInfo.Code(value: 0)
+        memory[MachExceptionResourceInfo.Code.type] = 3
+        memory[MachExceptionResourceInfo.Code.flavor] = 1
+        memory[MachExceptionResourceInfo.Code.memoryHWMLimit] = 4096
+        var unknown = MachExceptionResourceInfo.Code(value: 0)
+        unknown[MachExceptionResourceInfo.Code.type] = 7
+
+        let batch = MachExceptionBatch(architecture: .arm64,
+                                       types: [resource, resource, resource, resource],
+                                       codes: [cpu.value, io.value, memory.value, unknown.value],
+                                       subcodes: [99, 3000, 5, 6])
+        XCTAssertEqual(batch.knownCount, 3)
+        XCTAssertEqual(batch.causes, [cause(MACH_EXCEPTION_CAUSE_RESOURCE_CPU),
+                                      cause(MACH_EXCEPTION_CAUSE_RESOURCE_IO),
+                                      cause(MACH_EXCEPTION_CAUSE_RESOURCE_MEMORY),
+                                      cause(MACH_EXCEPTION_CAUSE_UNKNOWN)])
+        XCTAssertEqual(batch.flavors, [2, 1, 1, 0])
+        XCTAssertEqual(batch.primaries, [180, 86400, 4096, 0])
+        XCTAssertEqual(batch.secondaries, [50, 2048, 0, 0])
+        XCTAssertEqual(batch.details, [99, 3000, 0, 6])
+    }
+
+    func testGuard() throws {
+        var port = MachExceptionGuardInfo.Code(value: 0)
+        port[MachExceptionGuardInfo.Code.type] = 1
+        port[MachExceptionGuardInfo.Code.reason] = 4
+        port[MachExceptionGuardInfo.Code.portName] = 0x1307
+        var fileDescriptor = MachExceptionGuardInfo.Code(value: 0)
+        fileDescriptor[MachExceptionGuardInfo.Code.type] = 2
+        fileDescriptor[MachExceptionGuardInfo.Code.flavor] = 1 << 5
+        fileDescriptor[MachExceptionGuardInfo.Code.fileDescriptor] = 9
+
+        let batch = MachExceptionBatch(architecture: .x86_64,
+                                       records: [
+                                        mach_exception_record_t(type: `guard`, code: port.value, subcode: 0x1234),
+                                        mach_exception_record_t(type: `guard`, code: fileDescriptor.value, subcode: -1),
+                                       ])
+        XCTAssertEqual(batch.causes, [cause(MACH_EXCEPTION_CAUSE_GUARD_MACH_PORT),
+                                      cause(MACH_EXCEPTION_CAUSE_GUARD_FD)])
+        XCTAssertEqual(batch.flavors, [4, 1 << 5])
+        XCTAssertEqual(batch.primaries, [0x1307, 9])
+        XCTAssertEqual(batch.details, [0x1234, UInt64.max])
+    }
+
+    func testBlocks() throws {
+        // More records than the decoder processes per block, with a resource exception straddling a block boundary.
+        let count = 2500
+        var types = [exception_type_t](repeating: badAccess, count: count)
+        var codes = [mach_exception_data_type_t](repeating: 1, count: count)
+        let subcodes = (0 ..< count).map { mach_exception_data_type_t($0) }
+        var threads = MachExceptionResourceInfo.Code(value: 0)
+        threads[MachExceptionResourceInfo.Code.type] = 5
+        threads[MachExceptionResourceInfo.Code.flavor] = 1
+        threads[MachExceptionResourceInfo.Code.threadsCount] = 5000
+        types[1024] = resource
+        codes[1024] = threads.value
+        let batch = MachExceptionBatch(architecture: .arm64, types: types, codes: codes, subcodes: subcodes)
+        XCTAssertEqual(batch.knownCount, count)
+        XCTAssertEqual(batch.causes[1023], cause(MACH_EXCEPTION_CAUSE_VM_FAULT))
+        XCTAssertEqual(batch.causes[1024], cause(MACH_EXCEPTION_CAUSE_RESOURCE_THREADS))
+        XCTAssertEqual(batch.primaries[1024], 5000)
+        XCTAssertEqual(batch.details[count - 1], UInt64(count - 1))
+    }
+
+    func testEmpty() throws {
+        let batch = MachExceptionBatch(architecture: .arm64, types: [], codes: [], subcodes: [])
+        XCTAssertEqual(batch.count, 0)
+        XCTAssertEqual(batch.knownCount, 0)
+    }
+
+    func testPerformanceDecode() throws {
+        // A million records mixing every exception type the decoder classifies.
+        let count = 1_000_000
+        let types: [exception_type_t] = [badAccess, badInstruction, arithmetic, breakpoint, resource, `guard`]
+        var cpu = MachExceptionResourceInfo.Code(value: 0)
+        cpu[MachExceptionResourceInfo.Code.type] = 1
+        cpu[MachExceptionResourceInfo.Code.flavor] = 1
+        let codes: [mach_exception_data_type_t] = [1, 1, 2, 1, cpu.value, 1 << 61]
+        let recordTypes = (0 ..< count).map { types[$0 % types.count] }
+        let recordCodes = (0 ..< count).map { codes[$0 % codes.count] }
+        let recordSubcodes = (0 ..< count).map { mach_exception_data_type_t($0) }
+        measure {
+            let batch = MachExceptionBatch(architecture: .arm64,
+                                           types: recordTypes,
+                                           codes: recordCodes,
+                                           subcodes: recordSubcodes)
+            XCTAssertEqual(batch.knownCount, count)
+        }
+    }
+}
@@ -0,0 +1,190 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+//
+// machExceptionCaptureTests.swift
+// Created by Patrick Gili on 2/28/23.
+//
+
+import Foundation
+import XCTest
+
+import mach_exception
+import mach_exception_helper
+
+@testable import mach_exception
+
+final class machExceptionCaptureTests: XCTestCase {
+
+    var directory: URL!
+
+    var path: String {
+        return directory.appendingPathComponent("exceptions.capture").path
+    }
+
+    override func setUpWithError() throws {
+        directory = FileManager.default.temporaryDirectory.appendingPathComponent(UUID().uuidString)
+        try FileManager.default.createDirectory(at: directory, withIntermediateDirectories: true)
+    }
+
+    override func tearDownWithError() throws {
+        try FileManager.default.removeItem(at: directory)
+    }
+
+    // A mach_exception_raise request for a bad access at `address`, with the thread's and task's ports.
+    func raiseRequest(address: Int64) -> [UInt8] {
+        var words: [UInt32] = [
+            0x8000_0000 | 18, 84, 0x0103, 0x0207, 0, UInt32(MACH_EXC_DISPATCH_RAISE),
+            2,
+            0x0303, 0, 0x0011_0000,
+            0x0403, 0, 0x0011_0000,
+            0, 1,
+            UInt32(EXC_BAD_ACCESS), 2,
+        ]
+        for code in [Int64(KERN_INVALID_ADDRESS), address] {
+            words += [UInt32(truncatingIfNeeded: code), UInt32(truncatingIfNeeded: code >> 32)]
+        }
+        return words.withUnsafeBytes { Array($0) }
+    }
+
+    func testCaptureAndReplayMessages() throws {
+        let capture = try MachExceptionCapture(path: path)
+        for address in 0 ..< 10 {
+            try raiseRequest(address: Int64(address)).withUnsafeBytes { try capture.append(message: $0) }
+        }
+        // A message that isn't an exception request, like the one waking the listener.
+        try [UInt8](repeating: 0, count: 24).withUnsafeBytes { try capture.append(message: $0) }
+
+        let replay = try MachExceptionReplay(file: path)
+        XCTAssertEqual(replay.header.magic, MACH_EXCEPTION_CAPTURE_MAGIC)
+        XCTAssertEqual(replay.header.version, UInt16(MACH_EXCEPTION_CAPTURE_VERSION))
+        let events = replay.map { $0.pointee }
+        XCTAssertEqual(events.count, 11)
+        XCTAssert(events.allSatisfy { $0.isMessage })
+        XCTAssertEqual(events[0].size, 84)
+        XCTAssertEqual(events[10].size, 24)
+        XCTAssertEqual(events.map { $0.timestamp }, events.map { $0.timestamp }.sorted())
+
+        let statistics = replay.run()
+        XCTAssertEqual(statistics.messages, 11)
+        XCTAssertEqual(statistics.handled, 10)
+        XCTAssertEqual(statistics.faults, 0)
+        XCTAssertEqual(statistics.skipped, 0)
+    }
+
+    func testReplayDeliversRequestsToHandlers() throws {
+        final class Addresses {
+            var values: [Int64] = []
+        }
+
+        let capture = try MachExceptionCapture(path: path)
+        for address in [0x10, 0x20, 0x30] {
+            try raiseRequest(address: Int64(address)).withUnsafeBytes { try capture.append(message: $0) }
+        }
+
+        let addresses = Addresses()
+        var handlers = mach_exc_dispatch_handlers_t()
+        handlers.context = Unmanaged.passUnretained(addresses).toOpaque()
+        handlers.raise = { context, _, _, _, _, code, codeCnt in
+            let addresses = Unmanaged<Addresses>.fromOpaque(context!).takeUnretainedValue()
+            addresses.values.append(code![Int(codeCnt) - 1])
+            return KERN_SUCCESS
+        }
+        let statistics = try MachExceptionReplay(file: path).run(handlers: handlers)
+        XCTAssertEqual(statistics.handled, 3)
+        XCTAssertEqual(addresses.values, [0x10, 0x20, 0x30])
+    }
+
+    func testReplayAtRecordedPace() throws {
+        let capture = try MachExceptionCapture(path: path)
+        let request = raiseRequest(address: 0)
+        try request.withUnsafeBytes { try capture.append(message: $0) }
+        Thread.sleep(forTimeInterval: 0.1)
+        try request.withUnsafeBytes { try capture.append(message: $0) }
+
+        let replay = try MachExceptionReplay(file: path)
+        let timestamps = replay.map { $0.pointee.timestamp }
+        let span = timestamps[1] - timestamps[0]
+        XCTAssertGreaterThanOrEqual(span, 100_000_000)
+        XCTAssertGreaterThanOrEqual(replay.run(speed: 1).elapsed, span)
+        XCTAssertGreaterThanOrEqual(replay.run(speed: 4).elapsed, span / 4)
+        XCTAssertLessThan(replay.run().elapsed, span)
+    }
+
+    func testTruncatedCapture() throws {
+        let capture = try MachExceptionCapture(path: path)
+        for address in 0 ..< 3 {
+            try raiseRequest(address: Int64(address)).withUnsafeBytes { try capture.append(message: $0) }
+        }
+        let handle = try XCTUnwrap(FileHandle(forWritingAtPath: path))
+        handle.truncateFile(atOffset: handle.seekToEndOfFile() - 8)
+        handle.closeFile()
+
+        // The event a crashed handler left incomplete is dropped.
+        XCTAssertEqual(try MachExceptionReplay(file: path).run().messages, 2)
+    }
+
+    func testNotACaptureFile() throws {
+        let file = directory.appendingPathComponent("garbage").path
+        XCTAssert(FileManager.default.createFile(atPath: file, contents: Data(repeating: 0xff, count: 4096)))
+        XCTAssertThrowsError(try MachExceptionReplay(file: file)) { error in
+            XCTAssertEqual((error as NSError).code, Int(EINVAL))
+        }
+        XCTAssertThrowsError(try MachExceptionCapture(path: directory.appendingPathComponent("missing/file").path))
+    }
+
+#if os(Linux)
+    func testCaptureAndReplayFaults() throws {
+        let capture = try MachExceptionCapture(path: path)
+        capture.install()
+        var caught: [MachExceptionError] = []
+        for _ in 0 ..< 3 {
+            XCTAssertThrowsError(try withUnsafeMachException(types: [.badAccess]) {
+                UnsafeMutablePointer<UInt8>(bitPattern: 8)!.pointee = 0
+            }) { error in
+                caught.append(error as! MachExceptionError)
+            }
+        }
+        capture.uninstall()
+
+        // Faults decode as the handler decoded them, without the kernel delivering them.
+        var faults: [mach_exception_replay_fault_t] = []
+        let replay = try MachExceptionReplay(file: path)
+        let statistics = replay.run { faults.append($0) }
+        XCTAssertEqual(statistics.faults, 3)
+        XCTAssertEqual(statistics.messages, 0)
+        XCTAssertEqual(faults.count, 3)
+        for (fault, error) in zip(faults, caught) {
+            XCTAssertEqual(fault.signal, SIGSEGV)
+            XCTAssertEqual(MachExceptionError(fault.record)?.type, error.type)
+            XCTAssertEqual(fault.record.code, error.code)
+            XCTAssertEqual(fault.record.subcode, error.subcode)
+            XCTAssertEqual(fault.state.pc, error.state?.pc)
+            XCTAssertEqual(fault.state.sp, error.state?.sp)
+            XCTAssertEqual(fault.state.fault_address, 8)
+        }
+    }
+
+    func testUninstalledCaptureRecordsNothing() throws {
+        let capture = try MachExceptionCapture(path: path)
+        capture.install()
+        capture.uninstall()
+        XCTAssertThrowsError(try withUnsafeMachException(types: [.badAccess]) {
+            UnsafeMutablePointer<UInt8>(bitPattern: 8)!.pointee = 0
+        })
+        XCTAssertEqual(Array(try MachExceptionReplay(file: path)).count, 0)
+    }
+#endif
+
+    func testPerformanceReplay() throws {
+        let capture = try MachExceptionCapture(path: path)
+        for address in 0 ..< 10_000 {
+            try raiseRequest(address: Int64(address)).withUnsafeBytes { try capture.append(message: $0) }
+        }
+        let replay = try MachExceptionReplay(file: path)
+        measure {
+            replay.run()
+        }
+    }
+}
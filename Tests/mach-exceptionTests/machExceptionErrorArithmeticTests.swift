@@ -8,7 +8,9 @@
 //
 
 import Foundation
+#if canImport(Darwin)
 import Darwin
+#endif
 import XCTest
 
 import mach_exception
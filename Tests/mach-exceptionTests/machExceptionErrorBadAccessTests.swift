@@ -8,7 +8,9 @@
 //
 
 import Foundation
+#if canImport(Darwin)
 import Darwin
+#endif
 import XCTest
 
 import mach_exception
@@ -80,6 +82,16 @@ final class machExceptionErrorBadAccessTests: XCTestCase {
     }
     
 #elseif arch(i386) || arch(x86_64)
+    func testMachExceptionBadAccessInfoVMFault() throws {
+        let nsError = makeNSError(type: EXC_BAD_ACCESS,
+                                  code: mach_exception_data_type_t(KERN_INVALID_ADDRESS),
+                                  subcode: 0x0)
+        let error = try XCTUnwrap(MachExceptionError(nsError))
+        let info = try XCTUnwrap(error.badAccess)
+        XCTAssertEqual(info.address, 0x0)
+        XCTAssertEqual(info.code, .vmFault(kernResult: KERN_INVALID_ADDRESS))
+    }
+    
     func testMachExceptionBadAccessInfoFPUOverranSegmentFaultOnRead() throws {
         let nsError = makeNSError(type: EXC_BAD_ACCESS,
                                   code: mach_exception_data_type_t(VM_PROT_READ | VM_PROT_EXECUTE),
@@ -8,7 +8,9 @@
 //
 
 import Foundation
+#if canImport(Darwin)
 import Darwin
+#endif
 import XCTest
 
 import mach_exception
@@ -71,8 +73,7 @@ final class machExceptionErrorBreakpointTests: XCTestCase {
                                   subcode: 0x1)
         let error = try XCTUnwrap(MachExceptionError(nsError))
         let info = try XCTUnwrap(error.breakpoint)
-        XCTAssertEqual(info.code, .outOfBounds)
-        XCTAssertEqual(info.subcode, 0x1)
+        XCTAssertEqual(info.codes, .outOfBounds)
     }
 
     func testMachExceptionBreakpointInfoDebug() throws {
@@ -81,8 +82,7 @@ final class machExceptionErrorBreakpointTests: XCTestCase {
                                   subcode: 0x1)
         let error = try XCTUnwrap(MachExceptionError(nsError))
         let info = try XCTUnwrap(error.breakpoint)
-        XCTAssertEqual(info.code, .debug)
-        XCTAssertEqual(info.subcode, 0x1)
+        XCTAssertEqual(info.codes, .debug)
     }
 
     func testMachExceptionBreakpointInfoBreakpoint() throws {
@@ -91,8 +91,7 @@ final class machExceptionErrorBreakpointTests: XCTestCase {
                                   subcode: 0x1)
         let error = try XCTUnwrap(MachExceptionError(nsError))
         let info = try XCTUnwrap(error.breakpoint)
-        XCTAssertEqual(info.code, .breakpoint)
-        XCTAssertEqual(info.subcode, 0x1)
+        XCTAssertEqual(info.codes, .breakpoint)
     }
 
 #endif
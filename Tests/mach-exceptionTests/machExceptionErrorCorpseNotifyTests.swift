@@ -8,7 +8,9 @@
 //
 
 import Foundation
+#if canImport(Darwin)
 import Darwin
+#endif
 import XCTest
 
 import mach_exception
@@ -20,8 +22,8 @@ final class machExceptionErrorCorpseNotifyTests: XCTestCase {
 
     func testMachExceptionCorpseNotifyInfoCrash() throws {
         var subcode = MachExceptionCorpseNotifyInfo.Subcode(value: 0)
-        subcode.namespace = OSReasonNamespace.invalid.rawValue
-        subcode.reason = 2
+        subcode[MachExceptionCorpseNotifyInfo.Subcode.namespace] = OSReasonNamespace.invalid.rawValue
+        subcode[MachExceptionCorpseNotifyInfo.Subcode.reason] = 2
         let nsError = makeNSError(type: EXC_CORPSE_NOTIFY,
                                   code: mach_exception_data_type_t(EXC_CRASH),
                                   subcode: subcode.value)
@@ -32,8 +34,8 @@ final class machExceptionErrorCorpseNotifyTests: XCTestCase {
     
     func testMachExceptionCorpseNotifyInfoCrashInvalidNamespace() throws {
         var subcode = MachExceptionCorpseNotifyInfo.Subcode(value: 0)
-        subcode.namespace = 0xff
-        subcode.reason = 2
+        subcode[MachExceptionCorpseNotifyInfo.Subcode.namespace] = 0xff
+        subcode[MachExceptionCorpseNotifyInfo.Subcode.reason] = 2
         let nsError = makeNSError(type: EXC_CORPSE_NOTIFY,
                                   code: mach_exception_data_type_t(EXC_CRASH),
                                   subcode: subcode.value)
@@ -43,10 +45,10 @@ final class machExceptionErrorCorpseNotifyTests: XCTestCase {
     
     func testMachExceptionCorpseNotifyInfoResource() throws {
         var resourceCode = MachExceptionResourceInfo.Code(value: 0)
-        resourceCode.type = RESOURCE_TYPE_CPU
-        resourceCode.flavor = MachExceptionResourceInfo.CpuFlavor.monitor.rawValue
-        resourceCode.cpuInterval = 1
-        resourceCode.cpuLimit = 2
+        resourceCode[MachExceptionResourceInfo.Code.type] = RESOURCE_TYPE_CPU
+        resourceCode[MachExceptionResourceInfo.Code.flavor] = MachExceptionResourceInfo.CpuFlavor.monitor.rawValue
+        resourceCode[MachExceptionResourceInfo.Code.cpuInterval] = 1
+        resourceCode[MachExceptionResourceInfo.Code.cpuLimit] = 2
         let nsError = makeNSError(type: EXC_CORPSE_NOTIFY,
                                   code: mach_exception_data_type_t(EXC_RESOURCE),
                                   subcode: resourceCode.value)
@@ -57,7 +59,7 @@ final class machExceptionErrorCorpseNotifyTests: XCTestCase {
     
     func testMachExceptionCorpseNotifyInfoResourceInvalid() throws {
         var resourceCode = MachExceptionResourceInfo.Code(value: 0)
-        resourceCode.type = 7
+        resourceCode[MachExceptionResourceInfo.Code.type] = 7
         let nsError = makeNSError(type: EXC_CORPSE_NOTIFY,
                                   code: mach_exception_data_type_t(EXC_RESOURCE),
                                   subcode: resourceCode.value)
@@ -67,9 +69,9 @@ final class machExceptionErrorCorpseNotifyTests: XCTestCase {
     
     func testMachExceptionCorpseNotifyInfoGuard() throws {
         var guardCode = MachExceptionGuardInfo.Code(value: 0)
-        guardCode.type = GUARD_TYPE_MACH_PORT
-        guardCode.portName = 1
-        guardCode.reason = 2
+        guardCode[MachExceptionGuardInfo.Code.type] = GUARD_TYPE_MACH_PORT
+        guardCode[MachExceptionGuardInfo.Code.portName] = 1
+        guardCode[MachExceptionGuardInfo.Code.reason] = 2
         let nsError = makeNSError(type: EXC_CORPSE_NOTIFY,
                                   code: mach_exception_data_type_t(EXC_GUARD),
                                   subcode: guardCode.value)
@@ -80,7 +82,7 @@ final class machExceptionErrorCorpseNotifyTests: XCTestCase {
     
     func testMachExceptionCorpseNotifyInfoGuardInvalid() throws {
         var guardCode = MachExceptionGuardInfo.Code(value: 0)
-        guardCode.type = 7
+        guardCode[MachExceptionGuardInfo.Code.type] = 7
         let nsError = makeNSError(type: EXC_CORPSE_NOTIFY,
                                   code: mach_exception_data_type_t(EXC_GUARD),
                                   subcode: guardCode.value)
@@ -8,7 +8,9 @@
 //
 
 import Foundation
+#if canImport(Darwin)
 import Darwin
+#endif
 import XCTest
 
 import mach_exception
@@ -20,9 +22,9 @@ final class machExceptionErrorCrashTests: XCTestCase {
 
     func testMachExceptionCrashInfoCpu() throws {
         var code = MachExceptionCrashInfo.Code(value: 0)
-        code.originalException = EXC_GUARD
-        code.originalCode = 1
-        code.signalValue = 2
+        code[MachExceptionCrashInfo.Code.originalException] = EXC_GUARD
+        code[MachExceptionCrashInfo.Code.originalCode] = 1
+        code[MachExceptionCrashInfo.Code.signalValue] = 2
         let nsError = makeNSError(type: EXC_CRASH, code: code.value, subcode: 0)
         let error = try XCTUnwrap(MachExceptionError(nsError))
         let info = try XCTUnwrap(error.crash)
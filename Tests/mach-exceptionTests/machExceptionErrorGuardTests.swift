@@ -8,7 +8,9 @@
 //
 
 import Foundation
+#if canImport(Darwin)
 import Darwin
+#endif
 import XCTest
 
 import mach_exception
@@ -20,7 +22,7 @@ final class machExceptionErrorGuardTests: XCTestCase {
 
     func testMachExceptionGuardInfoNone() throws {
         var code = MachExceptionGuardInfo.Code(value: 0)
-        code.type = GUARD_TYPE_NONE
+        code[MachExceptionGuardInfo.Code.type] = GUARD_TYPE_NONE
         let nsError = makeNSError(type: EXC_GUARD, code: code.value, subcode: 0)
         let error = try XCTUnwrap(MachExceptionError(nsError))
         let info = try XCTUnwrap(error.guard)
@@ -29,9 +31,9 @@ final class machExceptionErrorGuardTests: XCTestCase {
     
     func testMachExceptionGuardInfoMachPort() throws {
         var code = MachExceptionGuardInfo.Code(value: 0)
-        code.type = GUARD_TYPE_MACH_PORT
-        code.portName = 1
-        code.reason = 2
+        code[MachExceptionGuardInfo.Code.type] = GUARD_TYPE_MACH_PORT
+        code[MachExceptionGuardInfo.Code.portName] = 1
+        code[MachExceptionGuardInfo.Code.reason] = 2
         let nsError = makeNSError(type: EXC_GUARD, code: code.value, subcode: 3)
         let error = try XCTUnwrap(MachExceptionError(nsError))
         let info = try XCTUnwrap(error.guard)
@@ -40,9 +42,9 @@ final class machExceptionErrorGuardTests: XCTestCase {
     
     func testMachExceptionGuardInfoFileDescriptor() throws {
         var code = MachExceptionGuardInfo.Code(value: 0)
-        code.type = GUARD_TYPE_FD
-        code.fileDescriptor = 1
-        code.flavor = 2
+        code[MachExceptionGuardInfo.Code.type] = GUARD_TYPE_FD
+        code[MachExceptionGuardInfo.Code.fileDescriptor] = 1
+        code[MachExceptionGuardInfo.Code.flavor] = 2
         let nsError = makeNSError(type: EXC_GUARD, code: code.value, subcode: 3)
         let error = try XCTUnwrap(MachExceptionError(nsError))
         let info = try XCTUnwrap(error.guard)
@@ -52,8 +54,8 @@ final class machExceptionErrorGuardTests: XCTestCase {
     
     func testMachExceptionGuardInfoUser() throws {
         var code = MachExceptionGuardInfo.Code(value: 0)
-        code.type = GUARD_TYPE_USER
-        code.namespace = 1
+        code[MachExceptionGuardInfo.Code.type] = GUARD_TYPE_USER
+        code[MachExceptionGuardInfo.Code.namespace] = 1
         let nsError = makeNSError(type: EXC_GUARD, code: code.value, subcode: 3)
         let error = try XCTUnwrap(MachExceptionError(nsError))
         let info = try XCTUnwrap(error.guard)
@@ -62,8 +64,8 @@ final class machExceptionErrorGuardTests: XCTestCase {
 
     func testMachExceptionGuardInfoUserInvalidNamespace() throws {
         var code = MachExceptionGuardInfo.Code(value: 0)
-        code.type = GUARD_TYPE_USER
-        code.namespace = 255
+        code[MachExceptionGuardInfo.Code.type] = GUARD_TYPE_USER
+        code[MachExceptionGuardInfo.Code.namespace] = 255
         let nsError = makeNSError(type: EXC_GUARD, code: code.value, subcode: 3)
         let error = try XCTUnwrap(MachExceptionError(nsError))
         XCTAssertNil(error.guard)
@@ -71,8 +73,8 @@ final class machExceptionErrorGuardTests: XCTestCase {
 
     func testMachExceptionGuardInfoVNode() throws {
         var code = MachExceptionGuardInfo.Code(value: 0)
-        code.type = GUARD_TYPE_VN
-        code.pid = 1
+        code[MachExceptionGuardInfo.Code.type] = GUARD_TYPE_VN
+        code[MachExceptionGuardInfo.Code.pid] = 1
         let nsError = makeNSError(type: EXC_GUARD, code: code.value, subcode: 3)
         let error = try XCTUnwrap(MachExceptionError(nsError))
         let info = try XCTUnwrap(error.guard)
@@ -81,7 +83,7 @@ final class machExceptionErrorGuardTests: XCTestCase {
     
     func testMachExceptionGuardInfoVirtualMemory() throws {
         var code = MachExceptionGuardInfo.Code(value: 0)
-        code.type = GUARD_TYPE_VIRT_MEMORY
+        code[MachExceptionGuardInfo.Code.type] = GUARD_TYPE_VIRT_MEMORY
         let nsError = makeNSError(type: EXC_GUARD, code: code.value, subcode: 3)
         let error = try XCTUnwrap(MachExceptionError(nsError))
         let info = try XCTUnwrap(error.guard)
@@ -90,7 +92,7 @@ final class machExceptionErrorGuardTests: XCTestCase {
     
     func testMachExceptionGuardInfoInvalidType() throws {
         var code = MachExceptionGuardInfo.Code(value: 0)
-        code.type = 7
+        code[MachExceptionGuardInfo.Code.type] = 7
         let nsError = makeNSError(type: EXC_GUARD, code: code.value, subcode: 3)
         let error = try XCTUnwrap(MachExceptionError(nsError))
         XCTAssertNil(error.guard)
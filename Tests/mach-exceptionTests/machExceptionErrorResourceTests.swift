@@ -8,7 +8,9 @@
 //
 
 import Foundation
+#if canImport(Darwin)
 import Darwin
+#endif
 import XCTest
 
 import mach_exception
@@ -21,11 +23,11 @@ final class machExceptionErrorResourceTests: XCTestCase {
     func testMachExceptionResourceInfoCpu() throws {
         var code = MachExceptionResourceInfo.Code(value: 0)
         var subcode = MachExceptionResourceInfo.Subcode(value: 0)
-        code.type = RESOURCE_TYPE_CPU
-        code.flavor = MachExceptionResourceInfo.CpuFlavor.monitor.rawValue
-        code.cpuInterval = 1
-        code.cpuLimit = 2
-        subcode.cpuUtilization = 3
+        code[MachExceptionResourceInfo.Code.type] = RESOURCE_TYPE_CPU
+        code[MachExceptionResourceInfo.Code.flavor] = MachExceptionResourceInfo.CpuFlavor.monitor.rawValue
+        code[MachExceptionResourceInfo.Code.cpuInterval] = 1
+        code[MachExceptionResourceInfo.Code.cpuLimit] = 2
+        subcode[MachExceptionResourceInfo.Subcode.cpuUtilization] = 3
         let nsError = makeNSError(type: EXC_RESOURCE, code: code.value, subcode: subcode.value)
         let error = try XCTUnwrap(MachExceptionError(nsError))
         let info = try XCTUnwrap(error.resource)
@@ -35,11 +37,11 @@ final class machExceptionErrorResourceTests: XCTestCase {
     func testMachExceptionResourceInfoCpuInvalidFlavor() throws {
         var code = MachExceptionResourceInfo.Code(value: 0)
         var subcode = MachExceptionResourceInfo.Subcode(value: 0)
-        code.type = RESOURCE_TYPE_CPU
-        code.flavor = 0
-        code.cpuInterval = 1
-        code.cpuLimit = 2
-        subcode.cpuUtilization = 3
+        code[MachExceptionResourceInfo.Code.type] = RESOURCE_TYPE_CPU
+        code[MachExceptionResourceInfo.Code.flavor] = 0
+        code[MachExceptionResourceInfo.Code.cpuInterval] = 1
+        code[MachExceptionResourceInfo.Code.cpuLimit] = 2
+        subcode[MachExceptionResourceInfo.Subcode.cpuUtilization] = 3
         let nsError = makeNSError(type: EXC_RESOURCE, code: code.value, subcode: subcode.value)
         let error = try XCTUnwrap(MachExceptionError(nsError))
         XCTAssertNil(error.resource)
@@ -48,11 +50,11 @@ final class machExceptionErrorResourceTests: XCTestCase {
     func testMachExceptionResourceInfoWakeups() throws {
         var code = MachExceptionResourceInfo.Code(value: 0)
         var subcode = MachExceptionResourceInfo.Subcode(value: 0)
-        code.type = RESOURCE_TYPE_WAKEUPS
-        code.flavor = MachExceptionResourceInfo.WakeupsFlavor.monitor.rawValue
-        code.wakeupsInterval = 1
-        code.wakeupsPermitted = 2
-        subcode.wakeupsObserved = 3
+        code[MachExceptionResourceInfo.Code.type] = RESOURCE_TYPE_WAKEUPS
+        code[MachExceptionResourceInfo.Code.flavor] = MachExceptionResourceInfo.WakeupsFlavor.monitor.rawValue
+        code[MachExceptionResourceInfo.Code.wakeupsInterval] = 1
+        code[MachExceptionResourceInfo.Code.wakeupsPermitted] = 2
+        subcode[MachExceptionResourceInfo.Subcode.wakeupsObserved] = 3
         let nsError = makeNSError(type: EXC_RESOURCE, code: code.value, subcode: subcode.value)
         let error = try XCTUnwrap(MachExceptionError(nsError))
         let info = try XCTUnwrap(error.resource)
@@ -62,11 +64,11 @@ final class machExceptionErrorResourceTests: XCTestCase {
     func testMachExceptionResourceInfoWakeupsInvalidFlavor() throws {
         var code = MachExceptionResourceInfo.Code(value: 0)
         var subcode = MachExceptionResourceInfo.Subcode(value: 0)
-        code.type = RESOURCE_TYPE_WAKEUPS
-        code.flavor = 0
-        code.cpuInterval = 1
-        code.cpuLimit = 2
-        subcode.cpuUtilization = 3
+        code[MachExceptionResourceInfo.Code.type] = RESOURCE_TYPE_WAKEUPS
+        code[MachExceptionResourceInfo.Code.flavor] = 0
+        code[MachExceptionResourceInfo.Code.cpuInterval] = 1
+        code[MachExceptionResourceInfo.Code.cpuLimit] = 2
+        subcode[MachExceptionResourceInfo.Subcode.cpuUtilization] = 3
         let nsError = makeNSError(type: EXC_RESOURCE, code: code.value, subcode: subcode.value)
         let error = try XCTUnwrap(MachExceptionError(nsError))
         XCTAssertNil(error.resource)
@@ -75,9 +77,9 @@ final class machExceptionErrorResourceTests: XCTestCase {
     func testMachExceptionResourceInfoMemory() throws {
         var code = MachExceptionResourceInfo.Code(value: 0)
         let subcode = MachExceptionResourceInfo.Subcode(value: 0)
-        code.type = RESOURCE_TYPE_MEMORY
-        code.flavor = MachExceptionResourceInfo.MemoryFlavor.highWatermark.rawValue
-        code.memoryHWMLimit = 1
+        code[MachExceptionResourceInfo.Code.type] = RESOURCE_TYPE_MEMORY
+        code[MachExceptionResourceInfo.Code.flavor] = MachExceptionResourceInfo.MemoryFlavor.highWatermark.rawValue
+        code[MachExceptionResourceInfo.Code.memoryHWMLimit] = 1
         let nsError = makeNSError(type: EXC_RESOURCE, code: code.value, subcode: subcode.value)
         let error = try XCTUnwrap(MachExceptionError(nsError))
         let info = try XCTUnwrap(error.resource)
@@ -87,9 +89,9 @@ final class machExceptionErrorResourceTests: XCTestCase {
     func testMachExceptionResourceInfoMemoryInvalidFlavor() throws {
         var code = MachExceptionResourceInfo.Code(value: 0)
         let subcode = MachExceptionResourceInfo.Subcode(value: 0)
-        code.type = RESOURCE_TYPE_MEMORY
-        code.flavor = 0
-        code.memoryHWMLimit = 1
+        code[MachExceptionResourceInfo.Code.type] = RESOURCE_TYPE_MEMORY
+        code[MachExceptionResourceInfo.Code.flavor] = 0
+        code[MachExceptionResourceInfo.Code.memoryHWMLimit] = 1
         let nsError = makeNSError(type: EXC_RESOURCE, code: code.value, subcode: subcode.value)
         let error = try XCTUnwrap(MachExceptionError(nsError))
         XCTAssertNil(error.resource)
@@ -98,11 +100,11 @@ final class machExceptionErrorResourceTests: XCTestCase {
     func testMachExceptionResourceInfoIO() throws {
         var code = MachExceptionResourceInfo.Code(value: 0)
         var subcode = MachExceptionResourceInfo.Subcode(value: 0)
-        code.type = RESOURCE_TYPE_IO
-        code.flavor = MachExceptionResourceInfo.IOFlavor.physicalWrites.rawValue
-        code.ioInterval = 1
-        code.ioLimit = 2
-        subcode.ioCount = 3
+        code[MachExceptionResourceInfo.Code.type] = RESOURCE_TYPE_IO
+        code[MachExceptionResourceInfo.Code.flavor] = MachExceptionResourceInfo.IOFlavor.physicalWrites.rawValue
+        code[MachExceptionResourceInfo.Code.ioInterval] = 1
+        code[MachExceptionResourceInfo.Code.ioLimit] = 2
+        subcode[MachExceptionResourceInfo.Subcode.ioCount] = 3
         let nsError = makeNSError(type: EXC_RESOURCE, code: code.value, subcode: subcode.value)
         let error = try XCTUnwrap(MachExceptionError(nsError))
         let info = try XCTUnwrap(error.resource)
@@ -112,11 +114,11 @@ final class machExceptionErrorResourceTests: XCTestCase {
     func testMachExceptionResourceInfoIOInvalidFlavor() throws {
         var code = MachExceptionResourceInfo.Code(value: 0)
         var subcode = MachExceptionResourceInfo.Subcode(value: 0)
-        code.type = RESOURCE_TYPE_IO
-        code.flavor = 0
-        code.ioInterval = 1
-        code.ioLimit = 2
-        subcode.ioCount = 3
+        code[MachExceptionResourceInfo.Code.type] = RESOURCE_TYPE_IO
+        code[MachExceptionResourceInfo.Code.flavor] = 0
+        code[MachExceptionResourceInfo.Code.ioInterval] = 1
+        code[MachExceptionResourceInfo.Code.ioLimit] = 2
+        subcode[MachExceptionResourceInfo.Subcode.ioCount] = 3
         let nsError = makeNSError(type: EXC_RESOURCE, code: code.value, subcode: subcode.value)
         let error = try XCTUnwrap(MachExceptionError(nsError))
         XCTAssertNil(error.resource)
@@ -125,9 +127,9 @@ final class machExceptionErrorResourceTests: XCTestCase {
     func testMachExceptionResourceInfoThreads() throws {
         var code = MachExceptionResourceInfo.Code(value: 0)
         let subcode = MachExceptionResourceInfo.Subcode(value: 0)
-        code.type = RESOURCE_TYPE_THREADS
-        code.flavor = MachExceptionResourceInfo.ThreadsFlavor.highWatermark.rawValue
-        code.threadsCount = 1
+        code[MachExceptionResourceInfo.Code.type] = RESOURCE_TYPE_THREADS
+        code[MachExceptionResourceInfo.Code.flavor] = MachExceptionResourceInfo.ThreadsFlavor.highWatermark.rawValue
+        code[MachExceptionResourceInfo.Code.threadsCount] = 1
         let nsError = makeNSError(type: EXC_RESOURCE, code: code.value, subcode: subcode.value)
         let error = try XCTUnwrap(MachExceptionError(nsError))
         let info = try XCTUnwrap(error.resource)
@@ -137,9 +139,9 @@ final class machExceptionErrorResourceTests: XCTestCase {
     func testMachExceptionResourceInfoThreadsInvalidFlavor() throws {
         var code = MachExceptionResourceInfo.Code(value: 0)
         let subcode = MachExceptionResourceInfo.Subcode(value: 0)
-        code.type = RESOURCE_TYPE_THREADS
-        code.flavor = 0
-        code.threadsCount = 1
+        code[MachExceptionResourceInfo.Code.type] = RESOURCE_TYPE_THREADS
+        code[MachExceptionResourceInfo.Code.flavor] = 0
+        code[MachExceptionResourceInfo.Code.threadsCount] = 1
         let nsError = makeNSError(type: EXC_RESOURCE, code: code.value, subcode: subcode.value)
         let error = try XCTUnwrap(MachExceptionError(nsError))
         XCTAssertNil(error.resource)
@@ -147,7 +149,7 @@ final class machExceptionErrorResourceTests: XCTestCase {
     
     func testMachExceptionResourceInfoInvalidType() throws {
         var code = MachExceptionGuardInfo.Code(value: 0)
-        code.type = 7
+        code[MachExceptionGuardInfo.Code.type] = 7
         let nsError = makeNSError(type: EXC_RESOURCE, code: code.value, subcode: 3)
         let error = try XCTUnwrap(MachExceptionError(nsError))
         XCTAssertNil(error.resource)
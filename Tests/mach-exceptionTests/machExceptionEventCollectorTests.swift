@@ -0,0 +1,129 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+//
+// machExceptionEventCollectorTests.swift
+// Created by Patrick Gili on 2/10/23.
+//
+
+import Foundation
+import XCTest
+
+import mach_exception
+import mach_exception_helper
+
+@testable import mach_exception
+
+final class machExceptionEventCollectorTests: XCTestCase {
+
+    // The lowest page is never mapped, so reading any address in it raises EXC_BAD_ACCESS with the address as the
+    // subcode.
+    let base = 0x100
+
+    func fault(_ index: Int) {
+        let address = base + index
+        XCTAssertThrowsError(try withUnsafeMachException(types: [.badAccess]) {
+            _ = UnsafePointer<UInt8>(bitPattern: address)!.pointee
+        })
+    }
+
+    override func setUpWithError() throws {
+        // Discard the events earlier tests published.
+        MachExceptionEventCollector { _, _ in }.drain()
+    }
+
+    func testDrain() throws {
+        fault(1)
+        fault(2)
+        var events = [mach_exception_event_t]()
+        var dropped: UInt64 = 0
+        let collector = MachExceptionEventCollector { batch, count in
+            events += batch
+            dropped += count
+        }
+        XCTAssertEqual(collector.drain(), 2)
+        XCTAssertEqual(dropped, 0)
+        XCTAssertEqual(events.map { $0.type }, [EXC_BAD_ACCESS, EXC_BAD_ACCESS])
+        XCTAssertEqual(events.map { $0.subcode }, [Int64(base + 1), Int64(base + 2)])
+        XCTAssertEqual(events[1].sequence, events[0].sequence + 1)
+        XCTAssertNotEqual(events[0].pc, 0)
+        XCTAssertNotEqual(events[0].thread, 0)
+        XCTAssertEqual(collector.drain(), 0)
+    }
+
+    func testFullRingDropsEvents() throws {
+        let count = Int(MACH_EXCEPTION_RING_CAPACITY) + 44
+        for index in 0 ..< count {
+            fault(index)
+        }
+        var events = [mach_exception_event_t]()
+        var dropped: UInt64 = 0
+        let collector = MachExceptionEventCollector(batchSize: 100) { batch, count in
+            events += batch
+            dropped += count
+        }
+        XCTAssertEqual(collector.drain(), Int(MACH_EXCEPTION_RING_CAPACITY))
+        XCTAssertEqual(dropped, 44)
+        XCTAssertEqual(events.map { $0.subcode }, (0 ..< Int(MACH_EXCEPTION_RING_CAPACITY)).map { Int64(base + $0) })
+        let first = events[0].sequence
+
+        // Publishing resumes once the collector makes room, and the sequence numbers show the gap.
+        fault(0)
+        events.removeAll()
+        collector.drain()
+        XCTAssertEqual(events.count, 1)
+        XCTAssertEqual(events[0].sequence, first + UInt64(count))
+    }
+
+    func testStressManyFaultingThreads() throws {
+        let threads = 16
+        let faults = 2000
+        let lock = NSLock()
+        var events = [UInt64 : [mach_exception_event_t]]()
+        var dropped: UInt64 = 0
+        let collector = MachExceptionEventCollector(interval: 0.001) { batch, count in
+            lock.lock()
+            for event in batch {
+                events[event.thread, default: []].append(event)
+            }
+            dropped += count
+            lock.unlock()
+        }
+        collector.start()
+        DispatchQueue.concurrentPerform(iterations: threads) { _ in
+            for index in 0 ..< faults {
+                fault(index)
+            }
+        }
+        collector.stop()
+
+        // No event is lost: each was either received or counted as dropped.
+        let received = events.values.reduce(0) { $0 + $1.count }
+        XCTAssertEqual(UInt64(received) + dropped, UInt64(threads * faults))
+
+        // No event is torn: each thread's events are intact, and arrive in the order the thread faulted.
+        XCTAssertLessThanOrEqual(events.count, threads)
+        for (_, threadEvents) in events {
+            for event in threadEvents {
+                XCTAssertEqual(event.type, EXC_BAD_ACCESS)
+                XCTAssertEqual(event.code, mach_exception_data_type_t(KERN_INVALID_ADDRESS))
+                XCTAssert(event.subcode >= Int64(base) && event.subcode < Int64(base + faults))
+                XCTAssertNotEqual(event.pc, 0)
+            }
+            let subcodes = threadEvents.map { $0.subcode }
+            XCTAssertEqual(subcodes, subcodes.sorted())
+            XCTAssertEqual(Set(subcodes).count, subcodes.count)
+        }
+    }
+
+    func testPerformanceFaultWithEvents() throws {
+        let collector = MachExceptionEventCollector { _, _ in }
+        measure {
+            for index in 0 ..< 1000 {
+                fault(index)
+            }
+            collector.drain()
+        }
+    }
+}
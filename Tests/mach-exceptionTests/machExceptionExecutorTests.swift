@@ -0,0 +1,219 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+//
+// machExceptionExecutorTests.swift
+// Created by Patrick Gili on 2/25/23.
+//
+
+import Foundation
+import XCTest
+
+import mach_exception
+import mach_exception_helper
+
+@testable import mach_exception
+
+// A counter shared by concurrent operations.
+private final class Counter {
+    private let lock = NSLock()
+    private var count = 0
+
+    var value: Int {
+        lock.lock()
+        defer { lock.unlock() }
+        return count
+    }
+
+    func increment() {
+        lock.lock()
+        count += 1
+        lock.unlock()
+    }
+}
+
+// An object whose release a test observes through a weak reference.
+private final class Token {
+}
+
+private struct WeakToken {
+    weak var token: Token?
+}
+
+final class machExceptionExecutorTests: XCTestCase {
+
+    let calls = 10 * ProcessInfo.processInfo.activeProcessorCount
+
+    func testExecutedJobsAreReleasedBeforeTheQueueDrains() throws {
+        let executor = MachExceptionExecutor(maximumThreadCount: 1)
+        var tokens: [WeakToken] = []
+        for _ in 0 ..< 100 {
+            let token = Token()
+            tokens.append(WeakToken(token: token))
+            executor.execute {
+                withExtendedLifetime(token) {}
+            }
+        }
+        let started = DispatchSemaphore(value: 0)
+        let release = DispatchSemaphore(value: 0)
+        executor.execute {
+            started.signal()
+            release.wait()
+        }
+        // Keep a job waiting, so the queue hasn't drained when the jobs holding the tokens have executed.
+        executor.execute {}
+        started.wait()
+        XCTAssert(tokens.allSatisfy { $0.token == nil })
+        release.signal()
+    }
+
+    func testAsyncWithNoException() async throws {
+        var executed = false
+        var finallyExecuted = false
+        try await withUnsafeMachException(types: [.badAccess]) {
+            executed = true
+        } finally: {
+            finallyExecuted = true
+        }
+        XCTAssert(executed)
+        XCTAssert(finallyExecuted)
+    }
+
+    func testAsyncCatchesException() async throws {
+        var caughtError: Error?
+        do {
+            try await withUnsafeMachException(types: [.badAccess]) {
+                UnsafeMutablePointer<Int>(bitPattern: 0x18)!.pointee = 1
+            }
+        } catch {
+            caughtError = error
+        }
+        let machExceptionError = try XCTUnwrap(caughtError as? MachExceptionError)
+        XCTAssertEqual(machExceptionError.type, .badAccess)
+        XCTAssertEqual(machExceptionError.state?.faultAddress, 0x18)
+    }
+
+    func testAsyncCancelledBeforeStarting() async throws {
+        let task = Task {
+            withUnsafeCurrentTask { $0?.cancel() }
+            return try await withUnsafeMachExceptionResult(types: [.badAccess]) {
+                XCTFail("The operation of a cancelled task executed")
+            }
+        }
+        do {
+            _ = try await task.value
+            XCTFail("A cancelled task didn't throw")
+        } catch {
+            XCTAssert(error is CancellationError)
+        }
+    }
+
+    func testExecutorReusesAndRetiresThreads() async throws {
+        let executor = MachExceptionExecutor(maximumThreadCount: 2, idleTimeout: 0.2)
+        var threads = Set<String>()
+        for _ in 0 ..< 8 {
+            _ = try await withUnsafeMachExceptionResult(types: [.badAccess], executor: executor) {
+                threads.insert("\(pthread_self())")
+            }
+        }
+        // A call can arrive before the thread that performed the call before it is idle again, so it can start a
+        // second thread, but never more than the maximum.
+        XCTAssertLessThanOrEqual(threads.count, 2)
+        XCTAssertGreaterThan(executor.threads, 0)
+        XCTAssertLessThanOrEqual(executor.threads, 2)
+        try await Task.sleep(nanoseconds: 1_000_000_000)
+        XCTAssertEqual(executor.threads, 0)
+    }
+
+    func testExecutorWithOneThreadPerformsInOrder() throws {
+        let executor = MachExceptionExecutor(maximumThreadCount: 1)
+        let finished = DispatchSemaphore(value: 0)
+        var threads = Set<String>()
+        var order: [Int] = []
+        for job in 0 ..< 4 {
+            executor.execute {
+                threads.insert("\(pthread_self())")
+                order.append(job)
+                finished.signal()
+            }
+        }
+        for _ in 0 ..< 4 {
+            XCTAssertEqual(finished.wait(timeout: .now() + 10), .success)
+        }
+        XCTAssertEqual(threads.count, 1)
+        XCTAssertEqual(order, [0, 1, 2, 3])
+        XCTAssertEqual(executor.threads, 1)
+    }
+
+    // Run 10 calls per core at once, each blocking its thread until released. Blocked operations must not keep other
+    // tasks from running, and once released, the calls must all finish.
+    func testConcurrentCallsDoNotStarveCooperativePool() async throws {
+        let executor = MachExceptionExecutor()
+        let release = DispatchSemaphore(value: 0)
+        let started = Counter()
+        let calls = self.calls
+
+        let results = Task {
+            try await withThrowingTaskGroup(of: Bool.self) { group in
+                for call in 0 ..< calls {
+                    group.addTask {
+                        try await withUnsafeMachExceptionResult(types: [.badAccess], executor: executor) {
+                            started.increment()
+                            release.wait()
+                            if call.isMultiple(of: 2) {
+                                UnsafeMutablePointer<Int>(bitPattern: 0x10)!.pointee = 1
+                            }
+                        } != nil
+                    }
+                }
+                return try await group.reduce(0) { $0 + ($1 ? 1 : 0) }
+            }
+        }
+
+        // Wait, without blocking a thread of the cooperative pool, until every thread of the executor is blocked.
+        let deadline = DispatchTime.now() + 10
+        while started.value < executor.maximumThreadCount && DispatchTime.now() < deadline {
+            try await Task.sleep(nanoseconds: 10_000_000)
+        }
+        XCTAssertEqual(started.value, executor.maximumThreadCount)
+
+        // Every thread the executor runs is blocked, yet the cooperative pool still runs other tasks.
+        let start = DispatchTime.now().uptimeNanoseconds
+        let unrelated = await Task.detached { 6 * 7 }.value
+        XCTAssertEqual(unrelated, 42)
+        XCTAssertLessThan(DispatchTime.now().uptimeNanoseconds - start, 1_000_000_000)
+
+        for _ in 0 ..< calls {
+            release.signal()
+        }
+        let caught = try await results.value
+        XCTAssertEqual(caught, (calls + 1) / 2)
+        XCTAssertEqual(started.value, calls)
+        XCTAssertLessThanOrEqual(executor.threads, executor.maximumThreadCount)
+    }
+
+    // Measure the throughput of 10 calls per core at once, half of which fault.
+    func testConcurrentCallThroughput() async throws {
+        let calls = self.calls
+        let rounds = 20
+        let start = DispatchTime.now().uptimeNanoseconds
+        for _ in 0 ..< rounds {
+            let caught = try await withThrowingTaskGroup(of: Bool.self) { group in
+                for call in 0 ..< calls {
+                    group.addTask {
+                        try await withUnsafeMachExceptionResult(types: [.badAccess]) {
+                            if call.isMultiple(of: 2) {
+                                UnsafeMutablePointer<Int>(bitPattern: 0x10)!.pointee = 1
+                            }
+                        } != nil
+                    }
+                }
+                return try await group.reduce(0) { $0 + ($1 ? 1 : 0) }
+            }
+            XCTAssertEqual(caught, (calls + 1) / 2)
+        }
+        let seconds = Double(DispatchTime.now().uptimeNanoseconds - start) / 1e9
+        print("\(calls * rounds) concurrent calls in \(seconds) s: \(Int(Double(calls * rounds) / seconds)) calls/s")
+    }
+}
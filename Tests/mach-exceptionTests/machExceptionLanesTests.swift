@@ -0,0 +1,155 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+//
+// machExceptionLanesTests.swift
+// Created by Patrick Gili on 2/16/23.
+//
+
+import Foundation
+import XCTest
+
+import mach_exception
+import mach_exception_helper
+
+@testable import mach_exception
+
+final class machExceptionLanesTests: XCTestCase {
+
+    // Kept out of reach of constant folding, so the division happens at run time.
+    var one = 1.0
+    var zero = 0.0
+    var quotient = 0.0
+
+    override func tearDown() {
+        MachExceptionLanes.isAttributionEnabled = false
+    }
+
+    // Attribute the instruction encoded in `bytes` with the vector registers `vectors`, each given as its lanes.
+    private func attribute<T>(_ bytes: [UInt8], _ vectors: [Int: [T]], wide: Bool = false) -> mach_exception_lanes_t? {
+        var state = mach_exception_simd_state_t()
+        withUnsafeMutableBytes(of: &state.vector) { registers in
+            for (index, lanes) in vectors {
+                lanes.withUnsafeBytes { lanes in
+                    registers.baseAddress!.advanced(by: index * 32).copyMemory(from: lanes.baseAddress!,
+                                                                               byteCount: lanes.count)
+                }
+            }
+        }
+        state.wide = wide
+        var lanes = mach_exception_lanes_t()
+        let attributed = bytes.withUnsafeBufferPointer { bytes -> Bool in
+            state.pc = UInt64(UInt(bitPattern: bytes.baseAddress))
+            return mach_exception_lanes_attribute(&state, &lanes)
+        }
+        return attributed ? lanes : nil
+    }
+
+#if arch(i386) || arch(x86_64)
+    func testAttributePackedDivide() throws {
+        // vdivps ymm0, ymm0, ymm1
+        let lanes = try XCTUnwrap(attribute([0xc5, 0xfc, 0x5e, 0xc1],
+                                            [0: [Float](repeating: 1, count: 8),
+                                             1: [Float]([1, 0, 1, 1, 1, 0, 1, 1])],
+                                            wide: true))
+        XCTAssertEqual(lanes.count, 8)
+        XCTAssertEqual(lanes.width, 32)
+        XCTAssertEqual(lanes.divide_by_zero, 0x22)
+        XCTAssertEqual(lanes.invalid, 0)
+    }
+
+    func testAttributePackedSquareRoot() throws {
+        // sqrtpd xmm0, xmm1
+        let lanes = try XCTUnwrap(attribute([0x66, 0x0f, 0x51, 0xc1], [1: [Double]([-1, 4])]))
+        XCTAssertEqual(lanes.count, 2)
+        XCTAssertEqual(lanes.width, 64)
+        XCTAssertEqual(lanes.invalid, 0x1)
+    }
+
+    func testAttributeWithoutUpperHalvesFails() throws {
+        // vdivps ymm0, ymm0, ymm1
+        XCTAssertNil(attribute([0xc5, 0xfc, 0x5e, 0xc1], [1: [Float](repeating: 0, count: 8)]))
+    }
+
+    func testAttributeUnsupportedInstructionFails() throws {
+        // movaps xmm0, xmm1
+        XCTAssertNil(attribute([0x0f, 0x28, 0xc1], [1: [Float](repeating: 0, count: 4)]))
+    }
+#elseif arch(arm) || arch(arm64)
+    func testAttributePackedDivide() throws {
+        // fdiv v0.4s, v1.4s, v2.4s
+        let lanes = try XCTUnwrap(attribute([0x20, 0xfc, 0x22, 0x6e],
+                                            [1: [Float](repeating: 1, count: 4),
+                                             2: [Float]([1, 0, 1, 1])]))
+        XCTAssertEqual(lanes.count, 4)
+        XCTAssertEqual(lanes.width, 32)
+        XCTAssertEqual(lanes.divide_by_zero, 0x2)
+        XCTAssertEqual(lanes.invalid, 0)
+    }
+
+    func testAttributePackedSquareRoot() throws {
+        // fsqrt v0.2d, v1.2d
+        let lanes = try XCTUnwrap(attribute([0x20, 0xf8, 0xe1, 0x6e], [1: [Double]([-1, 4])]))
+        XCTAssertEqual(lanes.count, 2)
+        XCTAssertEqual(lanes.width, 64)
+        XCTAssertEqual(lanes.invalid, 0x1)
+    }
+
+    func testAttributeUnsupportedInstructionFails() throws {
+        // mov v0.16b, v1.16b
+        XCTAssertNil(attribute([0x20, 0x1c, 0xa1, 0x4e], [1: [Float](repeating: 0, count: 4)]))
+    }
+#endif
+
+    func testExceptionsInLane() throws {
+        var raw = mach_exception_lanes_t()
+        raw.count = 4
+        raw.width = 32
+        raw.divide_by_zero = 0x2
+        raw.invalid = 0x6
+        let lanes = MachExceptionLanes(raw)
+        XCTAssertEqual(lanes.exceptions(inLane: 0), [])
+        XCTAssertEqual(lanes.exceptions(inLane: 1), [.invalid, .divideByZero])
+        XCTAssertEqual(lanes.exceptions(inLane: 2), [.invalid])
+        XCTAssertEqual(lanes.exceptions(inLane: 4), [])
+    }
+
+    func testCaughtTrapIsAttributed() throws {
+        var previous: Int32 = 0
+        guard mach_fp_traps_enter(Int32(FE_DIVBYZERO), &previous) else {
+            throw XCTSkip("The processor doesn't support trapping floating-point exceptions")
+        }
+        mach_fp_traps_leave(previous)
+
+        MachExceptionLanes.isAttributionEnabled = true
+        var caughtError: Error?
+        XCTAssertThrowsError(try withFloatingPointTraps([.divideByZero]) {
+            self.quotient = self.one / self.zero
+        }) { error in
+            caughtError = error
+        }
+        let machExceptionError = try XCTUnwrap(caughtError as? MachExceptionError)
+        let lanes = try XCTUnwrap(machExceptionError.lanes)
+        XCTAssertEqual(lanes.count, 1)
+        XCTAssertEqual(lanes.width, 64)
+        XCTAssertEqual(lanes.exceptions(inLane: 0), [.divideByZero])
+    }
+
+    func testCaughtTrapIsNotAttributedWhenDisabled() throws {
+        var previous: Int32 = 0
+        guard mach_fp_traps_enter(Int32(FE_DIVBYZERO), &previous) else {
+            throw XCTSkip("The processor doesn't support trapping floating-point exceptions")
+        }
+        mach_fp_traps_leave(previous)
+
+        var caughtError: Error?
+        XCTAssertThrowsError(try withFloatingPointTraps([.divideByZero]) {
+            self.quotient = self.one / self.zero
+        }) { error in
+            caughtError = error
+        }
+        let machExceptionError = try XCTUnwrap(caughtError as? MachExceptionError)
+        XCTAssertNil(machExceptionError.lanes)
+    }
+}
@@ -0,0 +1,192 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+//
+// machExceptionLogTests.swift
+// Created by Patrick Gili on 2/8/23.
+//
+
+import Foundation
+import XCTest
+
+import mach_exception
+import mach_exception_helper
+
+@testable import mach_exception
+
+final class machExceptionLogTests: XCTestCase {
+
+    // The size of a log file holding `records` records.
+    func fileSize(records: Int) -> Int {
+        return Int(MACH_EXCEPTION_LOG_HEADER_SIZE) + records * Int(MACH_EXCEPTION_LOG_RECORD_SIZE)
+    }
+
+    var directory: URL!
+
+    var path: String {
+        return directory.appendingPathComponent("exceptions").path
+    }
+
+    override func setUpWithError() throws {
+        directory = FileManager.default.temporaryDirectory.appendingPathComponent(UUID().uuidString)
+        try FileManager.default.createDirectory(at: directory, withIntermediateDirectories: true)
+    }
+
+    override func tearDownWithError() throws {
+        MachExceptionLog.shared = nil
+        try FileManager.default.removeItem(at: directory)
+    }
+
+    func records(sequence: UInt64) throws -> [mach_exception_log_record_t] {
+        let reader = try MachExceptionLogReader(file: MachExceptionLogReader.file(path: path, sequence: sequence))
+        return reader.map { $0.pointee }
+    }
+
+    func testAppendAndRead() throws {
+        let log = try MachExceptionLog(path: path)
+        var backtrace = mach_exception_backtrace_t()
+        backtrace.pc = 0x1000
+        backtrace.depth = 2
+        backtrace.frames.0 = 0x2000
+        backtrace.frames.1 = 0x3000
+        XCTAssert(log.append(mach_exception_record_t(type: EXC_BAD_ACCESS, code: 1, subcode: 0x10),
+                             backtrace: backtrace))
+        XCTAssert(log.append(mach_exception_record_t(type: EXC_ARITHMETIC, code: 2, subcode: 3)))
+
+        let reader = try MachExceptionLogReader(file: MachExceptionLogReader.file(path: path, sequence: 0))
+        XCTAssertEqual(reader.header.magic, MACH_EXCEPTION_LOG_MAGIC)
+        XCTAssertEqual(reader.header.version, UInt16(MACH_EXCEPTION_LOG_VERSION))
+        XCTAssertEqual(reader.header.capacity, 8191)
+        XCTAssertEqual(reader.header.tail, 2)
+        XCTAssertFalse(reader.isFull)
+
+        let records = reader.map { $0.pointee }
+        XCTAssertEqual(records.count, 2)
+        XCTAssertEqual(records[0].state, MACH_EXCEPTION_LOG_COMMITTED)
+        XCTAssertEqual(records[0].type, EXC_BAD_ACCESS)
+        XCTAssertEqual(records[0].code, 1)
+        XCTAssertEqual(records[0].subcode, 0x10)
+        XCTAssertEqual(records[0].pc, 0x1000)
+        XCTAssertEqual(records[0].backtrace, [0x2000, 0x3000])
+        XCTAssertNotEqual(records[0].thread, 0)
+        XCTAssertEqual(Double(records[0].timestamp) / 1e9, Date().timeIntervalSince1970, accuracy: 60)
+        XCTAssertEqual(records[1].type, EXC_ARITHMETIC)
+        XCTAssertEqual(records[1].pc, 0)
+        XCTAssertEqual(records[1].backtrace, [])
+        XCTAssertEqual(MachExceptionError(records[1].record)?.type, .arithmetic)
+    }
+
+    func testRotation() throws {
+        let log = try MachExceptionLog(path: path, fileSize: fileSize(records: 4))
+        for subcode in 0 ..< 10 {
+            XCTAssert(log.append(mach_exception_record_t(type: EXC_BAD_ACCESS, code: 1, subcode: Int64(subcode))))
+        }
+        XCTAssertEqual(log.sequence, 2)
+        XCTAssertEqual(try records(sequence: 0).map { $0.subcode }, [0, 1, 2, 3])
+        XCTAssertEqual(try records(sequence: 1).map { $0.subcode }, [4, 5, 6, 7])
+        XCTAssertEqual(try records(sequence: 2).map { $0.subcode }, [8, 9])
+        XCTAssert(try MachExceptionLogReader(file: MachExceptionLogReader.file(path: path, sequence: 0)).isFull)
+    }
+
+    func testConcurrentAppend() throws {
+        let log = try MachExceptionLog(path: path, fileSize: fileSize(records: 100))
+        DispatchQueue.concurrentPerform(iterations: 8) { thread in
+            for index in 0 ..< 1000 {
+                log.append(mach_exception_record_t(type: EXC_BAD_ACCESS, code: Int64(thread), subcode: Int64(index)))
+            }
+        }
+        var records = [mach_exception_log_record_t]()
+        for sequence in 0 ... log.sequence {
+            records += try self.records(sequence: sequence)
+        }
+        XCTAssertEqual(records.count, 8000)
+        for thread in 0 ..< 8 {
+            XCTAssertEqual(records.filter { $0.code == Int64(thread) }.map { $0.subcode }.sorted(),
+                           (0 ..< 1000).map { Int64($0) })
+        }
+    }
+
+    func testResume() throws {
+        var log: MachExceptionLog? = try MachExceptionLog(path: path, fileSize: fileSize(records: 4))
+        log?.append(mach_exception_record_t(type: EXC_BAD_ACCESS, code: 1, subcode: 0))
+        log = nil
+        log = try MachExceptionLog(path: path, fileSize: fileSize(records: 4))
+        log?.append(mach_exception_record_t(type: EXC_BAD_ACCESS, code: 1, subcode: 1))
+        XCTAssertEqual(log?.sequence, 0)
+        XCTAssertEqual(try records(sequence: 0).map { $0.subcode }, [0, 1])
+    }
+
+    func testReadWhileWriting() throws {
+        let log = try MachExceptionLog(path: path)
+        let reader = try MachExceptionLogReader(file: MachExceptionLogReader.file(path: path, sequence: 0))
+        var cursor: UInt64 = 0
+        XCTAssertNil(reader.next(&cursor, skipPending: false))
+        log.append(mach_exception_record_t(type: EXC_BREAKPOINT, code: 1, subcode: 0))
+        XCTAssertEqual(reader.next(&cursor, skipPending: false)?.pointee.type, EXC_BREAKPOINT)
+        XCTAssertEqual(cursor, 1)
+    }
+
+    func testPendingRecord() throws {
+        // A writer that reserved the second record, then crashed before committing it.
+        var log: MachExceptionLog? = try MachExceptionLog(path: path)
+        log?.append(mach_exception_record_t(type: EXC_BAD_ACCESS, code: 1, subcode: 0))
+        log = nil
+        let file = MachExceptionLogReader.file(path: path, sequence: 0)
+        let handle = try XCTUnwrap(FileHandle(forUpdatingAtPath: file))
+        handle.seek(toFileOffset: UInt64(MemoryLayout<mach_exception_log_header_t>.offset(of: \.tail)!))
+        withUnsafeBytes(of: UInt64(2)) { handle.write(Data($0)) }
+        handle.closeFile()
+        log = try MachExceptionLog(path: path)
+        log?.append(mach_exception_record_t(type: EXC_BAD_ACCESS, code: 1, subcode: 2))
+
+        let reader = try MachExceptionLogReader(file: file)
+        var cursor: UInt64 = 0
+        XCTAssertEqual(reader.next(&cursor, skipPending: false)?.pointee.subcode, 0)
+        XCTAssertNil(reader.next(&cursor, skipPending: false))
+        XCTAssertEqual(cursor, 1)
+        XCTAssertEqual(reader.next(&cursor, skipPending: true)?.pointee.subcode, 2)
+        XCTAssertEqual(reader.map { $0.pointee.subcode }, [0, 2])
+    }
+
+    func testNotALogFile() throws {
+        let file = directory.appendingPathComponent("garbage").path
+        XCTAssert(FileManager.default.createFile(atPath: file, contents: Data(repeating: 0xff, count: 4096)))
+        XCTAssertThrowsError(try MachExceptionLogReader(file: file)) { error in
+            XCTAssertEqual((error as NSError).code, Int(EINVAL))
+        }
+        XCTAssertThrowsError(try MachExceptionLog(path: path, fileSize: 0))
+    }
+
+    func testWithUnsafeMachExceptionAppendsToSharedLog() throws {
+#if arch(arm) || arch(arm64)
+        let exceptionType: MachExceptionTypes = [.breakpoint]
+#elseif arch(i386) || arch(x86_64)
+        let exceptionType: MachExceptionTypes = [.badInstruction]
+#endif
+        MachExceptionLog.shared = try MachExceptionLog(path: path)
+        XCTAssertThrowsError(try withUnsafeMachException(types: exceptionType) {
+            fatalError("Testing fatal error")
+        })
+        let records = try self.records(sequence: 0)
+        XCTAssertEqual(records.count, 1)
+#if arch(arm) || arch(arm64)
+        XCTAssertEqual(records[0].type, EXC_BREAKPOINT)
+#elseif arch(i386) || arch(x86_64)
+        XCTAssertEqual(records[0].type, EXC_BAD_INSTRUCTION)
+#endif
+        XCTAssertNotEqual(records[0].pc, 0)
+    }
+
+    func testPerformanceAppend() throws {
+        let log = try MachExceptionLog(path: path, fileSize: 64 << 20)
+        let record = mach_exception_record_t(type: EXC_BAD_ACCESS, code: 1, subcode: 0)
+        var backtrace = mach_exception_backtrace_t()
+        backtrace.depth = UInt32(MACH_EXCEPTION_BACKTRACE_DEPTH)
+        measure {
+            for _ in 0 ..< 50_000 {
+                log.append(record, backtrace: backtrace)
+            }
+        }
+    }
+}
@@ -0,0 +1,164 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+//
+// machExceptionMetricsTests.swift
+// Created by Patrick Gili on 2/24/23.
+//
+
+import Foundation
+import XCTest
+
+import mach_exception
+import mach_exception_helper
+
+@testable import mach_exception
+
+final class machExceptionMetricsTests: XCTestCase {
+
+    func fault() throws {
+        XCTAssertThrowsError(try withUnsafeMachException(types: [.badAccess]) {
+            UnsafeMutablePointer<UInt8>(bitPattern: 8)!.pointee = 0
+        })
+    }
+
+    func testScopesAndFaultsAreCounted() throws {
+        let before = MachExceptionMetrics()
+        for _ in 0 ..< 10 {
+            try withUnsafeMachException(types: [.badAccess]) {}
+        }
+        for _ in 0 ..< 3 {
+            try fault()
+        }
+        let after = MachExceptionMetrics()
+
+        XCTAssertGreaterThanOrEqual(after.scopesEntered - before.scopesEntered, 13)
+        XCTAssertGreaterThanOrEqual(after.listenerWakeups - before.listenerWakeups, 3)
+        XCTAssertEqual(after.caught(.badAccess) - before.caught(.badAccess), 3)
+        let family = MachExceptionMetrics.Family(type: .badAccess, name: "vm_fault")
+        XCTAssertEqual(after.caught[family, default: 0] - before.caught[family, default: 0], 3)
+
+        let handler = try XCTUnwrap(after.handlerLatency[.badAccess])
+        let resume = try XCTUnwrap(after.resumeLatency[.badAccess])
+        XCTAssertEqual(handler.count - (before.handlerLatency[.badAccess]?.count ?? 0), 3)
+        XCTAssertEqual(resume.count - (before.resumeLatency[.badAccess]?.count ?? 0), 3)
+        XCTAssertEqual(handler.buckets.reduce(0, +), handler.count)
+        XCTAssertGreaterThan(handler.mean, 0)
+        XCTAssertLessThanOrEqual(handler.quantile(0.5), handler.quantile(0.99))
+    }
+
+    func testCountsOfExitedThreadsAreKept() throws {
+        let before = MachExceptionMetrics()
+        let thread = Thread {
+            try? self.fault()
+        }
+        let finished = expectation(forNotification: .NSThreadWillExit, object: thread)
+        thread.start()
+        wait(for: [finished], timeout: 10)
+        // The thread's shard may not be retired yet, but it must be counted exactly once either way.
+        XCTAssertEqual(MachExceptionMetrics().caught(.badAccess) - before.caught(.badAccess), 1)
+        usleep(100_000)
+        XCTAssertEqual(MachExceptionMetrics().caught(.badAccess) - before.caught(.badAccess), 1)
+    }
+
+    func testFamilies() throws {
+        var record = mach_exception_record_t(type: EXC_BAD_ACCESS,
+                                             code: mach_exception_data_type_t(KERN_INVALID_ADDRESS),
+                                             subcode: 8)
+        var family = mach_exception_metrics_family(&record)
+        XCTAssertEqual(mach_exception_metrics_family_type(family), EXC_BAD_ACCESS)
+        XCTAssertEqual(String(cString: mach_exception_metrics_family_name(family)), "vm_fault")
+
+        record = mach_exception_record_t(type: EXC_CRASH, code: 0, subcode: 0)
+        family = mach_exception_metrics_family(&record)
+        XCTAssertEqual(mach_exception_metrics_family_type(family), EXC_CRASH)
+        XCTAssertEqual(String(cString: mach_exception_metrics_family_name(family)), "other")
+        XCTAssertEqual(String(cString: mach_exception_metrics_type_name(EXC_CRASH)), "crash")
+        XCTAssertNil(mach_exception_metrics_type_name(0))
+    }
+
+    func testExposition() throws {
+        try fault()
+        let exposition = MachExceptionMetrics().exposition
+        XCTAssert(exposition.contains("# TYPE mach_exception_scopes_entered_total counter\n"))
+        XCTAssert(exposition.contains("mach_exception_faults_caught_total{type=\"bad_access\",family=\"vm_fault\"} "))
+        XCTAssert(exposition.contains("# TYPE mach_exception_handler_latency_seconds histogram\n"))
+        XCTAssert(exposition.contains(
+            "mach_exception_handler_latency_seconds_bucket{type=\"bad_access\",le=\"+Inf\"} "))
+        XCTAssert(exposition.contains("mach_exception_resume_latency_seconds_count{type=\"bad_access\"} "))
+    }
+
+    func testHistogramBuckets() throws {
+        var histogram = mach_exception_histogram_t()
+        withUnsafeMutableBytes(of: &histogram.buckets) { bytes in
+            let buckets = bytes.bindMemory(to: UInt64.self)
+            buckets[3] = 2
+            buckets[10] = 1
+        }
+        histogram.count = 3
+        histogram.sum = 1_030
+        let metrics = MachExceptionMetrics.Histogram(histogram)
+        XCTAssertEqual(MachExceptionMetrics.Histogram.upperBound(ofBucket: 3), 8e-9)
+        XCTAssertEqual(MachExceptionMetrics.Histogram.upperBound(ofBucket: 31), .infinity)
+        XCTAssertEqual(metrics.quantile(0.5), 8e-9)
+        XCTAssertEqual(metrics.quantile(0.99), 1.024e-6)
+        XCTAssertEqual(metrics.mean, 1_030e-9 / 3, accuracy: 1e-15)
+    }
+
+    func testWriteToFile() throws {
+        let path = NSTemporaryDirectory() + "mach-exception-metrics-\(getpid()).prom"
+        defer { unlink(path) }
+        try MachExceptionMetrics.write(toFile: path)
+        let exposition = try String(contentsOfFile: path, encoding: .utf8)
+        XCTAssert(exposition.hasPrefix("# HELP mach_exception_scopes_entered_total"))
+        XCTAssertThrowsError(try MachExceptionMetrics.write(toFile: "/nonexistent/metrics.prom"))
+    }
+
+    // Connect to a Unix-domain socket and read until the server closes the connection.
+    func read(socketPath path: String) throws -> String {
+#if os(Linux)
+        let descriptor = socket(AF_UNIX, Int32(SOCK_STREAM.rawValue), 0)
+#else
+        let descriptor = socket(AF_UNIX, SOCK_STREAM, 0)
+#endif
+        XCTAssertGreaterThanOrEqual(descriptor, 0)
+        defer { close(descriptor) }
+        var address = sockaddr_un()
+        address.sun_family = sa_family_t(AF_UNIX)
+        withUnsafeMutableBytes(of: &address.sun_path) { bytes in
+            bytes.copyBytes(from: path.utf8)
+        }
+        let result = withUnsafePointer(to: &address) {
+            $0.withMemoryRebound(to: sockaddr.self, capacity: 1) {
+                connect(descriptor, $0, socklen_t(MemoryLayout<sockaddr_un>.size))
+            }
+        }
+        XCTAssertEqual(result, 0)
+
+        var data = Data()
+        var buffer = [UInt8](repeating: 0, count: 4096)
+        while true {
+            let count = Foundation.read(descriptor, &buffer, buffer.count)
+            if count <= 0 {
+                break
+            }
+            data.append(buffer, count: count)
+        }
+        return String(decoding: data, as: UTF8.self)
+    }
+
+    func testServer() throws {
+        // Socket paths are limited to about 100 bytes, which a temporary directory can exceed.
+        let path = "/tmp/mach-exception-metrics-\(getpid()).sock"
+        var server: MachExceptionMetricsServer? = try MachExceptionMetricsServer(socketPath: path)
+        XCTAssertEqual(server?.socketPath, path)
+        for _ in 0 ..< 2 {
+            let exposition = try read(socketPath: path)
+            XCTAssert(exposition.hasPrefix("# HELP mach_exception_scopes_entered_total"))
+            XCTAssert(exposition.hasSuffix("\n"))
+        }
+        server = nil
+        XCTAssertFalse(FileManager.default.fileExists(atPath: path))
+    }
+}
@@ -0,0 +1,174 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+//
+// machExceptionPagedRegionTests.swift
+// Created by Patrick Gili on 2/20/23.
+//
+
+import Foundation
+import XCTest
+
+import mach_exception
+import mach_exception_helper
+
+@testable import mach_exception
+
+#if os(Linux)
+final class machExceptionPagedRegionTests: XCTestCase {
+
+    let pageSize = Int(sysconf(Int32(_SC_PAGESIZE)))
+
+    // Each 8-byte word of the region holds its own index.
+    let indexFill: MachExceptionPagedRegion.Fill = { offset, buffer in
+        let words = buffer.bindMemory(to: UInt64.self)
+        for index in words.indices {
+            words[index] = UInt64(offset / 8 + index)
+        }
+        return true
+    }
+
+    func makeRegion(size: Int,
+                    faultAround: Int = 16,
+                    prefetch: Int = 0,
+                    fill: MachExceptionPagedRegion.Fill? = nil) throws -> MachExceptionPagedRegion
+    {
+        do {
+            return try MachExceptionPagedRegion(size: size,
+                                                faultAround: faultAround,
+                                                prefetch: prefetch,
+                                                fill: fill ?? indexFill)
+        } catch let error as NSError where error.code == Int(EPERM) || error.code == Int(ENOSYS) {
+            throw XCTSkip("userfaultfd(2) isn't available to the process")
+        }
+    }
+
+    func testPagesAreFilledOnFirstTouch() throws {
+        let region = try makeRegion(size: 1 << 30)
+        let words = region.memory.bindMemory(to: UInt64.self)
+        XCTAssertEqual(region.statistics.faults, 0)
+        XCTAssertEqual(words[12_345_678], 12_345_678)
+        XCTAssertEqual(words[3], 3)
+        let statistics = region.statistics
+        XCTAssertEqual(statistics.faults, 2)
+        XCTAssertEqual(statistics.pages, 32)
+        XCTAssertGreaterThan(statistics.meanServiceTime, 0)
+    }
+
+    func testFaultAroundServesTheWindow() throws {
+        let region = try makeRegion(size: 64 * pageSize, faultAround: 8)
+        let bytes = region.memory
+        for page in 0 ..< 16 {
+            XCTAssertEqual(bytes.load(fromByteOffset: page * pageSize, as: UInt64.self), UInt64(page * pageSize / 8))
+        }
+        XCTAssertEqual(region.statistics.faults, 2)
+        XCTAssertEqual(region.statistics.pages, 16)
+    }
+
+    func testPrefetchServesFollowingPages() throws {
+        let region = try makeRegion(size: 64 * pageSize, faultAround: 4, prefetch: 12)
+        let bytes = region.memory
+        XCTAssertEqual(bytes.load(fromByteOffset: 0, as: UInt64.self), 0)
+        // Wait for the handler thread to finish prefetching, which it does after waking the faulting thread.
+        let deadline = Date(timeIntervalSinceNow: 5)
+        while region.statistics.prefetchedPages < 12 && Date() < deadline {
+            usleep(1_000)
+        }
+        XCTAssertEqual(region.statistics.prefetchedPages, 12)
+        for page in 0 ..< 16 {
+            XCTAssertEqual(bytes.load(fromByteOffset: page * pageSize, as: UInt64.self), UInt64(page * pageSize / 8))
+        }
+        XCTAssertEqual(region.statistics.faults, 1)
+    }
+
+    func testSequentialScanWithPrefetchNotAMultipleOfTheWindow() throws {
+        // A thread faulting on a prefetched page, whose copy woke no thread, must be woken when its fault is handled.
+        for (faultAround, prefetch) in [(16, 8), (8, 5), (1, 3)] {
+            let region = try makeRegion(size: 1_024 * pageSize, faultAround: faultAround, prefetch: prefetch)
+            for page in 0 ..< 1_024 {
+                XCTAssertEqual(region.memory.load(fromByteOffset: page * pageSize, as: UInt64.self),
+                               UInt64(page * pageSize / 8))
+            }
+        }
+    }
+
+    func testFailedFillProtectsOnlyTheFailedRun() throws {
+        let pageSize = self.pageSize
+        let region = try makeRegion(size: 64 * pageSize, faultAround: 16, prefetch: 8) { offset, buffer in
+            guard offset + buffer.count <= 24 * pageSize else {
+                return false
+            }
+            let words = buffer.bindMemory(to: UInt64.self)
+            for index in words.indices {
+                words[index] = UInt64(offset / 8 + index)
+            }
+            return true
+        }
+        let bytes = region.memory
+        XCTAssertEqual(bytes.load(fromByteOffset: 0, as: UInt64.self), 0)
+        let deadline = Date(timeIntervalSinceNow: 5)
+        while region.statistics.prefetchedPages < 8 && Date() < deadline {
+            usleep(1_000)
+        }
+
+        // The window of page 24 holds pages 16-23, prefetched, and pages 24-31, whose fill fails.
+        XCTAssertThrowsError(try withUnsafeMachException(types: [.badAccess]) {
+            _ = bytes.load(fromByteOffset: 24 * pageSize, as: UInt8.self)
+        })
+        XCTAssertEqual(region.statistics.failures, 1)
+        XCTAssertNoThrow(try withUnsafeMachException(types: [.badAccess]) {
+            XCTAssertEqual(bytes.load(fromByteOffset: 16 * pageSize, as: UInt64.self), UInt64(16 * pageSize / 8))
+            XCTAssertEqual(bytes.load(fromByteOffset: 23 * pageSize, as: UInt64.self), UInt64(23 * pageSize / 8))
+        })
+    }
+
+    func testFailedFillRaisesBadAccess() throws {
+        let pageSize = self.pageSize
+        let region = try makeRegion(size: 64 * pageSize, faultAround: 1) { offset, buffer in
+            return offset < 32 * pageSize
+        }
+        let bytes = region.memory
+        var caughtError: Error?
+        XCTAssertThrowsError(try withUnsafeMachException(types: [.badAccess]) {
+            _ = bytes.load(fromByteOffset: 0, as: UInt8.self)
+            _ = bytes.load(fromByteOffset: 40 * pageSize, as: UInt8.self)
+        }) { error in
+            caughtError = error
+        }
+        let machExceptionError = try XCTUnwrap(caughtError as? MachExceptionError)
+        XCTAssertEqual(machExceptionError.type, .badAccess)
+        XCTAssertEqual(region.statistics.failures, 1)
+    }
+
+    // A sequential scan touching a word per page of 64 MiB, with and without fault-around and prefetch, so the times
+    // reported compare the throughput of the configurations. `statistics` reports each one's fault-service latency
+    // and pages served per second.
+    func scan(faultAround: Int, prefetch: Int) throws {
+        let size = 64 << 20
+        let pageSize = self.pageSize
+        measure {
+            guard let region = try? makeRegion(size: size, faultAround: faultAround, prefetch: prefetch) else {
+                return
+            }
+            var sum: UInt64 = 0
+            for offset in stride(from: 0, to: size, by: pageSize) {
+                sum &+= region.memory.load(fromByteOffset: offset, as: UInt64.self)
+            }
+            XCTAssertNotEqual(sum, 0)
+        }
+    }
+
+    func testPerformanceScanSinglePages() throws {
+        try scan(faultAround: 1, prefetch: 0)
+    }
+
+    func testPerformanceScanFaultAround() throws {
+        try scan(faultAround: 16, prefetch: 0)
+    }
+
+    func testPerformanceScanFaultAroundAndPrefetch() throws {
+        try scan(faultAround: 16, prefetch: 256)
+    }
+}
+#endif
@@ -0,0 +1,212 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+//
+// machFloatingPointTrapsTests.swift
+// Created by Patrick Gili on 2/14/23.
+//
+
+import Foundation
+import XCTest
+
+import mach_exception
+import mach_exception_helper
+
+@testable import mach_exception
+
+final class machFloatingPointTrapsTests: XCTestCase {
+
+    // Kept out of reach of constant folding, so the division happens at run time.
+    var one = 1.0
+    var zero = 0.0
+    var quotient = 0.0
+
+    override func setUpWithError() throws {
+        var previous: Int32 = 0
+        guard mach_fp_traps_enter(Int32(FE_DIVBYZERO), &previous) else {
+            throw XCTSkip("The processor doesn't support trapping floating-point exceptions")
+        }
+        mach_fp_traps_leave(previous)
+    }
+
+    func testEnterAndLeaveNest() throws {
+        XCTAssertEqual(FloatingPointTraps.enabled, [])
+        var outer: Int32 = 0
+        var inner: Int32 = 0
+        XCTAssert(mach_fp_traps_enter(FloatingPointTraps.invalid.rawValue, &outer))
+        XCTAssert(mach_fp_traps_enter(FloatingPointTraps.divideByZero.rawValue, &inner))
+        XCTAssertEqual(mach_fp_traps_depth(), 2)
+        XCTAssertEqual(FloatingPointTraps.enabled, [.invalid, .divideByZero])
+        mach_fp_traps_leave(inner)
+        XCTAssertEqual(FloatingPointTraps.enabled, [.invalid])
+        mach_fp_traps_leave(outer)
+        XCTAssertEqual(mach_fp_traps_depth(), 0)
+        XCTAssertEqual(FloatingPointTraps.enabled, [])
+    }
+
+    func testDivideByZeroTraps() throws {
+        var finallyBlockWasExecuted = false
+        var caughtError: Error?
+        XCTAssertThrowsError(try withFloatingPointTraps([.divideByZero]) {
+            self.quotient = self.one / self.zero
+        } finally: {
+            finallyBlockWasExecuted = true
+        }) { error in
+            caughtError = error
+        }
+        XCTAssert(finallyBlockWasExecuted)
+        let machExceptionError = try XCTUnwrap(caughtError as? MachExceptionError)
+        XCTAssertEqual(machExceptionError.type, .arithmetic)
+        let arithmetic = try XCTUnwrap(machExceptionError.arithmetic)
+#if arch(arm) || arch(arm64)
+        XCTAssertEqual(arithmetic.code, .divideError)
+#elseif arch(i386) || arch(x86_64)
+        XCTAssertEqual(arithmetic.code, .simdOperationError)
+#endif
+        XCTAssertEqual(arithmetic.floatingPointExceptions, [.divideByZero])
+        XCTAssertEqual(FloatingPointTraps.enabled, [])
+        XCTAssertEqual(mach_fp_traps_depth(), 0)
+    }
+
+    func testUntrappedExceptionsDoNotTrap() throws {
+        XCTAssertNoThrow(try withFloatingPointTraps([.invalid]) {
+            self.quotient = self.one / self.zero
+        })
+        XCTAssertEqual(quotient, .infinity)
+    }
+
+    func testUntrappedFlagsSurviveLeavingTheScope() throws {
+        feclearexcept(FloatingPointTraps.all.rawValue)
+        XCTAssertNoThrow(try withFloatingPointTraps([.divideByZero]) {
+            self.quotient = self.one / (self.one + self.one + self.one)
+        })
+        XCTAssertNotEqual(fetestexcept(FloatingPointTraps.inexact.rawValue), 0)
+        feclearexcept(FloatingPointTraps.all.rawValue)
+    }
+
+    func testStickyModeSeesFlagsRaisedInAnInnerTrappingScope() throws {
+        var caughtError: Error?
+        XCTAssertThrowsError(try withFloatingPointTraps([.inexact], mode: .sticky) {
+            var previous: Int32 = 0
+            XCTAssert(mach_fp_traps_enter(FloatingPointTraps.divideByZero.rawValue, &previous))
+            self.quotient = self.one / (self.one + self.one + self.one)
+            mach_fp_traps_leave(previous)
+        }) { error in
+            caughtError = error
+        }
+        let machExceptionError = try XCTUnwrap(caughtError as? MachExceptionError)
+        XCTAssertEqual(machExceptionError.arithmetic?.floatingPointExceptions, [.inexact])
+        XCTAssertEqual(FloatingPointTraps.enabled, [])
+    }
+
+    func testTrapsRemainEnabledAfterCaughtException() throws {
+        var previous: Int32 = 0
+        XCTAssert(mach_fp_traps_enter(FloatingPointTraps.divideByZero.rawValue, &previous))
+        defer { mach_fp_traps_leave(previous) }
+        for _ in 0 ..< 2 {
+            XCTAssertThrowsError(try withUnsafeMachException(types: [.arithmetic]) {
+                self.quotient = self.one / self.zero
+            })
+            XCTAssertEqual(FloatingPointTraps.enabled, [.divideByZero])
+        }
+    }
+
+    func testStickyModeReportsSameCodeAsTrapping() throws {
+        var finallyBlockWasExecuted = false
+        var caughtError: Error?
+        XCTAssertThrowsError(try withFloatingPointTraps([.divideByZero], mode: .sticky) {
+            self.quotient = self.one / self.zero
+        } finally: {
+            finallyBlockWasExecuted = true
+        }) { error in
+            caughtError = error
+        }
+        XCTAssert(finallyBlockWasExecuted)
+        // The operation ran to completion.
+        XCTAssertEqual(quotient, .infinity)
+        let machExceptionError = try XCTUnwrap(caughtError as? MachExceptionError)
+        XCTAssertEqual(machExceptionError.type, .arithmetic)
+        let arithmetic = try XCTUnwrap(machExceptionError.arithmetic)
+#if arch(arm) || arch(arm64)
+        XCTAssertEqual(arithmetic.code, .divideError)
+#elseif arch(i386) || arch(x86_64)
+        XCTAssertEqual(arithmetic.code, .simdOperationError)
+#endif
+        XCTAssertEqual(arithmetic.floatingPointExceptions, [.divideByZero])
+        XCTAssertEqual(FloatingPointTraps.enabled, [])
+    }
+
+    func testStickyModeIgnoresUnwatchedExceptions() throws {
+        XCTAssertNoThrow(try withFloatingPointTraps([.invalid, .overflow], mode: .sticky) {
+            self.quotient = self.one / self.zero
+        })
+        XCTAssertEqual(quotient, .infinity)
+    }
+
+    func testStickyModeIgnoresFlagsRaisedBeforeEntry() throws {
+        var previous: Int32 = 0
+        mach_fp_flags_enter(FloatingPointTraps.divideByZero.rawValue, &previous)
+        quotient = one / zero
+        XCTAssertNoThrow(try withFloatingPointTraps([.divideByZero], mode: .sticky) {
+            self.quotient = self.one + self.one
+        })
+        // Leaving the inner scope restored the flag raised before it, so the outer scope still sees it.
+        XCTAssertEqual(mach_fp_flags_leave(FloatingPointTraps.divideByZero.rawValue, previous), Int32(FE_DIVBYZERO))
+    }
+
+#if arch(i386) || arch(x86_64)
+    func testStickyModeReportsEveryException() throws {
+        var caughtError: Error?
+        XCTAssertThrowsError(try withFloatingPointTraps([.invalid, .divideByZero], mode: .sticky) {
+            self.quotient = self.one / self.zero
+            self.quotient = self.zero / self.zero
+        }) { error in
+            caughtError = error
+        }
+        let machExceptionError = try XCTUnwrap(caughtError as? MachExceptionError)
+        XCTAssertEqual(machExceptionError.arithmetic?.floatingPointExceptions, [.invalid, .divideByZero])
+    }
+#endif
+
+    // Each iteration enters and leaves a scope that toggles the traps, so the time reported divided by 100,000 is the
+    // cost per entry, including the write to the control register on entry and on exit.
+    func testPerformanceScopeEntry() throws {
+        measure {
+            for _ in 0 ..< 100_000 {
+                var previous: Int32 = 0
+                _ = mach_fp_traps_enter(FloatingPointTraps.divideByZero.rawValue, &previous)
+                mach_fp_traps_leave(previous)
+            }
+        }
+    }
+
+    // A dense kernel, executed in batches of 4,096 elements, each in its own scope, so the times reported by the two
+    // tests below compare the throughput of the trapping and sticky modes.
+    private func denseKernel(_ x: [Double], _ y: inout [Double]) {
+        let a = one
+        for index in 0 ..< y.count {
+            y[index] = y[index] * a + x[index] / (y[index] + a)
+        }
+    }
+
+    private func measureDenseKernel(mode: FloatingPointExceptionMode) {
+        let x = (0 ..< 4_096).map { Double($0) * 0.5 }
+        var y = (0 ..< 4_096).map { Double($0) }
+        measure {
+            for _ in 0 ..< 1_000 {
+                try? withFloatingPointTraps([.invalid, .divideByZero, .overflow], mode: mode) {
+                    self.denseKernel(x, &y)
+                }
+            }
+        }
+    }
+
+    func testPerformanceDenseKernelTrapping() throws {
+        measureDenseKernel(mode: .trapping)
+    }
+
+    func testPerformanceDenseKernelSticky() throws {
+        measureDenseKernel(mode: .sticky)
+    }
+}
@@ -0,0 +1,117 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+//
+// machGuardedBufferTests.swift
+// Created by Patrick Gili on 2/22/23.
+//
+
+import Foundation
+import XCTest
+
+import mach_exception
+import mach_exception_helper
+
+@testable import mach_exception
+
+final class machGuardedBufferTests: XCTestCase {
+
+    func testBufferIsZeroFilledAndEndsAtGuard() throws {
+        let buffer = try MachGuardedBuffer(byteCount: 1_000, maximumStride: 1)
+        let bytes = UnsafeMutableRawBufferPointer(start: buffer.baseAddress, count: buffer.byteCount)
+        XCTAssert(bytes.allSatisfy { $0 == 0 })
+        var offset: UInt64 = 0
+        XCTAssert(mach_guarded_buffer_guards(&buffer.buffer, UInt64(UInt(bitPattern: buffer.baseAddress + 1_000)),
+                                             &offset))
+        XCTAssertEqual(offset, 1_000)
+        XCTAssertFalse(mach_guarded_buffer_guards(&buffer.buffer, UInt64(UInt(bitPattern: buffer.baseAddress + 999)),
+                                                  &offset))
+    }
+
+    func testUncheckedAccessWithinBounds() throws {
+        let array = try MachGuardedArray((0 ..< 1_000).map { Double($0) })
+        let sum = try array.withUncheckedAccess { array -> Double in
+            var sum = 0.0
+            for index in 0 ..< array.count {
+                sum += array[index]
+            }
+            return sum
+        }
+        XCTAssertEqual(sum, 499_500)
+    }
+
+    func testOverrunThrowsOutOfBounds() throws {
+        let array = try MachGuardedArray(repeating: 1.0, count: 1_000)
+        XCTAssertThrowsError(try array.withUncheckedAccess { array -> Double in
+            var sum = 0.0
+            // The loop's bound is wrong, so it runs off the end of the array.
+            for index in 0 ..< array.count + 100 {
+                sum += array[index]
+            }
+            return sum
+        }) { error in
+            XCTAssertEqual(error as? MachExceptionOutOfBoundsError,
+                           MachExceptionOutOfBoundsError(offset: 8_000, byteCount: 8_000))
+        }
+    }
+
+    func testOverrunWithDeclaredStrideThrowsOutOfBounds() throws {
+        let array = try MachGuardedArray(repeating: Int32(1), count: 10_000, maximumStride: 3_000)
+        XCTAssertGreaterThanOrEqual(array.maximumStride, 3_000)
+        XCTAssertThrowsError(try array.withUncheckedAccess { array in
+            var index = 0
+            while true {
+                array[index] += 1
+                index += 3_000
+            }
+        }) { error in
+            XCTAssertEqual(error as? MachExceptionOutOfBoundsError,
+                           MachExceptionOutOfBoundsError(offset: 12_000 * 4, byteCount: 40_000))
+        }
+    }
+
+    func testFaultOutsideGuardIsBadAccess() throws {
+        let buffer = try MachGuardedBuffer(byteCount: 64, maximumStride: 8)
+        XCTAssertThrowsError(try buffer.withUncheckedAccess { _ in
+            UnsafeMutablePointer<UInt8>(bitPattern: 8)!.pointee = 0
+        }) { error in
+            XCTAssertEqual((error as? MachExceptionError)?.type, .badAccess)
+        }
+    }
+
+    // MARK: - Performance
+
+    // The two tests below sum 16M doubles ten times, so the times they report compare unchecked access to a guarded
+    // array with checked access to a Swift array.
+    static let count = 1 << 24
+
+    func testPerformanceGuardedArrayScan() throws {
+        let array = try MachGuardedArray(repeating: 1.0, count: Self.count)
+        measure {
+            let sum = try? array.withUncheckedAccess { array -> Double in
+                var sum = 0.0
+                for _ in 0 ..< 10 {
+                    for index in 0 ..< array.count {
+                        sum += array[index]
+                    }
+                }
+                return sum
+            }
+            XCTAssertEqual(sum, Double(10 * Self.count))
+        }
+    }
+
+    func testPerformanceCheckedArrayScan() throws {
+        let array = [Double](repeating: 1.0, count: Self.count)
+        measure {
+            var sum = 0.0
+            for _ in 0 ..< 10 {
+                for index in 0 ..< array.count {
+                    sum += array[index]
+                }
+            }
+            XCTAssertEqual(sum, Double(10 * Self.count))
+        }
+    }
+}
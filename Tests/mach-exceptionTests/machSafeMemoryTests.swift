@@ -0,0 +1,68 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+//
+// machSafeMemoryTests.swift
+// Created by Patrick Gili on 3/2/23.
+//
+
+import Foundation
+import XCTest
+
+import mach_exception
+import mach_exception_helper
+
+@testable import mach_exception
+
+final class machSafeMemoryTests: XCTestCase {
+
+    override func setUpWithError() throws {
+        try prepareSafeMemoryAccess()
+    }
+
+    func testSafeLoad() throws {
+        let words: [Int64] = [-2, 0x1234_5678]
+        words.withUnsafeBytes { bytes in
+            XCTAssertEqual(safeLoad(from: bytes.baseAddress!, as: Int64.self), -2)
+            XCTAssertEqual(safeLoad(from: bytes.baseAddress!, as: Int8.self), -2)
+            XCTAssertEqual(safeLoad(from: bytes.baseAddress! + 8, as: UInt16.self), 0x5678)
+            XCTAssertEqual(safeLoad(from: bytes.baseAddress! + 8, as: UInt32.self), 0x1234_5678)
+        }
+        XCTAssertNil(safeLoad(from: UnsafeRawPointer(bitPattern: 0x40)!, as: UInt64.self))
+    }
+
+    func testSafeMemcpyAndMemcmp() throws {
+        let source = [UInt8](0 ..< 200)
+        var destination = [UInt8](repeating: 0, count: 200)
+        XCTAssert(safeMemcpy(&destination, source, 200))
+        XCTAssertEqual(destination, source)
+        XCTAssertEqual(safeMemcmp(destination, source, 200), 0)
+        destination[150] = 0
+        XCTAssertEqual(safeMemcmp(destination, source, 200), -1)
+        XCTAssertEqual(safeMemcmp(source, destination, 200), 1)
+
+        XCTAssertFalse(safeMemcpy(&destination, UnsafeRawPointer(bitPattern: 0x40)!, 8))
+        XCTAssertNil(safeMemcmp(source, UnsafeRawPointer(bitPattern: 0x40)!, 8))
+    }
+
+    func testPerformanceSafeMemcpy() throws {
+        let source = [UInt8](repeating: 1, count: 4_096)
+        var destination = [UInt8](repeating: 0, count: 4_096)
+        measure {
+            for _ in 0 ..< 100_000 {
+                safeMemcpy(&destination, source, 4_096)
+            }
+        }
+    }
+
+    func testPerformanceMemcpy() throws {
+        let source = [UInt8](repeating: 1, count: 4_096)
+        var destination = [UInt8](repeating: 0, count: 4_096)
+        measure {
+            for _ in 0 ..< 100_000 {
+                memcpy(&destination, source, 4_096)
+            }
+        }
+    }
+}
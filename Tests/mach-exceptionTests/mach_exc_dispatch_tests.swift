@@ -0,0 +1,280 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// mach-exception
+// mach_exc_dispatch_tests.swift
+// Created by Patrick Gili on 2/4/23.
+//
+
+import Foundation
+import XCTest
+
+import mach_exception_helper
+
+// The arguments the dispatch core passed to a handler, recorded through the handlers' context.
+private final class DispatchRecorder {
+    var calls = 0
+    var exceptionPort: mach_port_name_t = 0
+    var thread: mach_port_name_t = 0
+    var task: mach_port_name_t = 0
+    var exception: exception_type_t = 0
+    var codes: [mach_exception_data_type_t] = []
+    var flavor: Int32 = 0
+    var state: [natural_t] = []
+}
+
+final class mach_exc_dispatch_tests: XCTestCase {
+
+    let requestSize = 1024
+    let replySize = 44 + 4 * Int(MACH_EXC_DISPATCH_STATE_MAX)
+    var request: UnsafeMutableRawPointer!
+    var reply: UnsafeMutableRawPointer!
+    private var recorder: DispatchRecorder!
+    var handlers = mach_exc_dispatch_handlers_t()
+
+    override func setUp() {
+        request = UnsafeMutableRawPointer.allocate(byteCount: requestSize, alignment: 8)
+        request.initializeMemory(as: UInt8.self, repeating: 0, count: requestSize)
+        reply = UnsafeMutableRawPointer.allocate(byteCount: replySize, alignment: 8)
+        reply.initializeMemory(as: UInt8.self, repeating: 0xff, count: replySize)
+        recorder = DispatchRecorder()
+        handlers = mach_exc_dispatch_handlers_t()
+        handlers.context = Unmanaged.passUnretained(recorder).toOpaque()
+        handlers.raise = { context, exceptionPort, thread, task, exception, code, codeCnt in
+            let recorder = Unmanaged<DispatchRecorder>.fromOpaque(context!).takeUnretainedValue()
+            recorder.calls += 1
+            recorder.exceptionPort = exceptionPort
+            recorder.thread = thread
+            recorder.task = task
+            recorder.exception = exception
+            recorder.codes = Array(UnsafeBufferPointer(start: code, count: Int(codeCnt)))
+            return KERN_SUCCESS
+        }
+        handlers.raise_state_identity = { context, exceptionPort, thread, task, exception, code, codeCnt,
+                                          flavor, oldState, oldStateCnt, newState, newStateCnt in
+            let recorder = Unmanaged<DispatchRecorder>.fromOpaque(context!).takeUnretainedValue()
+            recorder.calls += 1
+            recorder.exceptionPort = exceptionPort
+            recorder.thread = thread
+            recorder.task = task
+            recorder.exception = exception
+            recorder.codes = Array(UnsafeBufferPointer(start: code, count: Int(codeCnt)))
+            recorder.flavor = flavor!.pointee
+            recorder.state = Array(UnsafeBufferPointer(start: oldState, count: Int(oldStateCnt)))
+            // Resume past the faulting instruction, as the library's handler does.
+            for index in 0 ..< Int(oldStateCnt) {
+                newState![index] = oldState![index] &+ 1
+            }
+            newStateCnt!.pointee = oldStateCnt
+            return KERN_SUCCESS
+        }
+    }
+
+    override func tearDown() {
+        request.deallocate()
+        reply.deallocate()
+    }
+
+    // MARK: - Message construction
+
+    func store(_ value: UInt32, at offset: Int, in buffer: UnsafeMutableRawPointer) {
+        buffer.storeBytes(of: value, toByteOffset: offset, as: UInt32.self)
+    }
+
+    func load(at offset: Int, in buffer: UnsafeMutableRawPointer) -> UInt32 {
+        return buffer.load(fromByteOffset: offset, as: UInt32.self)
+    }
+
+    // Codes are 8 bytes wide, but only 4-byte aligned on the wire.
+    func storeCode(_ value: Int64, at offset: Int) {
+        store(UInt32(truncatingIfNeeded: value), at: offset, in: request)
+        store(UInt32(truncatingIfNeeded: value >> 32), at: offset + 4, in: request)
+    }
+
+    func storePortDescriptor(name: mach_port_name_t, at offset: Int, disposition: UInt8 = 17) {
+        store(name, at: offset, in: request)
+        request.storeBytes(of: disposition, toByteOffset: offset + 10, as: UInt8.self)
+        request.storeBytes(of: 0, toByteOffset: offset + 11, as: UInt8.self)
+    }
+
+    // Build a mach_exception_raise_state_identity request, returning its size.
+    @discardableResult
+    func buildRaiseStateIdentity(codes: [Int64], flavor: Int32, state: [UInt32]) -> Int {
+        let codeOffset = 68
+        let flavorOffset = codeOffset + 8 * codes.count
+        let size = flavorOffset + 8 + 4 * state.count
+        store(0x8000_0000 | 18, at: 0, in: request)
+        store(UInt32(size), at: 4, in: request)
+        store(0x0103, at: 8, in: request)
+        store(0x0207, at: 12, in: request)
+        store(UInt32(MACH_EXC_DISPATCH_RAISE_STATE_IDENTITY), at: 20, in: request)
+        store(2, at: 24, in: request)
+        storePortDescriptor(name: 0x0303, at: 28)
+        storePortDescriptor(name: 0x0403, at: 40)
+        store(UInt32(EXC_BAD_ACCESS), at: codeOffset - 8, in: request)
+        store(UInt32(codes.count), at: codeOffset - 4, in: request)
+        for (index, code) in codes.enumerated() {
+            storeCode(code, at: codeOffset + 8 * index)
+        }
+        store(UInt32(bitPattern: flavor), at: flavorOffset, in: request)
+        store(UInt32(state.count), at: flavorOffset + 4, in: request)
+        for (index, word) in state.enumerated() {
+            store(word, at: flavorOffset + 8 + 4 * index, in: request)
+        }
+        return size
+    }
+
+    // Build a mach_exception_raise request, returning its size.
+    @discardableResult
+    func buildRaise(codes: [Int64]) -> Int {
+        let size = 68 + 8 * codes.count
+        store(0x8000_0000 | 18, at: 0, in: request)
+        store(UInt32(size), at: 4, in: request)
+        store(0x0103, at: 8, in: request)
+        store(0x0207, at: 12, in: request)
+        store(UInt32(MACH_EXC_DISPATCH_RAISE), at: 20, in: request)
+        store(2, at: 24, in: request)
+        storePortDescriptor(name: 0x0303, at: 28)
+        storePortDescriptor(name: 0x0403, at: 40)
+        store(UInt32(EXC_BAD_INSTRUCTION), at: 60, in: request)
+        store(UInt32(codes.count), at: 64, in: request)
+        for (index, code) in codes.enumerated() {
+            storeCode(code, at: 68 + 8 * index)
+        }
+        return size
+    }
+
+    // MARK: - Dispatch
+
+    func testRaiseStateIdentity() throws {
+        buildRaiseStateIdentity(codes: [1, 0x1_0000_0010], flavor: 4, state: [10, 20, 30])
+        XCTAssert(mach_exc_dispatch(&handlers, request, requestSize, reply))
+        XCTAssertEqual(mach_exc_dispatch_reply_code(reply), KERN_SUCCESS)
+        XCTAssertEqual(recorder.calls, 1)
+        XCTAssertEqual(recorder.exceptionPort, 0x0207)
+        XCTAssertEqual(recorder.thread, 0x0303)
+        XCTAssertEqual(recorder.task, 0x0403)
+        XCTAssertEqual(recorder.exception, exception_type_t(EXC_BAD_ACCESS))
+        XCTAssertEqual(recorder.codes, [1, 0x1_0000_0010])
+        XCTAssertEqual(recorder.flavor, 4)
+        XCTAssertEqual(recorder.state, [10, 20, 30])
+
+        // The reply returns the send-once right to the request's reply port, and carries the new state.
+        XCTAssertEqual(load(at: 0, in: reply), 18)
+        XCTAssertEqual(load(at: 4, in: reply), 44 + 4 * 3)
+        XCTAssertEqual(load(at: 8, in: reply), 0x0103)
+        XCTAssertEqual(load(at: 20, in: reply), UInt32(MACH_EXC_DISPATCH_RAISE_STATE_IDENTITY + 100))
+        XCTAssertEqual(load(at: 36, in: reply), 4)
+        XCTAssertEqual(load(at: 40, in: reply), 3)
+        XCTAssertEqual(load(at: 44, in: reply), 11)
+        XCTAssertEqual(load(at: 48, in: reply), 21)
+        XCTAssertEqual(load(at: 52, in: reply), 31)
+    }
+
+    func testRaiseWithOneCode() throws {
+        buildRaise(codes: [7])
+        XCTAssert(mach_exc_dispatch(&handlers, request, requestSize, reply))
+        XCTAssertEqual(mach_exc_dispatch_reply_code(reply), KERN_SUCCESS)
+        XCTAssertEqual(recorder.calls, 1)
+        XCTAssertEqual(recorder.exception, exception_type_t(EXC_BAD_INSTRUCTION))
+        XCTAssertEqual(recorder.codes, [7])
+        XCTAssertEqual(load(at: 4, in: reply), 36)
+        XCTAssertEqual(load(at: 20, in: reply), UInt32(MACH_EXC_DISPATCH_RAISE + 100))
+    }
+
+    func testUnknownIdentifier() throws {
+        buildRaise(codes: [7])
+        store(1234, at: 20, in: request)
+        XCTAssertFalse(mach_exc_dispatch(&handlers, request, requestSize, reply))
+        XCTAssertEqual(mach_exc_dispatch_reply_code(reply), MIG_BAD_ID)
+        XCTAssertEqual(load(at: 20, in: reply), 1334)
+        XCTAssertEqual(recorder.calls, 0)
+    }
+
+    func testUnimplementedRoutine() throws {
+        buildRaiseStateIdentity(codes: [1], flavor: 4, state: [10])
+        handlers.raise_state_identity = nil
+        XCTAssertFalse(mach_exc_dispatch(&handlers, request, requestSize, reply))
+        XCTAssertEqual(mach_exc_dispatch_reply_code(reply), MIG_BAD_ID)
+    }
+
+    func testSizeMismatch() throws {
+        let size = buildRaiseStateIdentity(codes: [1, 2], flavor: 4, state: [10, 20])
+        store(UInt32(size + 4), at: 4, in: request)
+        XCTAssert(mach_exc_dispatch(&handlers, request, requestSize, reply))
+        XCTAssertEqual(mach_exc_dispatch_reply_code(reply), MIG_BAD_ARGUMENTS)
+        XCTAssertEqual(load(at: 4, in: reply), 36)
+        XCTAssertEqual(recorder.calls, 0)
+    }
+
+    func testSizeBeyondBuffer() throws {
+        let size = buildRaiseStateIdentity(codes: [1, 2], flavor: 4, state: [10, 20])
+        XCTAssert(mach_exc_dispatch(&handlers, request, size - 4, reply))
+        XCTAssertEqual(mach_exc_dispatch_reply_code(reply), MIG_BAD_ARGUMENTS)
+        XCTAssertEqual(recorder.calls, 0)
+    }
+
+    func testTooManyCodes() throws {
+        buildRaise(codes: [1, 2])
+        store(3, at: 64, in: request)
+        XCTAssert(mach_exc_dispatch(&handlers, request, requestSize, reply))
+        XCTAssertEqual(mach_exc_dispatch_reply_code(reply), MIG_BAD_ARGUMENTS)
+        XCTAssertEqual(recorder.calls, 0)
+    }
+
+    func testWrongDisposition() throws {
+        buildRaiseStateIdentity(codes: [1], flavor: 4, state: [10])
+        storePortDescriptor(name: 0x0303, at: 28, disposition: 16)
+        XCTAssert(mach_exc_dispatch(&handlers, request, requestSize, reply))
+        XCTAssertEqual(mach_exc_dispatch_reply_code(reply), MIG_TYPE_ERROR)
+        XCTAssertEqual(recorder.calls, 0)
+    }
+
+    func testHandlerFailure() throws {
+        buildRaiseStateIdentity(codes: [1], flavor: 4, state: [10])
+        handlers.raise_state_identity = { _, _, _, _, _, _, _, _, _, _, _, _ in KERN_FAILURE }
+        XCTAssert(mach_exc_dispatch(&handlers, request, requestSize, reply))
+        XCTAssertEqual(mach_exc_dispatch_reply_code(reply), KERN_FAILURE)
+        XCTAssertEqual(load(at: 4, in: reply), 36)
+    }
+
+    // MARK: - Arena
+
+    func testArena() throws {
+        var arena = mach_exc_arena_t()
+        XCTAssert(mach_exc_arena_init(&arena, 64))
+        XCTAssertNotNil(arena.request)
+        XCTAssertNotNil(arena.reply)
+        XCTAssertEqual(arena.request_size, 64)
+        XCTAssertEqual(arena.reply_size, replySize)
+
+        // Reserving no more than the buffer holds keeps the buffer.
+        let request = arena.request
+        XCTAssert(mach_exc_arena_reserve(&arena, 32))
+        XCTAssertEqual(arena.request, request)
+        XCTAssertEqual(arena.request_size, 64)
+
+        XCTAssert(mach_exc_arena_reserve(&arena, 4096))
+        XCTAssertEqual(arena.request_size, 4096)
+
+        mach_exc_arena_destroy(&arena)
+        XCTAssertNil(arena.request)
+        XCTAssertNil(arena.reply)
+        XCTAssertEqual(arena.request_size, 0)
+    }
+
+    // MARK: - Performance
+
+    func testPerformanceDispatch() throws {
+        // A request the size of x86_THREAD_STATE64's, dispatched repeatedly from the same buffers.
+        let state = [UInt32](repeating: 0, count: 42)
+        buildRaiseStateIdentity(codes: [1, 0x10], flavor: 4, state: state)
+        measure {
+            for _ in 0 ..< 100_000 {
+                mach_exc_dispatch(&handlers, request, requestSize, reply)
+            }
+        }
+        XCTAssertEqual(mach_exc_dispatch_reply_code(reply), KERN_SUCCESS)
+    }
+}
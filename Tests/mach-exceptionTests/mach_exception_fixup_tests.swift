@@ -0,0 +1,148 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+//
+// mach_exception_fixup_tests.swift
+// Created by Patrick Gili on 3/2/23.
+//
+
+import Foundation
+import XCTest
+
+import mach_exception
+import mach_exception_helper
+
+@testable import mach_exception
+
+final class mach_exception_fixup_tests: XCTestCase {
+
+    var table: [mach_exception_fixup_t] {
+        var count = 0
+        let table = mach_exception_fixup_table(&count)!
+        return Array(UnsafeBufferPointer(start: table, count: count))
+    }
+
+    func testTableIsSortedAndDisjoint() throws {
+        let table = self.table
+#if arch(x86_64)
+        XCTAssertEqual(table.count, 7)
+#else
+        XCTAssertEqual(table.count, 6)
+#endif
+        for (index, range) in table.enumerated() {
+            XCTAssertLessThan(range.begin, range.end)
+            XCTAssertNotEqual(range.fixup, 0)
+            if index > 0 {
+                XCTAssertLessThanOrEqual(table[index - 1].end, range.begin)
+            }
+        }
+    }
+
+    func testFindHitsAndMisses() throws {
+        for range in table {
+            XCTAssertEqual(mach_exception_fixup_find(range.begin), range.fixup)
+            XCTAssertEqual(mach_exception_fixup_find(range.end - 1), range.fixup)
+        }
+        XCTAssertEqual(mach_exception_fixup_find(0), 0)
+        XCTAssertEqual(mach_exception_fixup_find(table[0].begin - 1), 0)
+        XCTAssertEqual(mach_exception_fixup_find(UInt64.max), 0)
+    }
+
+    func testApplyRewritesOnlyTheProgramCounter() throws {
+        let range = table[4]
+        let layout = mach_exception_resume_host_layout!
+        var context = [UInt64](repeating: 0, count: 128)
+        let pc = Int(layout.pointee.pc) / 8
+        context[pc] = range.begin
+        var expected = context
+        expected[pc] = range.fixup
+        XCTAssert(context.withUnsafeMutableBytes { mach_exception_fixup_apply(layout, $0.baseAddress!) })
+        XCTAssertEqual(context, expected)
+
+        context[pc] = 0x1000
+        expected = context
+        XCTAssertFalse(context.withUnsafeMutableBytes { mach_exception_fixup_apply(layout, $0.baseAddress!) })
+        XCTAssertEqual(context, expected)
+    }
+
+    func testProbesOfReadableMemory() throws {
+        var error: Int32 = 0
+        XCTAssert(mach_exception_fixup_prepare(&error))
+        let words: [UInt64] = [0x0807_0605_0403_0201, 0x100f_0e0d_0c0b_0a09]
+        words.withUnsafeBytes { bytes in
+            var value8: UInt8 = 0
+            var value16: UInt16 = 0
+            var value32: UInt32 = 0
+            var value64: UInt64 = 0
+            XCTAssertEqual(mach_exception_safe_load8(bytes.baseAddress! + 3, &value8), 0)
+            XCTAssertEqual(mach_exception_safe_load16(bytes.baseAddress! + 2, &value16), 0)
+            XCTAssertEqual(mach_exception_safe_load32(bytes.baseAddress! + 4, &value32), 0)
+            XCTAssertEqual(mach_exception_safe_load64(bytes.baseAddress! + 8, &value64), 0)
+            XCTAssertEqual(value8, 0x04)
+            XCTAssertEqual(value16, 0x0403)
+            XCTAssertEqual(value32, 0x0807_0605)
+            XCTAssertEqual(value64, 0x100f_0e0d_0c0b_0a09)
+        }
+    }
+
+    func testMemcpyAndMemcmpMatchLibc() throws {
+        let source = (0 ..< 5_000).map { _ in UInt8.random(in: 0 ... 255) }
+        for count in Array(0 ... 300) + [511, 1_000, 2_047, 2_048, 4_095, 4_096, 4_097] {
+            var destination = [UInt8](repeating: 0xaa, count: count + 1)
+            XCTAssertEqual(mach_exception_safe_memcpy(&destination, source, count), 0)
+            XCTAssertEqual(destination[..<count], source[..<count])
+            XCTAssertEqual(destination[count], 0xaa)
+
+            var result: Int32 = 2
+            XCTAssertEqual(mach_exception_safe_memcmp(destination, source, count, &result), 0)
+            XCTAssertEqual(result, 0)
+            if count > 0 {
+                let index = Int.random(in: 0 ..< count)
+                destination[index] ^= UInt8.random(in: 1 ... 255)
+                let expected = memcmp(destination, source, count).signum()
+                XCTAssertEqual(mach_exception_safe_memcmp(destination, source, count, &result), 0)
+                XCTAssertEqual(result, expected)
+            }
+        }
+    }
+
+    func testProbesOfInaccessibleMemoryReturnEFAULT() throws {
+        var error: Int32 = 0
+        XCTAssert(mach_exception_fixup_prepare(&error))
+        let pageSize = Int(getpagesize())
+        let pages = mmap(nil, 2 * pageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)!
+        defer { munmap(pages, 2 * pageSize) }
+        XCTAssertEqual(mprotect(pages + pageSize, pageSize, PROT_NONE), 0)
+        memset(pages, 1, pageSize)
+        let guarded = UnsafeRawPointer(pages + pageSize)
+
+        var value64: UInt64 = 7
+        XCTAssertEqual(mach_exception_safe_load64(guarded, &value64), EFAULT)
+        XCTAssertEqual(mach_exception_safe_load64(nil, &value64), EFAULT)
+        XCTAssertEqual(value64, 7)
+
+        // A buffer straddling the guard page faults part way, leaving a prefix of its bytes copied.
+        var destination = [UInt8](repeating: 0, count: 4_096)
+        XCTAssertEqual(mach_exception_safe_memcpy(&destination, guarded - 1_000, 4_096), EFAULT)
+        XCTAssert(destination.prefix { $0 == 1 }.count <= 1_000)
+        XCTAssertEqual(mach_exception_safe_memcpy(&destination, guarded - 300, 600), EFAULT)
+        XCTAssertEqual(mach_exception_safe_memcpy(&destination, guarded - 20, 40), EFAULT)
+        XCTAssertEqual(mach_exception_safe_memcpy(pages + pageSize - 10, destination, 100), EFAULT)
+
+        var result: Int32 = 2
+        XCTAssertEqual(mach_exception_safe_memcmp(guarded - 100, guarded - 100, 200, &result), EFAULT)
+        XCTAssertEqual(result, 2)
+    }
+
+    func testProbeFaultsNeverReachAnEnclosingScope() throws {
+        var error: Int32 = 0
+        XCTAssert(mach_exception_fixup_prepare(&error))
+        var status: Int32 = 0
+        try withUnsafeMachException(types: [.badAccess]) {
+            var value: UInt32 = 0
+            status = mach_exception_safe_load32(UnsafeRawPointer(bitPattern: 0x18), &value)
+        }
+        XCTAssertEqual(status, EFAULT)
+    }
+}
@@ -8,7 +8,9 @@
 //
 
 import Foundation
+#if canImport(Darwin)
 import Darwin
+#endif
 import XCTest
 
 import mach_exception
@@ -16,6 +18,7 @@ import mach_exception_helper
 
 @testable import mach_exception
 
+#if canImport(Darwin)
 final class mach_exception_helper_tests: XCTestCase {
     
     func testCatchMachExceptionRaise() throws {
@@ -106,6 +109,29 @@ final class mach_exception_helper_tests: XCTestCase {
         XCTAssertEqual(machExceptionError.type, .badAccess)
     }
     
+    func testPerformWithFault() throws {
+        let dependencies = TestableDependencies()
+        let helper = try MachExceptionHelper(mask: exception_mask_t(EXC_MASK_BAD_ACCESS), dependencies: dependencies)
+        let listener = Thread {
+            try? helper.listen(withTimeout: 10_000)
+        }
+        listener.start()
+        var finallyBlockWasExecuted = false
+        var performError: NSError?
+        XCTAssertThrowsError(
+            try helper.perform {
+                UnsafeMutablePointer<Int>(bitPattern: 0x10)!.pointee = 1
+            } finally: {
+                finallyBlockWasExecuted = true
+            }) { error in
+                performError = error as NSError
+            }
+        XCTAssert(finallyBlockWasExecuted)
+        let error = try XCTUnwrap(performError)
+        let machExceptionError = try XCTUnwrap(MachExceptionError(error))
+        XCTAssertEqual(machExceptionError.type, .badAccess)
+    }
+
     func testPerformWithOtherException() throws {
         let dependencies = TestableDependencies()
         let helper = try MachExceptionHelper(mask: exception_mask_t(EXC_MASK_BAD_ACCESS), dependencies: dependencies)
@@ -132,6 +158,188 @@ final class mach_exception_helper_tests: XCTestCase {
         XCTAssertEqual(error.code, 0)
         XCTAssertEqual(error.userInfo.count, 0)
     }
+    
+    func raiseMachException(_ type: exception_type_t) {
+        let name: NSExceptionName = NSExceptionName(rawValue: MachExceptionErrorDomain)
+        let machException = MachException(name: name, reason: "Mach exception")
+        machException.type = type
+        machException.raise()
+    }
+    
+    func testPerformWithMaskWithNoException() throws {
+        let dependencies = TestableDependencies()
+        var tryBlockWasExecuted = false
+        var finallyBlockWasExecuted = false
+        XCTAssertNoThrow(
+            try MachExceptionHelper.perform(withMask: exception_mask_t(EXC_MASK_BAD_ACCESS),
+                                            dependencies: dependencies) {
+                tryBlockWasExecuted = true
+                XCTAssertEqual(MachExceptionHelper.activeMask, exception_mask_t(EXC_MASK_BAD_ACCESS))
+            } finally: {
+                finallyBlockWasExecuted = true
+            })
+        XCTAssert(tryBlockWasExecuted)
+        XCTAssert(finallyBlockWasExecuted)
+        XCTAssertEqual(MachExceptionHelper.activeMask, 0)
+        XCTAssertEqual(MachExceptionHelper.installedMask & exception_mask_t(EXC_MASK_BAD_ACCESS),
+                       exception_mask_t(EXC_MASK_BAD_ACCESS))
+    }
+    
+    func testPerformWithMaskWithMachException() throws {
+        let dependencies = TestableDependencies()
+        var finallyBlockWasExecuted = false
+        var performError: NSError?
+        XCTAssertThrowsError(
+            try MachExceptionHelper.perform(withMask: exception_mask_t(EXC_MASK_BAD_ACCESS),
+                                            dependencies: dependencies) {
+                self.raiseMachException(EXC_BAD_ACCESS)
+            } finally: {
+                finallyBlockWasExecuted = true
+            }) { error in
+                performError = error as NSError
+            }
+        XCTAssert(finallyBlockWasExecuted)
+        let error = try XCTUnwrap(performError)
+        let machExceptionError = try XCTUnwrap(MachExceptionError(error))
+        XCTAssertEqual(machExceptionError.type, .badAccess)
+    }
+    
+    func testPerformWithMaskNested() throws {
+        let dependencies = TestableDependencies()
+        var innerFinallyBlockWasExecuted = false
+        var outerFinallyBlockWasExecuted = false
+        var performError: NSError?
+        XCTAssertThrowsError(
+            try MachExceptionHelper.perform(withMask: exception_mask_t(EXC_MASK_BAD_ACCESS),
+                                            dependencies: dependencies) {
+                try? MachExceptionHelper.perform(withMask: exception_mask_t(EXC_MASK_ARITHMETIC),
+                                                 dependencies: dependencies) {
+                    XCTAssertEqual(MachExceptionHelper.activeMask,
+                                   exception_mask_t(EXC_MASK_BAD_ACCESS | EXC_MASK_ARITHMETIC))
+                    self.raiseMachException(EXC_BAD_ACCESS)
+                } finally: {
+                    innerFinallyBlockWasExecuted = true
+                }
+            } finally: {
+                outerFinallyBlockWasExecuted = true
+            }) { error in
+                performError = error as NSError
+            }
+        XCTAssert(innerFinallyBlockWasExecuted)
+        XCTAssert(outerFinallyBlockWasExecuted)
+        let error = try XCTUnwrap(performError)
+        let machExceptionError = try XCTUnwrap(MachExceptionError(error))
+        XCTAssertEqual(machExceptionError.type, .badAccess)
+    }
+    
+    func testPerformWithMaskMachPortAllocateFailure() throws {
+        // The test thread may already have an exception context, so create the context on a new thread.
+        let dependencies = TestableDependencies()
+        dependencies.failureOptions = [.portAllocateFailure]
+        var performError: Error?
+        let thread = Thread {
+            XCTAssertThrowsError(
+                try MachExceptionHelper.perform(withMask: exception_mask_t(EXC_MASK_BAD_ACCESS),
+                                                dependencies: dependencies) { } finally: { }) { error in
+                    performError = error
+                }
+        }
+        let finished = expectation(forNotification: .NSThreadWillExit, object: thread)
+        thread.start()
+        wait(for: [finished], timeout: 10)
+        let error = try XCTUnwrap(performError as? NSError)
+        XCTAssertEqual(error.domain, NSMachErrorDomain)
+        XCTAssertEqual(error.code, Int(KERN_RESOURCE_SHORTAGE))
+    }
+    
+    func testListenerDoesNotWakeDuringLongRunningOperation() throws {
+        let dependencies = TestableDependencies()
+        try MachExceptionHelper.perform(withMask: exception_mask_t(EXC_MASK_BAD_ACCESS),
+                                        dependencies: dependencies) { } finally: { }
+        let wakeups = MachExceptionHelper.listenerWakeups
+        try MachExceptionHelper.perform(withMask: exception_mask_t(EXC_MASK_BAD_ACCESS),
+                                        dependencies: dependencies) {
+            sleep(2)
+        } finally: { }
+        XCTAssertEqual(MachExceptionHelper.listenerWakeups, wakeups)
+    }
+    
+    func testListenerWakesOncePerException() throws {
+        try withUnsafeMachException(types: [.badAccess]) { }
+        let wakeups = MachExceptionHelper.listenerWakeups
+        XCTAssertThrowsError(
+            try withUnsafeMachException(types: [.badAccess])
+            {
+                UnsafeMutablePointer<Int>(bitPattern: 0x10)!.pointee = 1
+            })
+        XCTAssertEqual(MachExceptionHelper.listenerWakeups, wakeups + 1)
+    }
+    
+    func testPerformWithMaskInsideMachExceptionPerform() throws {
+        let dependencies = TestableDependencies()
+        var innerFinallyBlockWasExecuted = false
+        var caughtError: Error?
+        XCTAssertThrowsError(
+            try withUnsafeMachException(types: [.badAccess])
+            {
+                try? MachExceptionHelper.perform(withMask: exception_mask_t(EXC_MASK_ARITHMETIC),
+                                                 dependencies: dependencies) {
+                    UnsafeMutablePointer<Int>(bitPattern: 0x10)!.pointee = 1
+                } finally: {
+                    innerFinallyBlockWasExecuted = true
+                }
+            }
+        ) { error in
+            caughtError = error
+        }
+        XCTAssert(innerFinallyBlockWasExecuted)
+        let machExceptionError = try XCTUnwrap(caughtError as? MachExceptionError)
+        XCTAssertEqual(machExceptionError.type, .badAccess)
+        XCTAssertEqual(machExceptionError.subcode, 0x10)
+        XCTAssertEqual(MachExceptionHelper.activeMask, 0)
+    }
+    
+    func testMachExceptionPerformInsidePerformWithMask() throws {
+        let dependencies = TestableDependencies()
+        var innerFinallyBlockWasExecuted = false
+        var performError: NSError?
+        XCTAssertThrowsError(
+            try MachExceptionHelper.perform(withMask: exception_mask_t(EXC_MASK_BAD_ACCESS),
+                                            dependencies: dependencies) {
+                try? withUnsafeMachException(types: [.arithmetic])
+                {
+                    UnsafeMutablePointer<Int>(bitPattern: 0x10)!.pointee = 1
+                } finally: {
+                    innerFinallyBlockWasExecuted = true
+                }
+            } finally: { }) { error in
+                performError = error as NSError
+            }
+        XCTAssert(innerFinallyBlockWasExecuted)
+        let error = try XCTUnwrap(performError)
+        let machExceptionError = try XCTUnwrap(MachExceptionError(error))
+        XCTAssertEqual(machExceptionError.type, .badAccess)
+        XCTAssertEqual(MachExceptionHelper.activeMask, 0)
+    }
+    
+    func testMachExceptionPerformWithDependenciesFailure() throws {
+        // The test thread may already have an exception context, so create the context on a new thread.
+        let dependencies = TestableDependencies()
+        dependencies.failureOptions = [.portAllocateFailure]
+        var performError: Error?
+        let thread = Thread {
+            XCTAssertThrowsError(
+                try withUnsafeMachException(types: [.badAccess], dependencies: dependencies) { }) { error in
+                    performError = error
+                }
+        }
+        let finished = expectation(forNotification: .NSThreadWillExit, object: thread)
+        thread.start()
+        wait(for: [finished], timeout: 10)
+        let error = try XCTUnwrap(performError as? NSError)
+        XCTAssertEqual(error.domain, NSMachErrorDomain)
+        XCTAssertEqual(error.code, Int(KERN_RESOURCE_SHORTAGE))
+    }
 }
 
 struct TestableDependenciesOptions: OptionSet {
@@ -200,3 +408,4 @@ class TestableDependencies: MachExceptionHelperDependencies {
                                            flavors)
     }
 }
+#endif
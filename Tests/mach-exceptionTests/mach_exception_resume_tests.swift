@@ -0,0 +1,150 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+//
+// mach_exception_resume_tests.swift
+// Created by Patrick Gili on 3/1/23.
+//
+
+import Foundation
+import XCTest
+
+import mach_exception
+import mach_exception_helper
+
+@testable import mach_exception
+
+final class mach_exception_resume_tests: XCTestCase {
+
+    // A context of 8-byte words, each holding its own index, so a test sees which words a rewrite changed.
+    func rewrite(_ layout: mach_exception_resume_layout_t, words: Int) -> (changed: [Int: UInt64], point: UInt64) {
+        var context = (0 ..< words).map { UInt64($0) }
+        var point = mach_exception_resume_point_t()
+        point.sp = 0x7fff_5000
+        var record = mach_exception_record_t(type: EXC_BAD_ACCESS, code: 2, subcode: -8)
+        var layout = layout
+        let address = withUnsafeMutablePointer(to: &point) { point in
+            context.withUnsafeMutableBytes {
+                mach_exception_resume_rewrite(&layout, $0.baseAddress!, point, &record)
+            }
+            return UInt64(UInt(bitPattern: point))
+        }
+        var changed: [Int: UInt64] = [:]
+        for (index, word) in context.enumerated() where word != UInt64(index) {
+            changed[index] = word
+        }
+        return (changed, address)
+    }
+
+    typealias Landing = @convention(c) (UnsafeMutablePointer<mach_exception_resume_point_t>?,
+                                        exception_type_t,
+                                        mach_exception_data_type_t,
+                                        mach_exception_data_type_t) -> Never
+
+    var landing: UInt64 {
+        return UInt64(unsafeBitCast(mach_exception_resume_landing as Landing, to: UInt.self))
+    }
+
+    // The registers a rewrite sets, by the index of their word in the context.
+    func assertRewrite(_ layout: mach_exception_resume_layout_t,
+                       words: Int,
+                       pc: Int,
+                       sp: Int,
+                       arguments: [Int],
+                       file: StaticString = #filePath,
+                       line: UInt = #line) {
+        let (changed, point) = rewrite(layout, words: words)
+        XCTAssertEqual(changed, [
+            pc: landing,
+            sp: 0x7fff_5000,
+            arguments[0]: point,
+            arguments[1]: UInt64(EXC_BAD_ACCESS),
+            arguments[2]: 2,
+            arguments[3]: UInt64(bitPattern: -8),
+        ], file: file, line: line)
+    }
+
+    func testLinuxX86_64Layout() throws {
+        // uc_mcontext.gregs starts 40 bytes into the ucontext_t: REG_RIP is 16, REG_RSP 15, REG_RDI 8, REG_RSI 9,
+        // REG_RDX 12 and REG_RCX 14.
+        assertRewrite(mach_exception_resume_linux_x86_64, words: 128, pc: 21, sp: 20, arguments: [13, 14, 17, 19])
+    }
+
+    func testLinuxArm64Layout() throws {
+        // uc_mcontext starts 176 bytes into the ucontext_t, with the fault address, x0-x30, sp and pc.
+        assertRewrite(mach_exception_resume_linux_arm64, words: 128, pc: 55, sp: 54, arguments: [23, 24, 25, 26])
+    }
+
+    func testDarwinX86_64Layout() throws {
+        // rax, rbx, rcx, rdx, rdi, rsi, rbp, rsp, r8-r15, rip.
+        assertRewrite(mach_exception_resume_darwin_x86_64, words: 21, pc: 16, sp: 7, arguments: [4, 5, 3, 2])
+    }
+
+    func testDarwinArm64Layout() throws {
+        // x0-x28, fp, lr, sp, pc.
+        assertRewrite(mach_exception_resume_darwin_arm64, words: 34, pc: 32, sp: 31, arguments: [0, 1, 2, 3])
+    }
+
+    func testHostLayout() throws {
+        let host = mach_exception_resume_host_layout.pointee
+#if os(Linux) && arch(x86_64)
+        let expected = mach_exception_resume_linux_x86_64
+#elseif os(Linux) && arch(arm64)
+        let expected = mach_exception_resume_linux_arm64
+#elseif arch(x86_64)
+        let expected = mach_exception_resume_darwin_x86_64
+#else
+        let expected = mach_exception_resume_darwin_arm64
+#endif
+        XCTAssertEqual(host.pc, expected.pc)
+        XCTAssertEqual(host.sp, expected.sp)
+    }
+
+    func testResumeNestedScopes() throws {
+        var finallyBlocks = 0
+        XCTAssertThrowsError(try withUnsafeMachException(types: [.badAccess]) {
+            try? withUnsafeMachException(types: [.arithmetic]) {
+                UnsafeMutablePointer<Int>(bitPattern: 0x18)!.pointee = 1
+            } finally: {
+                finallyBlocks += 1
+            }
+        } finally: {
+            finallyBlocks += 1
+        }) { error in
+            XCTAssertEqual((error as? MachExceptionError)?.type, .badAccess)
+            XCTAssertEqual((error as? MachExceptionError)?.subcode, 0x18)
+        }
+        XCTAssertEqual(finallyBlocks, 2)
+    }
+
+#if os(Linux)
+    func testResumeRestoresThreadState() throws {
+        let rounding = fegetround()
+        fesetround(Int32(FE_UPWARD))
+        defer { fesetround(rounding) }
+        for _ in 0 ..< 3 {
+            XCTAssertThrowsError(try withUnsafeMachException(types: [.badAccess]) {
+                UnsafeMutablePointer<Int>(bitPattern: 8)!.pointee = 1
+            })
+
+            // Returning from the handler restores the signal mask, and the floating-point environment, the thread
+            // faulted with.
+            var blocked = sigset_t()
+            pthread_sigmask(SIG_SETMASK, nil, &blocked)
+            XCTAssertEqual(sigismember(&blocked, SIGSEGV), 0)
+            XCTAssertEqual(fegetround(), Int32(FE_UPWARD))
+        }
+    }
+#endif
+
+    func testPerformanceResume() throws {
+        measure {
+            for _ in 0 ..< 1_000 {
+                _ = try? withUnsafeMachException(types: [.badAccess]) {
+                    UnsafeMutablePointer<Int>(bitPattern: 8)!.pointee = 1
+                }
+            }
+        }
+    }
+}
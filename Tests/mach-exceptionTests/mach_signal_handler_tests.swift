@@ -0,0 +1,212 @@
+//
+// Copyright © 2022 Gili Labs. All rights reserved.
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// mach-exception
+// mach_signal_handler_tests.swift
+// Created by Patrick Gili on 1/28/23.
+//
+
+import Foundation
+import XCTest
+
+import mach_exception
+import mach_exception_helper
+
+@testable import mach_exception
+
+#if os(Linux)
+// The page the previous handler installed by testForwardToPreviousHandler makes accessible, and the number of times
+// it executed. A C function pointer can't capture context, so these are global.
+private var forwardedPage: UnsafeMutableRawPointer?
+private var forwardedPageSize = 0
+private var forwardedFaults = 0
+
+final class mach_signal_handler_tests: XCTestCase {
+
+    // The si_code constants import as Int or Int32, depending on whether the C library declares them as enumerators
+    // or macros, so accept either.
+    func makeSignalInfo<Code: BinaryInteger>(signal: Int32, code: Code, address: UInt) -> siginfo_t {
+        var info = siginfo_t()
+        info.si_signo = signal
+        info.si_code = Int32(code)
+        info._sifields._sigfault.si_addr = UnsafeMutableRawPointer(bitPattern: address)
+        return info
+    }
+
+    func testRecordFromSegmentationFault() throws {
+        var info = makeSignalInfo(signal: SIGSEGV, code: SEGV_MAPERR, address: 0x1000)
+        var record = mach_exception_record_t()
+        XCTAssert(mach_signal_record_from_siginfo(SIGSEGV, &info, nil, &record))
+        XCTAssertEqual(record.type, EXC_BAD_ACCESS)
+        XCTAssertEqual(record.code, mach_exception_data_type_t(KERN_INVALID_ADDRESS))
+        XCTAssertEqual(record.subcode, 0x1000)
+    }
+
+    func testRecordFromProtectionFault() throws {
+        var info = makeSignalInfo(signal: SIGSEGV, code: SEGV_ACCERR, address: 0x2000)
+        var record = mach_exception_record_t()
+        XCTAssert(mach_signal_record_from_siginfo(SIGSEGV, &info, nil, &record))
+        XCTAssertEqual(record.type, EXC_BAD_ACCESS)
+        XCTAssertEqual(record.code, mach_exception_data_type_t(KERN_PROTECTION_FAILURE))
+        XCTAssertEqual(record.subcode, 0x2000)
+    }
+
+    func testRecordFromBusError() throws {
+        var info = makeSignalInfo(signal: SIGBUS, code: BUS_ADRERR, address: 0x3000)
+        var record = mach_exception_record_t()
+        XCTAssert(mach_signal_record_from_siginfo(SIGBUS, &info, nil, &record))
+        XCTAssertEqual(record.type, EXC_BAD_ACCESS)
+        XCTAssertEqual(record.code, mach_exception_data_type_t(KERN_MEMORY_ERROR))
+        XCTAssertEqual(record.subcode, 0x3000)
+    }
+
+    func testRecordFromIllegalInstruction() throws {
+        var info = makeSignalInfo(signal: SIGILL, code: ILL_ILLOPN, address: 0)
+        var record = mach_exception_record_t()
+        XCTAssert(mach_signal_record_from_siginfo(SIGILL, &info, nil, &record))
+        XCTAssertEqual(record.type, EXC_BAD_INSTRUCTION)
+#if arch(arm64)
+        XCTAssertEqual(record.code, mach_exception_data_type_t(EXC_ARM_UNDEFINED))
+#elseif arch(x86_64)
+        XCTAssertEqual(record.code, mach_exception_data_type_t(EXC_I386_INVOP))
+#endif
+    }
+
+    func testRecordFromArithmeticError() throws {
+        var info = makeSignalInfo(signal: SIGFPE, code: FPE_FLTDIV, address: 0)
+        var record = mach_exception_record_t()
+        XCTAssert(mach_signal_record_from_siginfo(SIGFPE, &info, nil, &record))
+        XCTAssertEqual(record.type, EXC_ARITHMETIC)
+#if arch(arm64)
+        XCTAssertEqual(record.code, mach_exception_data_type_t(EXC_ARM_FP_DZ))
+#elseif arch(x86_64)
+        XCTAssertEqual(record.code, mach_exception_data_type_t(EXC_I386_SSEEXTERR))
+#endif
+    }
+
+    func testRecordFromUnsupportedSignal() throws {
+        var info = makeSignalInfo(signal: SIGUSR1, code: 0, address: 0)
+        var record = mach_exception_record_t()
+        XCTAssertFalse(mach_signal_record_from_siginfo(SIGUSR1, &info, nil, &record))
+    }
+
+    func testWithUnsafeMachExceptionBadAccess() throws {
+        var caughtError: Error?
+        XCTAssertThrowsError(
+            try withUnsafeMachException(types: [.badAccess])
+            {
+                UnsafeMutablePointer<Int>(bitPattern: 0x10)!.pointee = 1
+            }
+        ) { error in
+            caughtError = error
+        }
+        let machExceptionError = try XCTUnwrap(caughtError as? MachExceptionError)
+        let info = try XCTUnwrap(machExceptionError.badAccess)
+        XCTAssertEqual(info.code, .vmFault(kernResult: KERN_INVALID_ADDRESS))
+        XCTAssertEqual(info.address, 0x10)
+    }
+
+    func testStateFromContext() throws {
+        var info = makeSignalInfo(signal: SIGSEGV, code: SEGV_MAPERR, address: 0x4000)
+        var context = ucontext_t()
+#if arch(x86_64)
+        withUnsafeMutableBytes(of: &context.uc_mcontext.gregs) { gregs in
+            let registers = gregs.bindMemory(to: greg_t.self)
+            registers[Int(REG_RIP)] = 0x1000
+            registers[Int(REG_RSP)] = 0x2000
+            registers[Int(REG_RBP)] = 0x3000
+        }
+#elseif arch(arm64)
+        context.uc_mcontext.pc = 0x1000
+        context.uc_mcontext.sp = 0x2000
+        withUnsafeMutableBytes(of: &context.uc_mcontext.regs) { regs in
+            let registers = regs.bindMemory(to: UInt64.self)
+            registers[29] = 0x3000
+            registers[30] = 0x5000
+        }
+#endif
+        var state = mach_exception_state_t()
+        var fp: UInt64 = 0
+        XCTAssert(mach_signal_state_from_ucontext(SIGSEGV, &info, &context, &state, &fp))
+        XCTAssertEqual(state.pc, 0x1000)
+        XCTAssertEqual(state.sp, 0x2000)
+        XCTAssertEqual(fp, 0x3000)
+        XCTAssertEqual(state.fault_address, 0x4000)
+#if arch(arm64)
+        XCTAssertEqual(state.lr, 0x5000)
+#else
+        XCTAssertEqual(state.lr, 0)
+#endif
+
+        // Without a context, only the fault address is known, and only faults accessing memory have one.
+        XCTAssertFalse(mach_signal_state_from_ucontext(SIGSEGV, &info, nil, &state, &fp))
+        XCTAssertEqual(state.pc, 0)
+        XCTAssertEqual(state.fault_address, 0x4000)
+        XCTAssertFalse(mach_signal_state_from_ucontext(SIGILL, &info, nil, &state, &fp))
+        XCTAssertEqual(state.fault_address, 0)
+    }
+
+    func testWithUnsafeMachExceptionRepeated() throws {
+        for _ in 0 ..< 100 {
+            XCTAssertThrowsError(
+                try withUnsafeMachException(types: [.badAccess])
+                {
+                    UnsafeMutablePointer<Int>(bitPattern: 0x10)!.pointee = 1
+                })
+        }
+    }
+
+    func testForwardToPreviousHandler() throws {
+        // Install the library's signal handlers, then substitute a handler that resolves faults by making the
+        // faulting page accessible, as a virtual machine's handler would, for the handler installed before them.
+        try withUnsafeMachException(types: [.badAccess]) { }
+        forwardedPageSize = Int(sysconf(Int32(_SC_PAGESIZE)))
+        let page = try XCTUnwrap(mmap(nil, forwardedPageSize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0))
+        XCTAssertNotEqual(page, MAP_FAILED)
+        forwardedPage = page
+        forwardedFaults = 0
+        var action = sigaction()
+        action.__sigaction_handler.sa_sigaction = { _, _, _ in
+            forwardedFaults += 1
+            mprotect(forwardedPage, forwardedPageSize, PROT_READ | PROT_WRITE)
+        }
+        action.sa_flags = SA_SIGINFO
+        sigemptyset(&action.sa_mask)
+        var previous = sigaction()
+        XCTAssert(mach_signal_exchange_previous_action(SIGSEGV, &action, &previous))
+        defer {
+            mach_signal_exchange_previous_action(SIGSEGV, &previous, nil)
+            munmap(page, forwardedPageSize)
+        }
+        
+        // Forwarded faults are counted, but aren't wakeups, which count the faults a scope owns.
+        let before = MachExceptionMetrics()
+
+        // A fault outside every scope.
+        page.storeBytes(of: 1, as: Int.self)
+        XCTAssertEqual(forwardedFaults, 1)
+        XCTAssertEqual(page.load(as: Int.self), 1)
+        
+        // A fault inside a scope that doesn't catch it.
+        mprotect(page, forwardedPageSize, PROT_NONE)
+        try withUnsafeMachException(types: [.arithmetic]) {
+            page.storeBytes(of: 2, as: Int.self)
+        }
+        XCTAssertEqual(forwardedFaults, 2)
+        XCTAssertEqual(page.load(as: Int.self), 2)
+
+        let after = MachExceptionMetrics()
+        XCTAssertEqual(after.forwarded.values.reduce(0, +) - before.forwarded.values.reduce(0, +), 2)
+        XCTAssertEqual(after.listenerWakeups, before.listenerWakeups)
+    }
+    
+    func testPerformanceWithNoException() throws {
+        measure {
+            for _ in 0 ..< 100_000 {
+                try? withUnsafeMachException(types: [.badAccess]) { }
+            }
+        }
+    }
+}
+#endif